@@ -40,16 +40,14 @@
 
 #include <generated/blog_channel_DPReceive.h>
 
+#include "DPReceive_peers_hash.h"
+#include <structure/CHash_impl.h>
+
 static DPReceivePeer * find_peer (DPReceiveDevice *o, peerid_t id)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->peers_list); node; node = LinkedList1Node_Next(node)) {
-        DPReceivePeer *p = UPPER_OBJECT(node, DPReceivePeer, list_node);
-        if (p->peer_id == id) {
-            return p;
-        }
-    }
+    DPReceive__PeersHashRef ref = DPReceive__PeersHash_Lookup(&o->peers_hash, 0, id);
     
-    return NULL;
+    return ref.ptr;
 }
 
 static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, int packet_len)
@@ -106,7 +104,12 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     
     // inform sink of received packet
     if (peer->dp_sink) {
-        DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES));
+        DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES), packet_len);
+        
+        // keep-alives may carry round-trip time probes
+        if (num_ids == 0) {
+            DataProtoSink_ReceivedKeepalive(peer->dp_sink, data, data_len);
+        }
     }
     
     if (num_ids == 1) {
@@ -198,9 +201,18 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
     // init peers list
     LinkedList1_Init(&o->peers_list);
     
+    // init peers hash table
+    if (!DPReceive__PeersHash_Init(&o->peers_hash, DPRECEIVE_PEERS_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "DPReceive__PeersHash_Init failed");
+        goto fail1;
+    }
+    o->num_peers = 0;
+    
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail1:
+    DPRelayRouter_Free(&o->relay_router);
 fail0:
     return 0;
 }
@@ -209,6 +221,10 @@ void DPReceiveDevice_Free (DPReceiveDevice *o)
 {
     DebugObject_Free(&o->d_obj);
     ASSERT(LinkedList1_IsEmpty(&o->peers_list))
+    ASSERT(o->num_peers == 0)
+    
+    // free peers hash table
+    DPReceive__PeersHash_Free(&o->peers_hash);
     
     // free relay router
     DPRelayRouter_Free(&o->relay_router);
@@ -246,6 +262,18 @@ void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t pee
     // insert to peers list
     LinkedList1_Append(&device->peers_list, &o->list_node);
     
+    // insert to peers hash table
+    DPReceive__PeersHashRef ref = {o, o};
+    int res = DPReceive__PeersHash_Insert(&device->peers_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+    device->num_peers++;
+    
+    // keep the load factor at most one so lookups stay constant time;
+    // if growing fails we just keep working with longer chains
+    if (device->num_peers > device->peers_hash.num_buckets) {
+        DPReceive__PeersHash_MultiplyBuckets(&device->peers_hash, 0, 1);
+    }
+    
     DebugCounter_Init(&o->d_receivers_ctr);
     DebugObject_Init(&o->d_obj);
 }
@@ -256,6 +284,11 @@ void DPReceivePeer_Free (DPReceivePeer *o)
     DebugCounter_Free(&o->d_receivers_ctr);
     ASSERT(!o->dp_sink)
     
+    // remove from peers hash table
+    DPReceive__PeersHashRef ref = {o, o};
+    DPReceive__PeersHash_Remove(&o->device->peers_hash, 0, ref);
+    o->device->num_peers--;
+    
     // remove from peers list
     LinkedList1_Remove(&o->device->peers_list, &o->list_node);
     
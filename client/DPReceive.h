@@ -38,15 +38,24 @@
 #include <misc/debugcounter.h>
 #include <misc/debug.h>
 #include <structure/LinkedList1.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <client/DataProto.h>
 #include <client/DPRelay.h>
 #include <client/FrameDecider.h>
 
+#define DPRECEIVE_PEERS_HASH_INITIAL_BUCKETS 64
+
 typedef void (*DPReceiveDevice_output_func) (void *output_user, uint8_t *data, int data_len);
 
+struct DPReceivePeer_s;
 struct DPReceiveReceiver_s;
 
+typedef struct DPReceivePeer_s *DPReceive__peers_hash_link;
+
+#include "DPReceive_peers_hash.h"
+#include <structure/CHash_decl.h>
+
 typedef struct {
     int device_mtu;
     DPReceiveDevice_output_func output_func;
@@ -59,10 +68,12 @@ typedef struct {
     int have_peer_id;
     peerid_t peer_id;
     LinkedList1 peers_list;
+    DPReceive__PeersHash peers_hash;
+    size_t num_peers;
     DebugObject d_obj;
 } DPReceiveDevice;
 
-typedef struct {
+typedef struct DPReceivePeer_s {
     DPReceiveDevice *device;
     peerid_t peer_id;
     FrameDeciderPeer *decider_peer;
@@ -71,6 +82,7 @@ typedef struct {
     DPRelaySink relay_sink;
     DataProtoSink *dp_sink;
     LinkedList1Node list_node;
+    struct DPReceivePeer_s *hash_next;
     DebugObject d_obj;
     DebugCounter d_receivers_ctr;
 } DPReceivePeer;
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME DPReceive__PeersHash
+#define CHASH_PARAM_ENTRY struct DPReceivePeer_s
+#define CHASH_PARAM_LINK DPReceive__peers_hash_link
+#define CHASH_PARAM_KEY peerid_t
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((DPReceive__peers_hash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((size_t)(entry).ptr->peer_id)
+#define CHASH_PARAM_KEYHASH(arg, key) ((size_t)(key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->peer_id == (entry2).ptr->peer_id)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->peer_id)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -37,6 +37,14 @@
 
 #include <generated/blog_channel_DPRelay.h>
 
+static size_t DPRelay__flows_hash_hash (peerid_t source_id, peerid_t dest_id)
+{
+    return ((size_t)source_id << 16) ^ dest_id;
+}
+
+#include "DPRelay_flows_hash.h"
+#include <structure/CHash_impl.h>
+
 static void flow_inactivity_handler (struct DPRelay_flow *flow);
 
 static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink, int num_packets, int inactivity_time)
@@ -55,7 +63,7 @@ static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink,
     flow->sink = sink;
     
     // init DataProtoFlow
-    if (!DataProtoFlow_Init(&flow->dp_flow, &src->router->dp_source, src->source_id, sink->dest_id, num_packets, inactivity_time, flow, (DataProtoFlow_handler_inactivity)flow_inactivity_handler)) {
+    if (!DataProtoFlow_Init(&flow->dp_flow, &src->router->dp_source, src->source_id, sink->dest_id, num_packets, inactivity_time, NULL, 0, flow, (DataProtoFlow_handler_inactivity)flow_inactivity_handler)) {
         BLog(BLOG_ERROR, "relay flow %d->%d: DataProtoFlow_Init failed", (int)src->source_id, (int)sink->dest_id);
         goto fail1;
     }
@@ -66,6 +74,18 @@ static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink,
     // insert to sink list
     LinkedList1_Append(&sink->flows_list, &flow->sink_list_node);
     
+    // insert to flows hash table
+    DPRelayRouter *router = src->router;
+    DPRelay__FlowsHashRef ref = {flow, flow};
+    int res = DPRelay__FlowsHash_Insert(&router->flows_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+    router->num_flows++;
+    
+    // grow the table if it's getting full; failure only makes chains longer
+    if (router->num_flows > router->flows_hash.num_buckets) {
+        DPRelay__FlowsHash_MultiplyBuckets(&router->flows_hash, 0, 1);
+    }
+    
     // attach flow if needed
     if (sink->dp_sink) {
         DataProtoFlow_Attach(&flow->dp_flow, sink->dp_sink);
@@ -93,6 +113,11 @@ static void free_flow (struct DPRelay_flow *flow)
         flow->src->router->current_flow = NULL;
     }
     
+    // remove from flows hash table
+    DPRelay__FlowsHashRef ref = {flow, flow};
+    DPRelay__FlowsHash_Remove(&flow->src->router->flows_hash, 0, ref);
+    flow->src->router->num_flows--;
+    
     // remove from sink list
     LinkedList1_Remove(&flow->sink->flows_list, &flow->sink_list_node);
     
@@ -115,15 +140,11 @@ static void flow_inactivity_handler (struct DPRelay_flow *flow)
 
 static struct DPRelay_flow * source_find_flow (DPRelaySource *o, DPRelaySink *sink)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->flows_list); node; node = LinkedList1Node_Next(node)) {
-        struct DPRelay_flow *flow = UPPER_OBJECT(node, struct DPRelay_flow, src_list_node);
-        ASSERT(flow->src == o)
-        if (flow->sink == sink) {
-            return flow;
-        }
-    }
+    DPRelay__flows_hash_key key = {o, sink};
+    DPRelay__FlowsHashRef ref = DPRelay__FlowsHash_Lookup(&o->router->flows_hash, 0, key);
+    ASSERT(!ref.ptr || ref.ptr->src == o)
     
-    return NULL;
+    return ref.ptr;
 }
 
 static void router_dp_source_handler (DPRelayRouter *o, const uint8_t *frame, int frame_len)
@@ -161,10 +182,19 @@ int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
     // have no current flow
     o->current_flow = NULL;
     
+    // init flows hash table
+    if (!DPRelay__FlowsHash_Init(&o->flows_hash, DPRELAY_FLOWS_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "DPRelay__FlowsHash_Init failed");
+        goto fail2;
+    }
+    o->num_flows = 0;
+    
     DebugCounter_Init(&o->d_ctr);
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail2:
+    DataProtoSource_Free(&o->dp_source);
 fail1:
     BufferWriter_Free(&o->writer);
     return 0;
@@ -175,6 +205,10 @@ void DPRelayRouter_Free (DPRelayRouter *o)
     DebugObject_Free(&o->d_obj);
     DebugCounter_Free(&o->d_ctr);
     ASSERT(!o->current_flow) // have no sources
+    ASSERT(o->num_flows == 0)
+    
+    // free flows hash table
+    DPRelay__FlowsHash_Free(&o->flows_hash);
     
     // free DataProtoSource
     DataProtoSource_Free(&o->dp_source);
@@ -37,29 +37,42 @@
 #include <protocol/dataproto.h>
 #include <misc/debug.h>
 #include <structure/LinkedList1.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <flow/BufferWriter.h>
 #include <client/DataProto.h>
 
+#define DPRELAY_FLOWS_HASH_INITIAL_BUCKETS 64
+
 struct DPRelay_flow;
+struct DPRelaySource_s;
+struct DPRelaySink_s;
+
+typedef struct DPRelay_flow *DPRelay__flows_hash_link;
+typedef struct { struct DPRelaySource_s *src; struct DPRelaySink_s *sink; } DPRelay__flows_hash_key;
+
+#include "DPRelay_flows_hash.h"
+#include <structure/CHash_decl.h>
 
 typedef struct {
     int frame_mtu;
     BufferWriter writer;
     DataProtoSource dp_source;
     struct DPRelay_flow *current_flow;
+    DPRelay__FlowsHash flows_hash;
+    size_t num_flows;
     DebugObject d_obj;
     DebugCounter d_ctr;
 } DPRelayRouter;
 
-typedef struct {
+typedef struct DPRelaySource_s {
     DPRelayRouter *router;
     peerid_t source_id;
     LinkedList1 flows_list;
     DebugObject d_obj;
 } DPRelaySource;
 
-typedef struct {
+typedef struct DPRelaySink_s {
     peerid_t dest_id;
     LinkedList1 flows_list;
     DataProtoSink *dp_sink;
@@ -72,6 +85,7 @@ struct DPRelay_flow {
     DataProtoFlow dp_flow;
     LinkedList1Node src_list_node;
     LinkedList1Node sink_list_node;
+    struct DPRelay_flow *hash_next;
 };
 
 int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor) WARN_UNUSED;
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME DPRelay__FlowsHash
+#define CHASH_PARAM_ENTRY struct DPRelay_flow
+#define CHASH_PARAM_LINK DPRelay__flows_hash_link
+#define CHASH_PARAM_KEY DPRelay__flows_hash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((DPRelay__flows_hash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) DPRelay__flows_hash_hash((entry).ptr->src->source_id, (entry).ptr->sink->dest_id)
+#define CHASH_PARAM_KEYHASH(arg, key) DPRelay__flows_hash_hash((key).src->source_id, (key).sink->dest_id)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->src == (entry2).ptr->src && (entry1).ptr->sink == (entry2).ptr->sink)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).src == (entry2).ptr->src && (key1).sink == (entry2).ptr->sink)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -33,6 +33,7 @@
 
 #include <protocol/dataproto.h>
 #include <misc/byteorder.h>
+#include <misc/minmax.h>
 #include <base/BLog.h>
 
 #include <client/DataProto.h>
@@ -42,6 +43,7 @@
 static void monitor_handler (DataProtoSink *o);
 static void refresh_up_job (DataProtoSink *o);
 static void receive_timer_handler (DataProtoSink *o);
+static void ping_timer_handler (DataProtoSink *o);
 static void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len);
 static void up_job_handler (DataProtoSink *o);
 static void flow_buffer_free (struct DataProtoFlow_buffer *b);
@@ -57,6 +59,9 @@ void monitor_handler (DataProtoSink *o)
     
     // send keep-alive
     PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+    
+    // the keep-alive carries a ping, no need for another one soon
+    BReactor_SetTimer(o->reactor, &o->ping_timer);
 }
 
 void refresh_up_job (DataProtoSink *o)
@@ -78,11 +83,26 @@ void receive_timer_handler (DataProtoSink *o)
     refresh_up_job(o);
 }
 
+void ping_timer_handler (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // send keep-alive with a ping even though the link is busy
+    PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+    
+    // restart timer
+    BReactor_SetTimer(o->reactor, &o->ping_timer);
+}
+
 void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(data_len >= sizeof(struct dataproto_header))
     
+    // count packet
+    o->stats.tx_packets++;
+    o->stats.tx_bytes += data_len;
+    
     int flags = 0;
     
     // if we are receiving keepalives, set the flag
@@ -136,6 +156,11 @@ void flow_buffer_free (struct DataProtoFlow_buffer *b)
         PacketPassInactivityMonitor_Free(&b->monitor);
     }
     
+    // free shaper
+    if (b->shaping) {
+        PacketPassShaper_Free(&b->shaper);
+    }
+    
     // free connector
     PacketPassConnector_Free(&b->connector);
     
@@ -228,6 +253,7 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
 {
     ASSERT(PacketPassInterface_HasCancel(output))
     ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTO_MAX_OVERHEAD)
+    ASSERT(PacketPassInterface_GetMTU(output) >= sizeof(struct dataproto_header) + sizeof(struct dataproto_ping_record))
     
     // init arguments
     o->reactor = reactor;
@@ -269,6 +295,13 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
     // init receive timer
     BTimer_Init(&o->receive_timer, tolerance_time, (BTimer_handler)receive_timer_handler, o);
     
+    // init ping timer
+    BTimer_Init(&o->ping_timer, 2 * keepalive_time, (BTimer_handler)ping_timer_handler, o);
+    BReactor_SetTimer(o->reactor, &o->ping_timer);
+    
+    // clear statistics
+    memset(&o->stats, 0, sizeof(o->stats));
+    
     // init handler job
     BPending_Init(&o->up_job, BReactor_PendingGroup(o->reactor), (BPending_handler)up_job_handler, o);
     
@@ -311,6 +344,9 @@ void DataProtoSink_Free (DataProtoSink *o)
     // free handler job
     BPending_Free(&o->up_job);
     
+    // free ping timer
+    BReactor_RemoveTimer(o->reactor, &o->ping_timer);
+    
     // free receive timer
     BReactor_RemoveTimer(o->reactor, &o->receive_timer);
     
@@ -336,20 +372,33 @@ void DataProtoSink_Free (DataProtoSink *o)
     PacketPassNotifier_Free(&o->notifier);
 }
 
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int packet_len)
 {
     ASSERT(peer_receiving == 0 || peer_receiving == 1)
+    ASSERT(packet_len >= 0)
     DebugObject_Access(&o->d_obj);
     
+    // count packet
+    o->stats.rx_packets++;
+    o->stats.rx_bytes += packet_len;
+    
     // reset receive timer
     BReactor_SetTimer(o->reactor, &o->receive_timer);
     
+    // only probe the round-trip time while the link works both ways
+    DataProtoKeepaliveSource_SetSendRequests(&o->ka_source, peer_receiving);
+    
     if (!peer_receiving) {
         // peer reports not receiving, consider down
         o->up = 0;
         // send keep-alive to converge faster
         PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
     } else {
+        // measure the round-trip time as soon as the link comes up; this goes
+        // through the ping timer because a keep-alive may still be in flight
+        if (!o->up) {
+            BReactor_SetTimerAfter(o->reactor, &o->ping_timer, 0);
+        }
         // consider up
         o->up = 1;
     }
@@ -357,6 +406,68 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
     refresh_up_job(o);
 }
 
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // is there a ping record?
+    if (data_len < sizeof(struct dataproto_ping_record)) {
+        return;
+    }
+    struct dataproto_ping_record record;
+    memcpy(&record, data, sizeof(record));
+    if (ltoh32(record.magic) != DATAPROTO_PING_MAGIC) {
+        return;
+    }
+    
+    switch (ltoh8(record.type)) {
+        case DATAPROTO_PING_TYPE_REQUEST: {
+            // reply with the next keep-alive, and send it now
+            DataProtoKeepaliveSource_SetReply(&o->ka_source, ltoh64(record.time));
+            PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+        } break;
+        
+        case DATAPROTO_PING_TYPE_REPLY: {
+            btime_t now = btime_gettime();
+            btime_t sent = ltoh64(record.time);
+            btime_t hold_time = ltoh32(record.hold_time);
+            
+            // ignore bogus replies
+            if (sent > now || hold_time > now - sent) {
+                BLog(BLOG_INFO, "bogus ping reply");
+                return;
+            }
+            
+            btime_t rtt = now - sent - hold_time;
+            
+            // update round-trip time; the average is kept scaled by 8 so that
+            // it can move by less than a millisecond
+            if (!o->stats.have_rtt) {
+                o->rtt_avg8 = 8 * rtt;
+                o->stats.rtt_min = rtt;
+                o->stats.have_rtt = 1;
+            } else {
+                o->rtt_avg8 += rtt - o->rtt_avg8 / 8;
+                o->stats.rtt_min = bmin_int64(o->stats.rtt_min, rtt);
+            }
+            o->stats.rtt_last = rtt;
+            o->stats.rtt_smoothed = (o->rtt_avg8 + 4) / 8;
+        } break;
+        
+        default:
+            BLog(BLOG_INFO, "unknown ping record");
+            break;
+    }
+}
+
+const struct DataProtoSink_stats * DataProtoSink_GetStats (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->stats;
+}
+
 int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(PacketRecvInterface_GetMTU(input) <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
@@ -393,12 +504,14 @@ void DataProtoSource_Free (DataProtoSource *o)
     PacketRouter_Free(&o->router);
 }
 
-int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time, void *user,
-                        DataProtoFlow_handler_inactivity handler_inactivity)
+int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time,
+                        TokenBucket *shaper_parent, int64_t shaper_rate, void *user, DataProtoFlow_handler_inactivity handler_inactivity)
 {
     DebugObject_Access(&source->d_obj);
     ASSERT(num_packets > 0)
     ASSERT(!(inactivity_time >= 0) || handler_inactivity)
+    ASSERT(shaper_rate >= 0)
+    ASSERT(shaper_rate <= TOKENBUCKET_MAX_RATE)
     
     // init arguments
     o->source = source;
@@ -408,6 +521,9 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     // set no desired sink
     o->sink_desired = NULL;
     
+    // set nothing dropped
+    o->num_dropped = 0;
+    
     // allocate buffer structure
     struct DataProtoFlow_buffer *b = (struct DataProtoFlow_buffer *)malloc(sizeof(*b));
     if (!b) {
@@ -425,15 +541,24 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     // init connector
     PacketPassConnector_Init(&b->connector, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, BReactor_PendingGroup(source->reactor));
     
-    // init inactivity monitor
+    // init shaper. It comes after the inactivity monitor so that held
+    // frames count as activity.
     PacketPassInterface *buf_out = PacketPassConnector_GetInput(&b->connector);
+    b->shaping = (shaper_parent || shaper_rate > 0);
+    if (b->shaping) {
+        int64_t burst = TokenBucket_DefaultBurst(shaper_rate, PacketPassInterface_GetMTU(buf_out));
+        PacketPassShaper_Init(&b->shaper, buf_out, source->reactor, shaper_rate, burst, shaper_parent);
+        buf_out = PacketPassShaper_GetInput(&b->shaper);
+    }
+    
+    // init inactivity monitor
     if (b->inactivity_time >= 0) {
         PacketPassInactivityMonitor_Init(&b->monitor, buf_out, source->reactor, b->inactivity_time, handler_inactivity, user);
         buf_out = PacketPassInactivityMonitor_GetInput(&b->monitor);
     }
     
     // init route buffer
-    if (!RouteBuffer_Init(&b->rbuf, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, buf_out, num_packets)) {
+    if (!RouteBuffer_Init(&b->rbuf, PacketRouter_GetSource(&source->router), buf_out, num_packets, BReactor_PendingGroup(source->reactor))) {
         BLog(BLOG_ERROR, "RouteBuffer_Init failed");
         goto fail1;
     }
@@ -449,6 +574,9 @@ fail1:
     if (b->inactivity_time >= 0) {
         PacketPassInactivityMonitor_Free(&b->monitor);
     }
+    if (b->shaping) {
+        PacketPassShaper_Free(&b->shaper);
+    }
     PacketPassConnector_Free(&b->connector);
     free(b);
 fail0:
@@ -491,26 +619,51 @@ void DataProtoFlow_Route (DataProtoFlow *o, int more)
     ASSERT(more == 0 || more == 1)
     struct DataProtoFlow_buffer *b = o->b;
     
-    // write header. Don't set flags, it will be set in notifier_handler.
+    // build header. Flags will be set in notifier_handler.
+    // The frame itself is shared by all flows it is routed to, and the header
+    // is written in front of it only when this flow's buffer sends it.
+    uint8_t prefix[DATAPROTO_MAX_OVERHEAD];
     struct dataproto_header header;
     struct dataproto_peer_id id;
+    header.flags = hton8(0);
     header.from_id = htol16(o->source_id);
     header.num_peer_ids = htol16(1);
     id.id = htol16(o->dest_id);
-    memcpy(o->source->current_buf, &header, sizeof(header));
-    memcpy(o->source->current_buf + sizeof(header), &id, sizeof(id));
+    memcpy(prefix, &header, sizeof(header));
+    memcpy(prefix + sizeof(header), &id, sizeof(id));
+    
+    // don't allow further routing if more==0
+    if (!more) {
+        o->source->current_buf = NULL;
+    }
     
     // route
-    uint8_t *next_buf;
-    if (!PacketRouter_Route(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf,
-                            &next_buf, DATAPROTO_MAX_OVERHEAD, (more ? o->source->current_recv_len : 0)
-    )) {
+    if (!PacketRouter_Route(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf, prefix)) {
         BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
+        o->num_dropped++;
         return;
     }
+}
+
+uint64_t DataProtoFlow_GetNumDropped (DataProtoFlow *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_dropped;
+}
+
+void DataProtoFlow_EnableCodel (DataProtoFlow *o, const struct PacketCodel_params *codel)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    RouteBuffer_EnableCodel(&o->b->rbuf, codel);
+}
+
+uint64_t DataProtoFlow_GetNumCodelDropped (DataProtoFlow *o)
+{
+    DebugObject_Access(&o->d_obj);
     
-    // remember next buffer, or don't allow further routing if more==0
-    o->source->current_buf = (more ? next_buf : NULL);
+    return RouteBuffer_GetNumCodelDropped(&o->b->rbuf);
 }
 
 void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink)
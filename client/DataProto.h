@@ -47,6 +47,7 @@
 #include <flow/PacketPassConnector.h>
 #include <flow/PacketRouter.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
+#include <flowextra/PacketPassShaper.h>
 #include <client/DataProtoKeepaliveSource.h>
 
 typedef void (*DataProtoSink_handler) (void *user, int up);
@@ -55,6 +56,21 @@ typedef void (*DataProtoFlow_handler_inactivity) (void *user);
 
 struct DataProtoFlow_buffer;
 
+/**
+ * Traffic counters and round-trip time of a {@link DataProtoSink}.
+ * Round-trip times are in milliseconds and only defined if have_rtt is set.
+ */
+struct DataProtoSink_stats {
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    int have_rtt;
+    btime_t rtt_last;
+    btime_t rtt_smoothed;
+    btime_t rtt_min;
+};
+
 /**
  * Frame destination.
  * Represents a peer as a destination for sending frames to.
@@ -70,6 +86,9 @@ typedef struct {
     SinglePacketBuffer ka_buffer;
     PacketPassFairQueueFlow ka_qflow;
     BTimer receive_timer;
+    BTimer ping_timer;
+    struct DataProtoSink_stats stats;
+    btime_t rtt_avg8;
     int up;
     int up_report;
     DataProtoSink_handler handler;
@@ -107,14 +126,17 @@ typedef struct {
     peerid_t dest_id;
     DataProtoSink *sink_desired;
     struct DataProtoFlow_buffer *b;
+    uint64_t num_dropped;
     DebugObject d_obj;
 } DataProtoFlow;
 
 struct DataProtoFlow_buffer {
     DataProtoFlow *flow;
     int inactivity_time;
+    int shaping;
     RouteBuffer rbuf;
     PacketPassInactivityMonitor monitor;
+    PacketPassShaper shaper;
     PacketPassConnector connector;
     DataProtoSink *sink;
     PacketPassFairQueueFlow sink_qflow;
@@ -122,11 +144,15 @@ struct DataProtoFlow_buffer {
 
 /**
  * Initializes the sink.
+ * Keep-alives carry round-trip time probes, see {@link DataProtoSink_ReceivedKeepalive}.
+ * While the link is busy and no keep-alives are needed, one is still sent every
+ * 2*keepalive_time to measure the round-trip time.
  * 
  * @param o the object
  * @param reactor reactor we live in
  * @param output output interface. Must support cancel functionality. Its MTU must be
- *               >=DATAPROTO_MAX_OVERHEAD.
+ *               >=DATAPROTO_MAX_OVERHEAD and >=sizeof(struct dataproto_header) +
+ *               sizeof(struct dataproto_ping_record).
  * @param keepalive_time keepalive time
  * @param tolerance_time after how long of not having received anything from the peer
  *                       to consider the link down
@@ -151,8 +177,30 @@ void DataProtoSink_Free (DataProtoSink *o);
  * @param o the object
  * @param peer_receiving whether the DATAPROTO_FLAGS_RECEIVING_KEEPALIVES flag was set in the packet.
  *                       Must be 0 or 1.
+ * @param packet_len length of the packet. Must be >=0.
+ */
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int packet_len);
+
+/**
+ * Passes the payload of a keep-alive (a packet with no destination peers) received
+ * from the peer to the sink. Ping requests are answered with the next keep-alive,
+ * which is sent right away, and ping replies update the round-trip time.
+ * Anything else is ignored.
+ * Must not be in freeing state.
+ * 
+ * @param o the object
+ * @param data payload following the DataProto header
+ * @param data_len length of the payload. Must be >=0.
+ */
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const uint8_t *data, int data_len);
+
+/**
+ * Returns traffic counters and the round-trip time of the sink.
+ * 
+ * @param o the object
+ * @return statistics, valid until the sink is freed
  */
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving);
+const struct DataProtoSink_stats * DataProtoSink_GetStats (DataProtoSink *o);
 
 /**
  * Initiazes the source.
@@ -189,12 +237,16 @@ void DataProtoSource_Free (DataProtoSource *o);
  *                        inactivity handler; <0 to disable. Note that the flow is considered
  *                        active as long as its buffer is non-empty, even if is not attached to
  *                        a {@link DataProtoSink}.
+ * @param shaper_parent if not NULL, frames are rate limited by this bucket, together
+ *                      with other flows using it. Must outlive the flow.
+ * @param shaper_rate if >0, frames are rate limited to this many bytes per second, in
+ *                    addition to any limit by shaper_parent. Must be <=TOKENBUCKET_MAX_RATE.
  * @param user value to pass to handler
  * @param handler_inactivity inactivity handler, if inactivity_time >=0
  * @return 1 on success, 0 on failure
  */
-int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time, void *user,
-                        DataProtoFlow_handler_inactivity handler_inactivity) WARN_UNUSED;
+int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time,
+                        TokenBucket *shaper_parent, int64_t shaper_rate, void *user, DataProtoFlow_handler_inactivity handler_inactivity) WARN_UNUSED;
 
 /**
  * Frees the flow.
@@ -206,6 +258,7 @@ void DataProtoFlow_Free (DataProtoFlow *o);
 
 /**
  * Routes a frame from the flow's source to this flow.
+ * The frame is not copied; all flows it is routed to share it.
  * Must be called from within the job context of the {@link DataProtoSource_handler} handler.
  * Must not be called after this has been called with more=0 for the current frame.
  * 
@@ -216,6 +269,32 @@ void DataProtoFlow_Free (DataProtoFlow *o);
  */
 void DataProtoFlow_Route (DataProtoFlow *o, int more);
 
+/**
+ * Returns the number of frames dropped because the flow's buffer was full.
+ * 
+ * @param o the object
+ * @return number of dropped frames
+ */
+uint64_t DataProtoFlow_GetNumDropped (DataProtoFlow *o);
+
+/**
+ * Enables CoDel active queue management on the flow's buffer, so that frames
+ * which have been waiting too long to be sent are dropped.
+ * Must be called before any frames are routed to the flow.
+ * 
+ * @param o the object
+ * @param codel CoDel parameters, see {@link PacketCodel_Init}
+ */
+void DataProtoFlow_EnableCodel (DataProtoFlow *o, const struct PacketCodel_params *codel);
+
+/**
+ * Returns the number of frames dropped by CoDel.
+ * 
+ * @param o the object
+ * @return number of dropped frames; 0 if CoDel is not enabled
+ */
+uint64_t DataProtoFlow_GetNumCodelDropped (DataProtoFlow *o);
+
 /**
  * Attaches the flow to a sink.
  * The flow must be in not attached state.
@@ -44,14 +44,40 @@ static void output_handler_recv (DataProtoKeepaliveSource *o, uint8_t *data)
     header.num_peer_ids = htol16(0);
     memcpy(data, &header, sizeof(header));
     
+    // nothing to put in the payload?
+    if (!o->have_reply && !o->send_requests) {
+        PacketRecvInterface_Done(&o->output, sizeof(struct dataproto_header));
+        return;
+    }
+    
+    btime_t now = btime_gettime();
+    
+    struct dataproto_ping_record record;
+    record.magic = htol32(DATAPROTO_PING_MAGIC);
+    if (o->have_reply) {
+        record.type = htol8(DATAPROTO_PING_TYPE_REPLY);
+        record.time = htol64(o->reply_time);
+        record.hold_time = htol32(now - o->reply_received);
+        o->have_reply = 0;
+    } else {
+        record.type = htol8(DATAPROTO_PING_TYPE_REQUEST);
+        record.time = htol64(now);
+        record.hold_time = htol32(0);
+    }
+    memcpy(data + sizeof(header), &record, sizeof(record));
+    
     // finish packet
-    PacketRecvInterface_Done(&o->output, sizeof(struct dataproto_header));
+    PacketRecvInterface_Done(&o->output, sizeof(struct dataproto_header) + sizeof(struct dataproto_ping_record));
 }
 
 void DataProtoKeepaliveSource_Init (DataProtoKeepaliveSource *o, BPendingGroup *pg)
 {
     // init output
-    PacketRecvInterface_Init(&o->output, sizeof(struct dataproto_header), (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    PacketRecvInterface_Init(&o->output, sizeof(struct dataproto_header) + sizeof(struct dataproto_ping_record), (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    
+    // send no requests and have no reply
+    o->send_requests = 0;
+    o->have_reply = 0;
     
     DebugObject_Init(&o->d_obj);
 }
@@ -59,7 +85,7 @@ void DataProtoKeepaliveSource_Init (DataProtoKeepaliveSource *o, BPendingGroup *
 void DataProtoKeepaliveSource_Free (DataProtoKeepaliveSource *o)
 {
     DebugObject_Free(&o->d_obj);
-
+    
     // free output
     PacketRecvInterface_Free(&o->output);
 }
@@ -70,3 +96,20 @@ PacketRecvInterface * DataProtoKeepaliveSource_GetOutput (DataProtoKeepaliveSour
     
     return &o->output;
 }
+
+void DataProtoKeepaliveSource_SetReply (DataProtoKeepaliveSource *o, uint64_t time)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->have_reply = 1;
+    o->reply_time = time;
+    o->reply_received = btime_gettime();
+}
+
+void DataProtoKeepaliveSource_SetSendRequests (DataProtoKeepaliveSource *o, int send_requests)
+{
+    ASSERT(send_requests == 0 || send_requests == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    o->send_requests = send_requests;
+}
@@ -34,16 +34,27 @@
 #ifndef BADVPN_DATAPROTOKEEPALIVESOURCE_H
 #define BADVPN_DATAPROTOKEEPALIVESOURCE_H
 
+#include <stdint.h>
+
 #include <base/DebugObject.h>
+#include <system/BTime.h>
 #include <flow/PacketRecvInterface.h>
 
 /**
  * A {@link PacketRecvInterface} source which provides DataProto keepalive packets.
- * These packets have no payload, no destination peers and flags zero.
+ * These packets have no destination peers and flags zero. Their payload is a
+ * {@link dataproto_ping_record}: a reply if one was requested with
+ * {@link DataProtoKeepaliveSource_SetReply}, otherwise a request if requests
+ * are enabled with {@link DataProtoKeepaliveSource_SetSendRequests}. If there
+ * is nothing to send, the payload is empty.
  */
 typedef struct {
     DebugObject d_obj;
     PacketRecvInterface output;
+    int send_requests;
+    int have_reply;
+    uint64_t reply_time;
+    btime_t reply_received;
 } DataProtoKeepaliveSource;
 
 /**
@@ -63,11 +74,31 @@ void DataProtoKeepaliveSource_Free (DataProtoKeepaliveSource *o);
 
 /**
  * Returns the output interface.
- * The MTU of the output interface will be sizeof(struct dataproto_header).
+ * The MTU of the output interface will be sizeof(struct dataproto_header) +
+ * sizeof(struct dataproto_ping_record).
  *
  * @param o the object
  * @return output interface
  */
 PacketRecvInterface * DataProtoKeepaliveSource_GetOutput (DataProtoKeepaliveSource *o);
 
+/**
+ * Makes the next packet carry a ping reply instead of a request.
+ * Replaces any reply not yet sent.
+ * 
+ * @param o the object
+ * @param time time field from the request
+ */
+void DataProtoKeepaliveSource_SetReply (DataProtoKeepaliveSource *o, uint64_t time);
+
+/**
+ * Sets whether packets not carrying a reply carry a ping request.
+ * Requests are initially disabled, so that packets queued while the link
+ * is not yet working do not produce round-trip times including the setup.
+ * 
+ * @param o the object
+ * @param send_requests 1 to send requests, 0 to not. Must be 0 or 1.
+ */
+void DataProtoKeepaliveSource_SetSendRequests (DataProtoKeepaliveSource *o, int send_requests);
+
 #endif
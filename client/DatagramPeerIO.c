@@ -27,6 +27,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/minmax.h>
+#include <misc/balloc.h>
+#include <protocol/dataproto.h>
+
 #include <client/DatagramPeerIO.h>
 
 #include <generated/blog_channel_DatagramPeerIO.h>
@@ -34,26 +41,71 @@
 #define DATAGRAMPEERIO_MODE_NONE 0
 #define DATAGRAMPEERIO_MODE_CONNECT 1
 #define DATAGRAMPEERIO_MODE_BIND 2
+#define DATAGRAMPEERIO_MODE_SHARED_CONNECT 3
+#define DATAGRAMPEERIO_MODE_SHARED_BIND 4
+
+#define MODE_IS_SHARED(mode) ((mode) == DATAGRAMPEERIO_MODE_SHARED_CONNECT || (mode) == DATAGRAMPEERIO_MODE_SHARED_BIND)
+
+// datagram size assumed to get through on any path
+#define PMTU_BASE_SOCKET_MTU 1200
+
+// how long to wait for a probe to be acknowledged
+#define PMTU_PROBE_TIMEOUT 1000
+
+// after how many unacknowledged probes a size is considered not to work
+#define PMTU_MAX_PROBES 3
+
+// the search stops when the size is known up to this many bytes
+#define PMTU_SEARCH_ACCURACY 16
+
+// after how long to check the path again once the search is done
+#define PMTU_RECHECK_INTERVAL 600000
+
+#define PMTU_STATE_SEARCHING 0
+#define PMTU_STATE_DONE 1
+
+#define PMTU_MIN_PACKET_SIZE (sizeof(struct fragmentproto_chunk_header) + sizeof(struct dataproto_header) + sizeof(struct dataproto_pmtu_record))
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
 static void init_io (DatagramPeerIO *o);
 static void free_io (DatagramPeerIO *o);
+static void init_shared_io (DatagramPeerIO *o);
+static void free_shared_io (DatagramPeerIO *o);
 static void dgram_handler (DatagramPeerIO *o, int event);
+static void shared_entry_handler_error (DatagramPeerIO *o);
 static void reset_mode (DatagramPeerIO *o);
 static void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void pmtu_start (DatagramPeerIO *o);
+static void pmtu_set_current (DatagramPeerIO *o, int size);
+static void pmtu_send (DatagramPeerIO *o);
+static void pmtu_next_probe (DatagramPeerIO *o);
+static void pmtu_timer_handler (DatagramPeerIO *o);
+static void pmtu_send_handler_done (DatagramPeerIO *o);
+static void pmtu_recv_handler_send (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void pmtu_recv_handler_done (DatagramPeerIO *o);
 
 void init_io (DatagramPeerIO *o)
 {
     // init dgram recv interface
     BDatagram_RecvAsync_Init(&o->dgram, o->effective_socket_mtu);
     
+    // enable receive coalescing
+    if (o->socket_offload && !BDatagram_RecvAsync_EnableCoalescing(&o->dgram)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_RecvAsync_EnableCoalescing failed");
+    }
+    
     // connect source
     PacketRecvConnector_ConnectInput(&o->recv_connector, BDatagram_RecvAsync_GetIf(&o->dgram));
     
     // init dgram send interface
     BDatagram_SendAsync_Init(&o->dgram, o->effective_socket_mtu);
     
+    // enable send batching
+    if (o->socket_offload && !BDatagram_SendAsync_EnableBatching(&o->dgram)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SendAsync_EnableBatching failed");
+    }
+    
     // connect sink
     PacketPassConnector_ConnectOutput(&o->send_connector, BDatagram_SendAsync_GetIf(&o->dgram));
 }
@@ -73,6 +125,24 @@ void free_io (DatagramPeerIO *o)
     BDatagram_RecvAsync_Free(&o->dgram);
 }
 
+void init_shared_io (DatagramPeerIO *o)
+{
+    // connect source
+    PacketRecvConnector_ConnectInput(&o->recv_connector, DatagramSharedSocketEntry_GetRecvOutput(&o->shared_entry));
+    
+    // connect sink
+    PacketPassConnector_ConnectOutput(&o->send_connector, DatagramSharedSocketEntry_GetSendInput(&o->shared_entry));
+}
+
+void free_shared_io (DatagramPeerIO *o)
+{
+    // disconnect sink
+    PacketPassConnector_DisconnectOutput(&o->send_connector);
+    
+    // disconnect source
+    PacketRecvConnector_DisconnectInput(&o->recv_connector);
+}
+
 void dgram_handler (DatagramPeerIO *o, int event)
 {
     DebugObject_Access(&o->d_obj);
@@ -90,9 +160,26 @@ void dgram_handler (DatagramPeerIO *o, int event)
     }
 }
 
+void shared_entry_handler_error (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(MODE_IS_SHARED(o->mode))
+    
+    PeerLog(o, BLOG_NOTICE, "shared socket error");
+    
+    // reset mode
+    reset_mode(o);
+    
+    // report error
+    if (o->handler_error) {
+        o->handler_error(o->user);
+        return;
+    }
+}
+
 void reset_mode (DatagramPeerIO *o)
 {
-    ASSERT(o->mode == DATAGRAMPEERIO_MODE_NONE || o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_NONE || o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND || MODE_IS_SHARED(o->mode))
     
     if (o->mode == DATAGRAMPEERIO_MODE_NONE) {
         return;
@@ -101,11 +188,24 @@ void reset_mode (DatagramPeerIO *o)
     // remove recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, NULL, NULL);
     
-    // free I/O
-    free_io(o);
+    // stop path MTU discovery
+    if (o->pmtu_discovery) {
+        BReactor_RemoveTimer(o->reactor, &o->pmtu_timer);
+    }
     
-    // free datagram object
-    BDatagram_Free(&o->dgram);
+    if (MODE_IS_SHARED(o->mode)) {
+        // free I/O
+        free_shared_io(o);
+        
+        // free shared socket entry
+        DatagramSharedSocketEntry_Free(&o->shared_entry);
+    } else {
+        // free I/O
+        free_io(o);
+        
+        // free datagram object
+        BDatagram_Free(&o->dgram);
+    }
     
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
@@ -113,13 +213,17 @@ void reset_mode (DatagramPeerIO *o)
 
 void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len)
 {
-    ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND || o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND)
     DebugObject_Access(&o->d_obj);
     
     // obtain addresses from last received packet
     BAddr addr;
     BIPAddr local_addr;
-    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &addr, &local_addr))
+    if (o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+        ASSERT_EXECUTE(DatagramSharedSocketEntry_GetLastReceiveAddrs(&o->shared_entry, &addr, &local_addr))
+    } else {
+        ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &addr, &local_addr))
+    }
     
     // check address family just in case
     if (!BDatagram_AddressFamilySupported(addr.type)) {
@@ -128,7 +232,259 @@ void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_l
     }
     
     // update addresses
-    BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
+    if (o->mode == DATAGRAMPEERIO_MODE_SHARED_BIND) {
+        DatagramSharedSocketEntry_SetSendAddrs(&o->shared_entry, addr, local_addr);
+    } else {
+        BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
+    }
+}
+
+void pmtu_start (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtu_discovery)
+    ASSERT(o->mode != DATAGRAMPEERIO_MODE_NONE)
+    
+    // this may be a different path, start from the base size
+    pmtu_set_current(o, o->pmtu_base);
+    o->pmtu_high = o->spproto_payload_mtu + 1;
+    o->pmtu_state = PMTU_STATE_SEARCHING;
+    o->pmtu_probe_size = -1;
+    o->pmtu_probe_tries = 0;
+    o->pmtu_peer_seen = 0;
+    
+    // send the first probe soon
+    BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, 0);
+}
+
+void pmtu_set_current (DatagramPeerIO *o, int size)
+{
+    ASSERT(size >= o->pmtu_base)
+    ASSERT(size <= o->spproto_payload_mtu)
+    
+    if (size != o->pmtu_current) {
+        PeerLog(o, BLOG_INFO, "packet size limit %d", size);
+    }
+    
+    o->pmtu_current = size;
+    
+    // limit packets with frames
+    FragmentProtoDisassembler_SetOutputLimit(&o->send_disassembler, o->pmtu_current);
+}
+
+void pmtu_send (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtu_discovery)
+    
+    if (o->pmtu_sending) {
+        return;
+    }
+    
+    // acknowledge probes first, then send our probe
+    int type;
+    int size;
+    int len;
+    if (o->pmtu_ack_size >= 0) {
+        type = DATAPROTO_PMTU_TYPE_ACK;
+        size = o->pmtu_ack_size;
+        len = sizeof(struct dataproto_header) + sizeof(struct dataproto_pmtu_record);
+        o->pmtu_ack_size = -1;
+    }
+    else if (o->pmtu_send_probe) {
+        ASSERT(o->pmtu_probe_size >= o->pmtu_base)
+        type = DATAPROTO_PMTU_TYPE_PROBE;
+        size = o->pmtu_probe_size;
+        len = size - sizeof(struct fragmentproto_chunk_header);
+        o->pmtu_send_probe = 0;
+    }
+    else {
+        return;
+    }
+    
+    // write header
+    struct dataproto_header header;
+    header.flags = htol8(o->pmtu_peer_seen ? DATAPROTO_FLAGS_RECEIVING_KEEPALIVES : 0);
+    header.from_id = htol16(0);
+    header.num_peer_ids = htol16(0);
+    memcpy(o->pmtu_buf, &header, sizeof(header));
+    
+    // write record
+    struct dataproto_pmtu_record record;
+    record.magic = htol32(DATAPROTO_PMTU_MAGIC);
+    record.type = htol8(type);
+    record.size = htol16(size);
+    memcpy(o->pmtu_buf + sizeof(header), &record, sizeof(record));
+    
+    // write padding
+    int pos = sizeof(header) + sizeof(record);
+    memset(o->pmtu_buf + pos, 0, len - pos);
+    
+    // send
+    o->pmtu_sending = 1;
+    PacketPassInterface_Sender_Send(FragmentProtoDisassembler_GetProbeInput(&o->send_disassembler), o->pmtu_buf, len);
+}
+
+void pmtu_next_probe (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtu_state == PMTU_STATE_SEARCHING)
+    
+    if (o->pmtu_probe_size < 0) {
+        // is the search done?
+        if (o->pmtu_high - o->pmtu_current <= PMTU_SEARCH_ACCURACY) {
+            PeerLog(o, BLOG_INFO, "path MTU search done");
+            o->pmtu_state = PMTU_STATE_DONE;
+            BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, PMTU_RECHECK_INTERVAL);
+            return;
+        }
+        
+        // try the largest size first, then bisect
+        if (o->pmtu_high > o->spproto_payload_mtu) {
+            o->pmtu_probe_size = o->spproto_payload_mtu;
+        } else {
+            o->pmtu_probe_size = o->pmtu_current + (o->pmtu_high - o->pmtu_current) / 2;
+        }
+        o->pmtu_probe_tries = 0;
+    }
+    
+    // send probe
+    o->pmtu_send_probe = 1;
+    pmtu_send(o);
+    
+    // wait for ack
+    BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, PMTU_PROBE_TIMEOUT);
+}
+
+void pmtu_timer_handler (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->pmtu_discovery)
+    ASSERT(o->mode != DATAGRAMPEERIO_MODE_NONE)
+    
+    if (o->pmtu_state == PMTU_STATE_DONE) {
+        // check the path again: confirm the current size, then search upwards
+        o->pmtu_state = PMTU_STATE_SEARCHING;
+        o->pmtu_high = o->spproto_payload_mtu + 1;
+        o->pmtu_probe_size = (o->pmtu_current > o->pmtu_base ? o->pmtu_current : -1);
+        o->pmtu_probe_tries = 0;
+    }
+    else if (o->pmtu_probe_size >= 0) {
+        // probe was not acknowledged; losses only count once the peer is known to be there
+        if (o->pmtu_peer_seen) {
+            o->pmtu_probe_tries++;
+        }
+        
+        if (o->pmtu_probe_tries >= PMTU_MAX_PROBES) {
+            PeerLog(o, BLOG_INFO, "packet size %d does not get through", o->pmtu_probe_size);
+            
+            // if the path no longer takes the current size, start over
+            if (o->pmtu_probe_size <= o->pmtu_current) {
+                pmtu_set_current(o, o->pmtu_base);
+            }
+            
+            o->pmtu_high = o->pmtu_probe_size;
+            o->pmtu_probe_size = -1;
+            o->pmtu_probe_tries = 0;
+        }
+    }
+    
+    pmtu_next_probe(o);
+}
+
+void pmtu_send_handler_done (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->pmtu_discovery)
+    ASSERT(o->pmtu_sending)
+    
+    o->pmtu_sending = 0;
+    
+    // send anything that was waiting
+    pmtu_send(o);
+}
+
+static void pmtu_handle_record (DatagramPeerIO *o, int type, int size, int frame_len)
+{
+    switch (type) {
+        case DATAPROTO_PMTU_TYPE_PROBE: {
+            // the probe must have been sent in a packet of its own
+            if (frame_len + (int)sizeof(struct fragmentproto_chunk_header) != size) {
+                PeerLog(o, BLOG_INFO, "probe size mismatch");
+                return;
+            }
+            
+            // acknowledge
+            o->pmtu_ack_size = size;
+            pmtu_send(o);
+        } break;
+        
+        case DATAPROTO_PMTU_TYPE_ACK: {
+            if (o->mode == DATAGRAMPEERIO_MODE_NONE || size < o->pmtu_base || size > o->spproto_payload_mtu) {
+                return;
+            }
+            
+            // a late ack may prove a size we gave up on
+            if (size >= o->pmtu_high) {
+                o->pmtu_high = o->spproto_payload_mtu + 1;
+            }
+            
+            // raise the limit
+            if (size > o->pmtu_current) {
+                pmtu_set_current(o, size);
+            }
+            
+            // continue the search right away
+            if (size == o->pmtu_probe_size && o->pmtu_state == PMTU_STATE_SEARCHING) {
+                o->pmtu_probe_size = -1;
+                o->pmtu_probe_tries = 0;
+                BReactor_SetTimerAfter(o->reactor, &o->pmtu_timer, 0);
+            }
+        } break;
+        
+        default:
+            PeerLog(o, BLOG_INFO, "unknown path MTU record");
+            break;
+    }
+}
+
+void pmtu_recv_handler_send (DatagramPeerIO *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->pmtu_discovery)
+    ASSERT(data_len >= 0)
+    
+    // the peer is there
+    o->pmtu_peer_seen = 1;
+    
+    // is this a keep-alive with a path MTU record?
+    if (data_len >= sizeof(struct dataproto_header) + sizeof(struct dataproto_pmtu_record)) {
+        struct dataproto_header header;
+        memcpy(&header, data, sizeof(header));
+        struct dataproto_pmtu_record record;
+        memcpy(&record, data + sizeof(header), sizeof(record));
+        
+        if (ltoh16(header.num_peer_ids) == 0 && ltoh32(record.magic) == DATAPROTO_PMTU_MAGIC) {
+            pmtu_handle_record(o, ltoh8(record.type), ltoh16(record.size), data_len);
+            PacketPassInterface_Done(&o->pmtu_recv_if);
+            return;
+        }
+    }
+    
+    // only probes may be larger than frames
+    if (data_len > PacketPassInterface_GetMTU(o->recv_userif)) {
+        PeerLog(o, BLOG_INFO, "frame too large");
+        PacketPassInterface_Done(&o->pmtu_recv_if);
+        return;
+    }
+    
+    // pass frame to user
+    PacketPassInterface_Sender_Send(o->recv_userif, data, data_len);
+}
+
+void pmtu_recv_handler_done (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->pmtu_discovery)
+    
+    PacketPassInterface_Done(&o->pmtu_recv_if);
 }
 
 int DatagramPeerIO_Init (
@@ -138,6 +494,9 @@ int DatagramPeerIO_Init (
     int socket_mtu,
     struct spproto_security_params sp_params,
     btime_t latency,
+    int adaptive_latency,
+    int pmtu_discovery,
+    int socket_offload,
     int num_frames,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
@@ -151,6 +510,8 @@ int DatagramPeerIO_Init (
 {
     ASSERT(payload_mtu >= 0)
     ASSERT(socket_mtu >= 0)
+    ASSERT(pmtu_discovery == 0 || pmtu_discovery == 1)
+    ASSERT(socket_offload == 0 || socket_offload == 1)
     spproto_assert_security_params(sp_params);
     ASSERT(num_frames > 0)
     ASSERT(PacketPassInterface_GetMTU(recv_userif) >= payload_mtu)
@@ -166,6 +527,9 @@ int DatagramPeerIO_Init (
     o->user = user;
     o->logfunc = logfunc;
     o->handler_error = handler_error;
+    o->recv_userif = recv_userif;
+    o->pmtu_discovery = pmtu_discovery;
+    o->socket_offload = socket_offload;
     
     // check num frames (for FragmentProtoAssembler)
     if (num_frames >= FPA_MAX_TIME) {
@@ -191,14 +555,45 @@ int DatagramPeerIO_Init (
         goto fail0;
     }
     
+    // init path MTU discovery
+    PacketPassInterface *assembler_output = o->recv_userif;
+    if (o->pmtu_discovery) {
+        // calculate base packet size
+        if ((o->pmtu_base = spproto_payload_mtu_for_carrier_mtu(o->sp_params, bmin_int(socket_mtu, PMTU_BASE_SOCKET_MTU))) < (int)PMTU_MIN_PACKET_SIZE) {
+            PeerLog(o, BLOG_ERROR, "socket MTU is too small for path MTU discovery");
+            goto fail0;
+        }
+        
+        // allocate buffer for probes
+        if (!(o->pmtu_buf = (uint8_t *)BAlloc(o->spproto_payload_mtu - sizeof(struct fragmentproto_chunk_header)))) {
+            PeerLog(o, BLOG_ERROR, "BAlloc failed");
+            goto fail0;
+        }
+        
+        // init interface between assembler and user, taking probes too
+        int frame_mtu = bmax_int(PacketPassInterface_GetMTU(o->recv_userif), o->spproto_payload_mtu - sizeof(struct fragmentproto_chunk_header));
+        PacketPassInterface_Init(&o->pmtu_recv_if, frame_mtu, (PacketPassInterface_handler_send)pmtu_recv_handler_send, o, BReactor_PendingGroup(o->reactor));
+        PacketPassInterface_Sender_Init(o->recv_userif, (PacketPassInterface_handler_done)pmtu_recv_handler_done, o);
+        assembler_output = &o->pmtu_recv_if;
+        
+        // init timer
+        BTimer_Init(&o->pmtu_timer, 0, (BTimer_handler)pmtu_timer_handler, o);
+        
+        o->pmtu_sending = 0;
+        o->pmtu_ack_size = -1;
+        o->pmtu_send_probe = 0;
+        o->pmtu_current = -1;
+        o->pmtu_probe_size = -1;
+    }
+    
     // init receiving
     
     // init assembler
-    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->spproto_payload_mtu, recv_userif, num_frames, fragmentproto_max_chunks_for_frame(o->spproto_payload_mtu, o->payload_mtu),
+    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->spproto_payload_mtu, assembler_output, num_frames, fragmentproto_max_chunks_for_frame(o->spproto_payload_mtu, PacketPassInterface_GetMTU(assembler_output)),
                                      BReactor_PendingGroup(o->reactor), o->user, o->logfunc
     )) {
         PeerLog(o, BLOG_ERROR, "FragmentProtoAssembler_Init failed");
-        goto fail0;
+        goto fail0a;
     }
     
     // init notifier
@@ -223,7 +618,7 @@ int DatagramPeerIO_Init (
     // init sending base
     
     // init disassembler
-    FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency);
+    FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency, adaptive_latency);
     
     // init encoder
     if (!SPProtoEncoder_Init(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd)) {
@@ -232,6 +627,11 @@ int DatagramPeerIO_Init (
     }
     SPProtoEncoder_SetHandlers(&o->send_encoder, handler_otp_warning, user);
     
+    // send probes through the disassembler
+    if (o->pmtu_discovery) {
+        PacketPassInterface_Sender_Init(FragmentProtoDisassembler_GetProbeInput(&o->send_disassembler), (PacketPassInterface_handler_done)pmtu_send_handler_done, o);
+    }
+    
     // init connector
     PacketPassConnector_Init(&o->send_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
     
@@ -259,6 +659,11 @@ fail2:
 fail1:
     PacketPassNotifier_Free(&o->recv_notifier);
     FragmentProtoAssembler_Free(&o->recv_assembler);
+fail0a:
+    if (o->pmtu_discovery) {
+        PacketPassInterface_Free(&o->pmtu_recv_if);
+        BFree(o->pmtu_buf);
+    }
 fail0:
     return 0;
 }
@@ -266,7 +671,7 @@ fail0:
 void DatagramPeerIO_Free (DatagramPeerIO *o)
 {
     DebugObject_Free(&o->d_obj);
-
+    
     // reset mode
     reset_mode(o);
     
@@ -282,6 +687,12 @@ void DatagramPeerIO_Free (DatagramPeerIO *o)
     SPProtoDecoder_Free(&o->recv_decoder);
     PacketPassNotifier_Free(&o->recv_notifier);
     FragmentProtoAssembler_Free(&o->recv_assembler);
+    
+    // free path MTU discovery
+    if (o->pmtu_discovery) {
+        PacketPassInterface_Free(&o->pmtu_recv_if);
+        BFree(o->pmtu_buf);
+    }
 }
 
 PacketPassInterface * DatagramPeerIO_GetSendInput (DatagramPeerIO *o)
@@ -310,6 +721,12 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
         goto fail0;
     }
     
+    // disable fragmentation for path MTU discovery
+    if (o->pmtu_discovery && !BDatagram_SetDontFragment(&o->dgram)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_SetDontFragment failed");
+        goto fail1;
+    }
+    
     // set send address
     BIPAddr local_addr;
     BIPAddr_InitInvalid(&local_addr);
@@ -321,8 +738,15 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_CONNECT;
     
+    // start path MTU discovery
+    if (o->pmtu_discovery) {
+        pmtu_start(o);
+    }
+    
     return 1;
     
+fail1:
+    BDatagram_Free(&o->dgram);
 fail0:
     return 0;
 }
@@ -347,6 +771,12 @@ int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr)
         goto fail1;
     }
     
+    // disable fragmentation for path MTU discovery
+    if (o->pmtu_discovery && !BDatagram_SetDontFragment(&o->dgram)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_SetDontFragment failed");
+        goto fail1;
+    }
+    
     // init I/O
     init_io(o);
     
@@ -356,6 +786,11 @@ int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr)
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_BIND;
     
+    // start path MTU discovery
+    if (o->pmtu_discovery) {
+        pmtu_start(o);
+    }
+    
     return 1;
     
 fail1:
@@ -364,6 +799,86 @@ fail0:
     return 0;
 }
 
+int DatagramPeerIO_ConnectShared (DatagramPeerIO *o, DatagramSharedSocket *s, BAddr addr, uint64_t tag)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(DatagramSharedSocket_GetMTU(s) >= o->effective_socket_mtu)
+    
+    // reset mode
+    reset_mode(o);
+    
+    // check address
+    if (addr.type != DatagramSharedSocket_GetFamily(s)) {
+        PeerLog(o, BLOG_ERROR, "address family does not match shared socket");
+        goto fail0;
+    }
+    
+    // init shared socket entry
+    if (!DatagramSharedSocketEntry_Init(&o->shared_entry, s, tag, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor), o, (DatagramSharedSocketEntry_handler_error)shared_entry_handler_error)) {
+        PeerLog(o, BLOG_ERROR, "DatagramSharedSocketEntry_Init failed");
+        goto fail0;
+    }
+    
+    // set send address
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    DatagramSharedSocketEntry_SetSendAddrs(&o->shared_entry, addr, local_addr);
+    
+    // init I/O
+    init_shared_io(o);
+    
+    // set mode
+    o->mode = DATAGRAMPEERIO_MODE_SHARED_CONNECT;
+    
+    // start path MTU discovery
+    if (o->pmtu_discovery) {
+        pmtu_start(o);
+    }
+    
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+int DatagramPeerIO_BindShared (DatagramPeerIO *o, DatagramSharedSocket *s, uint64_t *out_tag)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(DatagramSharedSocket_GetMTU(s) >= o->effective_socket_mtu)
+    
+    // reset mode
+    reset_mode(o);
+    
+    // generate tag
+    uint64_t tag = DatagramSharedSocket_GenerateTag(s);
+    
+    // init shared socket entry
+    if (!DatagramSharedSocketEntry_Init(&o->shared_entry, s, tag, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor), o, (DatagramSharedSocketEntry_handler_error)shared_entry_handler_error)) {
+        PeerLog(o, BLOG_ERROR, "DatagramSharedSocketEntry_Init failed");
+        goto fail0;
+    }
+    
+    // init I/O
+    init_shared_io(o);
+    
+    // set recv notifier handler
+    PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
+    
+    // set mode
+    o->mode = DATAGRAMPEERIO_MODE_SHARED_BIND;
+    
+    // start path MTU discovery
+    if (o->pmtu_discovery) {
+        pmtu_start(o);
+    }
+    
+    *out_tag = tag;
+    return 1;
+    
+fail0:
+    return 0;
+}
+
 void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key)
 {
     ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
@@ -423,3 +938,28 @@ void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o)
     // remove receiving seeds
     SPProtoDecoder_RemoveOTPSeeds(&o->recv_decoder);
 }
+
+const struct SPProtoDecoder_counters * DatagramPeerIO_GetDecoderCounters (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return SPProtoDecoder_GetCounters(&o->recv_decoder);
+}
+
+const struct FragmentProtoAssembler_counters * DatagramPeerIO_GetAssemblerCounters (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return FragmentProtoAssembler_GetCounters(&o->recv_assembler);
+}
+
+int DatagramPeerIO_GetPathMTU (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->pmtu_discovery) {
+        return -1;
+    }
+    
+    return o->pmtu_current;
+}
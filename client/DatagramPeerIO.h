@@ -54,6 +54,7 @@
 #include <client/FragmentProtoAssembler.h>
 #include <client/SPProtoEncoder.h>
 #include <client/SPProtoDecoder.h>
+#include <client/DatagramSharedSocket.h>
 
 /**
  * Callback function invoked when an error occurs with the peer connection.
@@ -95,6 +96,16 @@ typedef void (*DatagramPeerIO_handler_otp_ready) (void *user);
  *                 Datagrams are being received on the socket. Datagrams are not being
  *                 sent initially. When a datagram is received, its source address is
  *                 used as a destination address for sending datagrams.
+ * 
+ * Connecting and binding can also be done through a {@link DatagramSharedSocket}
+ * instead of a socket of our own; datagrams are then identified by a tag which
+ * the binding peer generates and the connecting peer is told.
+ * 
+ * With path MTU discovery, datagrams are sent with fragmentation disabled and
+ * start out no larger than what any path should take. Padded DataProto keep-alives
+ * carrying a probe record are sent in datagrams of increasing size, and the
+ * largest size the peer acknowledges becomes the limit for packing frames into
+ * datagrams. The path is checked again from time to time.
  */
 typedef struct {
     DebugObject d_obj;
@@ -106,6 +117,24 @@ typedef struct {
     DatagramPeerIO_handler_error handler_error;
     int spproto_payload_mtu;
     int effective_socket_mtu;
+    PacketPassInterface *recv_userif;
+    int socket_offload;
+    
+    // path MTU discovery
+    int pmtu_discovery;
+    PacketPassInterface pmtu_recv_if;
+    uint8_t *pmtu_buf;
+    BTimer pmtu_timer;
+    int pmtu_sending;
+    int pmtu_ack_size;
+    int pmtu_send_probe;
+    int pmtu_base;
+    int pmtu_current;
+    int pmtu_high;
+    int pmtu_state;
+    int pmtu_probe_size;
+    int pmtu_probe_tries;
+    int pmtu_peer_seen;
     
     // sending base
     FragmentProtoDisassembler send_disassembler;
@@ -125,6 +154,9 @@ typedef struct {
     
     // datagram object
     BDatagram dgram;
+    
+    // shared socket entry
+    DatagramSharedSocketEntry shared_entry;
 } DatagramPeerIO;
 
 /**
@@ -143,6 +175,13 @@ typedef struct {
  *                   spproto_payload_mtu_for_carrier_mtu(sp_params, socket_mtu) > sizeof(struct fragmentproto_chunk_header)
  * @param sp_params SPProto security parameters
  * @param latency latency parameter to {@link FragmentProtoDisassembler_Init}.
+ * @param adaptive_latency adaptive parameter to {@link FragmentProtoDisassembler_Init}.
+ * @param pmtu_discovery whether to do path MTU discovery. Must be 0 or 1. If enabled,
+ *                       shared sockets must be created with fragmentation disabled.
+ * @param socket_offload whether to batch datagrams sent over our own socket and let the kernel
+ *                       coalesce received ones, see {@link BDatagram_SendAsync_EnableBatching}
+ *                       and {@link BDatagram_RecvAsync_EnableCoalescing}. Must be 0 or 1.
+ *                       Has no effect with shared sockets.
  * @param num_frames num_frames parameter to {@link FragmentProtoAssembler_Init}. Must be >0.
  * @param recv_userif interface to pass received packets to the user. Its MTU must be >=payload_mtu.
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
@@ -162,6 +201,9 @@ int DatagramPeerIO_Init (
     int socket_mtu,
     struct spproto_security_params sp_params,
     btime_t latency,
+    int adaptive_latency,
+    int pmtu_discovery,
+    int socket_offload,
     int num_frames,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
@@ -213,6 +255,35 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
  */
 int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
 
+/**
+ * Like {@link DatagramPeerIO_Connect}, but sends and receives through a shared socket.
+ * On success, the interface enters connecting mode.
+ * On failure, the interface enters default mode.
+ * 
+ * @param o the object
+ * @param s shared socket. Its MTU must be >= the socket MTU effectively used by this object,
+ *          i.e. at least socket_mtu in {@link DatagramPeerIO_Init} is enough.
+ *          Its address family must be that of addr.
+ * @param addr address to send packets to
+ * @param tag tag generated by the peer which has bound
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIO_ConnectShared (DatagramPeerIO *o, DatagramSharedSocket *s, BAddr addr, uint64_t tag) WARN_UNUSED;
+
+/**
+ * Like {@link DatagramPeerIO_Bind}, but receives through a shared socket which
+ * has been bound.
+ * On success, the interface enters binding mode.
+ * On failure, the interface enters default mode.
+ * 
+ * @param o the object
+ * @param s shared socket. Its MTU must be >= the socket MTU effectively used by this object,
+ *          i.e. at least socket_mtu in {@link DatagramPeerIO_Init} is enough.
+ * @param out_tag on success, returns the tag the other peer must connect with
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIO_BindShared (DatagramPeerIO *o, DatagramSharedSocket *s, uint64_t *out_tag) WARN_UNUSED;
+
 /**
  * Sets the encryption key to use for sending and receiving.
  * Encryption must be enabled.
@@ -268,4 +339,29 @@ void DatagramPeerIO_AddOTPRecvSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t
  */
 void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o);
 
+/**
+ * Returns counters of the receiving decoder.
+ * 
+ * @param o the object
+ * @return decoder counters, valid until the object is freed
+ */
+const struct SPProtoDecoder_counters * DatagramPeerIO_GetDecoderCounters (DatagramPeerIO *o);
+
+/**
+ * Returns counters of the receiving frame assembler.
+ * 
+ * @param o the object
+ * @return assembler counters, valid until the object is freed
+ */
+const struct FragmentProtoAssembler_counters * DatagramPeerIO_GetAssemblerCounters (DatagramPeerIO *o);
+
+/**
+ * Returns the currently used path MTU, as determined by path MTU discovery.
+ * 
+ * @param o the object
+ * @return path MTU in bytes of SPProto payload, or -1 if path MTU discovery
+ *         is disabled or has not determined a value yet
+ */
+int DatagramPeerIO_GetPathMTU (DatagramPeerIO *o);
+
 #endif
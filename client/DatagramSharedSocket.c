@@ -0,0 +1,659 @@
+/**
+ * @file DatagramSharedSocket.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <security/BRandom.h>
+#include <base/BLog.h>
+
+#include <client/DatagramSharedSocket.h>
+
+#include <generated/blog_channel_DatagramSharedSocket.h>
+
+#include "DatagramSharedSocket_entries_hash.h"
+#include <structure/CHash_impl.h>
+
+static int init_dgram (DatagramSharedSocket *o);
+static void free_dgram (DatagramSharedSocket *o);
+static void dgram_handler (DatagramSharedSocket *o, int event);
+static void error_job_handler (DatagramSharedSocket *o);
+static void schedule_send (DatagramSharedSocket *o);
+static void send_handler_done (DatagramSharedSocket *o);
+static void recv_handler_done (DatagramSharedSocket *o, int data_len);
+static DatagramSharedSocketEntry * find_entry (DatagramSharedSocket *o, uint64_t tag);
+static int common_init (DatagramSharedSocket *o, BReactor *reactor, int mtu, int dont_fragment);
+static void entry_send_handler_send (DatagramSharedSocketEntry *o, uint8_t *data, int data_len);
+static void entry_recv_handler_recv (DatagramSharedSocketEntry *o, uint8_t *data);
+static void entry_queue_send (DatagramSharedSocketEntry *o);
+
+int init_dgram (DatagramSharedSocket *o)
+{
+    ASSERT(!o->have_dgram)
+    
+    // init dgram
+    if (!BDatagram_Init(&o->dgram, o->family, o->reactor, o, (BDatagram_handler)dgram_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // bind dgram
+    if (o->bound && !BDatagram_Bind(&o->dgram, o->bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail1;
+    }
+    
+    // disable fragmentation
+    if (o->dont_fragment && !BDatagram_SetDontFragment(&o->dgram)) {
+        BLog(BLOG_ERROR, "BDatagram_SetDontFragment failed");
+        goto fail1;
+    }
+    
+    // init send interface
+    BDatagram_SendAsync_Init(&o->dgram, DATAGRAMSHAREDSOCKET_TAG_SIZE + o->mtu);
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&o->dgram), (PacketPassInterface_handler_done)send_handler_done, o);
+    
+    // init recv interface
+    BDatagram_RecvAsync_Init(&o->dgram, DATAGRAMSHAREDSOCKET_TAG_SIZE + o->mtu);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&o->dgram), (PacketRecvInterface_handler_done)recv_handler_done, o);
+    
+    // start receiving
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&o->dgram), o->recv_buf);
+    
+    // set not sending
+    o->sending = 0;
+    
+    // set have dgram
+    o->have_dgram = 1;
+    
+    return 1;
+    
+fail1:
+    BDatagram_Free(&o->dgram);
+fail0:
+    return 0;
+}
+
+void free_dgram (DatagramSharedSocket *o)
+{
+    ASSERT(o->have_dgram)
+    
+    // free recv interface
+    BDatagram_RecvAsync_Free(&o->dgram);
+    
+    // free send interface
+    BDatagram_SendAsync_Free(&o->dgram);
+    
+    // free dgram
+    BDatagram_Free(&o->dgram);
+    
+    // set have no dgram
+    o->have_dgram = 0;
+}
+
+void dgram_handler (DatagramSharedSocket *o, int event)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
+    
+    BLog(BLOG_ERROR, "socket error, failing %zu entries", o->num_entries);
+    
+    // free dgram
+    free_dgram(o);
+    
+    // move all entries to the failed list
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->entries_list)) {
+        DatagramSharedSocketEntry *e = UPPER_OBJECT(node, DatagramSharedSocketEntry, list_node);
+        ASSERT(!e->failed)
+        
+        // remove from send queue
+        if (e->send_queued) {
+            LinkedList1_Remove(&o->send_queue, &e->send_queue_node);
+            e->send_queued = 0;
+        }
+        
+        // remove from hash table, so that the tag can be used again right away
+        DatagramSharedSocket__EntriesHashRef ref = {e, e};
+        DatagramSharedSocket__EntriesHash_Remove(&o->entries_hash, 0, ref);
+        o->num_entries--;
+        
+        // move to failed list
+        LinkedList1_Remove(&o->entries_list, &e->list_node);
+        LinkedList1_Append(&o->failed_list, &e->list_node);
+        e->failed = 1;
+    }
+    
+    ASSERT(o->num_entries == 0)
+    ASSERT(LinkedList1_IsEmpty(&o->send_queue))
+    
+    // report errors
+    BPending_Set(&o->error_job);
+}
+
+void error_job_handler (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->failed_list);
+    if (!node) {
+        return;
+    }
+    DatagramSharedSocketEntry *e = UPPER_OBJECT(node, DatagramSharedSocketEntry, list_node);
+    ASSERT(e->failed)
+    
+    // continue with the other entries later
+    BPending_Set(&o->error_job);
+    
+    // report error; the handler frees the entry
+    e->handler_error(e->user);
+    return;
+}
+
+void schedule_send (DatagramSharedSocket *o)
+{
+    if (o->sending) {
+        return;
+    }
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->send_queue);
+    if (!node) {
+        return;
+    }
+    DatagramSharedSocketEntry *e = UPPER_OBJECT(node, DatagramSharedSocketEntry, send_queue_node);
+    ASSERT(o->have_dgram)
+    ASSERT(!e->failed)
+    ASSERT(e->send_queued)
+    ASSERT(e->have_send_addrs)
+    ASSERT(e->send_data_len >= 0)
+    
+    // remove entry from queue
+    LinkedList1_Remove(&o->send_queue, &e->send_queue_node);
+    e->send_queued = 0;
+    
+    // build datagram
+    uint64_t tag = htol64(e->tag);
+    memcpy(o->send_buf, &tag, DATAGRAMSHAREDSOCKET_TAG_SIZE);
+    memcpy(o->send_buf + DATAGRAMSHAREDSOCKET_TAG_SIZE, e->send_data, e->send_data_len);
+    
+    // set addresses; no send is in progress so they only apply to this datagram
+    BDatagram_SetSendAddrs(&o->dgram, e->send_remote_addr, e->send_local_addr);
+    
+    // send datagram
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&o->dgram), o->send_buf, DATAGRAMSHAREDSOCKET_TAG_SIZE + e->send_data_len);
+    o->sending = 1;
+    
+    // the packet was copied, let the entry continue
+    e->send_data_len = -1;
+    PacketPassInterface_Done(&e->send_input);
+}
+
+void send_handler_done (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
+    ASSERT(o->sending)
+    
+    // set not sending
+    o->sending = 0;
+    
+    // send next datagram
+    schedule_send(o);
+}
+
+void recv_handler_done (DatagramSharedSocket *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_dgram)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= DATAGRAMSHAREDSOCKET_TAG_SIZE + o->mtu)
+    
+    if (data_len < DATAGRAMSHAREDSOCKET_TAG_SIZE) {
+        BLog(BLOG_DEBUG, "datagram too short");
+        goto out;
+    }
+    
+    // read tag
+    uint64_t tag;
+    memcpy(&tag, o->recv_buf, DATAGRAMSHAREDSOCKET_TAG_SIZE);
+    tag = ltoh64(tag);
+    
+    uint8_t *payload = o->recv_buf + DATAGRAMSHAREDSOCKET_TAG_SIZE;
+    int payload_len = data_len - DATAGRAMSHAREDSOCKET_TAG_SIZE;
+    
+    // find entry
+    DatagramSharedSocketEntry *e = find_entry(o, tag);
+    if (!e) {
+        BLog(BLOG_DEBUG, "unknown tag");
+        goto out;
+    }
+    
+    if (payload_len > e->mtu) {
+        BLog(BLOG_DEBUG, "datagram too long for entry");
+        goto out;
+    }
+    
+    // get addresses
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &remote_addr, &local_addr))
+    
+    if (e->recv_data) {
+        // pass to entry
+        memcpy(e->recv_data, payload, payload_len);
+        e->recv_data = NULL;
+        e->have_recv_addrs = 1;
+        e->recv_remote_addr = remote_addr;
+        e->recv_local_addr = local_addr;
+        PacketRecvInterface_Done(&e->recv_output, payload_len);
+    }
+    else if (e->backlog_len < 0) {
+        // keep until the entry receives
+        memcpy(e->backlog, payload, payload_len);
+        e->backlog_len = payload_len;
+        e->backlog_remote_addr = remote_addr;
+        e->backlog_local_addr = local_addr;
+    }
+    else {
+        BLog(BLOG_DEBUG, "entry is busy, dropping datagram");
+    }
+    
+out:
+    // receive next datagram
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&o->dgram), o->recv_buf);
+}
+
+DatagramSharedSocketEntry * find_entry (DatagramSharedSocket *o, uint64_t tag)
+{
+    DatagramSharedSocket__EntriesHashRef ref = DatagramSharedSocket__EntriesHash_Lookup(&o->entries_hash, 0, tag);
+    
+    return ref.ptr;
+}
+
+int common_init (DatagramSharedSocket *o, BReactor *reactor, int mtu, int dont_fragment)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(dont_fragment == 0 || dont_fragment == 1)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->mtu = mtu;
+    o->dont_fragment = dont_fragment;
+    
+    // check MTU
+    if (o->mtu > INT_MAX - DATAGRAMSHAREDSOCKET_TAG_SIZE) {
+        BLog(BLOG_ERROR, "MTU is too big");
+        goto fail0;
+    }
+    
+    // allocate buffers
+    if (!(o->send_buf = (uint8_t *)BAlloc(DATAGRAMSHAREDSOCKET_TAG_SIZE + o->mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    if (!(o->recv_buf = (uint8_t *)BAlloc(DATAGRAMSHAREDSOCKET_TAG_SIZE + o->mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    
+    // init entries hash table
+    if (!DatagramSharedSocket__EntriesHash_Init(&o->entries_hash, DATAGRAMSHAREDSOCKET_ENTRIES_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "DatagramSharedSocket__EntriesHash_Init failed");
+        goto fail2;
+    }
+    o->num_entries = 0;
+    
+    // init lists
+    LinkedList1_Init(&o->send_queue);
+    LinkedList1_Init(&o->entries_list);
+    LinkedList1_Init(&o->failed_list);
+    
+    // init error job
+    BPending_Init(&o->error_job, BReactor_PendingGroup(o->reactor), (BPending_handler)error_job_handler, o);
+    
+    // have no dgram
+    o->have_dgram = 0;
+    
+    return 1;
+    
+fail2:
+    BFree(o->recv_buf);
+fail1:
+    BFree(o->send_buf);
+fail0:
+    return 0;
+}
+
+int DatagramSharedSocket_Init (DatagramSharedSocket *o, BReactor *reactor, int family, int mtu, int dont_fragment)
+{
+    ASSERT(BDatagram_AddressFamilySupported(family))
+    ASSERT(mtu >= 0)
+    
+    // init arguments
+    o->family = family;
+    o->bound = 0;
+    
+    // init common
+    if (!common_init(o, reactor, mtu, dont_fragment)) {
+        return 0;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_entries_ctr);
+    return 1;
+}
+
+int DatagramSharedSocket_InitBind (DatagramSharedSocket *o, BReactor *reactor, BAddr addr, int mtu, int dont_fragment)
+{
+    ASSERT(BDatagram_AddressFamilySupported(addr.type))
+    ASSERT(mtu >= 0)
+    
+    // init arguments
+    o->family = addr.type;
+    o->bound = 1;
+    o->bind_addr = addr;
+    
+    // init common
+    if (!common_init(o, reactor, mtu, dont_fragment)) {
+        goto fail0;
+    }
+    
+    // bind now to find out if the address is usable
+    if (!init_dgram(o)) {
+        goto fail1;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_entries_ctr);
+    return 1;
+    
+fail1:
+    BPending_Free(&o->error_job);
+    DatagramSharedSocket__EntriesHash_Free(&o->entries_hash);
+    BFree(o->recv_buf);
+    BFree(o->send_buf);
+fail0:
+    return 0;
+}
+
+void DatagramSharedSocket_Free (DatagramSharedSocket *o)
+{
+    DebugCounter_Free(&o->d_entries_ctr);
+    DebugObject_Free(&o->d_obj);
+    ASSERT(LinkedList1_IsEmpty(&o->entries_list))
+    ASSERT(LinkedList1_IsEmpty(&o->failed_list))
+    ASSERT(LinkedList1_IsEmpty(&o->send_queue))
+    ASSERT(o->num_entries == 0)
+    
+    // free dgram
+    if (o->have_dgram) {
+        free_dgram(o);
+    }
+    
+    // free error job
+    BPending_Free(&o->error_job);
+    
+    // free entries hash table
+    DatagramSharedSocket__EntriesHash_Free(&o->entries_hash);
+    
+    // free buffers
+    BFree(o->recv_buf);
+    BFree(o->send_buf);
+}
+
+int DatagramSharedSocket_GetMTU (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->mtu;
+}
+
+int DatagramSharedSocket_GetFamily (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->family;
+}
+
+uint64_t DatagramSharedSocket_GenerateTag (DatagramSharedSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint64_t tag;
+    do {
+        BRandom_randomize((uint8_t *)&tag, sizeof(tag));
+    } while (find_entry(o, tag));
+    
+    return tag;
+}
+
+void entry_send_handler_send (DatagramSharedSocketEntry *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->mtu)
+    ASSERT(o->send_data_len == -1)
+    ASSERT(!o->send_queued)
+    
+    // remember packet
+    o->send_data = data;
+    o->send_data_len = data_len;
+    
+    // queue for sending if we know where to
+    if (o->have_send_addrs && !o->failed) {
+        entry_queue_send(o);
+    }
+}
+
+void entry_recv_handler_recv (DatagramSharedSocketEntry *o, uint8_t *data)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->recv_data)
+    
+    if (o->backlog_len >= 0) {
+        // pass the datagram we have been holding
+        memcpy(data, o->backlog, o->backlog_len);
+        o->have_recv_addrs = 1;
+        o->recv_remote_addr = o->backlog_remote_addr;
+        o->recv_local_addr = o->backlog_local_addr;
+        int len = o->backlog_len;
+        o->backlog_len = -1;
+        PacketRecvInterface_Done(&o->recv_output, len);
+        return;
+    }
+    
+    // wait for a datagram
+    o->recv_data = data;
+}
+
+void entry_queue_send (DatagramSharedSocketEntry *o)
+{
+    ASSERT(!o->failed)
+    ASSERT(o->have_send_addrs)
+    ASSERT(o->send_data_len >= 0)
+    ASSERT(!o->send_queued)
+    
+    // append to send queue
+    LinkedList1_Append(&o->s->send_queue, &o->send_queue_node);
+    o->send_queued = 1;
+    
+    // send if the socket is idle
+    schedule_send(o->s);
+}
+
+int DatagramSharedSocketEntry_Init (DatagramSharedSocketEntry *o, DatagramSharedSocket *s, uint64_t tag, int mtu, BPendingGroup *pg, void *user, DatagramSharedSocketEntry_handler_error handler_error)
+{
+    DebugObject_Access(&s->d_obj);
+    ASSERT(mtu >= 0)
+    ASSERT(mtu <= s->mtu)
+    ASSERT(handler_error)
+    
+    // init arguments
+    o->s = s;
+    o->tag = tag;
+    o->mtu = mtu;
+    o->user = user;
+    o->handler_error = handler_error;
+    
+    // check tag
+    if (find_entry(s, o->tag)) {
+        BLog(BLOG_ERROR, "tag is already in use");
+        goto fail0;
+    }
+    
+    // create socket if needed
+    if (!s->have_dgram && !init_dgram(s)) {
+        goto fail0;
+    }
+    
+    // allocate backlog
+    if (!(o->backlog = (uint8_t *)BAlloc(o->mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    o->backlog_len = -1;
+    
+    // init send interface
+    PacketPassInterface_Init(&o->send_input, o->mtu, (PacketPassInterface_handler_send)entry_send_handler_send, o, pg);
+    o->have_send_addrs = 0;
+    o->send_data_len = -1;
+    o->send_queued = 0;
+    
+    // init recv interface
+    PacketRecvInterface_Init(&o->recv_output, o->mtu, (PacketRecvInterface_handler_recv)entry_recv_handler_recv, o, pg);
+    o->recv_data = NULL;
+    o->have_recv_addrs = 0;
+    
+    // insert to entries list
+    LinkedList1_Append(&s->entries_list, &o->list_node);
+    o->failed = 0;
+    
+    // insert to hash table
+    DatagramSharedSocket__EntriesHashRef ref = {o, o};
+    int res = DatagramSharedSocket__EntriesHash_Insert(&s->entries_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+    s->num_entries++;
+    
+    // keep the load factor at most one; if growing fails we keep working with longer chains
+    if (s->num_entries > s->entries_hash.num_buckets) {
+        DatagramSharedSocket__EntriesHash_MultiplyBuckets(&s->entries_hash, 0, 1);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&s->d_entries_ctr);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void DatagramSharedSocketEntry_Free (DatagramSharedSocketEntry *o)
+{
+    DatagramSharedSocket *s = o->s;
+    DebugCounter_Decrement(&s->d_entries_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    if (o->failed) {
+        // remove from failed list
+        LinkedList1_Remove(&s->failed_list, &o->list_node);
+    } else {
+        // remove from send queue
+        if (o->send_queued) {
+            LinkedList1_Remove(&s->send_queue, &o->send_queue_node);
+        }
+        
+        // remove from hash table
+        DatagramSharedSocket__EntriesHashRef ref = {o, o};
+        DatagramSharedSocket__EntriesHash_Remove(&s->entries_hash, 0, ref);
+        s->num_entries--;
+        
+        // remove from entries list
+        LinkedList1_Remove(&s->entries_list, &o->list_node);
+    }
+    
+    // free recv interface
+    PacketRecvInterface_Free(&o->recv_output);
+    
+    // free send interface
+    PacketPassInterface_Free(&o->send_input);
+    
+    // free backlog
+    BFree(o->backlog);
+}
+
+void DatagramSharedSocketEntry_SetSendAddrs (DatagramSharedSocketEntry *o, BAddr remote_addr, BIPAddr local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(remote_addr.type == o->s->family)
+    ASSERT(local_addr.type == BADDR_TYPE_NONE || BDatagram_AddressFamilySupported(local_addr.type))
+    
+    // set addresses
+    o->send_remote_addr = remote_addr;
+    o->send_local_addr = local_addr;
+    
+    if (!o->have_send_addrs) {
+        // set have addresses
+        o->have_send_addrs = 1;
+        
+        // start sending
+        if (o->send_data_len >= 0 && !o->failed) {
+            entry_queue_send(o);
+        }
+    }
+}
+
+int DatagramSharedSocketEntry_GetLastReceiveAddrs (DatagramSharedSocketEntry *o, BAddr *remote_addr, BIPAddr *local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->have_recv_addrs) {
+        return 0;
+    }
+    
+    *remote_addr = o->recv_remote_addr;
+    *local_addr = o->recv_local_addr;
+    return 1;
+}
+
+PacketPassInterface * DatagramSharedSocketEntry_GetSendInput (DatagramSharedSocketEntry *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->send_input;
+}
+
+PacketRecvInterface * DatagramSharedSocketEntry_GetRecvOutput (DatagramSharedSocketEntry *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->recv_output;
+}
@@ -0,0 +1,277 @@
+/**
+ * @file DatagramSharedSocket.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Datagram socket shared by many peer links, with datagrams demultiplexed
+ * by a tag.
+ */
+
+#ifndef BADVPN_CLIENT_DATAGRAMSHAREDSOCKET_H
+#define BADVPN_CLIENT_DATAGRAMSHAREDSOCKET_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+#include <system/BDatagram.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/PacketRecvInterface.h>
+
+/**
+ * Size of the tag which precedes the payload in every datagram.
+ */
+#define DATAGRAMSHAREDSOCKET_TAG_SIZE 8
+
+#define DATAGRAMSHAREDSOCKET_ENTRIES_HASH_INITIAL_BUCKETS 64
+
+/**
+ * Handler function called when the socket failed and the entry
+ * can no longer be used. The handler must free the entry.
+ * 
+ * @param user as in {@link DatagramSharedSocketEntry_Init}
+ */
+typedef void (*DatagramSharedSocketEntry_handler_error) (void *user);
+
+struct DatagramSharedSocketEntry_s;
+
+typedef struct DatagramSharedSocketEntry_s *DatagramSharedSocket__entries_hash_link;
+
+#include "DatagramSharedSocket_entries_hash.h"
+#include <structure/CHash_decl.h>
+
+/**
+ * Datagram socket shared by many peer links.
+ * 
+ * Every datagram sent or received through the socket starts with a
+ * {@link DATAGRAMSHAREDSOCKET_TAG_SIZE}-byte tag, a little-endian 64-bit
+ * unsigned integer, followed by the payload. The tag identifies the
+ * {@link DatagramSharedSocketEntry} a received datagram belongs to, and the
+ * same tag is used by both ends of a link. A peer which binds generates the tag
+ * with {@link DatagramSharedSocket_GenerateTag} and tells it to the other peer,
+ * which then registers an entry with the same tag on its own socket.
+ * 
+ * Entries share one file descriptor instead of each having its own socket.
+ * Sending is round-robin between the entries which have a packet queued.
+ * Each entry can buffer one received datagram while it is not receiving,
+ * further datagrams for it are dropped until it receives again, so a slow
+ * entry does not stall the others.
+ * 
+ * The socket is created lazily. If it fails, all entries are reported an error,
+ * one at a time, and it is created again when the next entry is registered.
+ */
+typedef struct {
+    BReactor *reactor;
+    int family;
+    int bound;
+    BAddr bind_addr;
+    int mtu;
+    int dont_fragment;
+    uint8_t *send_buf;
+    uint8_t *recv_buf;
+    int have_dgram;
+    BDatagram dgram;
+    int sending;
+    LinkedList1 send_queue;
+    LinkedList1 entries_list;
+    LinkedList1 failed_list;
+    DatagramSharedSocket__EntriesHash entries_hash;
+    size_t num_entries;
+    BPending error_job;
+    DebugObject d_obj;
+    DebugCounter d_entries_ctr;
+} DatagramSharedSocket;
+
+/**
+ * Registration of a peer link with a {@link DatagramSharedSocket}.
+ */
+typedef struct DatagramSharedSocketEntry_s {
+    DatagramSharedSocket *s;
+    uint64_t tag;
+    int mtu;
+    void *user;
+    DatagramSharedSocketEntry_handler_error handler_error;
+    int failed;
+    LinkedList1Node list_node;
+    struct DatagramSharedSocketEntry_s *hash_next;
+    PacketPassInterface send_input;
+    int have_send_addrs;
+    BAddr send_remote_addr;
+    BIPAddr send_local_addr;
+    const uint8_t *send_data;
+    int send_data_len;
+    int send_queued;
+    LinkedList1Node send_queue_node;
+    PacketRecvInterface recv_output;
+    uint8_t *recv_data;
+    uint8_t *backlog;
+    int backlog_len;
+    BAddr backlog_remote_addr;
+    BIPAddr backlog_local_addr;
+    int have_recv_addrs;
+    BAddr recv_remote_addr;
+    BIPAddr recv_local_addr;
+    DebugObject d_obj;
+} DatagramSharedSocketEntry;
+
+/**
+ * Initializes a socket which is not bound to a specific address.
+ * It is used by peers which connect; the system assigns a local port
+ * when the first datagram is sent.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param family address family. Must be supported according to
+ *               {@link BDatagram_AddressFamilySupported}.
+ * @param mtu maximum payload size of a datagram, excluding the tag. Must be >=0.
+ * @param dont_fragment whether to disable fragmentation of sent datagrams, see
+ *                      {@link BDatagram_SetDontFragment}. Must be 0 or 1.
+ * @return 1 on success, 0 on failure
+ */
+int DatagramSharedSocket_Init (DatagramSharedSocket *o, BReactor *reactor, int family, int mtu, int dont_fragment) WARN_UNUSED;
+
+/**
+ * Initializes a socket bound to an address.
+ * Binding is attempted immediately, so that the caller can find out
+ * whether the address can be used.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param addr address to bind to. Must be supported according to
+ *             {@link BDatagram_AddressFamilySupported}.
+ * @param mtu maximum payload size of a datagram, excluding the tag. Must be >=0.
+ * @param dont_fragment whether to disable fragmentation of sent datagrams, see
+ *                      {@link BDatagram_SetDontFragment}. Must be 0 or 1.
+ * @return 1 on success, 0 on failure
+ */
+int DatagramSharedSocket_InitBind (DatagramSharedSocket *o, BReactor *reactor, BAddr addr, int mtu, int dont_fragment) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * There must be no entries.
+ * 
+ * @param o the object
+ */
+void DatagramSharedSocket_Free (DatagramSharedSocket *o);
+
+/**
+ * Returns the maximum payload size of a datagram, excluding the tag.
+ * 
+ * @param o the object
+ * @return MTU
+ */
+int DatagramSharedSocket_GetMTU (DatagramSharedSocket *o);
+
+/**
+ * Returns the address family of the socket.
+ * 
+ * @param o the object
+ * @return address family
+ */
+int DatagramSharedSocket_GetFamily (DatagramSharedSocket *o);
+
+/**
+ * Generates a random tag which no entry of the socket is using.
+ * 
+ * @param o the object
+ * @return tag
+ */
+uint64_t DatagramSharedSocket_GenerateTag (DatagramSharedSocket *o);
+
+/**
+ * Registers an entry.
+ * Fails if another entry is using the tag, or if the socket needed to
+ * be created and this failed.
+ * 
+ * @param o the object
+ * @param s socket to register with
+ * @param tag tag identifying datagrams of this entry
+ * @param mtu maximum payload size the entry sends and receives. Must be >=0
+ *            and <= the socket's MTU. Received datagrams with longer payloads
+ *            are dropped.
+ * @param pg pending group the interfaces live in
+ * @param user value to pass to handler
+ * @param handler_error error handler
+ * @return 1 on success, 0 on failure
+ */
+int DatagramSharedSocketEntry_Init (DatagramSharedSocketEntry *o, DatagramSharedSocket *s, uint64_t tag, int mtu, BPendingGroup *pg, void *user, DatagramSharedSocketEntry_handler_error handler_error) WARN_UNUSED;
+
+/**
+ * Unregisters an entry.
+ * 
+ * @param o the object
+ */
+void DatagramSharedSocketEntry_Free (DatagramSharedSocketEntry *o);
+
+/**
+ * Sets the addresses for sending, like {@link BDatagram_SetSendAddrs}.
+ * Until they are set, the entry does not send.
+ * 
+ * @param o the object
+ * @param remote_addr remote address. Must be of the socket's address family.
+ * @param local_addr local IP address to send from. May be an invalid address
+ *                   to let the system choose.
+ */
+void DatagramSharedSocketEntry_SetSendAddrs (DatagramSharedSocketEntry *o, BAddr remote_addr, BIPAddr local_addr);
+
+/**
+ * Returns the addresses of the datagram last passed to the receive interface,
+ * like {@link BDatagram_GetLastReceiveAddrs}.
+ * 
+ * @param o the object
+ * @param remote_addr returns the remote address
+ * @param local_addr returns the local address
+ * @return 1 if a datagram was received, 0 if not
+ */
+int DatagramSharedSocketEntry_GetLastReceiveAddrs (DatagramSharedSocketEntry *o, BAddr *remote_addr, BIPAddr *local_addr);
+
+/**
+ * Returns the interface for sending payloads of this entry.
+ * The interface has MTU equal to the entry's MTU.
+ * 
+ * @param o the object
+ * @return sending interface
+ */
+PacketPassInterface * DatagramSharedSocketEntry_GetSendInput (DatagramSharedSocketEntry *o);
+
+/**
+ * Returns the interface providing received payloads of this entry.
+ * The interface has MTU equal to the entry's MTU.
+ * 
+ * @param o the object
+ * @return receiving interface
+ */
+PacketRecvInterface * DatagramSharedSocketEntry_GetRecvOutput (DatagramSharedSocketEntry *o);
+
+#endif
@@ -40,15 +40,18 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_impl.h>
+static struct FragmentProtoAssembler_frame ** ring_slot (FragmentProtoAssembler *o, fragmentproto_frameid id)
+{
+    return &o->frames_ring[id & o->ring_mask];
+}
 
 static void free_frame (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
 {
     // remove from used list
     LinkedList1_Remove(&o->frames_used, &frame->list_node);
-    // remove from used tree
-    FPAFramesTree_Remove(&o->frames_used_tree, 0, frame);
+    // remove from ring
+    ASSERT(*ring_slot(o, frame->id) == frame)
+    *ring_slot(o, frame->id) = NULL;
     
     // append to free list
     LinkedList1_Append(&o->frames_free, &frame->list_node);
@@ -69,12 +72,13 @@ static void free_oldest_frame (FragmentProtoAssembler *o)
 
 static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAssembler *o, fragmentproto_frameid id)
 {
-    ASSERT(!FPAFramesTree_LookupExact(&o->frames_used_tree, 0, id))
+    ASSERT(!*ring_slot(o, id))
     
     // if there are no free entries, free the oldest used one
     if (LinkedList1_IsEmpty(&o->frames_free)) {
         PeerLog(o, BLOG_INFO, "freeing used frame");
         free_oldest_frame(o);
+        o->counters.frames_lost++;
     }
     
     // obtain frame entry
@@ -95,13 +99,19 @@ static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAs
     
     // append to used list
     LinkedList1_Append(&o->frames_used, &frame->list_node);
-    // insert to used tree
-    int res = FPAFramesTree_Insert(&o->frames_used_tree, 0, frame, NULL);
-    ASSERT_EXECUTE(res)
+    // insert to ring
+    ASSERT(!*ring_slot(o, id))
+    *ring_slot(o, id) = frame;
     
     return frame;
 }
 
+static int frame_id_is_older (fragmentproto_frameid id, fragmentproto_frameid other)
+{
+    // IDs wrap around; an ID is older if it is closer behind the other one than ahead of it
+    return (fragmentproto_frameid)(other - id) < (fragmentproto_frameid)(id - other);
+}
+
 static int chunks_overlap (int c1_start, int c1_len, int c2_start, int c2_len)
 {
     return (c1_start + c1_len > c2_start && c2_start + c2_len > c1_start);
@@ -125,6 +135,7 @@ static void reduce_times (FragmentProtoAssembler *o)
         if (frame_is_timed_out(o, frame)) {
             PeerLog(o, BLOG_INFO, "freeing timed out frame (while reducing times)");
             free_frame(o, frame);
+            o->counters.frames_lost++;
         } else {
             if (!minframe || frame->time < minframe->time) {
                 minframe = frame;
@@ -162,12 +173,14 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     // check start
     if (chunk_start > o->output_mtu) {
         PeerLog(o, BLOG_INFO, "chunk starts outside");
+        o->counters.chunks_invalid++;
         return 0;
     }
     
     // check frame size bound
     if (chunk_len > o->output_mtu - chunk_start) {
         PeerLog(o, BLOG_INFO, "chunk ends outside");
+        o->counters.chunks_invalid++;
         return 0;
     }
     
@@ -177,7 +190,21 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     ASSERT(chunk_end <= o->output_mtu)
     
     // lookup frame
-    struct FragmentProtoAssembler_frame *frame = FPAFramesTree_LookupExact(&o->frames_used_tree, 0, frame_id);
+    struct FragmentProtoAssembler_frame *frame = *ring_slot(o, frame_id);
+    if (frame && frame->id != frame_id) {
+        if (!frame_is_timed_out(o, frame) && frame_id_is_older(frame_id, frame->id)) {
+            // slot is taken by a newer frame; this chunk is stale, drop it
+            PeerLog(o, BLOG_INFO, "chunk of frame older than frame in its slot");
+            o->counters.chunks_invalid++;
+            return 0;
+        }
+        
+        // slot is taken by a frame far behind this one, drop it
+        PeerLog(o, BLOG_INFO, "freeing frame outside of window");
+        free_frame(o, frame);
+        o->counters.frames_lost++;
+        frame = NULL;
+    }
     if (!frame) {
         // frame not found, add a new one
         frame = allocate_new_frame(o, frame_id);
@@ -188,6 +215,7 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
             // frame is timed out, remove it and use a new one
             PeerLog(o, BLOG_INFO, "freeing timed out frame (while processing chunk)");
             free_frame(o, frame);
+            o->counters.frames_lost++;
             frame = allocate_new_frame(o, frame_id);
         }
     }
@@ -272,6 +300,8 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     // free frame entry
     free_frame(o, frame);
     
+    o->counters.frames++;
+    
     // send frame
     PacketPassInterface_Sender_Send(o->output, frame->buffer, frame->length);
     
@@ -279,6 +309,7 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     
 fail_frame:
     free_frame(o, frame);
+    o->counters.chunks_invalid++;
     return 0;
 }
 
@@ -291,6 +322,7 @@ static void process_input (FragmentProtoAssembler *o)
         // obtain header
         if (o->in_len - o->in_pos < sizeof(struct fragmentproto_chunk_header)) {
             PeerLog(o, BLOG_INFO, "too little data for chunk header");
+            o->counters.chunks_invalid++;
             break;
         }
         struct fragmentproto_chunk_header header;
@@ -304,12 +336,14 @@ static void process_input (FragmentProtoAssembler *o)
         // check is_last field
         if (!(is_last == 0 || is_last == 1)) {
             PeerLog(o, BLOG_INFO, "chunk is_last wrong");
+            o->counters.chunks_invalid++;
             break;
         }
         
         // obtain data
         if (o->in_len - o->in_pos < chunk_len) {
             PeerLog(o, BLOG_INFO, "too little data for chunk data");
+            o->counters.chunks_invalid++;
             break;
         }
         
@@ -425,16 +459,33 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
         LinkedList1_Append(&o->frames_free, &frame->list_node);
     }
     
-    // init tree
-    FPAFramesTree_Init(&o->frames_used_tree);
+    // allocate ring, at least twice the number of frames
+    int ring_size = 1;
+    while (ring_size < FPA_MAX_RING_SIZE && ring_size / 2 < num_frames) {
+        ring_size *= 2;
+    }
+    if (!(o->frames_ring = (struct FragmentProtoAssembler_frame **)BAllocArray(ring_size, sizeof(o->frames_ring[0])))) {
+        goto fail4;
+    }
+    o->ring_mask = ring_size - 1;
+    
+    // init ring slots
+    for (int i = 0; i < ring_size; i++) {
+        o->frames_ring[i] = NULL;
+    }
     
     // have no input packet
     o->in_len = -1;
     
+    // init counters
+    memset(&o->counters, 0, sizeof(o->counters));
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail4:
+    BFree(o->frames_buffer);
 fail3:
     BFree(o->frames_chunks);
 fail2:
@@ -447,7 +498,10 @@ fail1:
 void FragmentProtoAssembler_Free (FragmentProtoAssembler *o)
 {
     DebugObject_Free(&o->d_obj);
-
+    
+    // free ring
+    BFree(o->frames_ring);
+    
     // free buffers
     BFree(o->frames_buffer);
     
@@ -467,3 +521,10 @@ PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o
     
     return &o->input;
 }
+
+const struct FragmentProtoAssembler_counters * FragmentProtoAssembler_GetCounters (FragmentProtoAssembler *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->counters;
+}
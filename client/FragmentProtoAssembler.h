@@ -38,19 +38,15 @@
 
 #include <protocol/fragmentproto.h>
 #include <misc/debug.h>
-#include <misc/compare.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <structure/LinkedList1.h>
-#include <structure/SAvl.h>
 #include <flow/PacketPassInterface.h>
 
 #define FPA_MAX_TIME UINT32_MAX
 
-struct FragmentProtoAssembler_frame;
-
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_decl.h>
+// upper bound for the size of the frame lookup ring, the number of distinct frame IDs
+#define FPA_MAX_RING_SIZE 65536
 
 struct FragmentProtoAssembler_chunk {
     int start;
@@ -64,18 +60,31 @@ struct FragmentProtoAssembler_frame {
     // everything below only defined when frame entry is used
     fragmentproto_frameid id; // frame identifier
     uint32_t time; // packet time when the last chunk was received
-    FPAFramesTreeNode tree_node; // node fields in tree for searching frames by id
     int num_chunks; // number of valid chunks
     int sum; // sum of all chunks' lengths
     int length; // length of the frame, or -1 if not yet known
     int length_so_far; // if length=-1, current data set's upper bound
 };
 
+/**
+ * Counters kept by {@link FragmentProtoAssembler}.
+ */
+struct FragmentProtoAssembler_counters {
+    uint64_t frames; // frames assembled
+    uint64_t frames_lost; // incomplete frames dropped because they timed out or were pushed out by newer frames
+    uint64_t chunks_invalid; // chunks dropped because they were malformed, inconsistent with their frame, or stale
+};
+
 /**
  * Object which decodes packets according to FragmentProto.
  *
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketPassInterface}.
+ * 
+ * Frames being assembled are found through a ring indexed by the low bits of
+ * the frame ID. The ring has at least twice as many slots as there are frame
+ * entries, so frames within the reassembly window never share a slot; a frame
+ * found in the slot of a new frame ID is so far behind that it is dropped.
  */
 typedef struct {
     void *user;
@@ -91,10 +100,12 @@ typedef struct {
     uint8_t *frames_buffer;
     LinkedList1 frames_free;
     LinkedList1 frames_used;
-    FPAFramesTree frames_used_tree;
+    struct FragmentProtoAssembler_frame **frames_ring;
+    int ring_mask;
     int in_len;
     uint8_t *in;
     int in_pos;
+    struct FragmentProtoAssembler_counters counters;
     DebugObject d_obj;
 } FragmentProtoAssembler;
 
@@ -131,4 +142,12 @@ void FragmentProtoAssembler_Free (FragmentProtoAssembler *o);
  */
 PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o);
 
+/**
+ * Returns counters of assembled and dropped frames.
+ * 
+ * @param o the object
+ * @return counters, valid until the object is freed
+ */
+const struct FragmentProtoAssembler_counters * FragmentProtoAssembler_GetCounters (FragmentProtoAssembler *o);
+
 #endif
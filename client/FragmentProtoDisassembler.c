@@ -36,10 +36,53 @@
 
 #include "client/FragmentProtoDisassembler.h"
 
+// the average gap is kept in fixed point with this many fractional bits
+#define GAP_FRAC_BITS 4
+
+// weight of a new sample in the average is 1/(2^GAP_WEIGHT_BITS)
+#define GAP_WEIGHT_BITS 3
+
+static void update_avg_gap (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->adaptive)
+    
+    btime_t now = btime_gettime();
+    
+    if (o->have_last_input) {
+        // limit the sample so that the average recovers quickly after idle periods
+        btime_t gap = bmin_int64(now - o->last_input_time, 4 * (o->latency + 1));
+        gap = bmax_int64(gap, 0);
+        
+        o->avg_gap += ((gap << GAP_FRAC_BITS) - o->avg_gap) >> GAP_WEIGHT_BITS;
+    }
+    
+    o->have_last_input = 1;
+    o->last_input_time = now;
+}
+
+static btime_t packing_latency (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->latency >= 0)
+    
+    if (!o->adaptive) {
+        return o->latency;
+    }
+    
+    btime_t gap = o->avg_gap >> GAP_FRAC_BITS;
+    
+    // the next packet is not expected in time, only wait for the current burst
+    if (gap > o->latency) {
+        return 0;
+    }
+    
+    // wait long enough for about two more packets
+    return bmin_int64(2 * gap + 1, o->latency);
+}
+
 static void write_chunks (FragmentProtoDisassembler *o)
 {
     #define IN_AVAIL (o->in_len - o->in_used)
-    #define OUT_AVAIL ((o->output_mtu - o->out_used) - (int)sizeof(struct fragmentproto_chunk_header))
+    #define OUT_AVAIL ((o->output_limit - o->out_used) - (int)sizeof(struct fragmentproto_chunk_header))
     
     ASSERT(o->in_len >= 0)
     ASSERT(o->out)
@@ -82,7 +125,8 @@ static void write_chunks (FragmentProtoDisassembler *o)
     }
     
     // should we finish the output packet?
-    if (OUT_AVAIL <= 0 || o->latency < 0) {
+    // If a probe is waiting, don't hold the packet back.
+    if (OUT_AVAIL <= 0 || o->latency < 0 || o->probe_len >= 0) {
         // set no output packet
         o->out = NULL;
         
@@ -96,16 +140,74 @@ static void write_chunks (FragmentProtoDisassembler *o)
     } else {
         // start timer if we have output and it's not running (output was empty before)
         if (!BTimer_IsRunning(&o->timer)) {
-            BReactor_SetTimer(o->reactor, &o->timer);
+            BReactor_SetTimerAfter(o->reactor, &o->timer, packing_latency(o));
         }
     }
 }
 
+static void finish_output (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->out)
+    ASSERT(o->out_used > 0)
+    ASSERT(o->in_len == -1)
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // stop timer (if it's running)
+    if (o->latency >= 0) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+    }
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, o->out_used);
+}
+
+static void write_probe (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->probe_len >= 0)
+    ASSERT(o->out)
+    ASSERT(o->out_used == 0)
+    ASSERT(o->in_len == -1 || o->in_used == 0)
+    
+    // write chunk header
+    struct fragmentproto_chunk_header header;
+    header.frame_id = htol16(o->frame_id);
+    header.chunk_start = htol16(0);
+    header.chunk_len = htol16(o->probe_len);
+    header.is_last = 1;
+    memcpy(o->out, &header, sizeof(header));
+    
+    // write chunk data
+    memcpy(o->out + sizeof(header), o->probe, o->probe_len);
+    int out_len = sizeof(header) + o->probe_len;
+    
+    // increment frame ID
+    o->frame_id++;
+    
+    // set no probe
+    o->probe_len = -1;
+    
+    // finish probe input
+    PacketPassInterface_Done(&o->probe_input);
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, out_len);
+}
+
 static void input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
     ASSERT(o->in_len == -1)
     
+    // track input rate
+    if (o->adaptive) {
+        update_avg_gap(o);
+    }
+    
     // set input packet
     o->in_len = data_len;
     o->in = data;
@@ -140,6 +242,12 @@ static void output_handler_recv (FragmentProtoDisassembler *o, uint8_t *data)
     o->out = data;
     o->out_used = 0;
     
+    // send probe unless we are in the middle of a frame
+    if (o->probe_len >= 0 && (o->in_len < 0 || o->in_used == 0)) {
+        write_probe(o);
+        return;
+    }
+    
     // if there is no input, wait for it
     if (o->in_len < 0) {
         return;
@@ -148,6 +256,30 @@ static void output_handler_recv (FragmentProtoDisassembler *o, uint8_t *data)
     write_chunks(o);
 }
 
+static void probe_input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->output_mtu - (int)sizeof(struct fragmentproto_chunk_header))
+    ASSERT(o->probe_len == -1)
+    
+    // set probe
+    o->probe_len = data_len;
+    o->probe = data;
+    
+    // if there is no output, wait for it
+    if (!o->out) {
+        return;
+    }
+    
+    // the probe needs an output packet of its own
+    if (o->out_used > 0) {
+        finish_output(o);
+        return;
+    }
+    
+    write_probe(o);
+}
+
 static void timer_handler (FragmentProtoDisassembler *o)
 {
     ASSERT(o->latency >= 0)
@@ -161,7 +293,7 @@ static void timer_handler (FragmentProtoDisassembler *o)
     PacketRecvInterface_Done(&o->output, o->out_used);
 }
 
-void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency)
+void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency, int adaptive)
 {
     ASSERT(input_mtu >= 0)
     ASSERT(input_mtu <= UINT16_MAX)
@@ -171,13 +303,18 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     // init arguments
     o->reactor = reactor;
     o->output_mtu = output_mtu;
+    o->output_limit = output_mtu;
     o->chunk_mtu = chunk_mtu;
     o->latency = latency;
+    o->adaptive = (latency >= 0 && adaptive);
     
     // init input
     PacketPassInterface_Init(&o->input, input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(reactor));
     PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     
+    // init probe input
+    PacketPassInterface_Init(&o->probe_input, o->output_mtu - sizeof(struct fragmentproto_chunk_header), (PacketPassInterface_handler_send)probe_input_handler_send, o, BReactor_PendingGroup(reactor));
+    
     // init output
     PacketRecvInterface_Init(&o->output, o->output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(reactor));
     
@@ -189,19 +326,26 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     // have no input packet
     o->in_len = -1;
     
+    // have no probe
+    o->probe_len = -1;
+    
     // have no output packet
     o->out = NULL;
     
     // start with zero frame ID
     o->frame_id = 0;
     
+    // have no input rate estimate
+    o->have_last_input = 0;
+    o->avg_gap = 0;
+    
     DebugObject_Init(&o->d_obj);
 }
 
 void FragmentProtoDisassembler_Free (FragmentProtoDisassembler *o)
 {
     DebugObject_Free(&o->d_obj);
-
+    
     // free timer
     if (o->latency >= 0) {
         BReactor_RemoveTimer(o->reactor, &o->timer);
@@ -210,6 +354,9 @@ void FragmentProtoDisassembler_Free (FragmentProtoDisassembler *o)
     // free output
     PacketRecvInterface_Free(&o->output);
     
+    // free probe input
+    PacketPassInterface_Free(&o->probe_input);
+    
     // free input
     PacketPassInterface_Free(&o->input);
 }
@@ -221,6 +368,27 @@ PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassemb
     return &o->input;
 }
 
+PacketPassInterface * FragmentProtoDisassembler_GetProbeInput (FragmentProtoDisassembler *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->probe_input;
+}
+
+void FragmentProtoDisassembler_SetOutputLimit (FragmentProtoDisassembler *o, int limit)
+{
+    ASSERT(limit > sizeof(struct fragmentproto_chunk_header))
+    ASSERT(limit <= o->output_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->output_limit = limit;
+    
+    // send out a pending packet if it cannot take any more data
+    if (o->out && o->out_used > 0 && o->out_used >= limit - (int)sizeof(struct fragmentproto_chunk_header)) {
+        finish_output(o);
+    }
+}
+
 PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassembler *o)
 {
     DebugObject_Access(&o->d_obj);
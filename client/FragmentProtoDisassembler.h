@@ -50,21 +50,41 @@
  *
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketRecvInterface}.
+ * 
+ * Output packets can be limited to a size smaller than the output MTU with
+ * {@link FragmentProtoDisassembler_SetOutputLimit}. Frames submitted to the
+ * probe input bypass the limit: each is sent as a single chunk in an output
+ * packet of its own, ahead of frames on the regular input.
+ * 
+ * In adaptive mode, the time a partially filled output packet waits for more
+ * data is derived from a moving average of the input packet inter-arrival
+ * times, bounded by the configured latency. When input packets come in
+ * further apart than the latency allows waiting, partial packets are sent
+ * out as soon as the current burst of input is processed; when input
+ * is queued up, packets arrive back to back and are packed tightly.
  */
 typedef struct {
     BReactor *reactor;
     int output_mtu;
+    int output_limit;
     int chunk_mtu;
     btime_t latency;
+    int adaptive;
     PacketPassInterface input;
+    PacketPassInterface probe_input;
     PacketRecvInterface output;
     BTimer timer;
     int in_len;
     uint8_t *in;
     int in_used;
+    int probe_len;
+    uint8_t *probe;
     uint8_t *out;
     int out_used;
     fragmentproto_frameid frame_id;
+    int have_last_input;
+    btime_t last_input_time;
+    btime_t avg_gap;
     DebugObject d_obj;
 } FragmentProtoDisassembler;
 
@@ -80,8 +100,10 @@ typedef struct {
  *                before being sent out. If nonnegative, a timer will be used. If negative,
  *                packets will always be sent out immediately. If low latency is desired,
  *                prefer setting this to zero rather than negative.
+ * @param adaptive if nonzero and latency is nonnegative, shorten the wait for more data
+ *                 based on the observed input rate, using latency only as the upper bound
  */
-void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency);
+void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency, int adaptive);
 
 /**
  * Frees the object.
@@ -98,6 +120,27 @@ void FragmentProtoDisassembler_Free (FragmentProtoDisassembler *o);
  */
 PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassembler *o);
 
+/**
+ * Returns the probe input interface.
+ * Its MTU is output_mtu - sizeof(struct fragmentproto_chunk_header).
+ * Each frame is sent as a single chunk in an output packet of its own.
+ * 
+ * @param o the object
+ * @return probe input interface
+ */
+PacketPassInterface * FragmentProtoDisassembler_GetProbeInput (FragmentProtoDisassembler *o);
+
+/**
+ * Limits the size of output packets with frames from the regular input.
+ * A pending output packet which is already too large to take more data
+ * is sent out immediately.
+ * 
+ * @param o the object
+ * @param limit maximum output packet size. Must be >sizeof(struct fragmentproto_chunk_header)
+ *              and <=output_mtu.
+ */
+void FragmentProtoDisassembler_SetOutputLimit (FragmentProtoDisassembler *o, int limit);
+
 /**
  * Returns the output interface.
  *
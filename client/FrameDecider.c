@@ -49,16 +49,9 @@
 #define DECIDE_STATE_FLOOD 3
 #define DECIDE_STATE_MULTICAST 4
 
-#define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
-
-static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
-{
-    int c = memcmp(mac1, mac2, 6);
-    return B_COMPARE(c, 0);
-}
+#define MAC_TABLE_MIN_SIZE 16
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_impl.h>
+#define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_impl.h>
@@ -66,24 +59,168 @@ static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
 #include "FrameDecider_multicast_tree.h"
 #include <structure/SAvl_impl.h>
 
+static size_t mac_table_hash (FrameDecider *d, const uint8_t *mac)
+{
+    uint16_t hi;
+    uint32_t lo;
+    memcpy(&hi, mac, sizeof(hi));
+    memcpy(&lo, mac + 2, sizeof(lo));
+    
+    uint64_t x = ((uint64_t)hi << 32) | lo;
+    x *= UINT64_C(0x9E3779B97F4A7C15);
+    
+    return (size_t)(x >> 32) & (d->mac_table_size - 1);
+}
+
+static struct _FrameDecider_mac_slot * mac_table_find (FrameDecider *d, const uint8_t *mac)
+{
+    if (d->mac_table_size == 0) {
+        return NULL;
+    }
+    
+    size_t mask = d->mac_table_size - 1;
+    
+    for (size_t i = mac_table_hash(d, mac);; i = (i + 1) & mask) {
+        struct _FrameDecider_mac_slot *slot = &d->mac_table[i];
+        if (!slot->entry) {
+            return NULL;
+        }
+        if (!memcmp(slot->mac, mac, sizeof(slot->mac))) {
+            return slot;
+        }
+    }
+}
+
+static void mac_table_insert_slot (FrameDecider *d, const uint8_t *mac, struct _FrameDecider_mac_entry *entry)
+{
+    ASSERT(d->mac_table_size > 0)
+    
+    size_t mask = d->mac_table_size - 1;
+    
+    // the table is kept at most half full, so there is always an empty slot
+    size_t i = mac_table_hash(d, mac);
+    while (d->mac_table[i].entry) {
+        ASSERT(memcmp(d->mac_table[i].mac, mac, 6))
+        i = (i + 1) & mask;
+    }
+    
+    memcpy(d->mac_table[i].mac, mac, 6);
+    d->mac_table[i].entry = entry;
+}
+
+static void mac_table_insert (FrameDecider *d, struct _FrameDecider_mac_entry *entry)
+{
+    ASSERT(!mac_table_find(d, entry->mac))
+    
+    mac_table_insert_slot(d, entry->mac, entry);
+}
+
+static void mac_table_remove (FrameDecider *d, struct _FrameDecider_mac_entry *entry)
+{
+    struct _FrameDecider_mac_slot *slot = mac_table_find(d, entry->mac);
+    ASSERT(slot)
+    ASSERT(slot->entry == entry)
+    
+    size_t mask = d->mac_table_size - 1;
+    size_t i = slot - d->mac_table;
+    size_t j = i;
+    
+    // shift back following entries which would no longer be reachable,
+    // so we don't need tombstones
+    while (1) {
+        j = (j + 1) & mask;
+        if (!d->mac_table[j].entry) {
+            break;
+        }
+        
+        size_t k = mac_table_hash(d, d->mac_table[j].mac);
+        
+        // leave the entry if its home slot is cyclically in (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        
+        d->mac_table[i] = d->mac_table[j];
+        i = j;
+    }
+    
+    d->mac_table[i].entry = NULL;
+}
+
+static int mac_table_reserve (FrameDecider *d, size_t num_entries)
+{
+    if (num_entries > SIZE_MAX / 2 - d->mac_table_reserved) {
+        return 0;
+    }
+    size_t needed = 2 * (d->mac_table_reserved + num_entries);
+    
+    if (d->mac_table_size < needed) {
+        size_t new_size = MAC_TABLE_MIN_SIZE;
+        while (new_size < needed) {
+            new_size *= 2;
+        }
+        
+        struct _FrameDecider_mac_slot *new_table = (struct _FrameDecider_mac_slot *)BAllocArray(new_size, sizeof(new_table[0]));
+        if (!new_table) {
+            return 0;
+        }
+        for (size_t i = 0; i < new_size; i++) {
+            new_table[i].entry = NULL;
+        }
+        
+        struct _FrameDecider_mac_slot *old_table = d->mac_table;
+        size_t old_size = d->mac_table_size;
+        
+        d->mac_table = new_table;
+        d->mac_table_size = new_size;
+        
+        // rehash existing entries
+        for (size_t i = 0; i < old_size; i++) {
+            if (old_table[i].entry) {
+                mac_table_insert_slot(d, old_table[i].mac, old_table[i].entry);
+            }
+        }
+        
+        if (old_table) {
+            BFree(old_table);
+        }
+    }
+    
+    d->mac_table_reserved += num_entries;
+    
+    return 1;
+}
+
+static void release_mac_entry (struct _FrameDecider_mac_entry *entry)
+{
+    FrameDeciderPeer *peer = entry->peer;
+    
+    mac_table_remove(peer->d, entry);
+    LinkedList1_Remove(&peer->mac_entries_used, &entry->list_node);
+    LinkedList1_Append(&peer->mac_entries_free, &entry->list_node);
+}
+
 static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
 {
     FrameDecider *d = o->d;
     
-    // locate entry in tree
-    struct _FrameDecider_mac_entry *e_entry = FDMacsTree_LookupExact(&d->macs_tree, 0, mac);
-    if (e_entry) {
+    btime_t now = btime_gettime();
+    
+    // locate entry in table
+    struct _FrameDecider_mac_slot *slot = mac_table_find(d, mac);
+    if (slot) {
+        struct _FrameDecider_mac_entry *e_entry = slot->entry;
+        
         if (e_entry->peer == o) {
-            // this is our MAC; only move it to the end of the used list
+            // this is our MAC; only refresh it and move it to the end of the used list
+            e_entry->last_seen = now;
             LinkedList1_Remove(&o->mac_entries_used, &e_entry->list_node);
             LinkedList1_Append(&o->mac_entries_used, &e_entry->list_node);
             return;
         }
         
         // some other peer has that MAC; disassociate it
-        FDMacsTree_Remove(&d->macs_tree, 0, e_entry);
-        LinkedList1_Remove(&e_entry->peer->mac_entries_used, &e_entry->list_node);
-        LinkedList1_Append(&e_entry->peer->mac_entries_free, &e_entry->list_node);
+        release_mac_entry(e_entry);
     }
     
     // aquire MAC address entry, if there are no free ones reuse the oldest used one
@@ -102,7 +239,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         ASSERT(entry->peer == o)
         
         // remove from used
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        mac_table_remove(d, entry);
         LinkedList1_Remove(&o->mac_entries_used, &entry->list_node);
     }
     
@@ -110,11 +247,11 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
     
     // set MAC in entry
     memcpy(entry->mac, mac, sizeof(entry->mac));
+    entry->last_seen = now;
     
     // add to used
     LinkedList1_Append(&o->mac_entries_used, &entry->list_node);
-    int res = FDMacsTree_Insert(&d->macs_tree, 0, entry, NULL);
-    ASSERT_EXECUTE(res)
+    mac_table_insert(d, entry);
 }
 
 static uint32_t compute_sig_for_group (uint32_t group)
@@ -145,6 +282,9 @@ static void add_to_multicast (FrameDecider *d, struct _FrameDecider_group_entry
         
         // insert to list
         LinkedList3Node_InitAfter(&group_entry->sig_list_node, &master->sig_list_node);
+        
+        // destinations need to be recomputed
+        master->master.dests_dirty = 1;
     } else {
         // make this entry master
         
@@ -154,6 +294,12 @@ static void add_to_multicast (FrameDecider *d, struct _FrameDecider_group_entry
         // set sig
         group_entry->master.sig = sig;
         
+        // have no destinations computed
+        group_entry->master.dests = NULL;
+        group_entry->master.dests_num = 0;
+        group_entry->master.dests_capacity = 0;
+        group_entry->master.dests_dirty = 1;
+        
         // insert to multicast tree
         int res = FDMulticastTree_Insert(&d->multicast_tree, 0, group_entry, NULL);
         ASSERT_EXECUTE(res)
@@ -186,16 +332,84 @@ static void remove_from_multicast (FrameDecider *d, struct _FrameDecider_group_e
             // set sig
             newmaster->master.sig = sig;
             
+            // take over destinations; the array stays where it is, so a decision
+            // in progress can keep using it
+            newmaster->master.dests = group_entry->master.dests;
+            newmaster->master.dests_num = group_entry->master.dests_num;
+            newmaster->master.dests_capacity = group_entry->master.dests_capacity;
+            newmaster->master.dests_dirty = 1;
+            
             // insert to multicast tree
             int res = FDMulticastTree_Insert(&d->multicast_tree, 0, newmaster, NULL);
             ASSERT_EXECUTE(res)
+        } else {
+            // this was the only entry; stop a decision in progress using the destinations
+            if (d->decide_state == DECIDE_STATE_MULTICAST && d->decide_multicast_dests == group_entry->master.dests) {
+                d->decide_state = DECIDE_STATE_NONE;
+            }
+            
+            // free destinations
+            if (group_entry->master.dests) {
+                BFree(group_entry->master.dests);
+            }
         }
+    } else {
+        // destinations of the master need to be recomputed
+        struct _FrameDecider_group_entry *master = FDMulticastTree_LookupExact(&d->multicast_tree, 0, sig);
+        ASSERT(master)
+        ASSERT(master->is_master)
+        master->master.dests_dirty = 1;
     }
     
     // free linked list node
     LinkedList3Node_Free(&group_entry->sig_list_node);
 }
 
+static int update_multicast_dests (FrameDecider *d, struct _FrameDecider_group_entry *master)
+{
+    ASSERT(master->is_master)
+    ASSERT(d->decide_state != DECIDE_STATE_MULTICAST)
+    
+    if (!master->master.dests_dirty) {
+        return 1;
+    }
+    
+    // count group entries with this sig, an upper bound for the number of peers
+    int count = 0;
+    for (LinkedList3Node *node = LinkedList3Node_First(&master->sig_list_node); node; node = LinkedList3Node_Next(node)) {
+        count++;
+    }
+    
+    // make sure there is enough space
+    if (count > master->master.dests_capacity) {
+        FrameDeciderPeer **new_dests = (FrameDeciderPeer **)BAllocArray(count, sizeof(new_dests[0]));
+        if (!new_dests) {
+            return 0;
+        }
+        if (master->master.dests) {
+            BFree(master->master.dests);
+        }
+        master->master.dests = new_dests;
+        master->master.dests_capacity = count;
+    }
+    
+    // collect distinct peers; a peer may have multiple groups with the same sig
+    d->multicast_mark++;
+    master->master.dests_num = 0;
+    for (LinkedList3Node *node = LinkedList3Node_First(&master->sig_list_node); node; node = LinkedList3Node_Next(node)) {
+        struct _FrameDecider_group_entry *group_entry = UPPER_OBJECT(node, struct _FrameDecider_group_entry, sig_list_node);
+        FrameDeciderPeer *peer = group_entry->peer;
+        if (peer->multicast_mark != d->multicast_mark) {
+            peer->multicast_mark = d->multicast_mark;
+            master->master.dests[master->master.dests_num++] = peer;
+        }
+    }
+    
+    master->master.dests_dirty = 0;
+    
+    return 1;
+}
+
 static void add_group_to_peer (FrameDeciderPeer *o, uint32_t group)
 {
     FrameDecider *d = o->d;
@@ -320,7 +534,7 @@ static void group_entry_timer_handler (struct _FrameDecider_group_entry *group_e
     remove_group_entry(group_entry);
 }
 
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
+void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, btime_t mac_aging_time, BReactor *reactor)
 {
     ASSERT(max_peer_macs > 0)
     ASSERT(max_peer_groups > 0)
@@ -330,16 +544,20 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     o->max_peer_groups = max_peer_groups;
     o->igmp_group_membership_interval = igmp_group_membership_interval;
     o->igmp_last_member_query_time = igmp_last_member_query_time;
+    o->mac_aging_time = mac_aging_time;
     o->reactor = reactor;
     
     // init peers list
     LinkedList1_Init(&o->peers_list);
     
-    // init MAC tree
-    FDMacsTree_Init(&o->macs_tree);
+    // init MAC table; it's allocated when peers are added
+    o->mac_table = NULL;
+    o->mac_table_size = 0;
+    o->mac_table_reserved = 0;
     
     // init multicast tree
     FDMulticastTree_Init(&o->multicast_tree);
+    o->multicast_mark = 0;
     
     // init decide state
     o->decide_state = DECIDE_STATE_NONE;
@@ -353,9 +571,14 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
 void FrameDecider_Free (FrameDecider *o)
 {
     ASSERT(FDMulticastTree_IsEmpty(&o->multicast_tree))
-    ASSERT(FDMacsTree_IsEmpty(&o->macs_tree))
+    ASSERT(o->mac_table_reserved == 0)
     ASSERT(LinkedList1_IsEmpty(&o->peers_list))
     DebugObject_Free(&o->d_obj);
+    
+    // free MAC table
+    if (o->mac_table) {
+        BFree(o->mac_table);
+    }
 }
 
 void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int frame_len)
@@ -372,8 +595,7 @@ void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int f
         case DECIDE_STATE_FLOOD:
             break;
         case DECIDE_STATE_MULTICAST:
-            LinkedList3Iterator_Free(&o->decide_multicast_it);
-            return;
+            break;
         default:
             ASSERT(0);
     }
@@ -488,19 +710,37 @@ out:;
         if (master) {
             ASSERT(master->is_master)
             
+            // make sure destinations are up to date
+            if (!update_multicast_dests(o, master)) {
+                BLog(BLOG_ERROR, "decide: failed to allocate multicast destinations, flooding");
+                o->decide_state = DECIDE_STATE_FLOOD;
+                o->decide_flood_current = LinkedList1_GetFirst(&o->peers_list);
+                return;
+            }
+            
             o->decide_state = DECIDE_STATE_MULTICAST;
-            LinkedList3Iterator_Init(&o->decide_multicast_it, LinkedList3Node_First(&master->sig_list_node), 1);
+            o->decide_multicast_dests = master->master.dests;
+            o->decide_multicast_num = master->master.dests_num;
+            o->decide_multicast_pos = 0;
         }
         
         return;
     }
     
     // look for MAC entry
-    struct _FrameDecider_mac_entry *entry = FDMacsTree_LookupExact(&o->macs_tree, 0, eh.dest);
-    if (entry) {
-        o->decide_state = DECIDE_STATE_UNICAST;
-        o->decide_unicast_peer = entry->peer;
-        return;
+    struct _FrameDecider_mac_slot *slot = mac_table_find(o, eh.dest);
+    if (slot) {
+        struct _FrameDecider_mac_entry *entry = slot->entry;
+        
+        if (o->mac_aging_time < 0 || btime_gettime() - entry->last_seen <= o->mac_aging_time) {
+            o->decide_state = DECIDE_STATE_UNICAST;
+            o->decide_unicast_peer = entry->peer;
+            return;
+        }
+        
+        // MAC has aged out; forget it and flood
+        PeerLog(entry->peer, BLOG_INFO, "MAC %02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8" aged out", entry->mac[0], entry->mac[1], entry->mac[2], entry->mac[3], entry->mac[4], entry->mac[5]);
+        release_mac_entry(entry);
     }
     
     // unknown destination MAC, flood
@@ -539,14 +779,16 @@ FrameDeciderPeer * FrameDecider_NextDestination (FrameDecider *o)
         } break;
         
         case DECIDE_STATE_MULTICAST: {
-            LinkedList3Node *list_node = LinkedList3Iterator_Next(&o->decide_multicast_it);
-            if (!list_node) {
-                o->decide_state = DECIDE_STATE_NONE;
-                return NULL;
+            // skip destinations removed by FrameDeciderPeer_Free
+            while (o->decide_multicast_pos < o->decide_multicast_num) {
+                FrameDeciderPeer *peer = o->decide_multicast_dests[o->decide_multicast_pos++];
+                if (peer) {
+                    return peer;
+                }
             }
-            struct _FrameDecider_group_entry *group_entry = UPPER_OBJECT(list_node, struct _FrameDecider_group_entry, sig_list_node);
             
-            return group_entry->peer;
+            o->decide_state = DECIDE_STATE_NONE;
+            return NULL;
         } break;
         
         default:
@@ -574,6 +816,15 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
         goto fail1;
     }
     
+    // reserve space for our MAC entries in the MAC table
+    if (!mac_table_reserve(d, d->max_peer_macs)) {
+        PeerLog(o, BLOG_ERROR, "failed to grow MAC table");
+        goto fail2;
+    }
+    
+    // not collected into any multicast destinations
+    o->multicast_mark = d->multicast_mark;
+    
     // insert to peers list
     LinkedList1_Append(&d->peers_list, &o->list_node);
     
@@ -617,6 +868,8 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
     
     return 1;
     
+fail2:
+    BFree(o->group_entries);
 fail1:
     BFree(o->mac_entries);
 fail0:
@@ -634,6 +887,15 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         d->decide_state = DECIDE_STATE_NONE;
     }
     
+    // remove decide multicast references
+    if (d->decide_state == DECIDE_STATE_MULTICAST) {
+        for (int i = d->decide_multicast_pos; i < d->decide_multicast_num; i++) {
+            if (d->decide_multicast_dests[i] == o) {
+                d->decide_multicast_dests[i] = NULL;
+            }
+        }
+    }
+    
     LinkedList1Node *node;
     
     // free group entries
@@ -647,14 +909,17 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         BReactor_RemoveTimer(d->reactor, &entry->timer);
     }
     
-    // remove used MAC entries from tree
+    // remove used MAC entries from table
     for (node = LinkedList1_GetFirst(&o->mac_entries_used); node; node = LinkedList1Node_Next(node)) {
         struct _FrameDecider_mac_entry *entry = UPPER_OBJECT(node, struct _FrameDecider_mac_entry, list_node);
         
-        // remove from tree
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        // remove from table
+        mac_table_remove(d, entry);
     }
     
+    // release our reservation in the MAC table
+    d->mac_table_reserved -= d->max_peer_macs;
+    
     // remove from peers list
     if (d->decide_flood_current == &o->list_node) {
         d->decide_flood_current = LinkedList1Node_Next(d->decide_flood_current);
@@ -48,11 +48,6 @@ struct _FrameDeciderPeer;
 struct _FrameDecider_mac_entry;
 struct _FrameDecider_group_entry;
 
-typedef const uint8_t *FDMacsTree_key;
-
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_decl.h>
-
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_decl.h>
 
@@ -64,7 +59,12 @@ struct _FrameDecider_mac_entry {
     LinkedList1Node list_node; // node in FrameDeciderPeer.mac_entries_free or FrameDeciderPeer.mac_entries_used
     // defined when used:
     uint8_t mac[6];
-    FDMacsTreeNode tree_node; // node in FrameDecider.macs_tree, indexed by mac
+    btime_t last_seen; // when the peer last sent a frame from this MAC
+};
+
+struct _FrameDecider_mac_slot {
+    uint8_t mac[6];
+    struct _FrameDecider_mac_entry *entry; // NULL if the slot is empty
 };
 
 struct _FrameDecider_group_entry {
@@ -83,6 +83,10 @@ struct _FrameDecider_group_entry {
     struct {
         uint32_t sig; // last 23 bits of group address
         FDMulticastTreeNode tree_node; // node in FrameDecider.multicast_tree, indexed by sig
+        struct _FrameDeciderPeer **dests; // distinct peers of all group entries with this sig
+        int dests_num;
+        int dests_capacity;
+        int dests_dirty; // dests needs to be recomputed
     } master;
 };
 
@@ -94,14 +98,20 @@ typedef struct {
     int max_peer_groups;
     btime_t igmp_group_membership_interval;
     btime_t igmp_last_member_query_time;
+    btime_t mac_aging_time;
     BReactor *reactor;
     LinkedList1 peers_list;
-    FDMacsTree macs_tree;
+    struct _FrameDecider_mac_slot *mac_table; // open addressing, linear probing
+    size_t mac_table_size; // zero or a power of two
+    size_t mac_table_reserved; // number of MAC entries of all peers
     FDMulticastTree multicast_tree;
+    unsigned int multicast_mark;
     int decide_state;
     LinkedList1Node *decide_flood_current;
     struct _FrameDeciderPeer *decide_unicast_peer;
-    LinkedList3Iterator decide_multicast_it;
+    struct _FrameDeciderPeer **decide_multicast_dests;
+    int decide_multicast_num;
+    int decide_multicast_pos;
     DebugObject d_obj;
 } FrameDecider;
 
@@ -120,6 +130,7 @@ typedef struct _FrameDeciderPeer {
     LinkedList1 group_entries_free;
     LinkedList1 group_entries_used;
     FDGroupsTree groups_tree;
+    unsigned int multicast_mark; // used to remove duplicates when computing multicast destinations
     DebugObject d_obj;
 } FrameDeciderPeer;
 
@@ -136,8 +147,12 @@ typedef struct _FrameDeciderPeer {
  * @param igmp_last_member_query_time IGMP Last Member Query Time value. When a Group-Specific
  *        Query is detected in {@link FrameDecider_AnalyzeAndDecide}, this is how long we wait for a peer
  *        belonging to the group to send a join before we remove the group from it.
+ * @param mac_aging_time how long a MAC address stays associated with a peer after the last
+ *        frame from it was seen in {@link FrameDeciderPeer_Analyze}. Frames to an aged out
+ *        MAC address are flooded. If negative, MAC addresses never age out.
+ * @param reactor reactor we live in
  */
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor);
+void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, btime_t mac_aging_time, BReactor *reactor);
 
 /**
  * Frees the object.
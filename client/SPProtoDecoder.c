@@ -48,6 +48,7 @@ static void decode_work_func (SPProtoDecoder *o)
     int in_len = o->in_len;
     
     o->tw_out_len = -1;
+    o->tw_out_bad_hash = 0;
     
     uint8_t *plaintext;
     int plaintext_len;
@@ -145,6 +146,7 @@ static void decode_work_func (SPProtoDecoder *o)
         // compare hashes
         if (memcmp(hash, hash_calc, o->hash_size)) {
             PeerLog(o, BLOG_WARNING, "packet has wrong hash");
+            o->tw_out_bad_hash = 1;
             return;
         }
     }
@@ -164,11 +166,21 @@ static void decode_work_handler (SPProtoDecoder *o)
     BThreadWork_Free(&o->tw);
     o->tw_have = 0;
     
+    // count packets the worker rejected
+    if (o->tw_out_len < 0) {
+        if (o->tw_out_bad_hash) {
+            o->counters.bad_hash++;
+        } else {
+            o->counters.malformed++;
+        }
+    }
+    
     // check OTP
     if (SPPROTO_HAVE_OTP(o->sp_params) && o->tw_out_len >= 0) {
         if (!OTPChecker_CheckOTP(&o->otpchecker, o->tw_out_seed_id, o->tw_out_otp)) {
             PeerLog(o, BLOG_WARNING, "packet has wrong OTP");
             o->tw_out_len = -1;
+            o->counters.bad_otp++;
         }
     }
     
@@ -177,6 +189,8 @@ static void decode_work_handler (SPProtoDecoder *o)
         PacketPassInterface_Done(&o->input);
         o->in_len = -1;
     } else {
+        o->counters.decoded++;
+        
         // submit decoded packet to output
         PacketPassInterface_Sender_Send(o->output, o->tw_out, o->tw_out_len);
     }
@@ -287,6 +301,9 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     // have no work
     o->tw_have = 0;
     
+    // clear counters
+    memset(&o->counters, 0, sizeof(o->counters));
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
@@ -396,3 +413,10 @@ void SPProtoDecoder_SetHandlers (SPProtoDecoder *o, SPProtoDecoder_otp_handler o
         OTPChecker_SetHandlers(&o->otpchecker, otp_handler, user);
     }
 }
+
+const struct SPProtoDecoder_counters * SPProtoDecoder_GetCounters (SPProtoDecoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->counters;
+}
@@ -44,6 +44,16 @@
 #include <security/OTPChecker.h>
 #include <flow/PacketPassInterface.h>
 
+/**
+ * Counters kept by {@link SPProtoDecoder}.
+ */
+struct SPProtoDecoder_counters {
+    uint64_t decoded; // packets decoded successfully
+    uint64_t malformed; // packets which could not be decrypted or have a broken structure
+    uint64_t bad_hash; // packets with a wrong hash
+    uint64_t bad_otp; // packets with a wrong OTP
+};
+
 /**
  * Handler called when OTP generation for a new seed is finished.
  * 
@@ -80,6 +90,8 @@ typedef struct {
     otp_t tw_out_otp;
     uint8_t *tw_out;
     int tw_out_len;
+    int tw_out_bad_hash;
+    struct SPProtoDecoder_counters counters;
     DebugObject d_obj;
 } SPProtoDecoder;
 
@@ -168,4 +180,12 @@ void SPProtoDecoder_RemoveOTPSeeds (SPProtoDecoder *o);
  */
 void SPProtoDecoder_SetHandlers (SPProtoDecoder *o, SPProtoDecoder_otp_handler otp_handler, void *user);
 
+/**
+ * Returns counters of decoded and dropped packets.
+ * 
+ * @param o the object
+ * @return counters, valid until the object is freed
+ */
+const struct SPProtoDecoder_counters * SPProtoDecoder_GetCounters (SPProtoDecoder *o);
+
 #endif
@@ -0,0 +1,215 @@
+/**
+ * @file StatsListener.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include <client/StatsListener.h>
+
+#include <generated/blog_channel_StatsListener.h>
+
+static void remove_client (struct StatsListenerClient *client);
+static void send_more (struct StatsListenerClient *client);
+static void listener_handler (StatsListener *l);
+static void client_connection_handler (struct StatsListenerClient *client, int event);
+static void client_send_handler_done (struct StatsListenerClient *client, int data_len);
+
+void remove_client (struct StatsListenerClient *client)
+{
+    StatsListener *l = client->l;
+    
+    // free data
+    ExpString_Free(&client->data);
+    
+    // free connection interfaces
+    BConnection_SendAsync_Free(&client->con);
+    
+    // free connection
+    BConnection_Free(&client->con);
+    
+    // move to free list
+    LinkedList1_Remove(&l->clients_used, &client->list_node);
+    LinkedList1_Append(&l->clients_free, &client->list_node);
+}
+
+void send_more (struct StatsListenerClient *client)
+{
+    size_t length = ExpString_Length(&client->data);
+    ASSERT(client->sent <= length)
+    
+    // if everything was sent, close the connection
+    if (client->sent == length) {
+        BLog(BLOG_INFO, "dump sent");
+        remove_client(client);
+        return;
+    }
+    
+    size_t left = length - client->sent;
+    int to_send = (left > INT_MAX ? INT_MAX : left);
+    
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&client->con), (uint8_t *)ExpString_Get(&client->data) + client->sent, to_send);
+}
+
+void listener_handler (StatsListener *l)
+{
+    DebugObject_Access(&l->d_obj);
+    
+    // obtain client entry
+    if (LinkedList1_IsEmpty(&l->clients_free)) {
+        struct StatsListenerClient *client = UPPER_OBJECT(LinkedList1_GetFirst(&l->clients_used), struct StatsListenerClient, list_node);
+        remove_client(client);
+    }
+    struct StatsListenerClient *client = UPPER_OBJECT(LinkedList1_GetLast(&l->clients_free), struct StatsListenerClient, list_node);
+    LinkedList1_Remove(&l->clients_free, &client->list_node);
+    LinkedList1_Append(&l->clients_used, &client->list_node);
+    
+    // accept connection
+    if (!BConnection_Init(&client->con, BConnection_source_listener(&l->listener, NULL), l->reactor, client, (BConnection_handler)client_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    BLog(BLOG_INFO, "Connection accepted");
+    
+    // init data
+    if (!ExpString_Init(&client->data)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail1;
+    }
+    client->sent = 0;
+    
+    // produce data
+    if (!l->handler_dump(l->user, &client->data)) {
+        BLog(BLOG_ERROR, "dump failed");
+        goto fail2;
+    }
+    
+    // init sending
+    BConnection_SendAsync_Init(&client->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&client->con), (StreamPassInterface_handler_done)client_send_handler_done, client);
+    
+    // start sending
+    send_more(client);
+    return;
+    
+    // cleanup on error
+fail2:
+    ExpString_Free(&client->data);
+fail1:
+    BConnection_Free(&client->con);
+fail0:
+    LinkedList1_Remove(&l->clients_used, &client->list_node);
+    LinkedList1_Append(&l->clients_free, &client->list_node);
+}
+
+void client_connection_handler (struct StatsListenerClient *client, int event)
+{
+    StatsListener *l = client->l;
+    DebugObject_Access(&l->d_obj);
+    
+    BLog(BLOG_INFO, "connection error");
+    
+    remove_client(client);
+}
+
+void client_send_handler_done (struct StatsListenerClient *client, int data_len)
+{
+    StatsListener *l = client->l;
+    DebugObject_Access(&l->d_obj);
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= ExpString_Length(&client->data) - client->sent)
+    
+    client->sent += data_len;
+    
+    send_more(client);
+}
+
+int StatsListener_Init (StatsListener *l, BReactor *reactor, const char *socket_path, int max_clients, void *user, StatsListener_handler_dump handler_dump)
+{
+    ASSERT(socket_path)
+    ASSERT(max_clients > 0)
+    ASSERT(handler_dump)
+    
+    // init arguments
+    l->reactor = reactor;
+    l->user = user;
+    l->handler_dump = handler_dump;
+    
+    // allocate client entries
+    if (!(l->clients_data = (struct StatsListenerClient *)BAllocArray(max_clients, sizeof(struct StatsListenerClient)))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // initialize client entries
+    LinkedList1_Init(&l->clients_free);
+    LinkedList1_Init(&l->clients_used);
+    for (int i = 0; i < max_clients; i++) {
+        struct StatsListenerClient *client = &l->clients_data[i];
+        client->l = l;
+        LinkedList1_Append(&l->clients_free, &client->list_node);
+    }
+    
+    // initialize listener
+    if (!BListener_InitUnix(&l->listener, socket_path, l->reactor, l, (BListener_handler)listener_handler)) {
+        BLog(BLOG_ERROR, "BListener_InitUnix failed");
+        goto fail1;
+    }
+    
+    DebugObject_Init(&l->d_obj);
+    return 1;
+    
+    // cleanup
+fail1:
+    BFree(l->clients_data);
+fail0:
+    return 0;
+}
+
+void StatsListener_Free (StatsListener *l)
+{
+    DebugObject_Free(&l->d_obj);
+    
+    // free clients
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&l->clients_used)) {
+        struct StatsListenerClient *client = UPPER_OBJECT(node, struct StatsListenerClient, list_node);
+        remove_client(client);
+    }
+    
+    // free listener
+    BListener_Free(&l->listener);
+    
+    // free client entries
+    BFree(l->clients_data);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file StatsListener.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which listens on a unix socket and, to every client that connects,
+ * writes a textual dump provided by the user, then closes the connection.
+ */
+
+#ifndef BADVPN_CLIENT_STATSLISTENER_H
+#define BADVPN_CLIENT_STATSLISTENER_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BConnection.h>
+
+/**
+ * Handler function called when a client connects, to produce the data
+ * sent to the client.
+ * 
+ * @param user as in {@link StatsListener_Init}
+ * @param out initialized string to append the data to
+ * @return 1 on success, 0 on failure. On failure, the client is disconnected
+ *         without sending anything.
+ */
+typedef int (*StatsListener_handler_dump) (void *user, ExpString *out);
+
+struct StatsListenerClient;
+
+/**
+ * Object which listens on a unix socket and, to every client that connects,
+ * writes a textual dump provided by the user, then closes the connection.
+ */
+typedef struct {
+    BReactor *reactor;
+    void *user;
+    StatsListener_handler_dump handler_dump;
+    struct StatsListenerClient *clients_data;
+    LinkedList1 clients_free;
+    LinkedList1 clients_used;
+    BListener listener;
+    DebugObject d_obj;
+} StatsListener;
+
+struct StatsListenerClient {
+    StatsListener *l;
+    LinkedList1Node list_node;
+    BConnection con;
+    ExpString data;
+    size_t sent;
+};
+
+/**
+ * Initializes the object.
+ * 
+ * @param l the object
+ * @param reactor reactor we live in
+ * @param socket_path path of the unix socket to listen on. An existing socket
+ *                    file at this path is removed.
+ * @param max_clients maximum number of clients being served at the same time.
+ *                    When a client connects and there are already this many,
+ *                    the oldest one is disconnected. Must be >0.
+ * @param user value passed to handler
+ * @param handler_dump handler called to produce the data for a client
+ * @return 1 on success, 0 on failure
+ */
+int StatsListener_Init (StatsListener *l, BReactor *reactor, const char *socket_path, int max_clients, void *user, StatsListener_handler_dump handler_dump) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * Clients being served are disconnected.
+ * 
+ * @param l the object
+ */
+void StatsListener_Free (StatsListener *l);
+
+#endif
@@ -121,6 +121,12 @@ void connector_handler (StreamPeerIO *pio, int is_error)
             goto fail2;
         }
         
+        // cache the session under this peer's certificate, so a reconnect can resume it
+        if (!BSSLConnection_SetSessionCacheKey(pio->connect.sock.ssl_prfd, pio->ssl_peer_cert, pio->ssl_peer_cert_len)) {
+            PeerLog(pio, BLOG_ERROR, "BSSLConnection_SetSessionCacheKey failed");
+            goto fail2;
+        }
+        
         // set verify peer certificate hook
         if (SSL_AuthCertificateHook(pio->connect.sock.ssl_prfd, (SSLAuthCertificate)client_auth_certificate_callback, pio) != SECSuccess) {
             PeerLog(pio, BLOG_ERROR, "SSL_AuthCertificateHook failed");
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include <protocol/msgproto.h>
 #include <protocol/addr.h>
@@ -42,9 +43,12 @@
 #include <misc/nsskey.h>
 #include <misc/loglevel.h>
 #include <misc/loggers_string.h>
+#include <misc/minmax.h>
 #include <misc/string_begins_with.h>
 #include <misc/open_standard_streams.h>
+#include <misc/expstring.h>
 #include <structure/LinkedList1.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <security/BSecurity.h>
@@ -60,12 +64,19 @@
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <client/StatsListener.h>
 #endif
 
 #include <client/client.h>
 
 #include <generated/blog_channel_client.h>
 
+#include "client_peers_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "client_peers_hash.h"
+#include <structure/CHash_impl.h>
+
 #define TRANSPORT_MODE_UDP 0
 #define TRANSPORT_MODE_TCP 1
 
@@ -113,16 +124,28 @@ struct {
     int otp_num;
     int otp_num_warn;
     int fragmentation_latency;
+    int fragmentation_latency_fixed;
+    int udp_shared_socket;
+    int udp_pmtu_discovery;
+    int udp_offload;
+    int udp_mtu;
     int peer_ssl;
     int peer_tcp_socket_sndbuf;
     int send_buffer_size;
     int send_buffer_relay_size;
+    int send_buffer_codel_target;
+    int send_rate_limit;
+    int total_send_rate_limit;
     int max_macs;
     int max_groups;
     int igmp_group_membership_interval;
     int igmp_last_member_query_time;
+    int mac_aging_time;
     int allow_peer_talk_without_ssl;
     int max_peers;
+    #ifndef BADVPN_USE_WINAPI
+    char *stats_socket;
+    #endif
 } options;
 
 // bind addresses
@@ -143,6 +166,13 @@ struct bind_addr bind_addrs[MAX_BIND_ADDRS];
 // TCP listeners
 PasswordListener listeners[MAX_BIND_ADDRS];
 
+// shared UDP sockets, if enabled; one bound to each bind address,
+// with the port adjustment it got, and an unbound one for each
+// address family for connecting
+DatagramSharedSocket udp_bind_sockets[MAX_BIND_ADDRS];
+int udp_bind_ports_add[MAX_BIND_ADDRS];
+DatagramSharedSocket udp_connect_sockets[2];
+
 // SPProto parameters (UDP only)
 struct spproto_security_params sp_params;
 
@@ -174,6 +204,9 @@ DataProtoSource device_dpsource;
 // DPReceiveDevice for device output (writing)
 DPReceiveDevice device_output_dprd;
 
+// rate limit shared by frames sent to all peers
+TokenBucket total_send_rate_bucket;
+
 // data communication MTU
 int data_mtu;
 
@@ -181,15 +214,26 @@ int data_mtu;
 LinkedList1 peers;
 int num_peers;
 
+// peers hash table, indexed by peer ID
+PeersHash peers_hash;
+
 // frame decider
 FrameDecider frame_decider;
 
+#ifndef BADVPN_USE_WINAPI
+// statistics socket, if enabled
+StatsListener stats_listener;
+#endif
+
 // peers that can be user as relays
 LinkedList1 relays;
 
 // peers than need a relay
 LinkedList1 waiting_relay_peers;
 
+// timer for moving relayed peers to better relays
+BTimer relay_rebalance_timer;
+
 // server connection
 ServerConnection server;
 
@@ -334,6 +378,9 @@ static void peer_dataproto_handler (struct peer_data *peer, int up);
 // looks for a peer with the given ID
 static struct peer_data * find_peer_by_id (peerid_t id);
 
+// returns the shared UDP socket for connecting to addresses of the given family, or NULL
+static DatagramSharedSocket * udp_connect_socket (int family);
+
 // device error handler
 static void device_error_handler (void *unused);
 
@@ -343,6 +390,20 @@ static void device_dpsource_handler (void *unused, const uint8_t *frame, int fra
 // assign relays to clients waiting for them
 static void assign_relays (void);
 
+// returns the cost of using a relay, when it has the given number of users
+static btime_t relay_cost (struct peer_data *relay, int num_users);
+
+// returns the relay with the lowest cost for one more user, excluding the given one, or NULL
+static struct peer_data * find_best_relay (struct peer_data *exclude);
+
+// relay rebalance timer handler
+static void relay_rebalance_timer_handler (void *unused);
+
+#ifndef BADVPN_USE_WINAPI
+// StatsListener handler producing per-peer statistics
+static int stats_listener_handler_dump (void *unused, ExpString *out);
+#endif
+
 // checks if the given address scope is known (i.e. we can connect to an address in it)
 static char * address_scope_known (uint8_t *name, int name_len);
 
@@ -469,6 +530,9 @@ int main (int argc, char *argv[])
     // init time
     BTime_Init();
     
+    // measure how long flow interfaces are busy, if tracing is compiled in
+    FlowTraceGlobal_SetClock(btime_gettime);
+    
     // process arguments
     if (!process_arguments()) {
         BLog(BLOG_ERROR, "Failed to process arguments");
@@ -503,6 +567,8 @@ int main (int argc, char *argv[])
     
     // init listeners
     int num_listeners = 0;
+    int num_udp_bind_sockets = 0;
+    int num_udp_connect_sockets = 0;
     if (options.transport_mode == TRANSPORT_MODE_TCP) {
         while (num_listeners < num_bind_addrs) {
             struct bind_addr *addr = &bind_addrs[num_listeners];
@@ -514,6 +580,39 @@ int main (int argc, char *argv[])
         }
     }
     
+    // init shared UDP sockets
+    if (options.transport_mode == TRANSPORT_MODE_UDP && options.udp_shared_socket) {
+        while (num_udp_bind_sockets < num_bind_addrs) {
+            struct bind_addr *addr = &bind_addrs[num_udp_bind_sockets];
+            
+            // try binding to all ports in the range
+            int port_add;
+            for (port_add = 0; port_add < addr->num_ports; port_add++) {
+                BAddr tryaddr = addr->addr;
+                BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
+                if (DatagramSharedSocket_InitBind(&udp_bind_sockets[num_udp_bind_sockets], &ss, tryaddr, options.udp_mtu - DATAGRAMSHAREDSOCKET_TAG_SIZE, options.udp_pmtu_discovery)) {
+                    break;
+                }
+            }
+            if (port_add == addr->num_ports) {
+                BLog(BLOG_ERROR, "failed to bind shared UDP socket to any port");
+                goto fail8;
+            }
+            
+            udp_bind_ports_add[num_udp_bind_sockets] = port_add;
+            num_udp_bind_sockets++;
+        }
+        
+        while (num_udp_connect_sockets < 2) {
+            int family = (num_udp_connect_sockets == 0 ? BADDR_TYPE_IPV4 : BADDR_TYPE_IPV6);
+            if (!DatagramSharedSocket_Init(&udp_connect_sockets[num_udp_connect_sockets], &ss, family, options.udp_mtu - DATAGRAMSHAREDSOCKET_TAG_SIZE, options.udp_pmtu_discovery)) {
+                BLog(BLOG_ERROR, "DatagramSharedSocket_Init failed");
+                goto fail8;
+            }
+            num_udp_connect_sockets++;
+        }
+    }
+    
     // init device
     if (!BTap_Init(&device, &ss, options.tapdev, device_error_handler, NULL, 0)) {
         BLog(BLOG_ERROR, "BTap_Init failed");
@@ -544,12 +643,32 @@ int main (int argc, char *argv[])
         goto fail10;
     }
     
+    // init total send rate limit
+    int64_t total_send_burst = TokenBucket_DefaultBurst(options.total_send_rate_limit, data_mtu);
+    TokenBucket_Init(&total_send_rate_bucket, NULL, options.total_send_rate_limit, total_send_burst);
+    
     // init peers list
     LinkedList1_Init(&peers);
     num_peers = 0;
     
+    // init peers hash table
+    if (!PeersHash_Init(&peers_hash, bmin_int(options.max_peers, PEERS_HASH_MAX_INITIAL_BUCKETS))) {
+        BLog(BLOG_ERROR, "PeersHash_Init failed");
+        goto fail10a;
+    }
+    
     // init frame decider
-    FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss);
+    FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, (options.mac_aging_time > 0 ? options.mac_aging_time : -1), &ss);
+    
+    #ifndef BADVPN_USE_WINAPI
+    // init statistics socket
+    if (options.stats_socket) {
+        if (!StatsListener_Init(&stats_listener, &ss, options.stats_socket, STATS_SOCKET_MAX_CLIENTS, NULL, stats_listener_handler_dump)) {
+            BLog(BLOG_ERROR, "StatsListener_Init failed");
+            goto fail10b;
+        }
+    }
+    #endif
     
     // init relays list
     LinkedList1_Init(&relays);
@@ -557,6 +676,10 @@ int main (int argc, char *argv[])
     // init need relay list
     LinkedList1_Init(&waiting_relay_peers);
     
+    // start relay rebalance timer
+    BTimer_Init(&relay_rebalance_timer, RELAY_REBALANCE_INTERVAL, relay_rebalance_timer_handler, NULL);
+    BReactor_SetTimer(&ss, &relay_rebalance_timer);
+    
     // start connecting to server
     if (!ServerConnection_Init(&server, &ss, &twd, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, ssl_flags(), client_cert, client_key, server_name, NULL,
                                server_handler_error, server_handler_ready, server_handler_newclient, server_handler_endclient, server_handler_message
@@ -600,13 +723,29 @@ int main (int argc, char *argv[])
     }
     ServerConnection_Free(&server);
 fail11:
+    BReactor_RemoveTimer(&ss, &relay_rebalance_timer);
+    #ifndef BADVPN_USE_WINAPI
+    if (options.stats_socket) {
+        StatsListener_Free(&stats_listener);
+    }
+fail10b:
+    #endif
     FrameDecider_Free(&frame_decider);
+    PeersHash_Free(&peers_hash);
+fail10a:
+    TokenBucket_Free(&total_send_rate_bucket);
     DPReceiveDevice_Free(&device_output_dprd);
 fail10:
     DataProtoSource_Free(&device_dpsource);
 fail9:
     BTap_Free(&device);
 fail8:
+    while (num_udp_connect_sockets-- > 0) {
+        DatagramSharedSocket_Free(&udp_connect_sockets[num_udp_connect_sockets]);
+    }
+    while (num_udp_bind_sockets-- > 0) {
+        DatagramSharedSocket_Free(&udp_bind_sockets[num_udp_bind_sockets]);
+    }
     if (options.transport_mode == TRANSPORT_MODE_TCP) {
         while (num_listeners-- > 0) {
             PasswordListener_Free(&listeners[num_listeners]);
@@ -686,6 +825,11 @@ void print_help (const char *name)
         "            --hash-mode <md5/sha1/none>\n"
         "            [--otp <blowfish/aes> <num> <num-warn>]\n"
         "            [--fragmentation-latency <milliseconds>]\n"
+        "            [--fragmentation-latency-fixed]\n"
+        "            [--udp-shared-socket]\n"
+        "            [--udp-pmtu-discovery]\n"
+        "            [--udp-offload]\n"
+        "            [--udp-mtu <bytes>]\n"
         "        )\n"
         "        (transport-mode=tcp?\n"
         "            (ssl? [--peer-ssl])\n"
@@ -693,12 +837,19 @@ void print_help (const char *name)
         "        )\n"
         "        [--send-buffer-size <num-packets>]\n"
         "        [--send-buffer-relay-size <num-packets>]\n"
+        "        [--send-buffer-codel-target <ms / 0>]\n"
+        "        [--send-rate-limit <bytes-per-second / 0>]\n"
+        "        [--total-send-rate-limit <bytes-per-second / 0>]\n"
         "        [--max-macs <num>]\n"
         "        [--max-groups <num>]\n"
         "        [--igmp-group-membership-interval <ms>]\n"
         "        [--igmp-last-member-query-time <ms>]\n"
+        "        [--mac-aging-time <ms / 0>]\n"
         "        [--allow-peer-talk-without-ssl]\n"
         "        [--max-peers <number>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--stats-socket <path>]\n"
+        #endif
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -742,18 +893,31 @@ int parse_arguments (int argc, char *argv[])
     options.hash_mode = -1;
     options.otp_mode = SPPROTO_OTP_MODE_NONE;
     options.fragmentation_latency = PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY;
+    options.fragmentation_latency_fixed = 0;
+    options.udp_shared_socket = 0;
+    options.udp_pmtu_discovery = 0;
+    options.udp_offload = 0;
+    options.udp_mtu = CLIENT_UDP_MTU;
     options.peer_ssl = 0;
     options.peer_tcp_socket_sndbuf = -1;
     options.send_buffer_size = PEER_DEFAULT_SEND_BUFFER_SIZE;
     options.send_buffer_relay_size = PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE;
+    options.send_buffer_codel_target = 0;
+    options.send_rate_limit = 0;
+    options.total_send_rate_limit = 0;
     options.max_macs = PEER_DEFAULT_MAX_MACS;
     options.max_groups = PEER_DEFAULT_MAX_GROUPS;
     options.igmp_group_membership_interval = DEFAULT_IGMP_GROUP_MEMBERSHIP_INTERVAL;
     options.igmp_last_member_query_time = DEFAULT_IGMP_LAST_MEMBER_QUERY_TIME;
+    options.mac_aging_time = PEER_DEFAULT_MAC_AGING_TIME;
     options.allow_peer_talk_without_ssl = 0;
     options.max_peers = DEFAULT_MAX_PEERS;
+    #ifndef BADVPN_USE_WINAPI
+    options.stats_socket = NULL;
+    #endif
     
     int have_fragmentation_latency = 0;
+    int have_udp_mtu = 0;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -1051,6 +1215,30 @@ int parse_arguments (int argc, char *argv[])
             have_fragmentation_latency = 1;
             i++;
         }
+        else if (!strcmp(arg, "--fragmentation-latency-fixed")) {
+            options.fragmentation_latency_fixed = 1;
+        }
+        else if (!strcmp(arg, "--udp-shared-socket")) {
+            options.udp_shared_socket = 1;
+        }
+        else if (!strcmp(arg, "--udp-pmtu-discovery")) {
+            options.udp_pmtu_discovery = 1;
+        }
+        else if (!strcmp(arg, "--udp-offload")) {
+            options.udp_offload = 1;
+        }
+        else if (!strcmp(arg, "--udp-mtu")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_mtu = atoi(argv[i + 1])) < CLIENT_MIN_UDP_MTU || options.udp_mtu > CLIENT_MAX_UDP_MTU) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_udp_mtu = 1;
+            i++;
+        }
         else if (!strcmp(arg, "--peer-ssl")) {
             options.peer_ssl = 1;
         }
@@ -1087,6 +1275,39 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--send-buffer-codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_buffer_codel_target = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--send-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--total-send-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.total_send_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--max-macs")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1131,6 +1352,17 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--mac-aging-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.mac_aging_time = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--max-peers")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1145,6 +1377,16 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--allow-peer-talk-without-ssl")) {
             options.allow_peer_talk_without_ssl = 1;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--stats-socket")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_socket = argv[i + 1];
+            i++;
+        }
+        #endif
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
@@ -1195,6 +1437,31 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!options.fragmentation_latency_fixed || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --fragmentation-latency-fixed => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_shared_socket || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-shared-socket => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_pmtu_discovery || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-pmtu-discovery => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.udp_offload || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-offload => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_udp_mtu || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --udp-mtu => UDP\n");
+        return 0;
+    }
+    
     if (!(!options.peer_ssl || (options.ssl && options.transport_mode == TRANSPORT_MODE_TCP))) {
         fprintf(stderr, "False: --peer-ssl => (--ssl && TCP)\n");
         return 0;
@@ -1304,7 +1571,8 @@ int process_arguments (void)
 
 int ssl_flags (void)
 {
-    int flags = 0;
+    // collect small packets into larger TLS records
+    int flags = BSSLCONNECTION_FLAG_COALESCE_WRITES;
     if (options.use_threads_for_ssl_handshake) {
         flags |= BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE;
     }
@@ -1438,11 +1706,21 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     peer->have_resetpeer = 0;
     
     // init local flow
-    if (!DataProtoFlow_Init(&peer->local_dpflow, &device_dpsource, my_id, peer->id, options.send_buffer_size, -1, NULL, NULL)) {
+    TokenBucket *shaper_parent = (options.total_send_rate_limit > 0 ? &total_send_rate_bucket : NULL);
+    if (!DataProtoFlow_Init(&peer->local_dpflow, &device_dpsource, my_id, peer->id, options.send_buffer_size, -1, shaper_parent, options.send_rate_limit, NULL, NULL)) {
         peer_log(peer, BLOG_ERROR, "DataProtoFlow_Init failed");
         goto fail4;
     }
     
+    // drop frames which wait too long in the send buffer
+    if (options.send_buffer_codel_target > 0) {
+        struct PacketCodel_params codel;
+        codel.clock = btime_gettime;
+        codel.target = options.send_buffer_codel_target;
+        codel.interval = PEER_SEND_BUFFER_CODEL_INTERVAL;
+        DataProtoFlow_EnableCodel(&peer->local_dpflow, &codel);
+    }
+    
     // init frame decider peer
     if (!FrameDeciderPeer_Init(&peer->decider_peer, &frame_decider, peer, (BLog_logfunc)peer_logfunc)) {
         peer_log(peer, BLOG_ERROR, "FrameDeciderPeer_Init failed");
@@ -1474,6 +1752,16 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     LinkedList1_Append(&peers, &peer->list_node);
     num_peers++;
     
+    // add to peers hash table
+    PeersHashRef ref = {peer, peer};
+    int res = PeersHash_Insert(&peers_hash, 0, ref, NULL);
+    ASSERT_EXECUTE(res)
+    
+    // grow the hash table if needed; failure only makes lookups slower
+    if (num_peers > peers_hash.num_buckets) {
+        PeersHash_MultiplyBuckets(&peers_hash, 0, 1);
+    }
+    
     switch (chat_ssl_mode) {
         case PEERCHAT_SSL_NONE:
             peer_log(peer, BLOG_INFO, "initialized; talking to peer in plaintext mode");
@@ -1518,6 +1806,10 @@ void peer_remove (struct peer_data *peer, int exiting)
     ASSERT(!peer->waiting_relay)
     ASSERT(!peer->is_relay)
     
+    // remove from peers hash table
+    PeersHashRef ref = {peer, peer};
+    PeersHash_Remove(&peers_hash, 0, ref);
+    
     // remove from peers list
     LinkedList1_Remove(&peers, &peer->list_node);
     num_peers--;
@@ -1620,8 +1912,10 @@ int peer_init_link (struct peer_data *peer)
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
         // init DatagramPeerIO
         if (!DatagramPeerIO_Init(
-            &peer->pio.udp.pio, &ss, data_mtu, CLIENT_UDP_MTU, sp_params,
-            options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES, recv_if,
+            &peer->pio.udp.pio, &ss, data_mtu,
+            (options.udp_shared_socket ? options.udp_mtu - DATAGRAMSHAREDSOCKET_TAG_SIZE : options.udp_mtu), sp_params,
+            options.fragmentation_latency, !options.fragmentation_latency_fixed, options.udp_pmtu_discovery, options.udp_offload,
+            PEER_UDP_ASSEMBLER_NUM_FRAMES, recv_if,
             options.otp_num_warn, &twd, peer,
             (BLog_logfunc)peer_logfunc,
             (DatagramPeerIO_handler_error)peer_udp_pio_handler_error,
@@ -1760,6 +2054,11 @@ void peer_enable_relay_provider (struct peer_data *peer)
     
     // init users list
     LinkedList1_Init(&peer->relay_users);
+    peer->relay_num_users = 0;
+    
+    // start measuring the traffic rate
+    peer->relay_last_tx_bytes = DataProtoSink_GetStats(&peer->send_dp)->tx_bytes;
+    peer->relay_rate = 0;
     
     // set is relay
     peer->is_relay = 1;
@@ -1813,6 +2112,7 @@ void peer_install_relaying (struct peer_data *peer, struct peer_data *relay)
     
     // add to relay's users list
     LinkedList1_Append(&relay->relay_users, &peer->relaying_list_node);
+    relay->relay_num_users++;
     
     // attach local flow to relay
     DataProtoFlow_Attach(&peer->local_dpflow, &relay->send_dp);
@@ -1838,7 +2138,9 @@ void peer_free_relaying (struct peer_data *peer)
     DataProtoFlow_Detach(&peer->local_dpflow);
     
     // remove from relay's users list
+    ASSERT(relay->relay_num_users > 0)
     LinkedList1_Remove(&relay->relay_users, &peer->relaying_list_node);
+    relay->relay_num_users--;
     
     // set not relaying
     peer->relaying_peer = NULL;
@@ -2067,6 +2369,12 @@ void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
                 return;
             }
         }
+        if (options.udp_shared_socket) {
+            if (!msg_youconnectParser_Getpassword(&parser, &password)) {
+                peer_log(peer, BLOG_WARNING, "msg_youconnect: no tag");
+                return;
+            }
+        }
     } else {
         if (!msg_youconnectParser_Getpassword(&parser, &password)) {
             peer_log(peer, BLOG_WARNING, "msg_youconnect: no password");
@@ -2355,22 +2663,34 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
     }
     
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        // get addr
-        struct bind_addr *addr = &bind_addrs[addr_index];
-        
-        // try binding to all ports in the range
         int port_add;
-        for (port_add = 0; port_add < addr->num_ports; port_add++) {
-            BAddr tryaddr = addr->addr;
-            BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
-            if (DatagramPeerIO_Bind(&peer->pio.udp.pio, tryaddr)) {
-                break;
+        uint64_t tag = 0;
+        
+        if (options.udp_shared_socket) {
+            // register with the shared socket
+            if (!DatagramPeerIO_BindShared(&peer->pio.udp.pio, &udp_bind_sockets[addr_index], &tag)) {
+                BLog(BLOG_NOTICE, "failed to bind to shared socket");
+                *cont = 1;
+                return;
+            }
+            port_add = udp_bind_ports_add[addr_index];
+        } else {
+            // get addr
+            struct bind_addr *addr = &bind_addrs[addr_index];
+            
+            // try binding to all ports in the range
+            for (port_add = 0; port_add < addr->num_ports; port_add++) {
+                BAddr tryaddr = addr->addr;
+                BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
+                if (DatagramPeerIO_Bind(&peer->pio.udp.pio, tryaddr)) {
+                    break;
+                }
+            }
+            if (port_add == addr->num_ports) {
+                BLog(BLOG_NOTICE, "failed to bind to any port");
+                *cont = 1;
+                return;
             }
-        }
-        if (port_add == addr->num_ports) {
-            BLog(BLOG_NOTICE, "failed to bind to any port");
-            *cont = 1;
-            return;
         }
         
         uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
@@ -2387,7 +2707,7 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
         }
         
         // send connectinfo
-        peer_send_conectinfo(peer, addr_index, port_add, key, 0);
+        peer_send_conectinfo(peer, addr_index, port_add, key, tag);
     } else {
         // order StreamPeerIO to listen
         uint64_t pass;
@@ -2413,11 +2733,21 @@ void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key,
     }
     
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        // order DatagramPeerIO to connect
-        if (!DatagramPeerIO_Connect(&peer->pio.udp.pio, addr)) {
-            peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_Connect failed");
-            peer_reset(peer);
-            return;
+        if (options.udp_shared_socket) {
+            // order DatagramPeerIO to connect through the shared socket
+            DatagramSharedSocket *sock = udp_connect_socket(addr.type);
+            if (!sock || !DatagramPeerIO_ConnectShared(&peer->pio.udp.pio, sock, addr, password)) {
+                peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_ConnectShared failed");
+                peer_reset(peer);
+                return;
+            }
+        } else {
+            // order DatagramPeerIO to connect
+            if (!DatagramPeerIO_Connect(&peer->pio.udp.pio, addr)) {
+                peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_Connect failed");
+                peer_reset(peer);
+                return;
+            }
         }
         
         // set encryption key
@@ -2537,8 +2867,8 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
         msg_len += msg_youconnect_SIZEkey(key_size);
     }
     
-    // password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    // password, or the tag if using a shared UDP socket
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.udp_shared_socket) {
         msg_len += msg_youconnect_SIZEpassword;
     }
     
@@ -2594,7 +2924,7 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     }
     
     // write password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.udp_shared_socket) {
         msg_youconnectWriter_Addpassword(&writer, pass);
     }
     
@@ -2646,14 +2976,24 @@ void peer_dataproto_handler (struct peer_data *peer, int up)
 
 struct peer_data * find_peer_by_id (peerid_t id)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&peers); node; node = LinkedList1Node_Next(node)) {
-        struct peer_data *peer = UPPER_OBJECT(node, struct peer_data, list_node);
-        if (peer->id == id) {
-            return peer;
-        }
-    }
+    PeersHashRef ref = PeersHash_Lookup(&peers_hash, 0, id);
     
-    return NULL;
+    return ref.ptr;
+}
+
+DatagramSharedSocket * udp_connect_socket (int family)
+{
+    ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
+    ASSERT(options.udp_shared_socket)
+    
+    switch (family) {
+        case BADDR_TYPE_IPV4:
+            return &udp_connect_sockets[0];
+        case BADDR_TYPE_IPV6:
+            return &udp_connect_sockets[1];
+        default:
+            return NULL;
+    }
 }
 
 void device_error_handler (void *unused)
@@ -2681,6 +3021,107 @@ void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
     }
 }
 
+#ifndef BADVPN_USE_WINAPI
+
+int stats_listener_handler_dump (void *unused, ExpString *out)
+{
+    char buf[128];
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&peers); node; node = LinkedList1Node_Next(node)) {
+        struct peer_data *peer = UPPER_OBJECT(node, struct peer_data, list_node);
+        
+        snprintf(buf, sizeof(buf), "id=%d", (int)peer->id);
+        if (!ExpString_Append(out, buf)) {
+            return 0;
+        }
+        
+        // link type; a relayed peer shares the link of its relay
+        DataProtoSink *sink = NULL;
+        if (peer->have_link) {
+            snprintf(buf, sizeof(buf), " link=%s", (options.transport_mode == TRANSPORT_MODE_UDP ? "udp" : "tcp"));
+            sink = &peer->send_dp;
+        }
+        else if (peer->relaying_peer) {
+            snprintf(buf, sizeof(buf), " link=relay relay=%d", (int)peer->relaying_peer->id);
+        }
+        else {
+            snprintf(buf, sizeof(buf), " link=none");
+        }
+        if (!ExpString_Append(out, buf)) {
+            return 0;
+        }
+        
+        // frames dropped on the way to the peer
+        snprintf(buf, sizeof(buf), " dropped=%"PRIu64, DataProtoFlow_GetNumDropped(&peer->local_dpflow));
+        if (!ExpString_Append(out, buf)) {
+            return 0;
+        }
+        if (options.send_buffer_codel_target > 0) {
+            snprintf(buf, sizeof(buf), " codel_dropped=%"PRIu64, DataProtoFlow_GetNumCodelDropped(&peer->local_dpflow));
+            if (!ExpString_Append(out, buf)) {
+                return 0;
+            }
+        }
+        
+        if (sink) {
+            const struct DataProtoSink_stats *stats = DataProtoSink_GetStats(sink);
+            snprintf(buf, sizeof(buf), " tx_packets=%"PRIu64" tx_bytes=%"PRIu64" rx_packets=%"PRIu64" rx_bytes=%"PRIu64,
+                    stats->tx_packets, stats->tx_bytes, stats->rx_packets, stats->rx_bytes);
+            if (!ExpString_Append(out, buf)) {
+                return 0;
+            }
+            if (stats->have_rtt) {
+                snprintf(buf, sizeof(buf), " rtt_last=%"PRId64" rtt_smoothed=%"PRId64" rtt_min=%"PRId64, (int64_t)stats->rtt_last, (int64_t)stats->rtt_smoothed, (int64_t)stats->rtt_min);
+                if (!ExpString_Append(out, buf)) {
+                    return 0;
+                }
+            }
+        }
+        
+        if (peer->is_relay) {
+            snprintf(buf, sizeof(buf), " relay_users=%d relay_rate=%"PRIu64, peer->relay_num_users, peer->relay_rate);
+            if (!ExpString_Append(out, buf)) {
+                return 0;
+            }
+        }
+        
+        if (peer->have_link && options.transport_mode == TRANSPORT_MODE_UDP) {
+            const struct SPProtoDecoder_counters *dc = DatagramPeerIO_GetDecoderCounters(&peer->pio.udp.pio);
+            snprintf(buf, sizeof(buf), " decoded=%"PRIu64" malformed=%"PRIu64" bad_hash=%"PRIu64" bad_otp=%"PRIu64,
+                    dc->decoded, dc->malformed, dc->bad_hash, dc->bad_otp);
+            if (!ExpString_Append(out, buf)) {
+                return 0;
+            }
+            const struct FragmentProtoAssembler_counters *ac = DatagramPeerIO_GetAssemblerCounters(&peer->pio.udp.pio);
+            snprintf(buf, sizeof(buf), " frames=%"PRIu64" frames_lost=%"PRIu64" chunks_invalid=%"PRIu64,
+                    ac->frames, ac->frames_lost, ac->chunks_invalid);
+            if (!ExpString_Append(out, buf)) {
+                return 0;
+            }
+            int pmtu = DatagramPeerIO_GetPathMTU(&peer->pio.udp.pio);
+            if (pmtu >= 0) {
+                snprintf(buf, sizeof(buf), " pmtu=%d", pmtu);
+                if (!ExpString_Append(out, buf)) {
+                    return 0;
+                }
+            }
+        }
+        
+        if (!ExpString_AppendChar(out, '\n')) {
+            return 0;
+        }
+    }
+    
+    // append flow graph, if tracing is compiled in
+    if (!FlowTraceGlobal_Dump(out)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+#endif
+
 void assign_relays (void)
 {
     LinkedList1Node *list_node;
@@ -2691,13 +3132,12 @@ void assign_relays (void)
         ASSERT(!peer->relaying_peer)
         ASSERT(!peer->have_link)
         
-        // get a relay
-        LinkedList1Node *list_node2 = LinkedList1_GetFirst(&relays);
-        if (!list_node2) {
+        // get the best relay
+        struct peer_data *relay = find_best_relay(NULL);
+        if (!relay) {
             BLog(BLOG_NOTICE, "no relays");
             return;
         }
-        struct peer_data *relay = UPPER_OBJECT(list_node2, struct peer_data, relay_list_node);
         ASSERT(relay->is_relay)
         
         // no longer waiting for relay
@@ -2708,6 +3148,82 @@ void assign_relays (void)
     }
 }
 
+btime_t relay_cost (struct peer_data *relay, int num_users)
+{
+    ASSERT(relay->is_relay)
+    ASSERT(num_users >= 0)
+    
+    const struct DataProtoSink_stats *stats = DataProtoSink_GetStats(&relay->send_dp);
+    btime_t rtt = (stats->have_rtt ? stats->rtt_smoothed : RELAY_UNKNOWN_RTT);
+    
+    return rtt + (btime_t)num_users * RELAY_USER_COST + (btime_t)(relay->relay_rate / RELAY_RATE_COST);
+}
+
+struct peer_data * find_best_relay (struct peer_data *exclude)
+{
+    struct peer_data *best = NULL;
+    btime_t best_cost = 0;
+    
+    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&relays); list_node; list_node = LinkedList1Node_Next(list_node)) {
+        struct peer_data *relay = UPPER_OBJECT(list_node, struct peer_data, relay_list_node);
+        ASSERT(relay->is_relay)
+        
+        if (relay == exclude) {
+            continue;
+        }
+        
+        btime_t cost = relay_cost(relay, relay->relay_num_users + 1);
+        if (!best || cost < best_cost) {
+            best = relay;
+            best_cost = cost;
+        }
+    }
+    
+    return best;
+}
+
+void relay_rebalance_timer_handler (void *unused)
+{
+    // restart timer
+    BReactor_SetTimer(&ss, &relay_rebalance_timer);
+    
+    // update traffic rates of relays
+    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&relays); list_node; list_node = LinkedList1Node_Next(list_node)) {
+        struct peer_data *relay = UPPER_OBJECT(list_node, struct peer_data, relay_list_node);
+        ASSERT(relay->is_relay)
+        
+        uint64_t tx_bytes = DataProtoSink_GetStats(&relay->send_dp)->tx_bytes;
+        relay->relay_rate = (tx_bytes - relay->relay_last_tx_bytes) * 1000 / RELAY_REBALANCE_INTERVAL;
+        relay->relay_last_tx_bytes = tx_bytes;
+    }
+    
+    // move relayed peers whose relay is considerably worse than another one;
+    // costs are recomputed after each move, so load spreads out gradually
+    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&peers); list_node; list_node = LinkedList1Node_Next(list_node)) {
+        struct peer_data *peer = UPPER_OBJECT(list_node, struct peer_data, list_node);
+        
+        if (!peer->relaying_peer) {
+            continue;
+        }
+        
+        struct peer_data *relay = peer->relaying_peer;
+        struct peer_data *best = find_best_relay(relay);
+        if (!best) {
+            continue;
+        }
+        
+        if (relay_cost(best, best->relay_num_users + 1) + RELAY_SWITCH_THRESHOLD >= relay_cost(relay, relay->relay_num_users)) {
+            continue;
+        }
+        
+        peer_log(peer, BLOG_INFO, "moving to a better relay");
+        
+        // move to the better relay
+        peer_free_relaying(peer);
+        peer_install_relaying(peer, best);
+    }
+}
+
 char * address_scope_known (uint8_t *name, int name_len)
 {
     ASSERT(name_len >= 0)
@@ -51,16 +51,27 @@
 // server output buffer size
 #define SERVER_BUFFER_MIN_PACKETS 200
 
-// maximum UDP payload size
+// default maximum UDP payload size
 #define CLIENT_UDP_MTU 1472
 
+// allowed range for --udp-mtu
+#define CLIENT_MIN_UDP_MTU 576
+#define CLIENT_MAX_UDP_MTU 65507
+
 // maximum number of pending TCP PasswordListener clients
 #define TCP_MAX_PASSWORD_LISTENER_CLIENTS 50
 
+// maximum number of clients of the statistics socket served at the same time
+#define STATS_SOCKET_MAX_CLIENTS 4
+
 // maximum number of peers
 #define DEFAULT_MAX_PEERS 256
+// maximum initial number of buckets in the peers hash table
+#define PEERS_HASH_MAX_INITIAL_BUCKETS 1024
 // maximum number of peer's MAC addresses to remember
 #define PEER_DEFAULT_MAX_MACS 16
+// how long a peer's MAC address is remembered after the last frame from it, in milliseconds, 0 to never forget
+#define PEER_DEFAULT_MAC_AGING_TIME 300000
 // maximum number of multicast addresses per peer
 #define PEER_DEFAULT_MAX_GROUPS 16
 // how long we wait for a packet to reach full size before sending it (see FragmentProtoDisassembler latency argument)
@@ -77,10 +88,22 @@
 #define PEER_DEFAULT_SEND_BUFFER_SIZE 32
 // size of frame send buffer for relayed packets, in number of frames
 #define PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE 32
+// CoDel interval for frame send buffers, if CoDel is enabled
+#define PEER_SEND_BUFFER_CODEL_INTERVAL 100
 // time after an unused relay flow is freed (-1 for never)
 #define PEER_RELAY_FLOW_INACTIVITY_TIME 10000
 // retry time
 #define PEER_RETRY_TIME 5000
+// how often relayed peers are moved to better relays
+#define RELAY_REBALANCE_INTERVAL 30000
+// round-trip time assumed for a relay whose round-trip time was not measured yet
+#define RELAY_UNKNOWN_RTT 200
+// cost of a relay, in milliseconds of round-trip time, for each peer relayed through it
+#define RELAY_USER_COST 5
+// traffic rate to a relay, in bytes per second, which costs as much as a millisecond of round-trip time
+#define RELAY_RATE_COST 262144
+// how much lower the cost of another relay must be for a relayed peer to be moved to it
+#define RELAY_SWITCH_THRESHOLD 20
 
 // for how long a peer can send no Membership Reports for a group
 // before the peer and group are disassociated
@@ -183,6 +206,9 @@ struct peer_data {
     int is_relay;
     LinkedList1Node relay_list_node;
     LinkedList1 relay_users;
+    int relay_num_users;
+    uint64_t relay_last_tx_bytes;
+    uint64_t relay_rate; // bytes per second sent to the relay in the last rebalance interval
     
     // binding state
     int binding;
@@ -190,4 +216,7 @@ struct peer_data {
     
     // peers linked list node
     LinkedList1Node list_node;
+    
+    // peers hash table link
+    struct peer_data *hash_next;
 };
@@ -0,0 +1,152 @@
+/**
+ * @file bsslconnection_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Checks that {@link BSSLConnection} with BSSLCONNECTION_FLAG_COALESCE_WRITES
+ * collects packets sent back to back through a {@link PacketStreamSender} into
+ * a single PR_Write. The connection is set up directly on the backend file
+ * descriptor, without an SSL layer, so that every PR_Write shows up as one send
+ * on the backend's output interface.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <prio.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <base/BPending.h>
+#include <flow/PacketStreamSender.h>
+#include <nspr_support/BSSLConnection.h>
+
+#define FORCE(cmd) if (!(cmd)) { fprintf(stderr, "failed\n"); exit(1); }
+
+#define PACKET_LEN 100
+#define NUM_PACKETS 20
+
+static BPendingGroup pg;
+static StreamPassInterface sink_if;
+static StreamRecvInterface source_if;
+static PacketPassInterface *packet_if;
+static uint8_t packet[PACKET_LEN];
+static int packets_sent;
+static int num_writes;
+static int bytes_written;
+
+static void sink_if_handler_send (void *user, uint8_t *data, int data_len)
+{
+    // the socket takes everything at once
+    num_writes++;
+    bytes_written += data_len;
+    StreamPassInterface_Done(&sink_if, data_len);
+}
+
+static void source_if_handler_recv (void *user, uint8_t *data, int data_len)
+{
+    // nothing is ever received
+}
+
+static void con_handler (void *user, int event)
+{
+    FORCE(0)
+}
+
+static void packet_if_handler_done (void *user)
+{
+    // send the next packet right away, as a busy sender would
+    if (++packets_sent < NUM_PACKETS) {
+        PacketPassInterface_Sender_Send(packet_if, packet, PACKET_LEN);
+    }
+}
+
+static void run (int flags)
+{
+    packets_sent = 0;
+    num_writes = 0;
+    bytes_written = 0;
+    
+    StreamPassInterface_Init(&sink_if, sink_if_handler_send, NULL, &pg);
+    StreamRecvInterface_Init(&source_if, source_if_handler_recv, NULL, &pg);
+    
+    PRFileDesc prfd;
+    FORCE( BSSLConnection_MakeBackend(&prfd, &sink_if, &source_if, NULL, flags) )
+    
+    BSSLConnection con;
+    BSSLConnection_Init(&con, &prfd, 0, &pg, NULL, con_handler);
+    
+    PacketStreamSender sender;
+    PacketStreamSender_Init(&sender, BSSLConnection_GetSendIf(&con), PACKET_LEN, &pg);
+    packet_if = PacketStreamSender_GetInput(&sender);
+    PacketPassInterface_Sender_Init(packet_if, packet_if_handler_done, NULL);
+    
+    PacketPassInterface_Sender_Send(packet_if, packet, PACKET_LEN);
+    
+    while (BPendingGroup_HasJobs(&pg)) {
+        BPendingGroup_ExecuteJob(&pg);
+    }
+    
+    FORCE( packets_sent == NUM_PACKETS )
+    FORCE( bytes_written == NUM_PACKETS * PACKET_LEN )
+    
+    PacketStreamSender_Free(&sender);
+    BSSLConnection_ReleaseBuffers(&con);
+    BSSLConnection_Free(&con);
+    FORCE( PR_Close(&prfd) == PR_SUCCESS )
+    StreamRecvInterface_Free(&source_if);
+    StreamPassInterface_Free(&sink_if);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    
+    BPendingGroup_Init(&pg);
+    
+    FORCE( BSSLConnection_GlobalInit() )
+    
+    memset(packet, 'x', sizeof(packet));
+    
+    // without coalescing, every packet is a separate write
+    run(0);
+    printf("plain: %d writes\n", num_writes);
+    FORCE( num_writes == NUM_PACKETS )
+    
+    // with coalescing, the burst fits into a single write
+    run(BSSLCONNECTION_FLAG_COALESCE_WRITES);
+    printf("coalesced: %d writes\n", num_writes);
+    FORCE( num_writes == 1 )
+    
+    BPendingGroup_Free(&pg);
+    
+    BLog_Free();
+    
+    return 0;
+}
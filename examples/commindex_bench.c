@@ -0,0 +1,322 @@
+/**
+ * @file commindex_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Join storm benchmark for {@link CommIndex}. For every given number of
+ * clients and every predicate scenario, clients join one after another, and
+ * for each join the set of already joined clients it may communicate with is
+ * computed, once by evaluating the predicate for every pair (as the server
+ * used to) and once by querying the index. Both methods must agree.
+ * 
+ * Scenarios:
+ *   - all: no predicate.
+ *   - star: only the first client (the hub) talks to everyone.
+ *   - acl: a disjunction of random p1name/p2name rules between client pairs.
+ *   - deny: everyone except one address, which cannot be narrowed down by
+ *     the index and falls back to checking every client.
+ * 
+ * Results are printed to standard output as CSV, one line per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/parse_number.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BAddr.h>
+#include <server/CommIndex.h>
+
+#include <generated/blog_channels_defines.h>
+
+#define MAX_CLIENT_COUNTS 32
+#define NAME_LEN 16
+
+static struct {
+    int client_counts[MAX_CLIENT_COUNTS];
+    int num_client_counts;
+    int rules;
+    int naive;
+} options;
+
+struct bench_client {
+    char name[NAME_LEN];
+    BIPAddr addr;
+    CommIndexEntry entry;
+};
+
+struct bench_result {
+    uint64_t allowed_pairs;
+    uint64_t checksum;
+};
+
+static void usage (const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s\n"
+        "    [--clients <count1,count2,...>] (default 256,1024)\n"
+        "    [--rules <num>] (default 64)\n"
+        "    [--no-naive]\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static void parse_arguments (int argc, char *argv[])
+{
+    options.client_counts[0] = 256;
+    options.client_counts[1] = 1024;
+    options.num_client_counts = 2;
+    options.rules = 64;
+    options.naive = 1;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        
+        if (!strcmp(arg, "--clients")) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            char *str = argv[++i];
+            options.num_client_counts = 0;
+            while (1) {
+                char *comma = strchr(str, ',');
+                size_t len = (comma ? (size_t)(comma - str) : strlen(str));
+                uintmax_t value;
+                if (options.num_client_counts == MAX_CLIENT_COUNTS || !parse_unsigned_integer_bin(str, len, &value) || value < 2 || value > 0xFFFFFF) {
+                    usage(argv[0]);
+                }
+                options.client_counts[options.num_client_counts++] = value;
+                if (!comma) {
+                    break;
+                }
+                str = comma + 1;
+            }
+        }
+        else if (!strcmp(arg, "--rules")) {
+            uintmax_t value;
+            if (i + 1 >= argc || !parse_unsigned_integer(argv[++i], &value) || value == 0 || value > 100000) {
+                usage(argv[0]);
+            }
+            options.rules = value;
+        }
+        else if (!strcmp(arg, "--no-naive")) {
+            options.naive = 0;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+}
+
+// builds the predicate for a scenario; returns NULL for no predicate
+static char * make_predicate (const char *bench, int num_clients, int *out_failed)
+{
+    *out_failed = 0;
+    
+    if (!strcmp(bench, "all")) {
+        return NULL;
+    }
+    
+    size_t max_len = 64 + (size_t)options.rules * 128;
+    char *str = (char *)BAlloc(max_len);
+    if (!str) {
+        *out_failed = 1;
+        return NULL;
+    }
+    
+    if (!strcmp(bench, "star")) {
+        snprintf(str, max_len, "p1name(\"c0\") OR p2name(\"c0\")");
+    }
+    else if (!strcmp(bench, "deny")) {
+        snprintf(str, max_len, "NOT p2addr(\"10.0.0.1\")");
+    }
+    else {
+        ASSERT(!strcmp(bench, "acl"))
+        
+        size_t pos = 0;
+        srand(1);
+        for (int i = 0; i < options.rules; i++) {
+            int a = rand() % num_clients;
+            int b = rand() % num_clients;
+            pos += snprintf(str + pos, max_len - pos, "%s(p1name(\"c%d\") AND p2name(\"c%d\")) OR (p1name(\"c%d\") AND p2name(\"c%d\"))",
+                            (i > 0 ? " OR " : ""), a, b, b, a);
+        }
+    }
+    
+    return str;
+}
+
+static void account_pair (struct bench_result *r, int joining, int other)
+{
+    r->allowed_pairs++;
+    r->checksum += ((uint64_t)joining << 32) ^ (uint64_t)other ^ ((uint64_t)other * 0x9E3779B97F4A7C15ULL);
+}
+
+static void print_result (const char *bench, int num_clients, const char *method, struct bench_result *r, btime_t elapsed)
+{
+    double seconds = (elapsed > 0 ? elapsed : 1) / 1000.0;
+    
+    printf("%s,%d,%d,%s,%d,%" PRIu64 ",%.3f,%.0f\n",
+           bench, num_clients, options.rules, method, num_clients, r->allowed_pairs,
+           seconds, num_clients / seconds);
+    fflush(stdout);
+}
+
+static int run_bench (const char *bench, int num_clients)
+{
+    int failed;
+    char *predicate = make_predicate(bench, num_clients, &failed);
+    if (failed) {
+        fprintf(stderr, "failed to build predicate\n");
+        goto fail0;
+    }
+    
+    CommIndex index;
+    if (!CommIndex_Init(&index, predicate)) {
+        fprintf(stderr, "CommIndex_Init failed\n");
+        goto fail1;
+    }
+    
+    struct bench_client *clients = (struct bench_client *)BAllocArray(num_clients, sizeof(clients[0]));
+    if (!clients) {
+        fprintf(stderr, "BAllocArray failed\n");
+        goto fail2;
+    }
+    
+    for (int i = 0; i < num_clients; i++) {
+        snprintf(clients[i].name, sizeof(clients[i].name), "c%d", i);
+        BIPAddr_InitIPv4(&clients[i].addr, hton32(0x0A000001 + i));
+    }
+    
+    // evaluate the predicate for every pair
+    struct bench_result naive = {0, 0};
+    if (options.naive) {
+        btime_t start = btime_gettime();
+        for (int i = 0; i < num_clients; i++) {
+            for (int j = 0; j < i; j++) {
+                if (CommIndex_Allowed(&index, clients[i].name, clients[i].addr, clients[j].name, clients[j].addr)) {
+                    account_pair(&naive, i, j);
+                }
+            }
+        }
+        print_result(bench, num_clients, "naive", &naive, btime_gettime() - start);
+    }
+    
+    // query the index
+    struct bench_result indexed = {0, 0};
+    int num_joined = 0;
+    btime_t start = btime_gettime();
+    for (int i = 0; i < num_clients; i++) {
+        if (!CommIndexEntry_Init(&clients[i].entry, &index, clients[i].name, clients[i].addr)) {
+            fprintf(stderr, "CommIndexEntry_Init failed\n");
+            goto fail3;
+        }
+        num_joined++;
+        
+        CommIndexEntry **allowed;
+        size_t num_allowed = CommIndex_Query(&index, clients[i].name, clients[i].addr, &allowed);
+        for (size_t k = 0; k < num_allowed; k++) {
+            struct bench_client *other = UPPER_OBJECT(allowed[k], struct bench_client, entry);
+            if (other != &clients[i]) {
+                account_pair(&indexed, i, other - clients);
+            }
+        }
+    }
+    print_result(bench, num_clients, "indexed", &indexed, btime_gettime() - start);
+    
+    if (options.naive && (naive.allowed_pairs != indexed.allowed_pairs || naive.checksum != indexed.checksum)) {
+        fprintf(stderr, "%s: indexed result differs from naive result\n", bench);
+        goto fail3;
+    }
+    
+    while (num_joined > 0) {
+        CommIndexEntry_Free(&clients[--num_joined].entry);
+    }
+    BFree(clients);
+    CommIndex_Free(&index);
+    if (predicate) {
+        BFree(predicate);
+    }
+    return 1;
+    
+fail3:
+    while (num_joined > 0) {
+        CommIndexEntry_Free(&clients[--num_joined].entry);
+    }
+    BFree(clients);
+fail2:
+    CommIndex_Free(&index);
+fail1:
+    if (predicate) {
+        BFree(predicate);
+    }
+fail0:
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    parse_arguments(argc, argv);
+    
+    BLog_InitStderr();
+    BTime_Init();
+    
+    printf("bench,clients,rules,method,joins,allowed_pairs,seconds,joins_per_sec\n");
+    
+    static const char *benches[] = {"all", "star", "acl", "deny"};
+    
+    int ret = 0;
+    
+    for (int i = 0; i < options.num_client_counts && !ret; i++) {
+        for (size_t j = 0; j < sizeof(benches) / sizeof(benches[0]); j++) {
+            if (!run_bench(benches[j], options.client_counts[i])) {
+                ret = 1;
+                break;
+            }
+        }
+    }
+    
+    BLog_Free();
+    
+    return ret;
+}
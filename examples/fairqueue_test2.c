@@ -25,69 +25,178 @@
  * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Checks that {@link PacketPassFairQueue} divides the output among busy flows
+ * in proportion to their weights, in both scheduling modes. The flows send
+ * packets of different sizes, and the share of each flow is measured in
+ * bytes, counting packet_weight extra for every packet. In DRR mode, a flow
+ * is then freed while it has a packet queued, and the remaining flows must
+ * keep their relative shares.
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include <misc/debug.h>
-#include <system/BReactor.h>
 #include <base/BLog.h>
-#include <system/BTime.h>
+#include <base/BPending.h>
 #include <flow/PacketPassFairQueue.h>
 #include <examples/FastPacketSource.h>
-#include <examples/RandomPacketSink.h>
 
-#define SINK_TIMER 0
+#define FORCE(cmd) if (!(cmd)) { fprintf(stderr, "failed\n"); exit(1); }
 
-int main ()
+#define NUM_FLOWS 3
+#define OUTPUT_MTU 100
+#define PACKET_WEIGHT 1
+#define RUN_BYTES 1000000
+#define MAX_ERROR_PERMILLE 10
+
+static BPendingGroup pg;
+static PacketPassInterface sink;
+static PacketPassFairQueue fq;
+static PacketPassFairQueueFlow flows[NUM_FLOWS];
+static FastPacketSource sources[NUM_FLOWS];
+static int flow_alive[NUM_FLOWS];
+static char *data[NUM_FLOWS] = {"data1", "data2data2", "data3data3data3data3data3data3data3data3data3"};
+static int weights[NUM_FLOWS] = {1, 2, 8};
+static long long flow_bytes[NUM_FLOWS];
+static long long total_bytes;
+static int sink_busy;
+
+static void sink_handler_send (void *user, uint8_t *packet, int packet_len)
 {
-    // initialize logging
-    BLog_InitStdout();
+    int i;
+    for (i = 0; i < NUM_FLOWS; i++) {
+        if (packet == (uint8_t *)data[i]) {
+            break;
+        }
+    }
+    FORCE( i < NUM_FLOWS )
+    FORCE( flow_alive[i] )
     
-    // init time
-    BTime_Init();
+    flow_bytes[i] += packet_len + PACKET_WEIGHT;
+    total_bytes += packet_len + PACKET_WEIGHT;
     
-    // initialize reactor
-    BReactor reactor;
-    if (!BReactor_Init(&reactor)) {
-        DEBUG("BReactor_Init failed");
-        return 1;
+    // completed later by run_until()
+    sink_busy = 1;
+}
+
+static void run_until (long long limit)
+{
+    while (1) {
+        // let everything react, like the event loop does before the next
+        // I/O completion; completing the packet right away from the send
+        // handler would starve the sources whose jobs were scheduled earlier
+        while (BPendingGroup_HasJobs(&pg)) {
+            BPendingGroup_ExecuteJob(&pg);
+        }
+        
+        // all sources always have packets, so the output is never idle
+        FORCE( sink_busy )
+        
+        if (total_bytes >= limit) {
+            return;
+        }
+        
+        sink_busy = 0;
+        PacketPassInterface_Done(&sink);
+    }
+}
+
+static void reset_counters (void)
+{
+    for (int i = 0; i < NUM_FLOWS; i++) {
+        flow_bytes[i] = 0;
+    }
+    total_bytes = 0;
+}
+
+static void check_shares (const char *name)
+{
+    int weight_sum = 0;
+    for (int i = 0; i < NUM_FLOWS; i++) {
+        if (flow_alive[i]) {
+            weight_sum += weights[i];
+        }
     }
     
-    // initialize sink
-    RandomPacketSink sink;
-    RandomPacketSink_Init(&sink, &reactor, 500, SINK_TIMER);
+    for (int i = 0; i < NUM_FLOWS; i++) {
+        if (!flow_alive[i]) {
+            continue;
+        }
+        
+        long long expected = total_bytes * weights[i] / weight_sum;
+        long long error = llabs(flow_bytes[i] - expected);
+        
+        printf("%s: flow %d weight %d: %lld of %lld bytes, expected %lld\n", name, i, weights[i], flow_bytes[i], total_bytes, expected);
+        FORCE( error * 1000 <= expected * MAX_ERROR_PERMILLE )
+    }
+}
+
+static void free_flow (int i)
+{
+    FastPacketSource_Free(&sources[i]);
+    PacketPassFairQueueFlow_Free(&flows[i]);
+    flow_alive[i] = 0;
+}
+
+static void run (int mode, const char *name)
+{
+    PacketPassInterface_Init(&sink, OUTPUT_MTU, sink_handler_send, NULL, &pg);
+    FORCE( PacketPassFairQueue_InitMode(&fq, &sink, &pg, 0, PACKET_WEIGHT, mode) )
+    
+    for (int i = 0; i < NUM_FLOWS; i++) {
+        PacketPassFairQueueFlow_Init(&flows[i], &fq);
+        PacketPassFairQueueFlow_SetWeight(&flows[i], weights[i]);
+        FastPacketSource_Init(&sources[i], PacketPassFairQueueFlow_GetInput(&flows[i]), (uint8_t *)data[i], strlen(data[i]), &pg);
+        flow_alive[i] = 1;
+    }
+    
+    sink_busy = 0;
+    reset_counters();
     
-    // initialize queue
-    PacketPassFairQueue fq;
-    if (!PacketPassFairQueue_Init(&fq, RandomPacketSink_GetInput(&sink), BReactor_PendingGroup(&reactor), 0, 1)) {
-        DEBUG("PacketPassFairQueue_Init failed");
-        return 1;
+    run_until(RUN_BYTES);
+    check_shares(name);
+    
+    if (mode == FAIRQUEUE_MODE_DRR) {
+        // free the heaviest flow that is not being sent; every source
+        // always has a packet queued
+        int i = NUM_FLOWS - 1;
+        if (PacketPassFairQueueFlow_IsBusy(&flows[i])) {
+            i--;
+        }
+        free_flow(i);
+        
+        reset_counters();
+        run_until(RUN_BYTES);
+        check_shares(name);
+    }
+    
+    PacketPassFairQueue_PrepareFree(&fq);
+    for (int i = 0; i < NUM_FLOWS; i++) {
+        if (flow_alive[i]) {
+            free_flow(i);
+        }
     }
+    PacketPassFairQueue_Free(&fq);
+    PacketPassInterface_Free(&sink);
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    
+    BPendingGroup_Init(&pg);
     
-    // initialize source 1
-    PacketPassFairQueueFlow flow1;
-    PacketPassFairQueueFlow_Init(&flow1, &fq);
-    FastPacketSource source1;
-    char data1[] = "data1";
-    FastPacketSource_Init(&source1, PacketPassFairQueueFlow_GetInput(&flow1), (uint8_t *)data1, strlen(data1), BReactor_PendingGroup(&reactor));
+    run(FAIRQUEUE_MODE_VTIME, "vtime");
+    run(FAIRQUEUE_MODE_DRR, "drr");
     
-    // initialize source 2
-    PacketPassFairQueueFlow flow2;
-    PacketPassFairQueueFlow_Init(&flow2, &fq);
-    FastPacketSource source2;
-    char data2[] = "data2data2";
-    FastPacketSource_Init(&source2, PacketPassFairQueueFlow_GetInput(&flow2), (uint8_t *)data2, strlen(data2), BReactor_PendingGroup(&reactor));
+    BPendingGroup_Free(&pg);
     
-    // initialize source 3
-    PacketPassFairQueueFlow flow3;
-    PacketPassFairQueueFlow_Init(&flow3, &fq);
-    FastPacketSource source3;
-    char data3[] = "data3data3data3data3data3data3data3data3data3";
-    FastPacketSource_Init(&source3, PacketPassFairQueueFlow_GetInput(&flow3), (uint8_t *)data3, strlen(data3), BReactor_PendingGroup(&reactor));
+    BLog_Free();
     
-    // run reactor
-    int ret = BReactor_Exec(&reactor);
-    BReactor_Free(&reactor);
-    return ret;
+    return 0;
 }
@@ -0,0 +1,395 @@
+/**
+ * @file framedecider_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Microbenchmark for {@link FrameDecider}. For every given number of peers,
+ * each peer is taught a number of MAC addresses and joins a number of IGMP
+ * groups, then unicast, broadcast and multicast frames are decided and their
+ * destinations iterated.
+ * 
+ * Results are printed to standard output as CSV, one line per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/parse_number.h>
+#include <misc/byteorder.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/igmp_proto.h>
+#include <base/BLog.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <client/FrameDecider.h>
+
+#include <generated/blog_channels_defines.h>
+
+#define MAX_PEER_COUNTS 32
+
+#define GROUP_BASE 0xEF010000
+
+B_START_PACKED
+struct igmp_frame {
+    struct ethernet_header eth;
+    struct ipv4_header ip;
+    struct igmp_base igmp;
+    struct igmp_v2_extra report;
+} B_PACKED;
+B_END_PACKED
+
+static struct {
+    int peer_counts[MAX_PEER_COUNTS];
+    int num_peer_counts;
+    int macs;
+    int groups;
+    uint64_t decisions;
+} options;
+
+static void usage (const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s\n"
+        "    [--peers <count1,count2,...>] (default 16,256,4096)\n"
+        "    [--macs <num>] (default 4)\n"
+        "    [--groups <num>] (default 8)\n"
+        "    [--decisions <number>] (default 1000000)\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static int parse_int (const char *str, int min_value, int *out)
+{
+    uintmax_t value;
+    if (!parse_unsigned_integer(str, &value) || value > INT_MAX || (int)value < min_value) {
+        return 0;
+    }
+    *out = value;
+    return 1;
+}
+
+static void parse_arguments (int argc, char *argv[])
+{
+    options.peer_counts[0] = 16;
+    options.peer_counts[1] = 256;
+    options.peer_counts[2] = 4096;
+    options.num_peer_counts = 3;
+    options.macs = 4;
+    options.groups = 8;
+    options.decisions = 1000000;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        
+        if (!strcmp(arg, "--peers")) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            char *str = argv[++i];
+            options.num_peer_counts = 0;
+            while (1) {
+                char *comma = strchr(str, ',');
+                size_t len = (comma ? (size_t)(comma - str) : strlen(str));
+                uintmax_t value;
+                if (options.num_peer_counts == MAX_PEER_COUNTS || !parse_unsigned_integer_bin(str, len, &value) || value == 0 || value > INT_MAX) {
+                    usage(argv[0]);
+                }
+                options.peer_counts[options.num_peer_counts++] = value;
+                if (!comma) {
+                    break;
+                }
+                str = comma + 1;
+            }
+        }
+        else if (!strcmp(arg, "--macs")) {
+            if (i + 1 >= argc || !parse_int(argv[++i], 1, &options.macs)) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--groups")) {
+            if (i + 1 >= argc || !parse_int(argv[++i], 1, &options.groups)) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--decisions")) {
+            uintmax_t value;
+            if (i + 1 >= argc || !parse_unsigned_integer(argv[++i], &value) || value == 0) {
+                usage(argv[0]);
+            }
+            options.decisions = value;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+}
+
+static void make_mac (uint8_t *mac, int peer, int index)
+{
+    mac[0] = 0x02;
+    mac[1] = index;
+    mac[2] = peer >> 24;
+    mac[3] = peer >> 16;
+    mac[4] = peer >> 8;
+    mac[5] = peer;
+}
+
+static uint32_t group_address (int group)
+{
+    return hton32(GROUP_BASE + group);
+}
+
+static void make_multicast_mac (uint8_t *mac, int group)
+{
+    uint32_t addr = GROUP_BASE + group;
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = (addr >> 16) & 0x7F;
+    mac[4] = addr >> 8;
+    mac[5] = addr;
+}
+
+static void make_eth_frame (struct ethernet_header *eh, const uint8_t *dest, const uint8_t *source)
+{
+    memcpy(eh->dest, dest, sizeof(eh->dest));
+    memcpy(eh->source, source, sizeof(eh->source));
+    // local experimental ethertype, so that the frame is not parsed any further
+    eh->type = hton16(0x88B5);
+}
+
+static void make_igmp_join (struct igmp_frame *f, const uint8_t *source, int group)
+{
+    memset(f, 0, sizeof(*f));
+    
+    make_multicast_mac(f->eth.dest, group);
+    memcpy(f->eth.source, source, sizeof(f->eth.source));
+    f->eth.type = hton16(ETHERTYPE_IPV4);
+    
+    f->ip.version4_ihl4 = IPV4_MAKE_VERSION_IHL(sizeof(f->ip));
+    f->ip.total_length = hton16(sizeof(f->ip) + sizeof(f->igmp) + sizeof(f->report));
+    f->ip.ttl = hton8(1);
+    f->ip.protocol = hton8(IPV4_PROTOCOL_IGMP);
+    f->ip.destination_address = group_address(group);
+    f->ip.checksum = ipv4_checksum(&f->ip, NULL, 0);
+    
+    f->igmp.type = hton8(IGMP_TYPE_V2_MEMBERSHIP_REPORT);
+    f->report.group = group_address(group);
+}
+
+static void peer_logfunc (void *user)
+{
+    BLog_Append("bench peer %d: ", *(int *)user);
+}
+
+static void print_result (const char *bench, int num_peers, uint64_t decisions, uint64_t destinations, btime_t elapsed)
+{
+    double seconds = (elapsed > 0 ? elapsed : 1) / 1000.0;
+    
+    printf("%s,%d,%d,%d,%" PRIu64 ",%" PRIu64 ",%.3f,%.0f,%.0f\n",
+           bench, num_peers, options.macs, options.groups, decisions, destinations,
+           seconds, decisions / seconds, destinations / seconds);
+    fflush(stdout);
+}
+
+static uint64_t drain (FrameDecider *d)
+{
+    uint64_t count = 0;
+    while (FrameDecider_NextDestination(d)) {
+        count++;
+    }
+    return count;
+}
+
+static int run_bench (int num_peers)
+{
+    BReactor reactor;
+    if (!BReactor_Init(&reactor)) {
+        fprintf(stderr, "BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    FrameDecider decider;
+    FrameDecider_Init(&decider, options.macs, options.groups, 260000, 2000, -1, &reactor);
+    
+    FrameDeciderPeer *peers = (FrameDeciderPeer *)BAllocArray(num_peers, sizeof(peers[0]));
+    int *peer_ids = (int *)BAllocArray(num_peers, sizeof(peer_ids[0]));
+    if (!peers || !peer_ids) {
+        fprintf(stderr, "BAllocArray failed\n");
+        goto fail1;
+    }
+    
+    int num_inited;
+    for (num_inited = 0; num_inited < num_peers; num_inited++) {
+        peer_ids[num_inited] = num_inited;
+        if (!FrameDeciderPeer_Init(&peers[num_inited], &decider, &peer_ids[num_inited], peer_logfunc)) {
+            fprintf(stderr, "FrameDeciderPeer_Init failed\n");
+            goto fail2;
+        }
+    }
+    
+    // learn MACs; every peer sends from all of its MACs
+    btime_t start_time = btime_gettime();
+    for (int i = 0; i < num_peers; i++) {
+        for (int j = 0; j < options.macs; j++) {
+            struct ethernet_header eh;
+            uint8_t source[6];
+            uint8_t dest[6];
+            make_mac(source, i, j);
+            make_mac(dest, (i + 1) % num_peers, 0);
+            make_eth_frame(&eh, dest, source);
+            FrameDeciderPeer_Analyze(&peers[i], (uint8_t *)&eh, sizeof(eh));
+        }
+    }
+    print_result("learn", num_peers, (uint64_t)num_peers * options.macs, 0, btime_gettime() - start_time);
+    
+    // join groups; peer i joins group g if (i + g) is even, so that each
+    // group has about half of the peers as members
+    start_time = btime_gettime();
+    uint64_t joins = 0;
+    for (int i = 0; i < num_peers; i++) {
+        uint8_t source[6];
+        make_mac(source, i, 0);
+        for (int g = 0; g < options.groups; g++) {
+            if ((i + g) % 2 == 0) {
+                struct igmp_frame f;
+                make_igmp_join(&f, source, g);
+                FrameDeciderPeer_Analyze(&peers[i], (uint8_t *)&f, sizeof(f));
+                joins++;
+            }
+        }
+    }
+    print_result("join", num_peers, joins, 0, btime_gettime() - start_time);
+    
+    uint8_t source[6];
+    make_mac(source, 0, 0);
+    
+    // unicast to learned MACs
+    start_time = btime_gettime();
+    uint64_t destinations = 0;
+    for (uint64_t k = 0; k < options.decisions; k++) {
+        struct ethernet_header eh;
+        uint8_t dest[6];
+        make_mac(dest, k % num_peers, (k / num_peers) % options.macs);
+        make_eth_frame(&eh, dest, source);
+        FrameDecider_AnalyzeAndDecide(&decider, (uint8_t *)&eh, sizeof(eh));
+        destinations += drain(&decider);
+    }
+    print_result("unicast", num_peers, options.decisions, destinations, btime_gettime() - start_time);
+    
+    // multicast to joined groups
+    start_time = btime_gettime();
+    destinations = 0;
+    for (uint64_t k = 0; k < options.decisions; k++) {
+        struct ethernet_header eh;
+        uint8_t dest[6];
+        make_multicast_mac(dest, k % options.groups);
+        make_eth_frame(&eh, dest, source);
+        FrameDecider_AnalyzeAndDecide(&decider, (uint8_t *)&eh, sizeof(eh));
+        destinations += drain(&decider);
+    }
+    print_result("multicast", num_peers, options.decisions, destinations, btime_gettime() - start_time);
+    
+    // broadcast; this iterates all peers, so do fewer decisions
+    uint64_t broadcast_decisions = options.decisions / num_peers;
+    if (broadcast_decisions == 0) {
+        broadcast_decisions = 1;
+    }
+    const uint8_t broadcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    start_time = btime_gettime();
+    destinations = 0;
+    for (uint64_t k = 0; k < broadcast_decisions; k++) {
+        struct ethernet_header eh;
+        make_eth_frame(&eh, broadcast_mac, source);
+        FrameDecider_AnalyzeAndDecide(&decider, (uint8_t *)&eh, sizeof(eh));
+        destinations += drain(&decider);
+    }
+    print_result("broadcast", num_peers, broadcast_decisions, destinations, btime_gettime() - start_time);
+    
+    while (num_inited-- > 0) {
+        FrameDeciderPeer_Free(&peers[num_inited]);
+    }
+    BFree(peer_ids);
+    BFree(peers);
+    FrameDecider_Free(&decider);
+    BReactor_Free(&reactor);
+    return 1;
+
+fail2:
+    while (num_inited-- > 0) {
+        FrameDeciderPeer_Free(&peers[num_inited]);
+    }
+fail1:
+    if (peer_ids) {
+        BFree(peer_ids);
+    }
+    if (peers) {
+        BFree(peers);
+    }
+    FrameDecider_Free(&decider);
+    BReactor_Free(&reactor);
+fail0:
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    parse_arguments(argc, argv);
+    
+    BLog_InitStderr();
+    BLog_SetChannelLoglevel(BLOG_CHANNEL_FrameDecider, BLOG_NOTICE);
+    BTime_Init();
+    
+    printf("bench,peers,macs,groups,decisions,destinations,seconds,decisions_per_sec,destinations_per_sec\n");
+    
+    int ret = 0;
+    
+    for (int i = 0; i < options.num_peer_counts; i++) {
+        if (!run_bench(options.peer_counts[i])) {
+            ret = 1;
+            break;
+        }
+    }
+    
+    BLog_Free();
+    
+    return ret;
+}
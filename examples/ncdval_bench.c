@@ -0,0 +1,294 @@
+/**
+ * @file ncdval_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Benchmark for {@link NCDVal} maps. For every given number of entries and
+ * every kind of key, a map is built using {@link NCDVal_NewMap} (embedded AVL
+ * tree) and using {@link NCDVal_NewHashMap}, and the following are timed:
+ *   - build: inserting all entries,
+ *   - lookup: finding every key, with the key in a different memory object,
+ *   - copy: copying the map to another memory object,
+ *   - iterate: the first ordered iteration over the copy,
+ *   - compare: comparing the map with its copy, which iterates in order.
+ * 
+ * Key kinds:
+ *   - stored: keys are stored strings.
+ *   - id: keys are ID strings from a {@link NCDStringIndex}.
+ * 
+ * Results are printed to standard output as CSV, one line per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <misc/debug.h>
+#include <misc/parse_number.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <ncd/NCDVal.h>
+#include <ncd/NCDStringIndex.h>
+
+#include <generated/blog_channels_defines.h>
+
+#define MAX_ENTRY_COUNTS 32
+#define KEY_LEN 32
+
+static struct {
+    int entry_counts[MAX_ENTRY_COUNTS];
+    int num_entry_counts;
+    int rounds;
+} options;
+
+static NCDStringIndex string_index;
+
+static void usage (const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s\n"
+        "    [--entries <count1,count2,...>] (default 1000,10000,50000)\n"
+        "    [--rounds <num>] (default 5)\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static void parse_arguments (int argc, char *argv[])
+{
+    options.entry_counts[0] = 1000;
+    options.entry_counts[1] = 10000;
+    options.entry_counts[2] = 50000;
+    options.num_entry_counts = 3;
+    options.rounds = 5;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        
+        if (!strcmp(arg, "--entries")) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            char *str = argv[++i];
+            options.num_entry_counts = 0;
+            while (1) {
+                char *comma = strchr(str, ',');
+                size_t len = (comma ? (size_t)(comma - str) : strlen(str));
+                uintmax_t value;
+                if (options.num_entry_counts == MAX_ENTRY_COUNTS || !parse_unsigned_integer_bin(str, len, &value) || value == 0 || value > 1000000) {
+                    usage(argv[0]);
+                }
+                options.entry_counts[options.num_entry_counts++] = value;
+                if (!comma) {
+                    break;
+                }
+                str = comma + 1;
+            }
+        }
+        else if (!strcmp(arg, "--rounds")) {
+            uintmax_t value;
+            if (i + 1 >= argc || !parse_unsigned_integer(argv[++i], &value) || value == 0 || value > 1000) {
+                usage(argv[0]);
+            }
+            options.rounds = value;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+}
+
+// keys share a long prefix so that comparisons have to look at many bytes
+static void make_key (char *buf, int i)
+{
+    snprintf(buf, KEY_LEN, "iptables-entry-%d", (int)(((uint64_t)i * 2654435761u) % 1000000007u));
+}
+
+static NCDValRef new_key (NCDValMem *mem, int id_keys, int i)
+{
+    char buf[KEY_LEN];
+    make_key(buf, i);
+    
+    if (!id_keys) {
+        return NCDVal_NewString(mem, buf);
+    }
+    
+    NCD_string_id_t id = NCDStringIndex_Get(&string_index, buf);
+    if (id < 0) {
+        return NCDVal_NewInvalid();
+    }
+    
+    return NCDVal_NewIdString(mem, id, &string_index);
+}
+
+static int run_bench (int num_entries, int id_keys, int hashed)
+{
+    btime_t build_time = 0;
+    btime_t lookup_time = 0;
+    btime_t copy_time = 0;
+    btime_t iterate_time = 0;
+    btime_t compare_time = 0;
+    
+    for (int round = 0; round < options.rounds; round++) {
+        NCDValMem mem;
+        NCDValMem_Init(&mem);
+        NCDValMem keys_mem;
+        NCDValMem_Init(&keys_mem);
+        NCDValMem copy_mem;
+        NCDValMem_Init(&copy_mem);
+        
+        // the lookup keys are prepared in advance so only the lookups are timed
+        NCDValRef keys = NCDVal_NewList(&keys_mem, num_entries);
+        if (NCDVal_IsInvalid(keys)) {
+            goto fail;
+        }
+        for (int i = 0; i < num_entries; i++) {
+            NCDValRef key = new_key(&keys_mem, id_keys, i);
+            if (NCDVal_IsInvalid(key) || !NCDVal_ListAppend(keys, key)) {
+                goto fail;
+            }
+        }
+        
+        btime_t t0 = btime_gettime();
+        
+        NCDValRef map = (hashed ? NCDVal_NewHashMap(&mem, num_entries) : NCDVal_NewMap(&mem, num_entries));
+        if (NCDVal_IsInvalid(map)) {
+            goto fail;
+        }
+        for (int i = 0; i < num_entries; i++) {
+            NCDValRef key = new_key(&mem, id_keys, i);
+            NCDValRef val = NCDVal_NewString(&mem, "ACCEPT");
+            int inserted;
+            if (NCDVal_IsInvalid(key) || NCDVal_IsInvalid(val) || !NCDVal_MapInsert(map, key, val, &inserted) || !inserted) {
+                goto fail;
+            }
+        }
+        
+        btime_t t1 = btime_gettime();
+        
+        for (int i = 0; i < num_entries; i++) {
+            if (NCDVal_MapElemInvalid(NCDVal_MapFindKey(map, NCDVal_ListGet(keys, i)))) {
+                goto fail;
+            }
+        }
+        
+        btime_t t2 = btime_gettime();
+        
+        NCDValRef copy = NCDVal_NewCopy(&copy_mem, map);
+        if (NCDVal_IsInvalid(copy)) {
+            goto fail;
+        }
+        
+        btime_t t3 = btime_gettime();
+        
+        // timed separately from compare, which may benefit from the first pass
+        size_t iterated = 0;
+        for (NCDValMapElem e = NCDVal_MapOrderedFirst(copy); !NCDVal_MapElemInvalid(e); e = NCDVal_MapOrderedNext(copy, e)) {
+            iterated++;
+        }
+        if (iterated != (size_t)num_entries) {
+            goto fail;
+        }
+        
+        btime_t t4 = btime_gettime();
+        
+        if (NCDVal_Compare(map, copy) != 0) {
+            goto fail;
+        }
+        
+        btime_t t5 = btime_gettime();
+        
+        build_time += t1 - t0;
+        lookup_time += t2 - t1;
+        copy_time += t3 - t2;
+        iterate_time += t4 - t3;
+        compare_time += t5 - t4;
+        
+        NCDValMem_Free(&copy_mem);
+        NCDValMem_Free(&keys_mem);
+        NCDValMem_Free(&mem);
+        continue;
+        
+    fail:
+        NCDValMem_Free(&copy_mem);
+        NCDValMem_Free(&keys_mem);
+        NCDValMem_Free(&mem);
+        fprintf(stderr, "benchmark failed (entries=%d)\n", num_entries);
+        return 0;
+    }
+    
+    printf("%s,%d,%s,%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%" PRIi64 "\n",
+           (id_keys ? "id" : "stored"), num_entries, (hashed ? "hash" : "tree"),
+           build_time, lookup_time, copy_time, iterate_time, compare_time);
+    fflush(stdout);
+    
+    return 1;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    parse_arguments(argc, argv);
+    
+    BLog_InitStderr();
+    BTime_Init();
+    
+    int ret = 1;
+    
+    if (!NCDStringIndex_Init(&string_index)) {
+        fprintf(stderr, "NCDStringIndex_Init failed\n");
+        goto fail0;
+    }
+    
+    printf("keys,entries,map,build_ms,lookup_ms,copy_ms,iterate_ms,compare_ms\n");
+    
+    for (int i = 0; i < options.num_entry_counts; i++) {
+        for (int id_keys = 0; id_keys <= 1; id_keys++) {
+            for (int hashed = 0; hashed <= 1; hashed++) {
+                if (!run_bench(options.entry_counts[i], id_keys, hashed)) {
+                    goto fail1;
+                }
+            }
+        }
+    }
+    
+    ret = 0;
+    
+fail1:
+    NCDStringIndex_Free(&string_index);
+fail0:
+    BLog_Free();
+    
+    return ret;
+}
@@ -39,6 +39,8 @@
 
 #define FORCE(cmd) if (!(cmd)) { fprintf(stderr, "failed\n"); exit(1); }
 
+#define NUM_MAP_KEYS 40
+
 struct composed_string {
     BRefTarget ref_target;
     size_t length;
@@ -157,6 +159,56 @@ static void test_string (NCDValRef str, const char *data, size_t length)
     }
 }
 
+static int external_released;
+
+static void external_ref_target_func_release (BRefTarget *ref_target)
+{
+    external_released++;
+}
+
+static NCDValRef build_cow_value (NCDValMem *mem)
+{
+    int res;
+    
+    NCDValRef top = NCDVal_NewList(mem, 3);
+    FORCE( !NCDVal_IsInvalid(top) )
+    
+    NCDValRef list = NCDVal_NewList(mem, 2);
+    FORCE( !NCDVal_IsInvalid(list) )
+    FORCE( NCDVal_ListAppend(list, NCDVal_NewString(mem, "first")) )
+    
+    NCDValRef map = NCDVal_NewMap(mem, 2);
+    FORCE( !NCDVal_IsInvalid(map) )
+    FORCE( NCDVal_MapInsert(map, NCDVal_NewString(mem, "K1"), NCDVal_NewString(mem, "V1"), &res) && res )
+    
+    FORCE( NCDVal_ListAppend(top, list) )
+    FORCE( NCDVal_ListAppend(top, map) )
+    FORCE( NCDVal_ListAppend(top, NCDVal_NewPlaceholder(mem, 0)) )
+    
+    return top;
+}
+
+static int cow_replace_func (void *arg, int plid, NCDValMem *mem, NCDValRef *out)
+{
+    *out = NCDVal_NewString(mem, arg);
+    return 1;
+}
+
+static NCDValRef build_map_key (NCDValMem *mem, int i, int kind, NCDStringIndex *string_index)
+{
+    char key[32];
+    sprintf(key, "key%d", i);
+    
+    switch (kind % 3) {
+        case 0:
+            return NCDVal_NewString(mem, key);
+        case 1:
+            return NCDVal_NewIdString(mem, NCDStringIndex_Get(string_index, key), string_index);
+        default:
+            return build_composed_string(mem, key, strlen(key), 2);
+    }
+}
+
 static void print_indent (int indent)
 {
     for (int i = 0; i < indent; i++) {
@@ -374,6 +426,168 @@ int main ()
     
     NCDValMem_Free(&mem);
     
+    // Copies made with NCDValMem_InitCopy() share the buffer of the original
+    // until one side is modified. Modify the original in the first round and
+    // the copy in the second; the other side must see none of it.
+    
+    for (int modify_copy = 0; modify_copy < 2; modify_copy++) {
+        NCDValMem_Init(&mem);
+        
+        NCDValRef top = build_cow_value(&mem);
+        NCDValSafeRef top_safe = NCDVal_ToSafe(top);
+        
+        NCDValReplaceProg prog;
+        FORCE( NCDValReplaceProg_Init(&prog, top) )
+        
+        NCDValMem mem_copy;
+        FORCE( NCDValMem_InitCopy(&mem_copy, &mem) )
+        
+        NCDValMem *mod_mem = (modify_copy ? &mem_copy : &mem);
+        NCDValMem *other_mem = (modify_copy ? &mem : &mem_copy);
+        NCDValRef mod_top = NCDVal_FromSafe(mod_mem, top_safe);
+        NCDValRef other_top = NCDVal_FromSafe(other_mem, top_safe);
+        
+        FORCE( NCDVal_ListAppend(NCDVal_ListGet(mod_top, 0), NCDVal_NewString(mod_mem, "second")) )
+        FORCE( NCDVal_MapInsert(NCDVal_ListGet(mod_top, 1), NCDVal_NewString(mod_mem, "K2"), NCDVal_NewString(mod_mem, "V2"), &res) && res )
+        FORCE( NCDValReplaceProg_Execute(prog, mod_mem, cow_replace_func, "replaced") )
+        
+        FORCE( NCDVal_ListCount(NCDVal_ListGet(mod_top, 0)) == 2 )
+        FORCE( NCDVal_StringEquals(NCDVal_ListGet(NCDVal_ListGet(mod_top, 0), 1), "second") )
+        FORCE( NCDVal_MapCount(NCDVal_ListGet(mod_top, 1)) == 2 )
+        FORCE( NCDVal_StringEquals(NCDVal_MapGetValue(NCDVal_ListGet(mod_top, 1), "K2"), "V2") )
+        FORCE( NCDVal_StringEquals(NCDVal_ListGet(mod_top, 2), "replaced") )
+        
+        FORCE( NCDVal_ListCount(NCDVal_ListGet(other_top, 0)) == 1 )
+        FORCE( NCDVal_StringEquals(NCDVal_ListGet(NCDVal_ListGet(other_top, 0), 0), "first") )
+        FORCE( NCDVal_MapCount(NCDVal_ListGet(other_top, 1)) == 1 )
+        FORCE( NCDVal_IsInvalid(NCDVal_MapGetValue(NCDVal_ListGet(other_top, 1), "K2")) )
+        FORCE( NCDVal_IsPlaceholder(NCDVal_ListGet(other_top, 2)) )
+        
+        NCDValReplaceProg_Free(&prog);
+        NCDValMem_Free(&mem_copy);
+        NCDValMem_Free(&mem);
+    }
+    
+    // External strings must stay referenced as long as any copy sharing
+    // or having copied the buffer is alive.
+    
+    BRefTarget ext_target;
+    BRefTarget_Init(&ext_target, external_ref_target_func_release);
+    
+    NCDValMem_Init(&mem);
+    
+    NCDValRef ext_list = NCDVal_NewList(&mem, 2);
+    FORCE( !NCDVal_IsInvalid(ext_list) )
+    FORCE( NCDVal_ListAppend(ext_list, NCDVal_NewExternalString(&mem, "external", 8, &ext_target)) )
+    NCDValSafeRef ext_list_safe = NCDVal_ToSafe(ext_list);
+    
+    NCDValMem shared_copy;
+    FORCE( NCDValMem_InitCopy(&shared_copy, &mem) )
+    NCDValMem modified_copy;
+    FORCE( NCDValMem_InitCopy(&modified_copy, &mem) )
+    FORCE( NCDVal_ListAppend(NCDVal_FromSafe(&modified_copy, ext_list_safe), NCDVal_NewString(&modified_copy, "more")) )
+    
+    NCDValMem_Free(&mem);
+    FORCE( external_released == 0 )
+    FORCE( NCDVal_StringEquals(NCDVal_ListGet(NCDVal_FromSafe(&shared_copy, ext_list_safe), 0), "external") )
+    
+    NCDValMem_Free(&shared_copy);
+    FORCE( external_released == 0 )
+    FORCE( NCDVal_StringEquals(NCDVal_ListGet(NCDVal_FromSafe(&modified_copy, ext_list_safe), 0), "external") )
+    
+    NCDValMem_Free(&modified_copy);
+    FORCE( external_released == 0 )
+    
+    BRefTarget_Deref(&ext_target);
+    FORCE( external_released == 1 )
+    
+    // Strings that compare equal must hash equally regardless of how they
+    // are stored, else hashed maps would miss keys.
+    
+    NCDValMem_Init(&mem);
+    
+    NCDValRef hs1 = NCDVal_NewString(&mem, "_arg1");
+    NCDValRef hs2 = NCDVal_NewIdString(&mem, NCD_STRING_ARG1, &string_index);
+    NCDValRef hs3 = build_composed_string(&mem, "_arg1", 5, 2);
+    FORCE( !NCDVal_IsInvalid(hs1) && !NCDVal_IsInvalid(hs2) && !NCDVal_IsInvalid(hs3) )
+    
+    FORCE( NCDVal_Compare(hs1, hs2) == 0 )
+    FORCE( NCDVal_Compare(hs1, hs3) == 0 )
+    FORCE( NCDVal_Hash(hs1) == NCDVal_Hash(hs2) )
+    FORCE( NCDVal_Hash(hs1) == NCDVal_Hash(hs3) )
+    
+    // Build a hashed map and a plain map with the same keys, inserted in
+    // a scrambled order and using different string kinds in each map.
+    
+    // one spare entry so that inserting duplicates stays within maxcount
+    NCDValRef tmap = NCDVal_NewMap(&mem, NUM_MAP_KEYS + 1);
+    NCDValRef hmap = NCDVal_NewHashMap(&mem, NUM_MAP_KEYS + 1);
+    FORCE( !NCDVal_IsInvalid(tmap) && !NCDVal_IsInvalid(hmap) )
+    FORCE( !NCDVal_MapIsHashed(tmap) )
+    FORCE( NCDVal_MapIsHashed(hmap) )
+    
+    for (int i = 0; i < NUM_MAP_KEYS; i++) {
+        int k = (i * 7) % NUM_MAP_KEYS;
+        NCDValRef val = NCDVal_NewString(&mem, "value");
+        FORCE( NCDVal_MapInsert(tmap, build_map_key(&mem, k, i, &string_index), val, &res) && res )
+        FORCE( NCDVal_MapInsert(hmap, build_map_key(&mem, k, i + 1, &string_index), val, &res) && res )
+        FORCE( !NCDVal_MapElemInvalid(NCDVal_MapFindKey(hmap, build_map_key(&mem, k, i + 2, &string_index))) )
+    }
+    
+    // Duplicate keys are rejected, also when stored differently.
+    for (int i = 0; i < 3; i++) {
+        FORCE( NCDVal_MapInsert(hmap, build_map_key(&mem, i, 0, &string_index), NCDVal_NewString(&mem, "dup"), &res) && !res )
+        FORCE( NCDVal_MapInsert(hmap, build_map_key(&mem, i, 1, &string_index), NCDVal_NewString(&mem, "dup"), &res) && !res )
+    }
+    FORCE( NCDVal_MapCount(hmap) == NUM_MAP_KEYS )
+    FORCE( NCDVal_StringEquals(NCDVal_MapGetValue(hmap, "key5"), "value") )
+    FORCE( NCDVal_IsInvalid(NCDVal_MapGetValue(hmap, "key40")) )
+    FORCE( NCDVal_MapElemInvalid(NCDVal_MapFindKey(hmap, NCDVal_NewString(&mem, "nokey"))) )
+    
+    // Iteration visits the keys in the same order as for the plain map.
+    NCDValMapElem te = NCDVal_MapOrderedFirst(tmap);
+    NCDValMapElem he = NCDVal_MapOrderedFirst(hmap);
+    while (!NCDVal_MapElemInvalid(te)) {
+        FORCE( !NCDVal_MapElemInvalid(he) )
+        FORCE( NCDVal_Compare(NCDVal_MapElemKey(tmap, te), NCDVal_MapElemKey(hmap, he)) == 0 )
+        te = NCDVal_MapOrderedNext(tmap, te);
+        he = NCDVal_MapOrderedNext(hmap, he);
+    }
+    FORCE( NCDVal_MapElemInvalid(he) )
+    
+    te = NCDVal_MapFirst(tmap);
+    he = NCDVal_MapFirst(hmap);
+    while (!NCDVal_MapElemInvalid(te)) {
+        FORCE( !NCDVal_MapElemInvalid(he) )
+        FORCE( NCDVal_Compare(NCDVal_MapElemKey(tmap, te), NCDVal_MapElemKey(hmap, he)) == 0 )
+        te = NCDVal_MapNext(tmap, te);
+        he = NCDVal_MapNext(hmap, he);
+    }
+    FORCE( NCDVal_MapElemInvalid(he) )
+    
+    FORCE( NCDVal_Compare(tmap, hmap) == 0 )
+    
+    // A copy in another memory object keeps the hash table working.
+    NCDValMem mem_copy;
+    NCDValMem_Init(&mem_copy);
+    
+    NCDValRef hcopy = NCDVal_NewCopy(&mem_copy, hmap);
+    FORCE( !NCDVal_IsInvalid(hcopy) )
+    FORCE( NCDVal_MapIsHashed(hcopy) )
+    FORCE( NCDVal_Compare(hcopy, tmap) == 0 )
+    
+    for (int i = 0; i < NUM_MAP_KEYS; i++) {
+        FORCE( !NCDVal_MapElemInvalid(NCDVal_MapFindKey(hcopy, build_map_key(&mem, i, i + 2, &string_index))) )
+    }
+    FORCE( NCDVal_MapElemInvalid(NCDVal_MapFindKey(hcopy, build_map_key(&mem, NUM_MAP_KEYS, 0, &string_index))) )
+    
+    NCDValMem_Free(&mem);
+    
+    FORCE( NCDVal_StringEquals(NCDVal_MapGetValue(hcopy, "key0"), "value") )
+    FORCE( NCDVal_MapCount(hcopy) == NUM_MAP_KEYS )
+    
+    NCDValMem_Free(&mem_copy);
+    
     NCDStringIndex_Free(&string_index);
     
     return 0;
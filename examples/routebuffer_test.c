@@ -0,0 +1,288 @@
+/**
+ * @file routebuffer_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Checks {@link RouteBuffer} by routing packets to several buffers whose
+ * outputs are randomly blocked and unblocked. Every output must receive the
+ * packets routed to its buffer in order, each with the prefix given for that
+ * buffer, whether the buffer sent the shared packet itself or a private copy.
+ * Routing continues while buffers are full, which must never leave the source
+ * without a free packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+#include <base/BPending.h>
+#include <flow/RouteBuffer.h>
+
+#define FORCE(cmd) if (!(cmd)) { fprintf(stderr, "failed\n"); exit(1); }
+
+#define MTU 64
+#define PREFIX_LEN 4
+#define NUM_BUFFERS 3
+#define BUF_SIZE 4
+#define NUM_PACKETS 20000
+
+struct output {
+    int index;
+    PacketPassInterface input;
+    RouteBuffer buf;
+    int blocked;
+    uint8_t *data;
+    int data_len;
+    int expected_seq[BUF_SIZE];
+    int expected_len[BUF_SIZE];
+    int expected_start;
+    int expected_used;
+    int num_lent;
+    int num_copied;
+};
+
+static BPendingGroup pg;
+static RouteBufferSource source;
+static struct output outputs[NUM_BUFFERS];
+
+static void make_prefix (uint8_t *prefix, int index, int seq)
+{
+    prefix[0] = index;
+    prefix[1] = seq;
+    prefix[2] = seq >> 8;
+    prefix[3] = seq >> 16;
+}
+
+static uint8_t payload_byte (int seq, int i)
+{
+    return (uint8_t)(seq * 31 + i * 7);
+}
+
+static void output_handler_send (struct output *o, uint8_t *data, int data_len)
+{
+    ASSERT(!o->data)
+    
+    // completed by complete_output(), so the data must stay valid until then
+    o->data = data;
+    o->data_len = data_len;
+}
+
+static void complete_output (struct output *o)
+{
+    ASSERT(o->data)
+    FORCE( o->expected_used > 0 )
+    
+    int seq = o->expected_seq[o->expected_start];
+    int len = o->expected_len[o->expected_start];
+    o->expected_start = (o->expected_start + 1) % BUF_SIZE;
+    o->expected_used--;
+    
+    // check prefix and payload
+    uint8_t prefix[PREFIX_LEN];
+    make_prefix(prefix, o->index, seq);
+    FORCE( o->data_len == len )
+    FORCE( !memcmp(o->data, prefix, PREFIX_LEN) )
+    for (int i = PREFIX_LEN; i < len; i++) {
+        FORCE( o->data[i] == payload_byte(seq, i) )
+    }
+    
+    // a private copy is sent from the buffer's copy buffer
+    if (o->data == o->buf.copy_buf) {
+        o->num_copied++;
+    } else {
+        o->num_lent++;
+    }
+    
+    o->data = NULL;
+    PacketPassInterface_Done(&o->input);
+}
+
+static void run_jobs (void)
+{
+    while (BPendingGroup_HasJobs(&pg)) {
+        BPendingGroup_ExecuteJob(&pg);
+    }
+}
+
+static void complete_unblocked (void)
+{
+    int progress;
+    do {
+        progress = 0;
+        for (int j = 0; j < NUM_BUFFERS; j++) {
+            struct output *o = &outputs[j];
+            if (!o->blocked && o->data) {
+                complete_output(o);
+                run_jobs();
+                progress = 1;
+            }
+        }
+    } while (progress);
+}
+
+static void route_packet (int seq, int len, int mask)
+{
+    uint8_t *data = RouteBufferSource_Pointer(&source);
+    for (int i = PREFIX_LEN; i < len; i++) {
+        data[i] = payload_byte(seq, i);
+    }
+    
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        if (!(mask & (1 << j))) {
+            continue;
+        }
+        
+        struct output *o = &outputs[j];
+        uint8_t prefix[PREFIX_LEN];
+        make_prefix(prefix, j, seq);
+        
+        int full = (o->expected_used == BUF_SIZE);
+        int res = RouteBufferSource_Route(&source, len, &o->buf, prefix);
+        FORCE( res == !full )
+        
+        if (res) {
+            int index = (o->expected_start + o->expected_used) % BUF_SIZE;
+            o->expected_seq[index] = seq;
+            o->expected_len[index] = len;
+            o->expected_used++;
+        }
+    }
+    
+    RouteBufferSource_Next(&source);
+    
+    run_jobs();
+}
+
+int main ()
+{
+    BLog_InitStdout();
+    
+    BPendingGroup_Init(&pg);
+    
+    FORCE( RouteBufferSource_Init(&source, MTU, PREFIX_LEN) )
+    
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        struct output *o = &outputs[j];
+        o->index = j;
+        PacketPassInterface_Init(&o->input, MTU, (PacketPassInterface_handler_send)output_handler_send, o, &pg);
+        FORCE( RouteBuffer_Init(&o->buf, &source, &o->input, BUF_SIZE, &pg) )
+        o->blocked = 0;
+        o->data = NULL;
+        o->expected_start = 0;
+        o->expected_used = 0;
+        o->num_lent = 0;
+        o->num_copied = 0;
+    }
+    
+    int seq = 0;
+    
+    // One packet to all buffers, with the first output blocked. The first
+    // buffer to send lends the packet, and the others must send copies
+    // while it is held.
+    outputs[0].blocked = 1;
+    route_packet(seq++, MTU, (1 << NUM_BUFFERS) - 1);
+    complete_unblocked();
+    outputs[0].blocked = 0;
+    complete_unblocked();
+    
+    int num_lent = 0;
+    int num_copied = 0;
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        FORCE( outputs[j].num_lent + outputs[j].num_copied == 1 )
+        num_lent += outputs[j].num_lent;
+        num_copied += outputs[j].num_copied;
+    }
+    FORCE( num_lent == 1 )
+    FORCE( num_copied == NUM_BUFFERS - 1 )
+    
+    // With all outputs blocked, fill every buffer and keep routing to the
+    // full buffers; the source must keep getting new packets.
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        outputs[j].blocked = 1;
+    }
+    for (int i = 0; i < 2 * BUF_SIZE; i++) {
+        route_packet(seq++, PREFIX_LEN + i, (1 << NUM_BUFFERS) - 1);
+    }
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        FORCE( outputs[j].expected_used == BUF_SIZE )
+        outputs[j].blocked = 0;
+    }
+    complete_unblocked();
+    
+    // Random routing with outputs randomly blocking.
+    srand(1);
+    for (int i = 0; i < NUM_PACKETS; i++) {
+        for (int j = 0; j < NUM_BUFFERS; j++) {
+            if (rand() % 4 == 0) {
+                outputs[j].blocked = !outputs[j].blocked;
+            }
+        }
+        
+        int len = PREFIX_LEN + rand() % (MTU - PREFIX_LEN + 1);
+        route_packet(seq++, len, rand() % (1 << NUM_BUFFERS));
+        complete_unblocked();
+    }
+    
+    // deliver the rest
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        outputs[j].blocked = 0;
+    }
+    complete_unblocked();
+    
+    num_lent = 0;
+    num_copied = 0;
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        FORCE( outputs[j].expected_used == 0 )
+        num_lent += outputs[j].num_lent;
+        num_copied += outputs[j].num_copied;
+    }
+    printf("%d packets lent, %d copied\n", num_lent, num_copied);
+    FORCE( num_lent > 0 )
+    FORCE( num_copied > 0 )
+    
+    // free some buffers with packets queued, and the source before the rest
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        outputs[j].blocked = 1;
+    }
+    route_packet(seq++, MTU, (1 << NUM_BUFFERS) - 1);
+    route_packet(seq++, MTU, 1);
+    RouteBufferSource_Free(&source);
+    
+    for (int j = 0; j < NUM_BUFFERS; j++) {
+        RouteBuffer_Free(&outputs[j].buf);
+        PacketPassInterface_Free(&outputs[j].input);
+    }
+    
+    BPendingGroup_Free(&pg);
+    
+    BLog_Free();
+    
+    return 0;
+}
@@ -0,0 +1,804 @@
+/**
+ * @file spproto_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Benchmark suite for the client's UDP transport: BHash, OTPChecker,
+ * FragmentProto disassembly/assembly, SPProto encoding/decoding, and the
+ * complete FragmentProto+SPProto chain as used by DatagramPeerIO.
+ * 
+ * Each benchmark is run for every combination of the given packet sizes and
+ * thread counts. For a thread count T, the work is spread over max(T, 1)
+ * independent flows sharing one {@link BThreadWorkDispatcher} with T threads,
+ * which is how the client shares workers among its peers.
+ * 
+ * Results are printed to standard output as CSV, one line per run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/parse_number.h>
+#include <protocol/spproto.h>
+#include <protocol/fragmentproto.h>
+#include <base/BLog.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <security/BSecurity.h>
+#include <security/BRandom.h>
+#include <security/BHash.h>
+#include <security/BEncryption.h>
+#include <security/OTPCalculator.h>
+#include <security/OTPChecker.h>
+#include <threadwork/BThreadWork.h>
+#include <flow/PacketRecvInterface.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/SinglePacketBuffer.h>
+#include <client/FragmentProtoDisassembler.h>
+#include <client/FragmentProtoAssembler.h>
+#include <client/SPProtoEncoder.h>
+#include <client/SPProtoDecoder.h>
+
+#define BENCH_HASH 1
+#define BENCH_OTP 2
+#define BENCH_FRAGMENT 3
+#define BENCH_SPPROTO 4
+#define BENCH_FULL 5
+
+#define MAX_SIZES 32
+#define MAX_THREAD_COUNTS 16
+#define HASH_BATCH 256
+#define CARRIER_MTU 1472
+#define ASSEMBLER_NUM_FRAMES 4
+
+struct bench_run;
+
+struct flow {
+    struct bench_run *run;
+    uint8_t *data;
+    int done;
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t bytes;
+    
+    // packet chain
+    PacketRecvInterface source;
+    PacketPassInterface sink;
+    int have_in_buffer;
+    SinglePacketBuffer in_buffer;
+    FragmentProtoDisassembler disassembler;
+    SPProtoEncoder encoder;
+    SinglePacketBuffer mid_buffer;
+    SPProtoDecoder decoder;
+    FragmentProtoAssembler assembler;
+    uint16_t seed_id;
+    uint8_t seed_key[BENCRYPTION_MAX_KEY_SIZE];
+    uint8_t seed_iv[BENCRYPTION_MAX_BLOCK_SIZE];
+    
+    // hash and OTP benchmarks
+    int tw_have;
+    BThreadWork tw;
+    uint8_t hash_out[BHASH_MAX_SIZE];
+    OTPChecker checker;
+    otp_t *otps;
+};
+
+struct bench_run {
+    int bench;
+    int size;
+    int num_threads;
+    int num_flows;
+    uint64_t target;
+    BReactor reactor;
+    BThreadWorkDispatcher twd;
+    struct flow *flows;
+    int flows_done;
+};
+
+static struct {
+    int benches[5];
+    int num_benches;
+    int sizes[MAX_SIZES];
+    int num_sizes;
+    int thread_counts[MAX_THREAD_COUNTS];
+    int num_thread_counts;
+    uint64_t packets;
+    struct spproto_security_params sp_params;
+} options;
+
+static const char *bench_names[] = {NULL, "hash", "otp", "fragment", "spproto", "full"};
+
+static void usage (const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s\n"
+        "    [--bench <all/hash/otp/fragment/spproto/full>] ...\n"
+        "    [--sizes <size1,size2,...>] (default 64,512,1400)\n"
+        "    [--threads <count1,count2,...>] (default 0,1,2,4)\n"
+        "    [--packets <number>] (default 100000)\n"
+        "    [--encryption-mode <blowfish/aes/none>] (default aes)\n"
+        "    [--hash-mode <md5/sha1/none>] (default sha1)\n"
+        "    [--otp <blowfish/aes> <num>] (default aes 4096)\n"
+        "    [--no-otp]\n",
+        name
+    );
+    
+    exit(1);
+}
+
+static int parse_list (char *str, int *out, int max, int min_value)
+{
+    int count = 0;
+    
+    while (1) {
+        char *comma = strchr(str, ',');
+        size_t len = (comma ? (size_t)(comma - str) : strlen(str));
+        
+        uintmax_t value;
+        if (count == max || !parse_unsigned_integer_bin(str, len, &value) || value > INT_MAX || (int)value < min_value) {
+            return -1;
+        }
+        out[count++] = value;
+        
+        if (!comma) {
+            break;
+        }
+        str = comma + 1;
+    }
+    
+    return count;
+}
+
+static int parse_cipher (const char *str, int allow_none, int *out)
+{
+    if (!strcmp(str, "blowfish")) {
+        *out = BENCRYPTION_CIPHER_BLOWFISH;
+    }
+    else if (!strcmp(str, "aes")) {
+        *out = BENCRYPTION_CIPHER_AES;
+    }
+    else if (allow_none && !strcmp(str, "none")) {
+        *out = SPPROTO_ENCRYPTION_MODE_NONE;
+    }
+    else {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static void parse_arguments (int argc, char *argv[])
+{
+    options.num_benches = 0;
+    options.sizes[0] = 64;
+    options.sizes[1] = 512;
+    options.sizes[2] = 1400;
+    options.num_sizes = 3;
+    options.thread_counts[0] = 0;
+    options.thread_counts[1] = 1;
+    options.thread_counts[2] = 2;
+    options.thread_counts[3] = 4;
+    options.num_thread_counts = 4;
+    options.packets = 100000;
+    options.sp_params.encryption_mode = BENCRYPTION_CIPHER_AES;
+    options.sp_params.hash_mode = BHASH_TYPE_SHA1;
+    options.sp_params.otp_mode = BENCRYPTION_CIPHER_AES;
+    options.sp_params.otp_num = 4096;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        
+        if (!strcmp(arg, "--bench")) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            char *str = argv[++i];
+            if (!strcmp(str, "all")) {
+                options.num_benches = 0;
+                for (int j = BENCH_HASH; j <= BENCH_FULL; j++) {
+                    options.benches[options.num_benches++] = j;
+                }
+                continue;
+            }
+            int found = 0;
+            for (int j = BENCH_HASH; j <= BENCH_FULL; j++) {
+                if (!strcmp(str, bench_names[j])) {
+                    found = j;
+                }
+            }
+            if (!found || options.num_benches == 5) {
+                usage(argv[0]);
+            }
+            options.benches[options.num_benches++] = found;
+        }
+        else if (!strcmp(arg, "--sizes")) {
+            if (i + 1 >= argc || (options.num_sizes = parse_list(argv[++i], options.sizes, MAX_SIZES, 1)) < 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--threads")) {
+            if (i + 1 >= argc || (options.num_thread_counts = parse_list(argv[++i], options.thread_counts, MAX_THREAD_COUNTS, 0)) < 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--packets")) {
+            uintmax_t packets;
+            if (i + 1 >= argc || !parse_unsigned_integer(argv[++i], &packets) || packets == 0) {
+                usage(argv[0]);
+            }
+            options.packets = packets;
+        }
+        else if (!strcmp(arg, "--encryption-mode")) {
+            if (i + 1 >= argc || !parse_cipher(argv[++i], 1, &options.sp_params.encryption_mode)) {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--hash-mode")) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            char *str = argv[++i];
+            if (!strcmp(str, "md5")) {
+                options.sp_params.hash_mode = BHASH_TYPE_MD5;
+            }
+            else if (!strcmp(str, "sha1")) {
+                options.sp_params.hash_mode = BHASH_TYPE_SHA1;
+            }
+            else if (!strcmp(str, "none")) {
+                options.sp_params.hash_mode = SPPROTO_HASH_MODE_NONE;
+            }
+            else {
+                usage(argv[0]);
+            }
+        }
+        else if (!strcmp(arg, "--otp")) {
+            uintmax_t num;
+            if (i + 2 >= argc || !parse_cipher(argv[i + 1], 0, &options.sp_params.otp_mode) ||
+                !parse_unsigned_integer(argv[i + 2], &num) || num == 0 || num > UINT16_MAX
+            ) {
+                usage(argv[0]);
+            }
+            options.sp_params.otp_num = num;
+            i += 2;
+        }
+        else if (!strcmp(arg, "--no-otp")) {
+            options.sp_params.otp_mode = SPPROTO_OTP_MODE_NONE;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    
+    if (options.num_benches == 0) {
+        for (int j = BENCH_HASH; j <= BENCH_FULL; j++) {
+            options.benches[options.num_benches++] = j;
+        }
+    }
+}
+
+static void flow_finish (struct flow *f)
+{
+    ASSERT(!f->done)
+    
+    struct bench_run *r = f->run;
+    
+    f->done = 1;
+    r->flows_done++;
+    
+    if (r->flows_done == r->num_flows) {
+        BReactor_Quit(&r->reactor, 0);
+    }
+}
+
+static void flow_source_handler_recv (struct flow *f, uint8_t *data)
+{
+    ASSERT(!f->done)
+    
+    memcpy(data, f->data, f->run->size);
+    f->sent++;
+    
+    PacketRecvInterface_Done(&f->source, f->run->size);
+}
+
+static void flow_sink_handler_send (struct flow *f, uint8_t *data, int data_len)
+{
+    ASSERT(!f->done)
+    
+    f->delivered++;
+    f->bytes += data_len;
+    
+    if (f->delivered == f->run->target) {
+        // leave the packet pending so the chain stops here
+        flow_finish(f);
+        return;
+    }
+    
+    PacketPassInterface_Done(&f->sink);
+}
+
+static void flow_logfunc (struct flow *f)
+{
+    BLog_Append("flow %p: ", (void *)f);
+}
+
+static void flow_new_seed (struct flow *f)
+{
+    ASSERT(SPPROTO_HAVE_OTP(options.sp_params))
+    
+    f->seed_id++;
+    BRandom_randomize(f->seed_key, BEncryption_cipher_key_size(options.sp_params.otp_mode));
+    BRandom_randomize(f->seed_iv, BEncryption_cipher_block_size(options.sp_params.otp_mode));
+    
+    // the decoder must know the seed before the encoder starts using it
+    SPProtoDecoder_AddOTPSeed(&f->decoder, f->seed_id, f->seed_key, f->seed_iv);
+}
+
+static void flow_decoder_handler_otp (struct flow *f)
+{
+    SPProtoEncoder_SetOTPSeed(&f->encoder, f->seed_id, f->seed_key, f->seed_iv);
+}
+
+static void flow_encoder_handler_warning (struct flow *f)
+{
+    flow_new_seed(f);
+}
+
+static int flow_init_chain (struct flow *f)
+{
+    struct bench_run *r = f->run;
+    BPendingGroup *pg = BReactor_PendingGroup(&r->reactor);
+    int bench = r->bench;
+    int use_fragment = (bench == BENCH_FRAGMENT || bench == BENCH_FULL);
+    int use_spproto = (bench == BENCH_SPPROTO || bench == BENCH_FULL);
+    
+    // payload MTU of a carrier packet
+    int payload_mtu = CARRIER_MTU;
+    if (use_spproto && use_fragment) {
+        payload_mtu = spproto_payload_mtu_for_carrier_mtu(options.sp_params, CARRIER_MTU);
+        if (payload_mtu <= (int)sizeof(struct fragmentproto_chunk_header)) {
+            fprintf(stderr, "carrier MTU too small for security parameters\n");
+            return 0;
+        }
+    }
+    else if (use_spproto) {
+        payload_mtu = r->size;
+        if (spproto_carrier_mtu_for_payload_mtu(options.sp_params, payload_mtu) < 0) {
+            fprintf(stderr, "packet size too large for SPProto\n");
+            return 0;
+        }
+    }
+    
+    // MTU of the sink
+    int sink_mtu = (use_fragment ? r->size : payload_mtu);
+    
+    PacketPassInterface_Init(&f->sink, sink_mtu, (PacketPassInterface_handler_send)flow_sink_handler_send, f, pg);
+    
+    // assemble back into frames
+    PacketPassInterface *decoder_output = &f->sink;
+    if (use_fragment) {
+        if (!FragmentProtoAssembler_Init(&f->assembler, payload_mtu, &f->sink, ASSEMBLER_NUM_FRAMES,
+            fragmentproto_max_chunks_for_frame(payload_mtu, r->size), pg, f, (BLog_logfunc)flow_logfunc)
+        ) {
+            fprintf(stderr, "FragmentProtoAssembler_Init failed\n");
+            goto fail0;
+        }
+        decoder_output = FragmentProtoAssembler_GetInput(&f->assembler);
+    }
+    
+    // decode
+    PacketPassInterface *carrier_output = decoder_output;
+    if (use_spproto) {
+        if (!SPProtoDecoder_Init(&f->decoder, decoder_output, options.sp_params, 2, pg, &r->twd, f, (BLog_logfunc)flow_logfunc)) {
+            fprintf(stderr, "SPProtoDecoder_Init failed\n");
+            goto fail1;
+        }
+        SPProtoDecoder_SetHandlers(&f->decoder, (SPProtoDecoder_otp_handler)flow_decoder_handler_otp, f);
+        carrier_output = SPProtoDecoder_GetInput(&f->decoder);
+    }
+    
+    PacketRecvInterface_Init(&f->source, r->size, (PacketRecvInterface_handler_recv)flow_source_handler_recv, f, pg);
+    
+    // disassemble into chunks
+    PacketRecvInterface *payload_input = &f->source;
+    f->have_in_buffer = 0;
+    if (use_fragment) {
+        FragmentProtoDisassembler_Init(&f->disassembler, &r->reactor, r->size, payload_mtu, -1, 0, 0);
+        if (!SinglePacketBuffer_Init(&f->in_buffer, &f->source, FragmentProtoDisassembler_GetInput(&f->disassembler), pg)) {
+            fprintf(stderr, "SinglePacketBuffer_Init failed\n");
+            goto fail2;
+        }
+        f->have_in_buffer = 1;
+        payload_input = FragmentProtoDisassembler_GetOutput(&f->disassembler);
+    }
+    
+    // encode
+    PacketRecvInterface *carrier_input = payload_input;
+    if (use_spproto) {
+        int otp_warning_count = (SPPROTO_HAVE_OTP(options.sp_params) ? (options.sp_params.otp_num + 1) / 2 : 0);
+        if (!SPProtoEncoder_Init(&f->encoder, payload_input, options.sp_params, otp_warning_count, pg, &r->twd)) {
+            fprintf(stderr, "SPProtoEncoder_Init failed\n");
+            goto fail3;
+        }
+        SPProtoEncoder_SetHandlers(&f->encoder, (SPProtoEncoder_handler)flow_encoder_handler_warning, f);
+        carrier_input = SPProtoEncoder_GetOutput(&f->encoder);
+    }
+    
+    // connect the carrier, as the socket would
+    if (!SinglePacketBuffer_Init(&f->mid_buffer, carrier_input, carrier_output, pg)) {
+        fprintf(stderr, "SinglePacketBuffer_Init failed\n");
+        goto fail4;
+    }
+    
+    // set keys
+    if (use_spproto) {
+        if (SPPROTO_HAVE_ENCRYPTION(options.sp_params)) {
+            uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+            BRandom_randomize(key, BEncryption_cipher_key_size(options.sp_params.encryption_mode));
+            SPProtoEncoder_SetEncryptionKey(&f->encoder, key);
+            SPProtoDecoder_SetEncryptionKey(&f->decoder, key);
+        }
+        if (SPPROTO_HAVE_OTP(options.sp_params)) {
+            f->seed_id = 0;
+            flow_new_seed(f);
+        }
+    }
+    
+    return 1;
+
+fail4:
+    if (use_spproto) {
+        SPProtoEncoder_Free(&f->encoder);
+    }
+fail3:
+    if (f->have_in_buffer) {
+        SinglePacketBuffer_Free(&f->in_buffer);
+    }
+fail2:
+    if (use_fragment) {
+        FragmentProtoDisassembler_Free(&f->disassembler);
+    }
+    PacketRecvInterface_Free(&f->source);
+    if (use_spproto) {
+        SPProtoDecoder_Free(&f->decoder);
+    }
+fail1:
+    if (use_fragment) {
+        FragmentProtoAssembler_Free(&f->assembler);
+    }
+fail0:
+    PacketPassInterface_Free(&f->sink);
+    return 0;
+}
+
+static void flow_free_chain (struct flow *f)
+{
+    int bench = f->run->bench;
+    int use_fragment = (bench == BENCH_FRAGMENT || bench == BENCH_FULL);
+    int use_spproto = (bench == BENCH_SPPROTO || bench == BENCH_FULL);
+    
+    SinglePacketBuffer_Free(&f->mid_buffer);
+    if (use_spproto) {
+        SPProtoEncoder_Free(&f->encoder);
+    }
+    if (f->have_in_buffer) {
+        SinglePacketBuffer_Free(&f->in_buffer);
+    }
+    if (use_fragment) {
+        FragmentProtoDisassembler_Free(&f->disassembler);
+    }
+    PacketRecvInterface_Free(&f->source);
+    if (use_spproto) {
+        SPProtoDecoder_Free(&f->decoder);
+    }
+    if (use_fragment) {
+        FragmentProtoAssembler_Free(&f->assembler);
+    }
+    PacketPassInterface_Free(&f->sink);
+}
+
+static void hash_work_func (struct flow *f)
+{
+    for (int i = 0; i < HASH_BATCH; i++) {
+        BHash_calculate(options.sp_params.hash_mode, f->data, f->run->size, f->hash_out);
+    }
+}
+
+static void hash_work_handler (struct flow *f)
+{
+    ASSERT(f->tw_have)
+    
+    BThreadWork_Free(&f->tw);
+    f->tw_have = 0;
+    
+    f->sent += HASH_BATCH;
+    f->delivered += HASH_BATCH;
+    f->bytes += (uint64_t)HASH_BATCH * f->run->size;
+    
+    if (f->delivered >= f->run->target) {
+        flow_finish(f);
+        return;
+    }
+    
+    BThreadWork_Init(&f->tw, &f->run->twd, (BThreadWork_handler_done)hash_work_handler, f, (BThreadWork_work_func)hash_work_func, f);
+    f->tw_have = 1;
+}
+
+static void otp_add_seed (struct flow *f)
+{
+    f->seed_id++;
+    OTPChecker_AddSeed(&f->checker, f->seed_id, f->seed_key, f->seed_iv);
+}
+
+static void otp_checker_handler (struct flow *f)
+{
+    ASSERT(!f->done)
+    
+    // check all OTPs of the seed, as the decoder would for a full seed's worth of packets
+    for (int i = 0; i < options.sp_params.otp_num; i++) {
+        int ok = OTPChecker_CheckOTP(&f->checker, f->seed_id, f->otps[i]);
+        ASSERT_EXECUTE(ok)
+        B_USE(ok)
+    }
+    
+    f->sent += options.sp_params.otp_num;
+    f->delivered += options.sp_params.otp_num;
+    f->bytes += (uint64_t)options.sp_params.otp_num * sizeof(otp_t);
+    
+    if (f->delivered >= f->run->target) {
+        flow_finish(f);
+        return;
+    }
+    
+    otp_add_seed(f);
+}
+
+static int flow_init (struct flow *f, struct bench_run *r)
+{
+    f->run = r;
+    f->done = 0;
+    f->sent = 0;
+    f->delivered = 0;
+    f->bytes = 0;
+    f->tw_have = 0;
+    
+    if (!(f->data = (uint8_t *)BAlloc(r->size))) {
+        fprintf(stderr, "BAlloc failed\n");
+        goto fail0;
+    }
+    BRandom_randomize(f->data, r->size);
+    
+    switch (r->bench) {
+        case BENCH_HASH: {
+            BThreadWork_Init(&f->tw, &r->twd, (BThreadWork_handler_done)hash_work_handler, f, (BThreadWork_work_func)hash_work_func, f);
+            f->tw_have = 1;
+        } break;
+        
+        case BENCH_OTP: {
+            int cipher = options.sp_params.otp_mode;
+            
+            BRandom_randomize(f->seed_key, BEncryption_cipher_key_size(cipher));
+            BRandom_randomize(f->seed_iv, BEncryption_cipher_block_size(cipher));
+            
+            // calculate the OTPs the checker will be expecting
+            OTPCalculator calc;
+            if (!OTPCalculator_Init(&calc, options.sp_params.otp_num, cipher)) {
+                fprintf(stderr, "OTPCalculator_Init failed\n");
+                goto fail1;
+            }
+            if (!(f->otps = (otp_t *)BAllocArray(options.sp_params.otp_num, sizeof(f->otps[0])))) {
+                fprintf(stderr, "BAllocArray failed\n");
+                OTPCalculator_Free(&calc);
+                goto fail1;
+            }
+            memcpy(f->otps, OTPCalculator_Generate(&calc, f->seed_key, f->seed_iv, 1), options.sp_params.otp_num * sizeof(f->otps[0]));
+            OTPCalculator_Free(&calc);
+            
+            if (!OTPChecker_Init(&f->checker, options.sp_params.otp_num, cipher, 2, &r->twd)) {
+                fprintf(stderr, "OTPChecker_Init failed\n");
+                BFree(f->otps);
+                goto fail1;
+            }
+            OTPChecker_SetHandlers(&f->checker, (OTPChecker_handler)otp_checker_handler, f);
+            
+            f->seed_id = 0;
+            otp_add_seed(f);
+        } break;
+        
+        default: {
+            if (!flow_init_chain(f)) {
+                goto fail1;
+            }
+        } break;
+    }
+    
+    return 1;
+
+fail1:
+    BFree(f->data);
+fail0:
+    return 0;
+}
+
+static void flow_free (struct flow *f)
+{
+    switch (f->run->bench) {
+        case BENCH_HASH: {
+            if (f->tw_have) {
+                BThreadWork_Free(&f->tw);
+            }
+        } break;
+        
+        case BENCH_OTP: {
+            OTPChecker_Free(&f->checker);
+            BFree(f->otps);
+        } break;
+        
+        default: {
+            flow_free_chain(f);
+        } break;
+    }
+    
+    BFree(f->data);
+}
+
+static int run_bench (int bench, int size, int num_threads)
+{
+    struct bench_run r;
+    r.bench = bench;
+    r.size = size;
+    r.num_threads = num_threads;
+    r.num_flows = (num_threads > 0 ? num_threads : 1);
+    r.target = (options.packets + r.num_flows - 1) / r.num_flows;
+    r.flows_done = 0;
+    
+    if (!BReactor_Init(&r.reactor)) {
+        fprintf(stderr, "BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    if (!BThreadWorkDispatcher_Init(&r.twd, &r.reactor, num_threads)) {
+        fprintf(stderr, "BThreadWorkDispatcher_Init failed\n");
+        goto fail1;
+    }
+    
+    if (!(r.flows = (struct flow *)BAllocArray(r.num_flows, sizeof(r.flows[0])))) {
+        fprintf(stderr, "BAllocArray failed\n");
+        goto fail2;
+    }
+    
+    int num_inited;
+    for (num_inited = 0; num_inited < r.num_flows; num_inited++) {
+        if (!flow_init(&r.flows[num_inited], &r)) {
+            goto fail3;
+        }
+    }
+    
+    btime_t start_time = btime_gettime();
+    BReactor_Exec(&r.reactor);
+    btime_t elapsed = btime_gettime() - start_time;
+    
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < r.num_flows; i++) {
+        sent += r.flows[i].sent;
+        delivered += r.flows[i].delivered;
+        bytes += r.flows[i].bytes;
+    }
+    
+    double seconds = (elapsed > 0 ? elapsed : 1) / 1000.0;
+    
+    printf("%s,%d,%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%.0f,%.2f\n",
+           bench_names[bench], size, num_threads, r.num_flows, sent, delivered, bytes,
+           seconds, delivered / seconds, bytes * 8.0 / seconds / 1000000.0);
+    fflush(stdout);
+    
+    while (num_inited-- > 0) {
+        flow_free(&r.flows[num_inited]);
+    }
+    BFree(r.flows);
+    BThreadWorkDispatcher_Free(&r.twd);
+    BReactor_Free(&r.reactor);
+    return 1;
+
+fail3:
+    while (num_inited-- > 0) {
+        flow_free(&r.flows[num_inited]);
+    }
+    BFree(r.flows);
+fail2:
+    BThreadWorkDispatcher_Free(&r.twd);
+fail1:
+    BReactor_Free(&r.reactor);
+fail0:
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    parse_arguments(argc, argv);
+    
+    int ret = 1;
+    
+    BLog_InitStderr();
+    BTime_Init();
+    
+    if (!BSecurity_GlobalInitThreadSafe()) {
+        fprintf(stderr, "BSecurity_GlobalInitThreadSafe failed\n");
+        goto fail0;
+    }
+    
+    printf("bench,size,threads,flows,sent,delivered,bytes,seconds,packets_per_sec,mbit_per_sec\n");
+    
+    for (int i = 0; i < options.num_benches; i++) {
+        int bench = options.benches[i];
+        
+        if (bench == BENCH_HASH && options.sp_params.hash_mode == SPPROTO_HASH_MODE_NONE) {
+            continue;
+        }
+        if (bench == BENCH_OTP && !SPPROTO_HAVE_OTP(options.sp_params)) {
+            continue;
+        }
+        
+        for (int k = 0; k < options.num_thread_counts; k++) {
+            // OTP checking does not depend on the packet size
+            if (bench == BENCH_OTP) {
+                if (!run_bench(bench, sizeof(otp_t), options.thread_counts[k])) {
+                    goto fail1;
+                }
+                continue;
+            }
+            
+            for (int j = 0; j < options.num_sizes; j++) {
+                if (!run_bench(bench, options.sizes[j], options.thread_counts[k])) {
+                    goto fail1;
+                }
+            }
+        }
+    }
+    
+    ret = 0;
+
+fail1:
+    BSecurity_GlobalFreeThreadSafe();
+fail0:
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    return ret;
+}
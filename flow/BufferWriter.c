@@ -46,6 +46,7 @@ void BufferWriter_Init (BufferWriter *o, int mtu, BPendingGroup *pg)
     
     // init output
     PacketRecvInterface_Init(&o->recv_interface, mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->recv_interface), "BufferWriter");
     
     // set no output packet
     o->out_have = 0;
@@ -0,0 +1,133 @@
+/**
+ * @file FlowTrace.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <misc/offset.h>
+
+#include "FlowTrace.h"
+
+#ifdef BADVPN_FLOW_TRACE
+#ifndef BADVPN_PLUGIN
+LinkedList1 flowtrace_list = {NULL, NULL};
+FlowTrace_clock flowtrace_clock = NULL;
+#if BADVPN_THREAD_SAFE
+pthread_mutex_t flowtrace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+#endif
+
+void FlowTraceGlobal_SetClock (FlowTrace_clock clock)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    flowtrace_clock = clock;
+    #endif
+}
+
+#ifdef BADVPN_FLOW_TRACE
+
+static int append_node (ExpString *out, void *obj)
+{
+    char buf[64];
+    
+    if (obj) {
+        sprintf(buf, "\"%p\"", obj);
+    } else {
+        sprintf(buf, "\"none\"");
+    }
+    
+    return ExpString_Append(out, buf);
+}
+
+static int append_trace (ExpString *out, FlowTrace *t)
+{
+    char buf[256];
+    
+    if (!ExpString_Append(out, "    ")) {
+        return 0;
+    }
+    if (!append_node(out, t->source)) {
+        return 0;
+    }
+    if (!ExpString_Append(out, " -> ")) {
+        return 0;
+    }
+    if (!append_node(out, t->sink)) {
+        return 0;
+    }
+    
+    sprintf(buf, " [label=\"%s %s\\nops=%"PRIu64" bytes=%"PRIu64" busy_ms=%"PRId64" depth=%d max_depth=%d%s\"];\n",
+            t->kind, (t->name ? t->name : ""), t->num_ops, t->num_bytes, t->busy_time, t->depth, t->max_depth, (t->busy ? " busy" : ""));
+    
+    return ExpString_Append(out, buf);
+}
+
+#endif
+
+int FlowTraceGlobal_Dump (ExpString *out)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    int res = 0;
+    
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_lock(&flowtrace_mutex) == 0)
+    #endif
+    
+    if (!ExpString_Append(out, "digraph flow {\n")) {
+        goto out;
+    }
+    
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&flowtrace_list); n; n = LinkedList1Node_Next(n)) {
+        FlowTrace *t = UPPER_OBJECT(n, FlowTrace, list_node);
+        if (!append_trace(out, t)) {
+            goto out;
+        }
+    }
+    
+    if (!ExpString_Append(out, "}\n")) {
+        goto out;
+    }
+    
+    res = 1;
+    
+out:
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_unlock(&flowtrace_mutex) == 0)
+    #endif
+    
+    return res;
+    
+    #else
+    
+    return 1;
+    
+    #endif
+}
@@ -0,0 +1,289 @@
+/**
+ * @file FlowTrace.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Optional counters for flow interfaces, for finding where a chain of
+ * flow elements stalls or drops.
+ */
+
+#ifndef BADVPN_FLOW_FLOWTRACE_H
+#define BADVPN_FLOW_FLOWTRACE_H
+
+#include <stdint.h>
+
+#if !defined(BADVPN_THREAD_SAFE) || (BADVPN_THREAD_SAFE != 0 && BADVPN_THREAD_SAFE != 1)
+#error BADVPN_THREAD_SAFE is not defined or incorrect
+#endif
+
+#ifdef BADVPN_FLOW_TRACE
+#if BADVPN_THREAD_SAFE
+#include <pthread.h>
+#endif
+#include <structure/LinkedList1.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/expstring.h>
+
+/**
+ * Function returning the current time in milliseconds, used to measure
+ * how long operations take.
+ */
+typedef int64_t (*FlowTrace_clock) (void);
+
+/**
+ * Counters of a flow interface.
+ * 
+ * Every flow interface embeds one of these. Unless BADVPN_FLOW_TRACE
+ * is defined, it is empty and all functions do nothing, so tracing has
+ * no cost in normal builds.
+ * 
+ * With tracing, all interfaces in existence are kept in a global list,
+ * which can be written out as a graph with {@link FlowTraceGlobal_Dump}.
+ * The nodes of the graph are the objects sending and receiving data over
+ * the interfaces, and the edges are the interfaces, labeled with their
+ * counters.
+ */
+typedef struct {
+    #ifdef BADVPN_FLOW_TRACE
+    const char *kind;
+    const char *name;
+    void *source;
+    void *sink;
+    uint64_t num_ops;
+    uint64_t num_bytes;
+    int64_t busy_time;
+    int64_t op_start_time;
+    int busy;
+    int depth;
+    int max_depth;
+    LinkedList1Node list_node;
+    #endif
+} FlowTrace;
+
+/**
+ * Initializes the counters and adds them to the global list.
+ * 
+ * @param t the object
+ * @param kind type of interface. Must be a static string.
+ */
+static void FlowTrace_Init (FlowTrace *t, const char *kind);
+
+/**
+ * Removes the counters from the global list.
+ * 
+ * @param t the object
+ */
+static void FlowTrace_Free (FlowTrace *t);
+
+/**
+ * Sets the name shown for the interface.
+ * 
+ * @param t the object
+ * @param name name of the interface, or NULL. Must be a static string.
+ */
+static void FlowTrace_SetName (FlowTrace *t, const char *name);
+
+/**
+ * Sets the object data comes from.
+ * 
+ * @param t the object
+ * @param obj the object sending data
+ */
+static void FlowTrace_SetSource (FlowTrace *t, void *obj);
+
+/**
+ * Sets the object data goes to.
+ * 
+ * @param t the object
+ * @param obj the object receiving data
+ */
+static void FlowTrace_SetSink (FlowTrace *t, void *obj);
+
+/**
+ * Records the start of an operation.
+ * 
+ * @param t the object
+ */
+static void FlowTrace_Begin (FlowTrace *t);
+
+/**
+ * Records the completion of an operation.
+ * 
+ * @param t the object
+ * @param data_len number of bytes transferred by the operation
+ */
+static void FlowTrace_End (FlowTrace *t, int data_len);
+
+/**
+ * Records the number of packets queued behind the interface,
+ * for elements which have buffers.
+ * 
+ * @param t the object
+ * @param depth number of queued packets
+ */
+static void FlowTrace_SetDepth (FlowTrace *t, int depth);
+
+/**
+ * Sets the clock used to measure how long interfaces are busy.
+ * Until this is called, busy times are not measured.
+ * 
+ * @param clock clock function, or NULL
+ */
+void FlowTraceGlobal_SetClock (FlowTrace_clock clock);
+
+/**
+ * Appends a snapshot of all interfaces, in Graphviz dot format.
+ * Without BADVPN_FLOW_TRACE, appends nothing.
+ * 
+ * @param out string to append to
+ * @return 1 on success, 0 on allocation failure
+ */
+int FlowTraceGlobal_Dump (ExpString *out);
+
+#ifdef BADVPN_FLOW_TRACE
+extern LinkedList1 flowtrace_list;
+extern FlowTrace_clock flowtrace_clock;
+#if BADVPN_THREAD_SAFE
+extern pthread_mutex_t flowtrace_mutex;
+#endif
+#endif
+
+void FlowTrace_Init (FlowTrace *t, const char *kind)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    t->kind = kind;
+    t->name = NULL;
+    t->source = NULL;
+    t->sink = NULL;
+    t->num_ops = 0;
+    t->num_bytes = 0;
+    t->busy_time = 0;
+    t->busy = 0;
+    t->depth = 0;
+    t->max_depth = 0;
+    
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_lock(&flowtrace_mutex) == 0)
+    #endif
+    
+    LinkedList1_Append(&flowtrace_list, &t->list_node);
+    
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_unlock(&flowtrace_mutex) == 0)
+    #endif
+    
+    #endif
+}
+
+void FlowTrace_Free (FlowTrace *t)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_lock(&flowtrace_mutex) == 0)
+    #endif
+    
+    LinkedList1_Remove(&flowtrace_list, &t->list_node);
+    
+    #if BADVPN_THREAD_SAFE
+    ASSERT_FORCE(pthread_mutex_unlock(&flowtrace_mutex) == 0)
+    #endif
+    
+    #endif
+}
+
+void FlowTrace_SetName (FlowTrace *t, const char *name)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    t->name = name;
+    #endif
+}
+
+void FlowTrace_SetSource (FlowTrace *t, void *obj)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    t->source = obj;
+    #endif
+}
+
+void FlowTrace_SetSink (FlowTrace *t, void *obj)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    t->sink = obj;
+    #endif
+}
+
+void FlowTrace_Begin (FlowTrace *t)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    ASSERT(!t->busy)
+    
+    t->busy = 1;
+    if (flowtrace_clock) {
+        t->op_start_time = flowtrace_clock();
+    }
+    
+    #endif
+}
+
+void FlowTrace_End (FlowTrace *t, int data_len)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    ASSERT(t->busy)
+    ASSERT(data_len >= 0)
+    
+    t->busy = 0;
+    t->num_ops++;
+    t->num_bytes += data_len;
+    if (flowtrace_clock) {
+        t->busy_time += flowtrace_clock() - t->op_start_time;
+    }
+    
+    #endif
+}
+
+void FlowTrace_SetDepth (FlowTrace *t, int depth)
+{
+    #ifdef BADVPN_FLOW_TRACE
+    
+    ASSERT(depth >= 0)
+    
+    t->depth = depth;
+    if (depth > t->max_depth) {
+        t->max_depth = depth;
+    }
+    
+    #endif
+}
+
+#endif
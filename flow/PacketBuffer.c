@@ -28,14 +28,54 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include <misc/debug.h>
 #include <misc/balloc.h>
 
 #include <flow/PacketBuffer.h>
 
+static void codel_drop (PacketBuffer *buf);
+static void schedule_send (PacketBuffer *buf);
 static void input_handler_done (PacketBuffer *buf, int in_len);
 static void output_handler_done (PacketBuffer *buf);
+static int init_buffer (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, const struct PacketCodel_params *codel, BPendingGroup *pg);
+
+static int have_input_space (PacketBuffer *buf)
+{
+    return (buf->buf.input_avail >= buf->chunk_offset + buf->input_mtu);
+}
+
+void codel_drop (PacketBuffer *buf)
+{
+    if (!buf->use_codel) {
+        return;
+    }
+    
+    int64_t now = PacketCodel_Now(&buf->codel);
+    
+    // drop packets from the front as long as CoDel says so
+    while (buf->buf.output_avail >= 0) {
+        int64_t enqueue_time;
+        memcpy(&enqueue_time, buf->buf.output_dest, sizeof(enqueue_time));
+        
+        if (!PacketCodel_ShouldDrop(&buf->codel, now, enqueue_time, buf->num_packets == 1)) {
+            break;
+        }
+        
+        ChunkBuffer2_ConsumePacket(&buf->buf);
+        buf->num_packets--;
+        FlowTrace_SetDepth(PacketPassInterface_GetTrace(buf->output), buf->num_packets);
+    }
+}
+
+void schedule_send (PacketBuffer *buf)
+{
+    ASSERT(buf->buf.output_avail >= 0)
+    
+    PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest + buf->chunk_offset, buf->buf.output_avail - buf->chunk_offset);
+}
 
 void input_handler_done (PacketBuffer *buf, int in_len)
 {
@@ -46,17 +86,28 @@ void input_handler_done (PacketBuffer *buf, int in_len)
     // remember if buffer is empty
     int was_empty = (buf->buf.output_avail < 0);
     
+    // write enqueue time in front of the packet
+    if (buf->use_codel) {
+        int64_t now = PacketCodel_Now(&buf->codel);
+        memcpy(buf->buf.input_dest, &now, sizeof(now));
+    }
+    
     // submit packet to buffer
-    ChunkBuffer2_SubmitPacket(&buf->buf, in_len);
+    ChunkBuffer2_SubmitPacket(&buf->buf, buf->chunk_offset + in_len);
+    buf->num_packets++;
+    FlowTrace_SetDepth(PacketPassInterface_GetTrace(buf->output), buf->num_packets);
     
     // if there is space, schedule receive
-    if (buf->buf.input_avail >= buf->input_mtu) {
-        PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
+    if (have_input_space(buf)) {
+        PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest + buf->chunk_offset);
     }
     
     // if buffer was empty, schedule send
     if (was_empty) {
-        PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest, buf->buf.output_avail);
+        codel_drop(buf);
+        if (buf->buf.output_avail >= 0) {
+            schedule_send(buf);
+        }
     }
 }
 
@@ -65,23 +116,28 @@ void output_handler_done (PacketBuffer *buf)
     DebugObject_Access(&buf->d_obj);
     
     // remember if buffer is full
-    int was_full = (buf->buf.input_avail < buf->input_mtu);
+    int was_full = !have_input_space(buf);
     
     // remove packet from buffer
     ChunkBuffer2_ConsumePacket(&buf->buf);
+    buf->num_packets--;
+    FlowTrace_SetDepth(PacketPassInterface_GetTrace(buf->output), buf->num_packets);
+    
+    // drop packets which have been queued for too long
+    codel_drop(buf);
     
     // if buffer was full and there is space, schedule receive
-    if (was_full && buf->buf.input_avail >= buf->input_mtu) {
-        PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
+    if (was_full && have_input_space(buf)) {
+        PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest + buf->chunk_offset);
     }
     
     // if there is more data, schedule send
     if (buf->buf.output_avail >= 0) {
-        PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest, buf->buf.output_avail);
+        schedule_send(buf);
     }
 }
 
-int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg)
+int init_buffer (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, const struct PacketCodel_params *codel, BPendingGroup *pg)
 {
     ASSERT(PacketPassInterface_GetMTU(output) >= PacketRecvInterface_GetMTU(input))
     ASSERT(num_packets > 0)
@@ -99,8 +155,18 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
     // init output
     PacketPassInterface_Sender_Init(buf->output, (PacketPassInterface_handler_done)output_handler_done, buf);
     
+    // init CoDel, which needs room for the enqueue time in each chunk
+    buf->use_codel = !!codel;
+    if (buf->use_codel) {
+        PacketCodel_Init(&buf->codel, codel);
+    }
+    buf->chunk_offset = (buf->use_codel ? sizeof(int64_t) : 0);
+    if (buf->input_mtu > INT_MAX - buf->chunk_offset) {
+        goto fail0;
+    }
+    
     // allocate buffer
-    int num_blocks = ChunkBuffer2_calc_blocks(buf->input_mtu, num_packets);
+    int num_blocks = ChunkBuffer2_calc_blocks(buf->chunk_offset + buf->input_mtu, num_packets);
     if (num_blocks < 0) {
         goto fail0;
     }
@@ -109,10 +175,11 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
     }
     
     // init buffer
-    ChunkBuffer2_Init(&buf->buf, buf->buf_data, num_blocks, buf->input_mtu);
+    ChunkBuffer2_Init(&buf->buf, buf->buf_data, num_blocks, buf->chunk_offset + buf->input_mtu);
+    buf->num_packets = 0;
     
     // schedule receive
-    PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest);
+    PacketRecvInterface_Receiver_Recv(buf->input, buf->buf.input_dest + buf->chunk_offset);
     
     DebugObject_Init(&buf->d_obj);
     
@@ -122,6 +189,18 @@ fail0:
     return 0;
 }
 
+int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg)
+{
+    return init_buffer(buf, input, output, num_packets, NULL, pg);
+}
+
+int PacketBuffer_InitCodel (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, const struct PacketCodel_params *codel, BPendingGroup *pg)
+{
+    ASSERT(codel)
+    
+    return init_buffer(buf, input, output, num_packets, codel, pg);
+}
+
 void PacketBuffer_Free (PacketBuffer *buf)
 {
     DebugObject_Free(&buf->d_obj);
@@ -129,3 +208,10 @@ void PacketBuffer_Free (PacketBuffer *buf)
     // free buffer
     BFree(buf->buf_data);
 }
+
+uint64_t PacketBuffer_GetNumCodelDropped (PacketBuffer *buf)
+{
+    DebugObject_Access(&buf->d_obj);
+    
+    return (buf->use_codel ? PacketCodel_GetNumDropped(&buf->codel) : 0);
+}
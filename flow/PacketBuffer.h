@@ -41,15 +41,22 @@
 #include <structure/ChunkBuffer2.h>
 #include <flow/PacketRecvInterface.h>
 #include <flow/PacketPassInterface.h>
+#include <flow/PacketCodel.h>
 
 /**
  * Packet buffer with {@link PacketRecvInterface} input and {@link PacketPassInterface} output.
+ * Optionally, the buffer drops packets according to {@link PacketCodel}; the time
+ * each packet was queued is then stored in front of it in the buffer.
  */
 typedef struct {
     DebugObject d_obj;
     PacketRecvInterface *input;
     int input_mtu;
     PacketPassInterface *output;
+    int use_codel;
+    PacketCodel codel;
+    int chunk_offset;
+    int num_packets;
     struct ChunkBuffer2_block *buf_data;
     ChunkBuffer2 buf;
 } PacketBuffer;
@@ -67,6 +74,28 @@ typedef struct {
  */
 int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg) WARN_UNUSED;
 
+/**
+ * Initializes the buffer with CoDel active queue management.
+ * Output MTU must be >= input MTU.
+ * 
+ * @param buf the object
+ * @param input input interface
+ * @param output output interface
+ * @param num_packets minimum number of packets the buffer must hold. Must be >0.
+ * @param codel CoDel parameters, see {@link PacketCodel_Init}
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketBuffer_InitCodel (PacketBuffer *buf, PacketRecvInterface *input, PacketPassInterface *output, int num_packets, const struct PacketCodel_params *codel, BPendingGroup *pg) WARN_UNUSED;
+
+/**
+ * Returns the number of packets dropped by CoDel.
+ * 
+ * @param buf the object
+ * @return number of dropped packets; 0 if CoDel is not used
+ */
+uint64_t PacketBuffer_GetNumCodelDropped (PacketBuffer *buf);
+
 /**
  * Frees the buffer.
  *
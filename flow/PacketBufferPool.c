@@ -0,0 +1,259 @@
+/**
+ * @file PacketBufferPool.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+
+#include <flow/PacketBufferPool.h>
+
+struct PacketBufferPool__buffer {
+    LinkedList1Node list_node;
+    int len;
+};
+
+static uint8_t * buffer_data (struct PacketBufferPool__buffer *b)
+{
+    return (uint8_t *)b + sizeof(struct PacketBufferPool__buffer);
+}
+
+static struct PacketBufferPool__buffer * pool_get (PacketBufferPool *o)
+{
+    if (o->num_used == o->max_buffers) {
+        return NULL;
+    }
+    
+    struct PacketBufferPool__buffer *b;
+    
+    // reuse a free buffer, or allocate a new one
+    LinkedList1Node *node = LinkedList1_GetLast(&o->free_list);
+    if (node) {
+        b = UPPER_OBJECT(node, struct PacketBufferPool__buffer, list_node);
+        LinkedList1_Remove(&o->free_list, &b->list_node);
+        o->num_free--;
+    } else {
+        if (!(b = (struct PacketBufferPool__buffer *)BAllocSize(bsize_add(bsize_fromsize(sizeof(*b)), bsize_fromint(o->buffer_size))))) {
+            return NULL;
+        }
+    }
+    
+    o->num_used++;
+    
+    return b;
+}
+
+static void pool_put (PacketBufferPool *o, struct PacketBufferPool__buffer *b)
+{
+    ASSERT(o->num_used > 0)
+    
+    o->num_used--;
+    
+    // keep the buffer for reuse, or release it
+    if (o->num_free < o->max_free_buffers) {
+        LinkedList1_Append(&o->free_list, &b->list_node);
+        o->num_free++;
+    } else {
+        BFree(b);
+    }
+}
+
+static void flow_send_first (PacketBufferPoolFlow *o)
+{
+    ASSERT(!o->sending)
+    ASSERT(!LinkedList1_IsEmpty(&o->queue))
+    
+    struct PacketBufferPool__buffer *b = UPPER_OBJECT(LinkedList1_GetFirst(&o->queue), struct PacketBufferPool__buffer, list_node);
+    
+    o->sending = 1;
+    PacketPassInterface_Sender_Send(o->output, buffer_data(b), b->len);
+}
+
+static void flow_output_handler_done (PacketBufferPoolFlow *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->sending)
+    
+    // release the sent buffer
+    struct PacketBufferPool__buffer *b = UPPER_OBJECT(LinkedList1_GetFirst(&o->queue), struct PacketBufferPool__buffer, list_node);
+    LinkedList1_Remove(&o->queue, &b->list_node);
+    o->num_buffers--;
+    pool_put(o->pool, b);
+    
+    o->sending = 0;
+    
+    // send the next packet
+    if (!LinkedList1_IsEmpty(&o->queue)) {
+        flow_send_first(o);
+    }
+}
+
+void PacketBufferPool_Init (PacketBufferPool *o, int buffer_size, int max_buffers, int max_free_buffers)
+{
+    ASSERT(buffer_size >= 0)
+    ASSERT(max_buffers > 0)
+    ASSERT(max_free_buffers >= 0)
+    
+    // init arguments
+    o->buffer_size = buffer_size;
+    o->max_buffers = max_buffers;
+    o->max_free_buffers = max_free_buffers;
+    
+    // set no buffers used
+    o->num_used = 0;
+    
+    // init free list
+    LinkedList1_Init(&o->free_list);
+    o->num_free = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_flows_ctr);
+}
+
+void PacketBufferPool_Free (PacketBufferPool *o)
+{
+    ASSERT(o->num_used == 0)
+    DebugCounter_Free(&o->d_flows_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // free free buffers
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->free_list)) {
+        struct PacketBufferPool__buffer *b = UPPER_OBJECT(node, struct PacketBufferPool__buffer, list_node);
+        LinkedList1_Remove(&o->free_list, &b->list_node);
+        BFree(b);
+    }
+}
+
+int PacketBufferPool_GetBufferSize (PacketBufferPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->buffer_size;
+}
+
+int PacketBufferPool_GetNumUsed (PacketBufferPool *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_used;
+}
+
+void PacketBufferPoolFlow_Init (PacketBufferPoolFlow *o, PacketBufferPool *pool, int quota, PacketPassInterface *output)
+{
+    DebugObject_Access(&pool->d_obj);
+    ASSERT(quota > 0)
+    ASSERT(PacketPassInterface_GetMTU(output) >= pool->buffer_size)
+    
+    // init arguments
+    o->pool = pool;
+    o->quota = quota;
+    o->output = output;
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)flow_output_handler_done, o);
+    
+    // init queue
+    LinkedList1_Init(&o->queue);
+    o->num_buffers = 0;
+    
+    // set not writing
+    o->writing = NULL;
+    
+    // set not sending
+    o->sending = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&pool->d_flows_ctr);
+}
+
+void PacketBufferPoolFlow_Free (PacketBufferPoolFlow *o)
+{
+    DebugCounter_Decrement(&o->pool->d_flows_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // release the buffer being written
+    if (o->writing) {
+        pool_put(o->pool, o->writing);
+    }
+    
+    // release queued buffers
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&o->queue)) {
+        struct PacketBufferPool__buffer *b = UPPER_OBJECT(node, struct PacketBufferPool__buffer, list_node);
+        LinkedList1_Remove(&o->queue, &b->list_node);
+        pool_put(o->pool, b);
+    }
+}
+
+int PacketBufferPoolFlow_StartPacket (PacketBufferPoolFlow *o, uint8_t **data)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->writing)
+    ASSERT(data)
+    
+    // check quota
+    if (o->num_buffers == o->quota) {
+        return 0;
+    }
+    
+    // get a buffer
+    struct PacketBufferPool__buffer *b = pool_get(o->pool);
+    if (!b) {
+        return 0;
+    }
+    
+    o->writing = b;
+    o->num_buffers++;
+    
+    *data = buffer_data(b);
+    return 1;
+}
+
+void PacketBufferPoolFlow_EndPacket (PacketBufferPoolFlow *o, int len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->writing)
+    ASSERT(len >= 0)
+    ASSERT(len <= o->pool->buffer_size)
+    
+    // queue the packet
+    struct PacketBufferPool__buffer *b = o->writing;
+    b->len = len;
+    LinkedList1_Append(&o->queue, &b->list_node);
+    
+    // set not writing
+    o->writing = NULL;
+    
+    // start sending if idle
+    if (!o->sending) {
+        flow_send_first(o);
+    }
+}
@@ -0,0 +1,156 @@
+/**
+ * @file PacketBufferPool.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Bounded pool of packet buffers shared by many packet queues, each
+ * with a {@link PacketPassInterface} output.
+ * 
+ * A queue only holds buffers while it has packets queued, so memory
+ * use follows the number of packets in flight rather than the number
+ * of queues. Each queue is limited to a quota of buffers, and the
+ * pool as a whole to a maximum number of buffers.
+ */
+
+#ifndef BADVPN_FLOW_PACKETBUFFERPOOL_H
+#define BADVPN_FLOW_PACKETBUFFERPOOL_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <flow/PacketPassInterface.h>
+
+struct PacketBufferPool__buffer;
+
+/**
+ * Bounded pool of packet buffers.
+ */
+typedef struct {
+    int buffer_size;
+    int max_buffers;
+    int max_free_buffers;
+    int num_used;
+    LinkedList1 free_list;
+    int num_free;
+    DebugObject d_obj;
+    DebugCounter d_flows_ctr;
+} PacketBufferPool;
+
+/**
+ * Packet queue taking buffers from a {@link PacketBufferPool}.
+ */
+typedef struct {
+    PacketBufferPool *pool;
+    int quota;
+    PacketPassInterface *output;
+    LinkedList1 queue;
+    int num_buffers;
+    struct PacketBufferPool__buffer *writing;
+    int sending;
+    DebugObject d_obj;
+} PacketBufferPoolFlow;
+
+/**
+ * Initializes the pool.
+ * 
+ * @param o the object
+ * @param buffer_size size of each buffer, i.e. maximum packet size. Must be >=0.
+ * @param max_buffers maximum number of buffers holding packets. Must be >0.
+ * @param max_free_buffers maximum number of unused buffers to keep allocated
+ *                         for reuse. Must be >=0.
+ */
+void PacketBufferPool_Init (PacketBufferPool *o, int buffer_size, int max_buffers, int max_free_buffers);
+
+/**
+ * Frees the pool.
+ * There must be no flows.
+ * 
+ * @param o the object
+ */
+void PacketBufferPool_Free (PacketBufferPool *o);
+
+/**
+ * Returns the size of the buffers.
+ * 
+ * @param o the object
+ * @return buffer size
+ */
+int PacketBufferPool_GetBufferSize (PacketBufferPool *o);
+
+/**
+ * Returns the number of buffers currently holding packets.
+ * 
+ * @param o the object
+ * @return number of used buffers
+ */
+int PacketBufferPool_GetNumUsed (PacketBufferPool *o);
+
+/**
+ * Initializes a flow.
+ * 
+ * @param o the object
+ * @param pool pool to take buffers from
+ * @param quota maximum number of buffers this flow can hold at once,
+ *              including the one being sent. Must be >0.
+ * @param output output interface. Its MTU must be >= the buffer size of the pool.
+ */
+void PacketBufferPoolFlow_Init (PacketBufferPoolFlow *o, PacketBufferPool *pool, int quota, PacketPassInterface *output);
+
+/**
+ * Frees the flow, releasing any buffers it holds.
+ * The output may be left busy; it must be freed or reset together with the flow.
+ * 
+ * @param o the object
+ */
+void PacketBufferPoolFlow_Free (PacketBufferPoolFlow *o);
+
+/**
+ * Starts writing a packet.
+ * Fails if the flow has used up its quota, or the pool has no buffers left.
+ * There must be no packet being written.
+ * 
+ * @param o the object
+ * @param data returns the location to write the packet to, of size equal to
+ *             the buffer size of the pool
+ * @return 1 on success, 0 if no buffer is available
+ */
+int PacketBufferPoolFlow_StartPacket (PacketBufferPoolFlow *o, uint8_t **data) WARN_UNUSED;
+
+/**
+ * Finishes writing a packet and queues it for sending.
+ * There must be a packet being written.
+ * 
+ * @param o the object
+ * @param len length of the packet. Must be >=0 and <= the buffer size of the pool.
+ */
+void PacketBufferPoolFlow_EndPacket (PacketBufferPoolFlow *o, int len);
+
+#endif
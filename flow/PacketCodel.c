@@ -0,0 +1,151 @@
+/**
+ * @file PacketCodel.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <flow/PacketCodel.h>
+
+// don't let the drop rate grow without bound
+#define MAX_COUNT 0xFFFF
+
+static uint64_t isqrt (uint64_t x)
+{
+    uint64_t res = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    
+    while (bit > x) {
+        bit >>= 2;
+    }
+    
+    while (bit != 0) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    
+    return res;
+}
+
+static int64_t control_law (PacketCodel *o, int64_t t)
+{
+    ASSERT(o->count > 0)
+    
+    // t + interval / sqrt(count), in 16.16 fixed point
+    return t + (int64_t)(((uint64_t)o->params.interval << 16) / isqrt((uint64_t)o->count << 32));
+}
+
+static int ok_to_drop (PacketCodel *o, int64_t now, int64_t enqueue_time, int is_last)
+{
+    int64_t sojourn = now - enqueue_time;
+    
+    if (sojourn < o->params.target || is_last) {
+        // went below target, or the queue is about to drain
+        o->first_above_time = 0;
+        return 0;
+    }
+    
+    if (o->first_above_time == 0) {
+        // went above target, give it an interval to go away
+        o->first_above_time = now + o->params.interval;
+        return 0;
+    }
+    
+    return (now >= o->first_above_time);
+}
+
+void PacketCodel_Init (PacketCodel *o, const struct PacketCodel_params *params)
+{
+    ASSERT(params->clock)
+    ASSERT(params->target > 0)
+    ASSERT(params->interval > 0)
+    
+    o->params = *params;
+    o->dropping = 0;
+    o->count = 0;
+    o->last_count = 0;
+    o->first_above_time = 0;
+    o->drop_next = 0;
+    o->num_dropped = 0;
+}
+
+int64_t PacketCodel_Now (PacketCodel *o)
+{
+    return o->params.clock();
+}
+
+int PacketCodel_ShouldDrop (PacketCodel *o, int64_t now, int64_t enqueue_time, int is_last)
+{
+    int ok = ok_to_drop(o, now, enqueue_time, is_last);
+    
+    if (o->dropping) {
+        if (!ok) {
+            // delay is back under control
+            o->dropping = 0;
+            return 0;
+        }
+        
+        if (now < o->drop_next) {
+            return 0;
+        }
+        
+        // drop, and schedule the next drop sooner
+        if (o->count < MAX_COUNT) {
+            o->count++;
+        }
+        o->drop_next = control_law(o, o->drop_next);
+        o->num_dropped++;
+        return 1;
+    }
+    
+    if (!ok) {
+        return 0;
+    }
+    
+    // enter dropping state. If we were dropping recently, resume close to the
+    // drop rate we left off at rather than starting over.
+    o->dropping = 1;
+    int delta = o->count - o->last_count;
+    if (delta > 1 && now - o->drop_next < 16 * o->params.interval) {
+        o->count = delta;
+    } else {
+        o->count = 1;
+    }
+    o->last_count = o->count;
+    o->drop_next = control_law(o, now);
+    o->num_dropped++;
+    
+    return 1;
+}
+
+uint64_t PacketCodel_GetNumDropped (PacketCodel *o)
+{
+    return o->num_dropped;
+}
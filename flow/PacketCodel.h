@@ -0,0 +1,126 @@
+/**
+ * @file PacketCodel.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * CoDel active queue management controller for packet buffers.
+ */
+
+#ifndef BADVPN_FLOW_PACKETCODEL_H
+#define BADVPN_FLOW_PACKETCODEL_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+/**
+ * Function returning the current time in milliseconds, such as btime_gettime.
+ */
+typedef int64_t (*PacketCodel_clock) (void);
+
+/**
+ * CoDel parameters.
+ */
+struct PacketCodel_params {
+    /**
+     * Clock to timestamp packets with.
+     */
+    PacketCodel_clock clock;
+    
+    /**
+     * Acceptable standing queue delay in milliseconds. Must be >0.
+     */
+    int64_t target;
+    
+    /**
+     * Time in milliseconds the queue delay must stay above target before
+     * packets are dropped; also the initial spacing of drops.
+     * Should be about a worst-case round-trip time. Must be >0.
+     */
+    int64_t interval;
+};
+
+/**
+ * CoDel active queue management controller for packet buffers.
+ * 
+ * The buffer timestamps packets with {@link PacketCodel_Now} when they are
+ * queued. Before sending the first queued packet, it asks the controller with
+ * {@link PacketCodel_ShouldDrop} whether to drop it instead, and repeats this
+ * for following packets until the answer is no.
+ * When the delay packets spend in the buffer stays above target for an interval,
+ * the controller starts dropping packets at an increasing rate, until the delay
+ * falls below target. Senders using congestion control will slow down, so the
+ * buffer stays short without having to be made small.
+ */
+typedef struct {
+    struct PacketCodel_params params;
+    int dropping;
+    int count;
+    int last_count;
+    int64_t first_above_time;
+    int64_t drop_next;
+    uint64_t num_dropped;
+} PacketCodel;
+
+/**
+ * Initializes the controller.
+ * 
+ * @param o the object
+ * @param params parameters. The structure is copied.
+ */
+void PacketCodel_Init (PacketCodel *o, const struct PacketCodel_params *params);
+
+/**
+ * Returns the current time from the controller's clock.
+ * 
+ * @param o the object
+ * @return current time in milliseconds
+ */
+int64_t PacketCodel_Now (PacketCodel *o);
+
+/**
+ * Decides whether the first packet in the buffer should be dropped instead of sent.
+ * 
+ * @param o the object
+ * @param now current time, as returned by {@link PacketCodel_Now}
+ * @param enqueue_time time the packet was queued, as returned by {@link PacketCodel_Now}
+ * @param is_last whether this is the only packet in the buffer. The last packet
+ *                is never considered to be part of a standing queue.
+ * @return 1 to drop the packet, 0 to send it
+ */
+int PacketCodel_ShouldDrop (PacketCodel *o, int64_t now, int64_t enqueue_time, int is_last);
+
+/**
+ * Returns the number of packets the controller decided to drop.
+ * 
+ * @param o the object
+ * @return number of dropped packets
+ */
+uint64_t PacketCodel_GetNumDropped (PacketCodel *o);
+
+#endif
@@ -96,10 +96,12 @@ void PacketCopier_Init (PacketCopier *o, int mtu, BPendingGroup *pg)
     
     // init input
     PacketPassInterface_Init(&o->input, mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketCopier");
     PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     
     // init output
     PacketRecvInterface_Init(&o->output, mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->output), "PacketCopier");
     
     // set no input packet
     o->in_len = -1;
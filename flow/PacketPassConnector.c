@@ -72,6 +72,7 @@ void PacketPassConnector_Init (PacketPassConnector *o, int mtu, BPendingGroup *p
     
     // init input
     PacketPassInterface_Init(&o->input, o->input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketPassConnector");
     
     // have no input packet
     o->in_len = -1;
@@ -49,6 +49,20 @@ static int compare_flows (PacketPassFairQueueFlow *f1, PacketPassFairQueueFlow *
 #include "PacketPassFairQueue_tree.h"
 #include <structure/SAvl_impl.h>
 
+static uint64_t packet_cost (PacketPassFairQueue *m, int data_len)
+{
+    return (uint64_t)m->packet_weight + data_len;
+}
+
+static int has_queued (PacketPassFairQueue *m)
+{
+    if (m->mode == FAIRQUEUE_MODE_DRR) {
+        return !LinkedList1_IsEmpty(&m->drr_list);
+    }
+    
+    return !PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree);
+}
+
 static uint64_t get_current_time (PacketPassFairQueue *m)
 {
     if (m->sending_flow) {
@@ -120,14 +134,29 @@ static void schedule (PacketPassFairQueue *m)
     ASSERT(!m->sending_flow)
     ASSERT(!m->previous_flow)
     ASSERT(!m->freeing)
-    ASSERT(!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(has_queued(m))
     
-    // get first queued flow
-    PacketPassFairQueueFlow *qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
-    ASSERT(qflow->is_queued)
+    PacketPassFairQueueFlow *qflow;
     
-    // remove flow from queue
-    PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    if (m->mode == FAIRQUEUE_MODE_DRR) {
+        // get flow whose turn it is
+        qflow = UPPER_OBJECT(LinkedList1_GetFirst(&m->drr_list), PacketPassFairQueueFlow, queued.drr_list_node);
+        ASSERT(qflow->is_queued)
+        ASSERT(qflow->deficit >= packet_cost(m, qflow->queued.data_len))
+        
+        // remove flow from queue
+        LinkedList1_Remove(&m->drr_list, &qflow->queued.drr_list_node);
+        
+        // charge the packet to the flow's turn
+        qflow->deficit -= packet_cost(m, qflow->queued.data_len);
+    } else {
+        // get first queued flow
+        qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
+        ASSERT(qflow->is_queued)
+        
+        // remove flow from queue
+        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    }
     qflow->is_queued = 0;
     
     // schedule send
@@ -145,7 +174,7 @@ static void schedule_job_handler (PacketPassFairQueue *m)
     // remove previous flow
     m->previous_flow = NULL;
     
-    if (!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree)) {
+    if (has_queued(m)) {
         schedule(m);
     }
 }
@@ -159,21 +188,44 @@ static void input_handler_send (PacketPassFairQueueFlow *flow, uint8_t *data, in
     ASSERT(!m->freeing)
     DebugObject_Access(&flow->d_obj);
     
-    if (flow == m->previous_flow) {
-        // remove from previous flow
-        m->previous_flow = NULL;
-    } else {
-        // raise time
-        flow->time = bmax_uint64(flow->time, get_current_time(m));
-    }
-    
     // queue flow
     flow->queued.data = data;
     flow->queued.data_len = data_len;
-    int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
-    ASSERT_EXECUTE(res)
     flow->is_queued = 1;
     
+    if (m->mode == FAIRQUEUE_MODE_DRR) {
+        uint64_t turn_quantum = m->drr_quantum * flow->weight;
+        
+        if (flow == m->previous_flow) {
+            // remove from previous flow
+            m->previous_flow = NULL;
+            
+            if (flow->deficit >= packet_cost(m, data_len)) {
+                // the flow's turn continues
+                LinkedList1_Prepend(&m->drr_list, &flow->queued.drr_list_node);
+            } else {
+                // the flow's turn is over, credit the next one
+                flow->deficit += turn_quantum;
+                LinkedList1_Append(&m->drr_list, &flow->queued.drr_list_node);
+            }
+        } else {
+            // the flow was idle, start a fresh turn
+            flow->deficit = turn_quantum;
+            LinkedList1_Append(&m->drr_list, &flow->queued.drr_list_node);
+        }
+    } else {
+        if (flow == m->previous_flow) {
+            // remove from previous flow
+            m->previous_flow = NULL;
+        } else {
+            // raise time
+            flow->time = bmax_uint64(flow->time, get_current_time(m));
+        }
+        
+        int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
+        ASSERT_EXECUTE(res)
+    }
+    
     if (!m->sending_flow && !BPending_IsSet(&m->schedule_job)) {
         schedule(m);
     }
@@ -196,7 +248,9 @@ static void output_handler_done (PacketPassFairQueue *m)
     m->previous_flow = flow;
     
     // update flow time by packet size
-    increment_sent_flow(flow, (uint64_t)m->packet_weight + m->sending_len);
+    if (m->mode == FAIRQUEUE_MODE_VTIME) {
+        increment_sent_flow(flow, packet_cost(m, m->sending_len) * FAIRQUEUE_MAX_WEIGHT / flow->weight);
+    }
     
     // schedule schedule
     BPending_Set(&m->schedule_job);
@@ -217,25 +271,36 @@ static void output_handler_done (PacketPassFairQueue *m)
 }
 
 int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight)
+{
+    return PacketPassFairQueue_InitMode(m, output, pg, use_cancel, packet_weight, FAIRQUEUE_MODE_VTIME);
+}
+
+int PacketPassFairQueue_InitMode (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight, int mode)
 {
     ASSERT(packet_weight > 0)
     ASSERT(use_cancel == 0 || use_cancel == 1)
     ASSERT(!use_cancel || PacketPassInterface_HasCancel(output))
+    ASSERT(mode == FAIRQUEUE_MODE_VTIME || mode == FAIRQUEUE_MODE_DRR)
     
     // init arguments
     m->output = output;
     m->pg = pg;
     m->use_cancel = use_cancel;
     m->packet_weight = packet_weight;
+    m->mode = mode;
     
-    // make sure that (output MTU + packet_weight <= FAIRQUEUE_MAX_TIME)
+    // make sure that ((output MTU + packet_weight) * FAIRQUEUE_MAX_WEIGHT <= FAIRQUEUE_MAX_TIME),
+    // so that the time increment of a packet fits
     if (!(
-        (PacketPassInterface_GetMTU(output) <= FAIRQUEUE_MAX_TIME) &&
-        (packet_weight <= FAIRQUEUE_MAX_TIME - PacketPassInterface_GetMTU(output))
+        (PacketPassInterface_GetMTU(output) <= FAIRQUEUE_MAX_TIME / FAIRQUEUE_MAX_WEIGHT) &&
+        (packet_weight <= FAIRQUEUE_MAX_TIME / FAIRQUEUE_MAX_WEIGHT - PacketPassInterface_GetMTU(output))
     )) {
         goto fail0;
     }
     
+    // a quantum of a flow of weight 1 covers the largest packet
+    m->drr_quantum = packet_cost(m, PacketPassInterface_GetMTU(output));
+    
     // init output
     PacketPassInterface_Sender_Init(m->output, (PacketPassInterface_handler_done)output_handler_done, m);
     
@@ -248,6 +313,9 @@ int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *outpu
     // init queued tree
     PacketPassFairQueue__Tree_Init(&m->queued_tree);
     
+    // init DRR list
+    LinkedList1_Init(&m->drr_list);
+    
     // init flows list
     LinkedList1_Init(&m->flows_list);
     
@@ -269,6 +337,7 @@ void PacketPassFairQueue_Free (PacketPassFairQueue *m)
 {
     ASSERT(LinkedList1_IsEmpty(&m->flows_list))
     ASSERT(PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(LinkedList1_IsEmpty(&m->drr_list))
     ASSERT(!m->previous_flow)
     ASSERT(!m->sending_flow)
     DebugCounter_Free(&m->d_ctr);
@@ -306,10 +375,17 @@ void PacketPassFairQueueFlow_Init (PacketPassFairQueueFlow *flow, PacketPassFair
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&flow->input), "PacketPassFairQueue");
+    
+    // set weight
+    flow->weight = 1;
     
     // set time
     flow->time = 0;
     
+    // set deficit
+    flow->deficit = 0;
+    
     // add to flows list
     LinkedList1_Append(&m->flows_list, &flow->list_node);
     
@@ -340,7 +416,11 @@ void PacketPassFairQueueFlow_Free (PacketPassFairQueueFlow *flow)
     
     // remove from queue
     if (flow->is_queued) {
-        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        if (m->mode == FAIRQUEUE_MODE_DRR) {
+            LinkedList1_Remove(&m->drr_list, &flow->queued.drr_list_node);
+        } else {
+            PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        }
     }
     
     // remove from flows list
@@ -397,6 +477,15 @@ void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, Pack
     flow->user = user;
 }
 
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight)
+{
+    ASSERT(weight >= 1)
+    ASSERT(weight <= FAIRQUEUE_MAX_WEIGHT)
+    DebugObject_Access(&flow->d_obj);
+    
+    flow->weight = weight;
+}
+
 PacketPassInterface * PacketPassFairQueueFlow_GetInput (PacketPassFairQueueFlow *flow)
 {
     DebugObject_Access(&flow->d_obj);
@@ -29,6 +29,12 @@
  * @section DESCRIPTION
  * 
  * Fair queue using {@link PacketPassInterface}.
+ * 
+ * Two scheduling modes are available. In virtual time mode, flows are ordered
+ * by the amount of data they have sent, scaled by their weights, which costs
+ * a tree operation per packet. In deficit round robin mode, flows with a packet
+ * queued take turns in a list, and each turn lets a flow send data up to a
+ * quantum proportional to its weight, which costs constant time per packet.
  */
 
 #ifndef BADVPN_FLOW_PACKETPASSFAIRQUEUE_H
@@ -47,6 +53,13 @@
 // reduce this to test time overflow handling
 #define FAIRQUEUE_MAX_TIME UINT64_MAX
 
+// maximum flow weight
+#define FAIRQUEUE_MAX_WEIGHT 256
+
+// scheduling modes
+#define FAIRQUEUE_MODE_VTIME 0
+#define FAIRQUEUE_MODE_DRR 1
+
 typedef void (*PacketPassFairQueue_handler_busy) (void *user);
 
 struct PacketPassFairQueueFlow_s;
@@ -59,11 +72,14 @@ typedef struct PacketPassFairQueueFlow_s {
     PacketPassFairQueue_handler_busy handler_busy;
     void *user;
     PacketPassInterface input;
+    int weight;
     uint64_t time;
+    uint64_t deficit;
     LinkedList1Node list_node;
     int is_queued;
     struct {
         PacketPassFairQueue__TreeNode tree_node;
+        LinkedList1Node drr_list_node;
         uint8_t *data;
         int data_len;
     } queued;
@@ -78,10 +94,13 @@ typedef struct PacketPassFairQueue_s {
     BPendingGroup *pg;
     int use_cancel;
     int packet_weight;
+    int mode;
+    uint64_t drr_quantum;
     struct PacketPassFairQueueFlow_s *sending_flow;
     int sending_len;
     struct PacketPassFairQueueFlow_s *previous_flow;
     PacketPassFairQueue__Tree queued_tree;
+    LinkedList1 drr_list;
     LinkedList1 flows_list;
     int freeing;
     BPending schedule_job;
@@ -89,6 +108,21 @@ typedef struct PacketPassFairQueue_s {
     DebugCounter d_ctr;
 } PacketPassFairQueue;
 
+/**
+ * Initializes the queue in virtual time mode.
+ * Equivalent to {@link PacketPassFairQueue_InitMode} with FAIRQUEUE_MODE_VTIME.
+ * 
+ * @param m the object
+ * @param output output interface
+ * @param pg pending group
+ * @param use_cancel whether cancel functionality is required. Must be 0 or 1.
+ *                   If 1, output must support cancel functionality.
+ * @param packet_weight additional weight a packet bears. Must be >0, to keep
+ *                      the queue fair for zero size packets.
+ * @return 1 on success, 0 on failure (because output MTU is too large)
+ */
+int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight) WARN_UNUSED;
+
 /**
  * Initializes the queue.
  *
@@ -99,9 +133,12 @@ typedef struct PacketPassFairQueue_s {
  *                   If 1, output must support cancel functionality.
  * @param packet_weight additional weight a packet bears. Must be >0, to keep
  *                      the queue fair for zero size packets.
+ * @param mode scheduling mode, FAIRQUEUE_MODE_VTIME or FAIRQUEUE_MODE_DRR.
+ *             In DRR mode, the quantum for a flow of weight 1 is the output MTU
+ *             plus packet_weight, so a flow sends at least one packet per turn.
  * @return 1 on success, 0 on failure (because output MTU is too large)
  */
-int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight) WARN_UNUSED;
+int PacketPassFairQueue_InitMode (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight, int mode) WARN_UNUSED;
 
 /**
  * Frees the queue.
@@ -193,6 +230,17 @@ void PacketPassFairQueueFlow_RequestCancel (PacketPassFairQueueFlow *flow);
  */
 void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, PacketPassFairQueue_handler_busy handler, void *user);
 
+/**
+ * Sets the weight of the flow. A flow's share of the output is proportional
+ * to its weight, relative to other flows with packets queued.
+ * Newly initialized flows have weight 1.
+ * The new weight applies to packets the flow sends from now on.
+ * 
+ * @param flow the object
+ * @param weight new weight. Must be >=1 and <=FAIRQUEUE_MAX_WEIGHT.
+ */
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight);
+
 /**
  * Returns the input interface of the flow.
  *
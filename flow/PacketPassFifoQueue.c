@@ -171,6 +171,7 @@ void PacketPassFifoQueueFlow_Init (PacketPassFifoQueueFlow *o, PacketPassFifoQue
     
     // init input
     PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(queue->output), (PacketPassInterface_handler_send)input_handler_send, o, queue->pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketPassFifoQueue");
     
     // set not waiting
     o->is_waiting = 0;
@@ -62,6 +62,8 @@ void _PacketPassInterface_job_done (PacketPassInterface *i)
     // set state
     i->state = PPI_STATE_NONE;
     
+    FlowTrace_End(&i->trace, i->job_operation_len);
+    
     // call handler
     i->handler_done(i->user_user);
     return;
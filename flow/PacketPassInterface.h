@@ -40,6 +40,7 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowTrace.h>
 
 #define PPI_STATE_NONE 1
 #define PPI_STATE_OPERATION_PENDING 2
@@ -78,6 +79,8 @@ typedef struct {
     int state;
     int cancel_requested;
     
+    FlowTrace trace;
+    
     DebugObject d_obj;
 } PacketPassInterface;
 
@@ -99,6 +102,8 @@ static void PacketPassInterface_Sender_RequestCancel (PacketPassInterface *i);
 
 static int PacketPassInterface_HasCancel (PacketPassInterface *i);
 
+static FlowTrace * PacketPassInterface_GetTrace (PacketPassInterface *i);
+
 void _PacketPassInterface_job_operation (PacketPassInterface *i);
 void _PacketPassInterface_job_requestcancel (PacketPassInterface *i);
 void _PacketPassInterface_job_done (PacketPassInterface *i);
@@ -124,6 +129,10 @@ void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterf
     // set state
     i->state = PPI_STATE_NONE;
     
+    // init trace
+    FlowTrace_Init(&i->trace, "PacketPass");
+    FlowTrace_SetSink(&i->trace, user);
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -131,6 +140,9 @@ void PacketPassInterface_Free (PacketPassInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    // free trace
+    FlowTrace_Free(&i->trace);
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_requestcancel);
@@ -176,6 +188,8 @@ void PacketPassInterface_Sender_Init (PacketPassInterface *i, PacketPassInterfac
     
     i->handler_done = handler_done;
     i->user_user = user;
+    
+    FlowTrace_SetSource(&i->trace, user);
 }
 
 void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int data_len)
@@ -195,6 +209,8 @@ void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int
     // set state
     i->state = PPI_STATE_OPERATION_PENDING;
     i->cancel_requested = 0;
+    
+    FlowTrace_Begin(&i->trace);
 }
 
 void PacketPassInterface_Sender_RequestCancel (PacketPassInterface *i)
@@ -233,4 +249,11 @@ int PacketPassInterface_HasCancel (PacketPassInterface *i)
     return !!i->handler_requestcancel;
 }
 
+FlowTrace * PacketPassInterface_GetTrace (PacketPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return &i->trace;
+}
+
 #endif
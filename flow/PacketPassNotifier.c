@@ -66,6 +66,7 @@ void PacketPassNotifier_Init (PacketPassNotifier *o, PacketPassInterface *output
     
     // init input
     PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketPassNotifier");
     if (PacketPassInterface_HasCancel(o->output)) {
         PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     }
@@ -198,6 +198,7 @@ void PacketPassPriorityQueueFlow_Init (PacketPassPriorityQueueFlow *flow, Packet
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&flow->input), "PacketPassPriorityQueue");
     
     // is not queued
     flow->is_queued = 0;
@@ -29,20 +29,132 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+
+#ifdef BADVPN_LINUX
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #include <misc/debug.h>
 #include <misc/byteorder.h>
 #include <misc/minmax.h>
+#include <misc/balign.h>
 #include <base/BLog.h>
 
 #include <flow/PacketProtoDecoder.h>
 
 #include <generated/blog_channel_PacketProtoDecoder.h>
 
+#if defined(BADVPN_LINUX) && defined(__NR_memfd_create)
+#define PACKETPROTODECODER_MIRRORED 1
+#endif
+
+// Smallest encoded packet size for which the mirrored buffer is used.
+// Each mirrored buffer costs two mappings and a memfd inode; for smaller
+// packets, moving the buffered data is cheaper.
+#define PACKETPROTODECODER_MIRRORED_MIN_SIZE 8192
+
+static int alloc_buffer (PacketProtoDecoder *enc);
+static void free_buffer (PacketProtoDecoder *enc);
+static int recv_space (PacketProtoDecoder *enc);
 static void process_data (PacketProtoDecoder *enc);
 static void input_handler_done (PacketProtoDecoder *enc, int data_len);
 static void output_handler_done (PacketProtoDecoder *enc);
 
+#ifdef PACKETPROTODECODER_MIRRORED
+
+static uint8_t * alloc_mirrored (int size)
+{
+    // create the memory object backing both halves of the mapping
+    int fd = syscall(__NR_memfd_create, "PacketProtoDecoder", 1 /* MFD_CLOEXEC */);
+    if (fd < 0) {
+        goto fail0;
+    }
+    
+    if (ftruncate(fd, size) < 0) {
+        goto fail1;
+    }
+    
+    // reserve address space for both halves
+    uint8_t *addr = mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        goto fail1;
+    }
+    
+    // map the object into each half
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        goto fail2;
+    }
+    if (mmap(addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        goto fail2;
+    }
+    
+    close(fd);
+    
+    return addr;
+    
+fail2:
+    munmap(addr, 2 * (size_t)size);
+fail1:
+    close(fd);
+fail0:
+    return NULL;
+}
+
+#endif
+
+int alloc_buffer (PacketProtoDecoder *enc)
+{
+    int packet_size = PACKETPROTO_ENCLEN(enc->output_mtu);
+    
+#ifdef PACKETPROTODECODER_MIRRORED
+    // make the ring big enough for two packets, rounded up to whole pages
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (packet_size >= PACKETPROTODECODER_MIRRORED_MIN_SIZE && page_size > 0 && page_size <= INT_MAX / 4) {
+        int size = bdivide_up(2 * packet_size, page_size) * page_size;
+        if ((enc->buf = alloc_mirrored(size))) {
+            enc->buf_size = size;
+            enc->buf_mirrored = 1;
+            return 1;
+        }
+        BLog(BLOG_DEBUG, "failed to set up mirrored buffer, using a plain one");
+    }
+#endif
+    
+    if (!(enc->buf = (uint8_t *)malloc(packet_size))) {
+        return 0;
+    }
+    enc->buf_size = packet_size;
+    enc->buf_mirrored = 0;
+    
+    return 1;
+}
+
+void free_buffer (PacketProtoDecoder *enc)
+{
+#ifdef PACKETPROTODECODER_MIRRORED
+    if (enc->buf_mirrored) {
+        munmap(enc->buf, 2 * (size_t)enc->buf_size);
+        return;
+    }
+#endif
+    
+    free(enc->buf);
+}
+
+int recv_space (PacketProtoDecoder *enc)
+{
+    // with a mirrored buffer, all free space follows the buffered data;
+    // otherwise only the space up to the end of the buffer does
+    if (enc->buf_mirrored) {
+        return enc->buf_size - enc->buf_used;
+    }
+    
+    return enc->buf_size - (enc->buf_start + enc->buf_used);
+}
+
 void process_data (PacketProtoDecoder *enc)
 {
     int was_error = 0;
@@ -86,6 +198,11 @@ void process_data (PacketProtoDecoder *enc)
         // reset buffer
         enc->buf_start = 0;
         enc->buf_used = 0;
+    } else if (enc->buf_mirrored) {
+        // the second half mirrors the first, so just wrap the start around
+        if (enc->buf_start >= enc->buf_size) {
+            enc->buf_start -= enc->buf_size;
+        }
     } else {
         // if we reached the end of the buffer, wrap around to allow more data to be received
         if (enc->buf_start + enc->buf_used == enc->buf_size) {
@@ -95,7 +212,7 @@ void process_data (PacketProtoDecoder *enc)
     }
     
     // receive data
-    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf + (enc->buf_start + enc->buf_used), enc->buf_size - (enc->buf_start + enc->buf_used));
+    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf + (enc->buf_start + enc->buf_used), recv_space(enc));
     
     // if we had error, report it
     if (was_error) {
@@ -107,7 +224,7 @@ void process_data (PacketProtoDecoder *enc)
 static void input_handler_done (PacketProtoDecoder *enc, int data_len)
 {
     ASSERT(data_len > 0)
-    ASSERT(data_len <= enc->buf_size - (enc->buf_start + enc->buf_used))
+    ASSERT(data_len <= recv_space(enc))
     DebugObject_Access(&enc->d_obj);
     
     // update buffer
@@ -145,17 +262,16 @@ int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input
     enc->output_mtu = bmin_int(PacketPassInterface_GetMTU(enc->output), PACKETPROTO_MAXPAYLOAD);
     
     // init buffer state
-    enc->buf_size = PACKETPROTO_ENCLEN(enc->output_mtu);
     enc->buf_start = 0;
     enc->buf_used = 0;
     
     // allocate buffer
-    if (!(enc->buf = (uint8_t *)malloc(enc->buf_size))) {
+    if (!alloc_buffer(enc)) {
         goto fail0;
     }
     
     // start receiving
-    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf, enc->buf_size);
+    StreamRecvInterface_Receiver_Recv(enc->input, enc->buf, recv_space(enc));
     
     DebugObject_Init(&enc->d_obj);
     
@@ -170,7 +286,7 @@ void PacketProtoDecoder_Free (PacketProtoDecoder *enc)
     DebugObject_Free(&enc->d_obj);
     
     // free buffer
-    free(enc->buf);
+    free_buffer(enc);
 }
 
 void PacketProtoDecoder_Reset (PacketProtoDecoder *enc)
@@ -179,4 +295,8 @@ void PacketProtoDecoder_Reset (PacketProtoDecoder *enc)
     
     enc->buf_start += enc->buf_used;
     enc->buf_used = 0;
+    
+    if (enc->buf_mirrored && enc->buf_start >= enc->buf_size) {
+        enc->buf_start -= enc->buf_size;
+    }
 }
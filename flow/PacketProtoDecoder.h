@@ -29,6 +29,13 @@
  * @section DESCRIPTION
  * 
  * Object which decodes a stream according to PacketProto.
+ * 
+ * On Linux, if the maximum packet is large (at least 8192 bytes encoded), the
+ * receive buffer is a ring whose memory is mapped twice back to back, so that
+ * both received packets and the free space are always contiguous and buffered
+ * data never has to be moved. Otherwise, or if the mapping cannot be set up,
+ * a plain buffer is used and the unprocessed data is moved to its start
+ * whenever the end of the buffer is reached.
  */
 
 #ifndef BADVPN_FLOW_PACKETPROTODECODER_H
@@ -59,6 +66,7 @@ typedef struct {
     int buf_size;
     int buf_start;
     int buf_used;
+    int buf_mirrored;
     uint8_t *buf;
     DebugObject d_obj;
 } PacketProtoDecoder;
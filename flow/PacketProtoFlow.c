@@ -32,7 +32,7 @@
 
 #include <flow/PacketProtoFlow.h>
 
-int PacketProtoFlow_Init (PacketProtoFlow *o, int input_mtu, int num_packets, PacketPassInterface *output, BPendingGroup *pg)
+static int init_flow (PacketProtoFlow *o, int input_mtu, int num_packets, const struct PacketCodel_params *codel, PacketPassInterface *output, BPendingGroup *pg)
 {
     ASSERT(input_mtu >= 0)
     ASSERT(input_mtu <= PACKETPROTO_MAXPAYLOAD)
@@ -46,8 +46,14 @@ int PacketProtoFlow_Init (PacketProtoFlow *o, int input_mtu, int num_packets, Pa
     PacketProtoEncoder_Init(&o->encoder, BufferWriter_GetOutput(&o->ainput), pg);
     
     // init buffer
-    if (!PacketBuffer_Init(&o->buffer, PacketProtoEncoder_GetOutput(&o->encoder), output, num_packets, pg)) {
-        goto fail0;
+    if (codel) {
+        if (!PacketBuffer_InitCodel(&o->buffer, PacketProtoEncoder_GetOutput(&o->encoder), output, num_packets, codel, pg)) {
+            goto fail0;
+        }
+    } else {
+        if (!PacketBuffer_Init(&o->buffer, PacketProtoEncoder_GetOutput(&o->encoder), output, num_packets, pg)) {
+            goto fail0;
+        }
     }
     
     DebugObject_Init(&o->d_obj);
@@ -60,6 +66,18 @@ fail0:
     return 0;
 }
 
+int PacketProtoFlow_Init (PacketProtoFlow *o, int input_mtu, int num_packets, PacketPassInterface *output, BPendingGroup *pg)
+{
+    return init_flow(o, input_mtu, num_packets, NULL, output, pg);
+}
+
+int PacketProtoFlow_InitCodel (PacketProtoFlow *o, int input_mtu, int num_packets, const struct PacketCodel_params *codel, PacketPassInterface *output, BPendingGroup *pg)
+{
+    ASSERT(codel)
+    
+    return init_flow(o, input_mtu, num_packets, codel, output, pg);
+}
+
 void PacketProtoFlow_Free (PacketProtoFlow *o)
 {
     DebugObject_Free(&o->d_obj);
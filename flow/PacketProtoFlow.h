@@ -65,6 +65,19 @@ typedef struct {
  */
 int PacketProtoFlow_Init (PacketProtoFlow *o, int input_mtu, int num_packets, PacketPassInterface *output, BPendingGroup *pg) WARN_UNUSED;
 
+/**
+ * Initializes the object with CoDel active queue management in the buffer.
+ * Whole encoded packets are dropped, so the output stream stays well-formed.
+ * @param o the object
+ * @param input_mtu maximum input packet size. Must be >=0 and <=PACKETPROTO_MAXPAYLOAD.
+ * @param num_packets minimum number of packets the buffer should hold. Must be >0.
+ * @param codel CoDel parameters, see {@link PacketCodel_Init}
+ * @param output output interface. Its MTU must be >=PACKETPROTO_ENCLEN(input_mtu).
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoFlow_InitCodel (PacketProtoFlow *o, int input_mtu, int num_packets, const struct PacketCodel_params *codel, PacketPassInterface *output, BPendingGroup *pg) WARN_UNUSED;
+
 /**
  * Frees the object.
  * 
@@ -60,6 +60,7 @@ void PacketRecvBlocker_Init (PacketRecvBlocker *o, PacketRecvInterface *input, B
     
     // init output
     PacketRecvInterface_Init(&o->output, PacketRecvInterface_GetMTU(o->input), (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->output), "PacketRecvBlocker");
     
     // have no output packet
     o->out_have = 0;
@@ -70,6 +70,7 @@ void PacketRecvConnector_Init (PacketRecvConnector *o, int mtu, BPendingGroup *p
     
     // init output
     PacketRecvInterface_Init(&o->output, o->output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->output), "PacketRecvConnector");
     
     // have no output packet
     o->out_have = 0;
@@ -50,6 +50,8 @@ void _PacketRecvInterface_job_done (PacketRecvInterface *i)
     // set state
     i->state = PRI_STATE_NONE;
     
+    FlowTrace_End(&i->trace, i->job_done_len);
+    
     // call handler
     i->handler_done(i->user_user, i->job_done_len);
     return;
@@ -40,6 +40,7 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowTrace.h>
 
 #define PRI_STATE_NONE 1
 #define PRI_STATE_OPERATION_PENDING 2
@@ -55,7 +56,7 @@ typedef struct {
     int mtu;
     PacketRecvInterface_handler_recv handler_operation;
     void *user_provider;
-
+    
     // user data
     PacketRecvInterface_handler_done handler_done;
     void *user_user;
@@ -71,6 +72,8 @@ typedef struct {
     // state
     int state;
     
+    FlowTrace trace;
+    
     DebugObject d_obj;
 } PacketRecvInterface;
 
@@ -86,6 +89,8 @@ static void PacketRecvInterface_Receiver_Init (PacketRecvInterface *i, PacketRec
 
 static void PacketRecvInterface_Receiver_Recv (PacketRecvInterface *i, uint8_t *data);
 
+static FlowTrace * PacketRecvInterface_GetTrace (PacketRecvInterface *i);
+
 void _PacketRecvInterface_job_operation (PacketRecvInterface *i);
 void _PacketRecvInterface_job_done (PacketRecvInterface *i);
 
@@ -108,6 +113,10 @@ void PacketRecvInterface_Init (PacketRecvInterface *i, int mtu, PacketRecvInterf
     // set state
     i->state = PRI_STATE_NONE;
     
+    // init trace
+    FlowTrace_Init(&i->trace, "PacketRecv");
+    FlowTrace_SetSource(&i->trace, user);
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -115,6 +124,9 @@ void PacketRecvInterface_Free (PacketRecvInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    // free trace
+    FlowTrace_Free(&i->trace);
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_operation);
@@ -150,6 +162,8 @@ void PacketRecvInterface_Receiver_Init (PacketRecvInterface *i, PacketRecvInterf
     
     i->handler_done = handler_done;
     i->user_user = user;
+    
+    FlowTrace_SetSink(&i->trace, user);
 }
 
 void PacketRecvInterface_Receiver_Recv (PacketRecvInterface *i, uint8_t *data)
@@ -165,6 +179,15 @@ void PacketRecvInterface_Receiver_Recv (PacketRecvInterface *i, uint8_t *data)
     
     // set state
     i->state = PRI_STATE_OPERATION_PENDING;
+    
+    FlowTrace_Begin(&i->trace);
+}
+
+FlowTrace * PacketRecvInterface_GetTrace (PacketRecvInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return &i->trace;
 }
 
 #endif
@@ -45,9 +45,10 @@
  * to one or more buffers using {@link PacketRouter_Route}.
  * 
  * @param user as in {@link PacketRouter_Init}
- * @param buf the buffer for the packet. May be modified by the user.
- *            Will have space for mtu bytes. Only valid in the job context of
- *            this handler, until {@link PacketRouter_Route} is called successfully.
+ * @param buf the buffer for the packet. The input packet may be modified by the user
+ *            before it is routed. Will have space for mtu bytes. Only valid in the job
+ *            context of this handler. The leading recv_offset bytes must not be accessed;
+ *            they are provided for each destination in {@link PacketRouter_Route}.
  * @param recv_len length of the input packet (located at recv_offset bytes offset)
  */
 typedef void (*PacketRouter_handler) (void *user, uint8_t *buf, int recv_len);
@@ -57,7 +58,8 @@ typedef void (*PacketRouter_handler) (void *user, uint8_t *buf, int recv_len);
  * {@link PacketRecvInterface} input.
  * 
  * Packets are routed by calling {@link PacketRouter_Route} (possibly multiple times)
- * from the job context of the {@link PacketRouter_handler} handler.
+ * from the job context of the {@link PacketRouter_handler} handler. A packet routed
+ * to multiple buffers is not copied (see {@link RouteBuffer}).
  */
 typedef struct {
     int mtu;
@@ -77,8 +79,8 @@ typedef struct {
  * @param mtu maximum packet size. Must be >=0. It will only be possible to route packets to
  *            {@link RouteBuffer}'s with the same MTU.
  * @param recv_offset offset from the beginning for receiving input packets.
- *                    Must be >=0 and <=mtu. The leading space should be initialized
- *                    by the user before routing a packet.
+ *                    Must be >=0 and <=mtu. The leading space is filled in separately
+ *                    for each destination the packet is routed to.
  * @param input input interface. Its MTU must be <= mtu - recv_offset.
  * @param handler handler called when a packet is received to allow the user to route it
  * @param user value passed to handler
@@ -94,27 +96,29 @@ int PacketRouter_Init (PacketRouter *o, int mtu, int recv_offset, PacketRecvInte
  */
 void PacketRouter_Free (PacketRouter *o);
 
+/**
+ * Returns the {@link RouteBufferSource} that {@link RouteBuffer}'s which packets
+ * are to be routed to need to be initialized with.
+ * 
+ * @param o the object
+ * @return route buffer source
+ */
+RouteBufferSource * PacketRouter_GetSource (PacketRouter *o);
+
 /**
  * Routes the current packet to the given buffer.
  * Must be called from the job context of the {@link PacketRouter_handler} handler.
- * On success, copies part of the current packet to next one (regardless if next_buf
- * is provided or not; if not, copies before receiving another packet).
  * 
  * @param o the object
  * @param len total packet length (e.g. recv_offset + (recv_len from handler)).
- *            Must be >=0 and <=mtu.
- * @param output buffer to route to. Its MTU must be the same as of this object.
- * @param next_buf if not NULL, on success, will be set to the address of a new current
- *                 packet that can be routed. The pointer will be valid in the job context of
- *                 the calling handler, until this function is called successfully again
- *                 (as for the original pointer provided by the handler).
- * @param copy_offset Offset from the beginning for copying to the next packet.
- *                    Must be >=0 and <=mtu.
- * @param copy_len Number of bytes to copy from the old current
- *                 packet to the next one. Must be >=0 and <= mtu - copy_offset.
+ *            Must be >=recv_offset and <=mtu.
+ * @param output buffer to route to. It must have been initialized with the source
+ *               returned by {@link PacketRouter_GetSource}.
+ * @param prefix recv_offset bytes to use as the leading space of the packet for
+ *               this destination
  * @return 1 on success, 0 on failure (buffer full)
  */
-int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, uint8_t **next_buf, int copy_offset, int copy_len);
+int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, const uint8_t *prefix);
 
 /**
  * Asserts that {@link PacketRouter_Route} can be called.
@@ -85,6 +85,7 @@ void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output
     
     // init input
     PacketPassInterface_Init(&s->input, mtu, (PacketPassInterface_handler_send)input_handler_send, s, pg);
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&s->input), "PacketStreamSender");
     
     // init output
     StreamPassInterface_Sender_Init(s->output, (StreamPassInterface_handler_done)output_handler_done, s);
@@ -30,124 +30,367 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <misc/offset.h>
+#include <misc/balloc.h>
 
 #include <flow/RouteBuffer.h>
 
-static struct RouteBuffer_packet * alloc_packet (int mtu)
+#define SEND_STATE_IDLE 1
+#define SEND_STATE_SCHEDULED 2
+#define SEND_STATE_LENT 3
+#define SEND_STATE_COPY 4
+
+/**
+ * Packet memory shared by a {@link RouteBufferSource} and the {@link RouteBuffer}'s
+ * it routes to. Enough packets are kept allocated that a new current packet for the
+ * source is always available: one for the source and one for every buffer slot.
+ */
+struct RouteBuffer_pool {
+    int mtu;
+    int prefix_len;
+    int refcnt;
+    int reserved;
+    int num_packets;
+    LinkedList1 packets_free;
+};
+
+static uint8_t * packet_data (struct RouteBuffer_packet *p)
 {
-    if (mtu > SIZE_MAX - sizeof(struct RouteBuffer_packet)) {
-        return NULL;
-    }
-    
-    // allocate memory
-    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)malloc(sizeof(*p) + mtu);
-    if (!p) {
-        return NULL;
-    }
-    
-    return p;
+    return (uint8_t *)(p + 1);
 }
 
-static int alloc_free_packet (RouteBuffer *o)
+static int pool_alloc_packet (struct RouteBuffer_pool *pool)
 {
-    struct RouteBuffer_packet *p = alloc_packet(o->mtu);
+    if (pool->mtu > SIZE_MAX - sizeof(struct RouteBuffer_packet)) {
+        return 0;
+    }
+    
+    // allocate memory
+    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)malloc(sizeof(*p) + pool->mtu);
     if (!p) {
         return 0;
     }
     
+    // init packet
+    p->pool = pool;
+    p->refcnt = 0;
+    p->lender = NULL;
+    
     // add to free packets list
-    LinkedList1_Append(&o->packets_free, &p->node);
+    LinkedList1_Append(&pool->packets_free, &p->pool_node);
+    pool->num_packets++;
     
     return 1;
 }
 
-static void free_free_packets (RouteBuffer *o)
+static void pool_trim (struct RouteBuffer_pool *pool)
 {
-    while (!LinkedList1_IsEmpty(&o->packets_free)) {
+    while (pool->num_packets > pool->reserved && !LinkedList1_IsEmpty(&pool->packets_free)) {
         // get packet
-        struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetLast(&o->packets_free), struct RouteBuffer_packet, node);
+        struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetLast(&pool->packets_free), struct RouteBuffer_packet, pool_node);
         
         // remove from free packets list
-        LinkedList1_Remove(&o->packets_free, &p->node);
+        LinkedList1_Remove(&pool->packets_free, &p->pool_node);
+        pool->num_packets--;
         
         // free memory
         free(p);
     }
 }
 
-static void release_used_packet (RouteBuffer *o)
+static int pool_reserve (struct RouteBuffer_pool *pool, int num)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->packets_used))
+    ASSERT(num > 0)
     
-    // get packet
-    struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
+    if (num > INT_MAX - pool->reserved) {
+        return 0;
+    }
     
-    // remove from used packets list
-    LinkedList1_Remove(&o->packets_used, &p->node);
+    pool->reserved += num;
     
-    // add to free packets list
-    LinkedList1_Append(&o->packets_free, &p->node);
+    // allocate packets
+    while (pool->num_packets < pool->reserved) {
+        if (!pool_alloc_packet(pool)) {
+            pool->reserved -= num;
+            pool_trim(pool);
+            return 0;
+        }
+    }
+    
+    return 1;
 }
 
-static void send_used_packet (RouteBuffer *o)
+static void pool_unreserve (struct RouteBuffer_pool *pool, int num)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->packets_used))
+    ASSERT(num > 0)
+    ASSERT(num <= pool->reserved)
+    
+    pool->reserved -= num;
+    
+    // free packets which are no longer needed
+    pool_trim(pool);
+}
+
+static struct RouteBuffer_packet * pool_get_packet (struct RouteBuffer_pool *pool)
+{
+    ASSERT(!LinkedList1_IsEmpty(&pool->packets_free))
     
     // get packet
-    struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
+    struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&pool->packets_free), struct RouteBuffer_packet, pool_node);
+    ASSERT(p->refcnt == 0)
+    
+    // remove from free packets list
+    LinkedList1_Remove(&pool->packets_free, &p->pool_node);
+    
+    // reference it
+    p->refcnt = 1;
+    
+    return p;
+}
+
+static void pool_unref (struct RouteBuffer_pool *pool)
+{
+    ASSERT(pool->refcnt > 0)
+    
+    pool->refcnt--;
     
-    // send
-    PacketPassInterface_Sender_Send(o->output, (uint8_t *)(p + 1), p->len);
+    if (pool->refcnt == 0) {
+        ASSERT(pool->reserved == 0)
+        
+        // free packets
+        pool_trim(pool);
+        ASSERT(pool->num_packets == 0)
+        
+        // free pool structure
+        free(pool);
+    }
+}
+
+static void packet_unref (struct RouteBuffer_packet *p)
+{
+    ASSERT(p->refcnt > 0)
+    
+    p->refcnt--;
+    
+    if (p->refcnt == 0) {
+        ASSERT(!p->lender)
+        
+        struct RouteBuffer_pool *pool = p->pool;
+        
+        // return to pool, or free if the pool has more packets than it needs
+        if (pool->num_packets > pool->reserved) {
+            pool->num_packets--;
+            free(p);
+        } else {
+            LinkedList1_Append(&pool->packets_free, &p->pool_node);
+        }
+    }
+}
+
+static struct RouteBuffer_entry * first_entry (RouteBuffer *o)
+{
+    ASSERT(o->entries_used > 0)
+    
+    return &o->entries[o->entries_start];
+}
+
+static uint8_t * first_prefix (RouteBuffer *o)
+{
+    ASSERT(o->entries_used > 0)
+    
+    return o->prefixes + (size_t)o->entries_start * o->prefix_len;
+}
+
+static void release_first_entry (RouteBuffer *o)
+{
+    ASSERT(o->entries_used > 0)
+    
+    struct RouteBuffer_packet *p = first_entry(o)->p;
+    
+    // remove entry
+    o->entries_start = (o->entries_start + 1) % o->buf_size;
+    o->entries_used--;
+    
+    // release packet
+    packet_unref(p);
+}
+
+static void send_lent (RouteBuffer *o)
+{
+    ASSERT(o->send_state == SEND_STATE_IDLE || o->send_state == SEND_STATE_SCHEDULED)
+    
+    struct RouteBuffer_entry *e = first_entry(o);
+    ASSERT(!e->p->lender)
+    
+    // borrow the packet
+    e->p->lender = o;
+    o->send_state = SEND_STATE_LENT;
+    
+    // write our prefix into the packet and send it
+    uint8_t *data = packet_data(e->p);
+    memcpy(data, first_prefix(o), o->prefix_len);
+    PacketPassInterface_Sender_Send(o->output, data, e->len);
+}
+
+static void send_copy (RouteBuffer *o)
+{
+    ASSERT(o->send_state == SEND_STATE_SCHEDULED)
+    
+    struct RouteBuffer_entry *e = first_entry(o);
+    
+    o->send_state = SEND_STATE_COPY;
+    
+    // build a private copy with our prefix and send it
+    memcpy(o->copy_buf, first_prefix(o), o->prefix_len);
+    memcpy(o->copy_buf + o->prefix_len, packet_data(e->p) + o->prefix_len, e->len - o->prefix_len);
+    PacketPassInterface_Sender_Send(o->output, o->copy_buf, e->len);
+}
+
+static void codel_drop (RouteBuffer *o)
+{
+    ASSERT(o->use_codel)
+    
+    int64_t now = PacketCodel_Now(&o->codel);
+    
+    // drop packets from the front as long as CoDel says so
+    while (o->entries_used > 0 && PacketCodel_ShouldDrop(&o->codel, now, first_entry(o)->time, o->entries_used == 1)) {
+        release_first_entry(o);
+    }
+    
+    FlowTrace_SetDepth(PacketPassInterface_GetTrace(o->output), o->entries_used);
+}
+
+static void start_send (RouteBuffer *o)
+{
+    ASSERT(o->send_state == SEND_STATE_IDLE)
+    ASSERT(o->entries_used > 0)
+    
+    // drop packets which have been queued for too long
+    if (o->use_codel) {
+        codel_drop(o);
+        if (o->entries_used == 0) {
+            return;
+        }
+    }
+    
+    struct RouteBuffer_packet *p = first_entry(o)->p;
+    
+    // if nobody else has the packet, send it right away
+    if (p->refcnt == 1) {
+        send_lent(o);
+        return;
+    }
+    
+    o->send_state = SEND_STATE_SCHEDULED;
+    BPending_Set(&o->send_job);
+}
+
+static void send_job_handler (RouteBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_state == SEND_STATE_SCHEDULED)
+    ASSERT(o->entries_used > 0)
+    
+    struct RouteBuffer_packet *p = first_entry(o)->p;
+    
+    // If another buffer is still sending the packet, its output is waiting for
+    // something else than jobs, so don't wait for it.
+    if (p->lender) {
+        send_copy(o);
+        return;
+    }
+    
+    send_lent(o);
 }
 
 static void output_handler_done (RouteBuffer *o)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->packets_used))
+    ASSERT(o->send_state == SEND_STATE_LENT || o->send_state == SEND_STATE_COPY)
     DebugObject_Access(&o->d_obj);
     
+    if (o->send_state == SEND_STATE_LENT) {
+        // give back the packet
+        ASSERT(first_entry(o)->p->lender == o)
+        first_entry(o)->p->lender = NULL;
+    }
+    
+    o->send_state = SEND_STATE_IDLE;
+    
     // release packet
-    release_used_packet(o);
+    release_first_entry(o);
+    FlowTrace_SetDepth(PacketPassInterface_GetTrace(o->output), o->entries_used);
     
     // send next packet if there is one
-    if (!LinkedList1_IsEmpty(&o->packets_used)) {
-        send_used_packet(o);
+    if (o->entries_used > 0) {
+        start_send(o);
     }
 }
 
-int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int buf_size)
+int RouteBuffer_Init (RouteBuffer *o, RouteBufferSource *source, PacketPassInterface *output, int buf_size, BPendingGroup *pg)
 {
-    ASSERT(mtu >= 0)
-    ASSERT(PacketPassInterface_GetMTU(output) >= mtu)
+    DebugObject_Access(&source->d_obj);
+    ASSERT(PacketPassInterface_GetMTU(output) >= source->mtu)
     ASSERT(buf_size > 0)
     
     // init arguments
-    o->mtu = mtu;
+    o->mtu = source->mtu;
+    o->prefix_len = source->prefix_len;
+    o->buf_size = buf_size;
+    o->pool = source->pool;
     o->output = output;
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
-    // init free packets list
-    LinkedList1_Init(&o->packets_free);
+    // allocate entries
+    if (!(o->entries = (struct RouteBuffer_entry *)BAllocArray(o->buf_size, sizeof(o->entries[0])))) {
+        goto fail0;
+    }
     
-    // init used packets list
-    LinkedList1_Init(&o->packets_used);
+    // allocate prefixes
+    if (!(o->prefixes = (uint8_t *)BAllocArray(o->buf_size, o->prefix_len))) {
+        goto fail1;
+    }
     
-    // allocate packets
-    for (int i = 0; i < buf_size; i++) {
-        if (!alloc_free_packet(o)) {
-            goto fail1;
-        }
+    // allocate copy buffer
+    if (!(o->copy_buf = (uint8_t *)BAlloc(o->mtu))) {
+        goto fail2;
+    }
+    
+    // reserve packets in pool
+    if (!pool_reserve(o->pool, o->buf_size)) {
+        goto fail3;
     }
     
+    // reference pool
+    o->pool->refcnt++;
+    
+    // init send job
+    BPending_Init(&o->send_job, pg, (BPending_handler)send_job_handler, o);
+    
+    // have no entries
+    o->entries_start = 0;
+    o->entries_used = 0;
+    
+    // not sending
+    o->send_state = SEND_STATE_IDLE;
+    
+    // no CoDel
+    o->use_codel = 0;
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail3:
+    BFree(o->copy_buf);
+fail2:
+    BFree(o->prefixes);
 fail1:
-    free_free_packets(o);
+    BFree(o->entries);
+fail0:
     return 0;
 }
 
@@ -155,13 +398,28 @@ void RouteBuffer_Free (RouteBuffer *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // release packets so they can be freed
-    while (!LinkedList1_IsEmpty(&o->packets_used)) {
-        release_used_packet(o);
+    // give back the packet if we're sending it
+    if (o->send_state == SEND_STATE_LENT) {
+        ASSERT(first_entry(o)->p->lender == o)
+        first_entry(o)->p->lender = NULL;
     }
     
-    // free packets
-    free_free_packets(o);
+    // release packets
+    while (o->entries_used > 0) {
+        release_first_entry(o);
+    }
+    
+    // free send job
+    BPending_Free(&o->send_job);
+    
+    // release pool
+    pool_unreserve(o->pool, o->buf_size);
+    pool_unref(o->pool);
+    
+    // free memory
+    BFree(o->copy_buf);
+    BFree(o->prefixes);
+    BFree(o->entries);
 }
 
 int RouteBuffer_GetMTU (RouteBuffer *o)
@@ -171,22 +429,57 @@ int RouteBuffer_GetMTU (RouteBuffer *o)
     return o->mtu;
 }
 
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu)
+void RouteBuffer_EnableCodel (RouteBuffer *o, const struct PacketCodel_params *codel)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->entries_used == 0)
+    
+    PacketCodel_Init(&o->codel, codel);
+    o->use_codel = 1;
+}
+
+uint64_t RouteBuffer_GetNumCodelDropped (RouteBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return (o->use_codel ? PacketCodel_GetNumDropped(&o->codel) : 0);
+}
+
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int prefix_len)
 {
     ASSERT(mtu >= 0)
+    ASSERT(prefix_len >= 0)
+    ASSERT(prefix_len <= mtu)
     
     // init arguments
     o->mtu = mtu;
+    o->prefix_len = prefix_len;
     
-    // allocate current packet
-    if (!(o->current_packet = alloc_packet(o->mtu))) {
+    // allocate pool
+    if (!(o->pool = (struct RouteBuffer_pool *)malloc(sizeof(*o->pool)))) {
         goto fail0;
     }
+    o->pool->mtu = o->mtu;
+    o->pool->prefix_len = o->prefix_len;
+    o->pool->refcnt = 1;
+    o->pool->reserved = 0;
+    o->pool->num_packets = 0;
+    LinkedList1_Init(&o->pool->packets_free);
+    
+    // reserve current packet
+    if (!pool_reserve(o->pool, 1)) {
+        goto fail1;
+    }
+    
+    // get current packet
+    o->current_packet = pool_get_packet(o->pool);
     
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail1:
+    free(o->pool);
 fail0:
     return 0;
 }
@@ -195,62 +488,65 @@ void RouteBufferSource_Free (RouteBufferSource *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // free current packet
-    free(o->current_packet);
+    // release current packet
+    packet_unref(o->current_packet);
+    
+    // release pool
+    pool_unreserve(o->pool, 1);
+    pool_unref(o->pool);
 }
 
 uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    return (uint8_t *)(o->current_packet + 1);
+    return packet_data(o->current_packet);
 }
 
-int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len)
+int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, const uint8_t *prefix)
 {
-    ASSERT(len >= 0)
+    ASSERT(len >= o->prefix_len)
     ASSERT(len <= o->mtu)
-    ASSERT(b->mtu == o->mtu)
-    ASSERT(copy_offset >= 0)
-    ASSERT(copy_offset <= o->mtu)
-    ASSERT(copy_len >= 0)
-    ASSERT(copy_len <= o->mtu - copy_offset)
+    ASSERT(b->pool == o->pool)
+    ASSERT(prefix || o->prefix_len == 0)
     DebugObject_Access(&b->d_obj);
     DebugObject_Access(&o->d_obj);
     
     // check if there's space in the buffer
-    if (LinkedList1_IsEmpty(&b->packets_free)) {
+    if (b->entries_used == b->buf_size) {
         return 0;
     }
     
-    int was_empty = LinkedList1_IsEmpty(&b->packets_used);
-    
-    struct RouteBuffer_packet *p = o->current_packet;
-    
-    // set packet length
-    p->len = len;
-    
-    // append packet to used packets list
-    LinkedList1_Append(&b->packets_used, &p->node);
-    
-    // get a free packet
-    struct RouteBuffer_packet *np = UPPER_OBJECT(LinkedList1_GetLast(&b->packets_free), struct RouteBuffer_packet, node);
-    
-    // remove it from free packets list
-    LinkedList1_Remove(&b->packets_free, &np->node);
-    
-    // make it the current packet
-    o->current_packet = np;
-    
-    // copy packet
-    if (copy_len > 0) {
-        memcpy((uint8_t *)(np + 1) + copy_offset, (uint8_t *)(p + 1) + copy_offset, copy_len);
+    // add entry referencing the current packet
+    int index = (b->entries_start + b->entries_used) % b->buf_size;
+    b->entries[index].p = o->current_packet;
+    b->entries[index].len = len;
+    if (b->use_codel) {
+        b->entries[index].time = PacketCodel_Now(&b->codel);
     }
+    memcpy(b->prefixes + (size_t)index * b->prefix_len, prefix, b->prefix_len);
+    b->entries_used++;
+    FlowTrace_SetDepth(PacketPassInterface_GetTrace(b->output), b->entries_used);
+    o->current_packet->refcnt++;
     
     // start sending if required
-    if (was_empty) {
-        send_used_packet(b);
+    if (b->send_state == SEND_STATE_IDLE) {
+        start_send(b);
     }
     
     return 1;
 }
+
+void RouteBufferSource_Next (RouteBufferSource *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // keep the current packet if nobody else has it
+    if (o->current_packet->refcnt == 1) {
+        return;
+    }
+    
+    // leave the packet to the buffers and get a new one
+    packet_unref(o->current_packet);
+    o->current_packet = pool_get_packet(o->pool);
+}
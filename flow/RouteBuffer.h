@@ -34,37 +34,75 @@
 #ifndef BADVPN_FLOW_ROUTEBUFFER_H
 #define BADVPN_FLOW_ROUTEBUFFER_H
 
+#include <stdint.h>
+
 #include <misc/debug.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
+#include <base/BPending.h>
 #include <flow/PacketPassInterface.h>
+#include <flow/PacketCodel.h>
+
+struct RouteBuffer_pool;
+struct RouteBuffer_s;
 
 struct RouteBuffer_packet {
-    LinkedList1Node node;
+    struct RouteBuffer_pool *pool;
+    LinkedList1Node pool_node;
+    int refcnt;
+    struct RouteBuffer_s *lender;
+};
+
+struct RouteBuffer_entry {
+    struct RouteBuffer_packet *p;
     int len;
+    int64_t time;
 };
 
 /**
  * Packet buffer for zero-copy packet routing.
  * 
- * Packets are buffered using {@link RouteBufferSource} objects.
+ * Packets are buffered using {@link RouteBufferSource} objects. A packet
+ * routed to multiple buffers is stored only once; each buffer only remembers
+ * its own prefix for the packet (e.g. a header with the destination).
+ * 
+ * To send a packet, the buffer writes its prefix into the packet and sends it
+ * directly. Only one buffer can do that at a time; a buffer wanting to send a
+ * packet which another buffer is sending sends a private copy instead.
+ * Sending of shared packets is started from a job, so that when a packet is
+ * routed to multiple idle buffers, each buffer's output gets to process it
+ * before the next buffer needs it (jobs are executed in LIFO order).
+ * Optionally, the buffer drops packets according to {@link PacketCodel}.
  */
-typedef struct {
+typedef struct RouteBuffer_s {
     int mtu;
+    int prefix_len;
+    int buf_size;
+    struct RouteBuffer_pool *pool;
     PacketPassInterface *output;
-    LinkedList1 packets_free;
-    LinkedList1 packets_used;
+    struct RouteBuffer_entry *entries;
+    uint8_t *prefixes;
+    int entries_start;
+    int entries_used;
+    int send_state;
+    BPending send_job;
+    uint8_t *copy_buf;
+    int use_codel;
+    PacketCodel codel;
     DebugObject d_obj;
 } RouteBuffer;
 
 /**
  * Object through which packets are buffered into {@link RouteBuffer} objects.
  * 
- * A packet is routed by calling {@link RouteBufferSource_Pointer}, writing it to
- * the returned address, then calling {@link RouteBufferSource_Route}.
+ * A packet is routed by writing it to the address returned by
+ * {@link RouteBufferSource_Pointer}, then calling {@link RouteBufferSource_Route}
+ * for each buffer it should go to, and finally calling {@link RouteBufferSource_Next}.
  */
 typedef struct {
     int mtu;
+    int prefix_len;
+    struct RouteBuffer_pool *pool;
     struct RouteBuffer_packet *current_packet;
     DebugObject d_obj;
 } RouteBufferSource;
@@ -73,13 +111,15 @@ typedef struct {
  * Initializes the object.
  * 
  * @param o the object
- * @param mtu maximum packet size. Must be >=0. It will only be possible to route packets to this buffer
- *            from {@link RouteBufferSource}.s with the same MTU.
- * @param output output interface. Its MTU must be >=mtu.
+ * @param source source which will route packets to this buffer. The buffer will share
+ *               packet memory with it; the source may be freed before the buffer.
+ *               It will only be possible to route packets to this buffer from this source.
+ * @param output output interface. Its MTU must be >= MTU of source.
  * @param buf_size size of the buffer in number of packet. Must be >0.
+ * @param pg pending group
  * @return 1 on success, 0 on failure
  */
-int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int buf_size) WARN_UNUSED;
+int RouteBuffer_Init (RouteBuffer *o, RouteBufferSource *source, PacketPassInterface *output, int buf_size, BPendingGroup *pg) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -87,21 +127,39 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
 void RouteBuffer_Free (RouteBuffer *o);
 
 /**
- * Retuns the buffer's MTU (mtu argument to {@link RouteBuffer_Init}).
+ * Retuns the buffer's MTU (MTU of the source passed to {@link RouteBuffer_Init}).
  * 
  * @return MTU
  */
 int RouteBuffer_GetMTU (RouteBuffer *o);
 
+/**
+ * Enables CoDel active queue management. Packets routed to the buffer from now on
+ * are timestamped, and those waiting too long are dropped instead of sent.
+ * The buffer must be empty.
+ * @param o the object
+ * @param codel CoDel parameters, see {@link PacketCodel_Init}
+ */
+void RouteBuffer_EnableCodel (RouteBuffer *o, const struct PacketCodel_params *codel);
+
+/**
+ * Returns the number of packets dropped by CoDel.
+ * @param o the object
+ * @return number of dropped packets; 0 if CoDel is not enabled
+ */
+uint64_t RouteBuffer_GetNumCodelDropped (RouteBuffer *o);
+
 /**
  * Initializes the object.
  * 
  * @param o the object
- * @param mtu maximum packet size. Must be >=0. The object will only be able to route packets
- *            to {@link RouteBuffer}'s with the same MTU.
+ * @param mtu maximum packet size. Must be >=0.
+ * @param prefix_len number of bytes at the beginning of each packet which are specific
+ *                   to the buffer the packet is routed to (see {@link RouteBufferSource_Route}).
+ *                   Must be >=0 and <=mtu.
  * @return 1 on success, 0 on failure
  */
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu) WARN_UNUSED;
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int prefix_len) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -113,7 +171,8 @@ void RouteBufferSource_Free (RouteBufferSource *o);
 /**
  * Returns a pointer to the current packet.
  * The pointed to memory area will have space for MTU bytes.
- * The pointer is only valid until {@link RouteBufferSource_Route} succeeds.
+ * The pointer is only valid until {@link RouteBufferSource_Next} is called.
+ * After the packet has been routed, the first prefix_len bytes must not be accessed.
  * 
  * @param o the object
  * @return pointer to the current packet
@@ -121,19 +180,24 @@ void RouteBufferSource_Free (RouteBufferSource *o);
 uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o);
 
 /**
- * Routes the current packet to a given buffer.
- * On success, this invalidates the pointer previously returned from
- * {@link RouteBufferSource_Pointer}.
+ * Routes the current packet to a given buffer, without copying it.
+ * 
+ * @param o the object
+ * @param len length of the packet, including the prefix. Must be >=prefix_len and <=mtu.
+ * @param b buffer to route to. It must have been initialized with this source.
+ * @param prefix prefix_len bytes to put at the beginning of the packet when the buffer
+ *               sends it. They are copied, so the memory only has to be valid for this call.
+ * @return 1 on success, 0 on failure (buffer full)
+ */
+int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, const uint8_t *prefix);
+
+/**
+ * Finishes routing the current packet and makes a new packet current,
+ * unless the current packet was not routed anywhere.
+ * This invalidates pointers previously returned from {@link RouteBufferSource_Pointer}.
  * 
  * @param o the object
- * @param len length of the packet. Must be >=0 and <=MTU.
- * @param b buffer to route to. Its MTU must equal this object's MTU.
- * @param copy_offset Offset from the beginning for copying. Must be >=0 and
- *                    <=mtu.
- * @param copy_len Number of bytes to copy from the old current packet to the new one.
- *                 Must be >=0 and <= mtu - copy_offset.
- * @return 1 on success, 0 on failure
  */
-int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len);
+void RouteBufferSource_Next (RouteBufferSource *o);
 
 #endif
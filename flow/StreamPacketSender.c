@@ -67,6 +67,7 @@ void StreamPacketSender_Init (StreamPacketSender *o, PacketPassInterface *output
     
     // init input
     StreamPassInterface_Init(&o->input, (StreamPassInterface_handler_send)input_handler_send, o, pg);
+    FlowTrace_SetName(StreamPassInterface_GetTrace(&o->input), "StreamPacketSender");
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
@@ -68,6 +68,7 @@ void StreamPassConnector_Init (StreamPassConnector *o, BPendingGroup *pg)
 {
     // init output
     StreamPassInterface_Init(&o->input, (StreamPassInterface_handler_send)input_handler_send, o, pg);
+    FlowTrace_SetName(StreamPassInterface_GetTrace(&o->input), "StreamPassConnector");
     
     // have no input packet
     o->in_len = -1;
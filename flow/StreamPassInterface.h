@@ -45,6 +45,7 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowTrace.h>
 
 #define SPI_STATE_NONE 1
 #define SPI_STATE_OPERATION_PENDING 2
@@ -76,6 +77,8 @@ typedef struct {
     // state
     int state;
     
+    FlowTrace trace;
+    
     DebugObject d_obj;
 } StreamPassInterface;
 
@@ -89,6 +92,8 @@ static void StreamPassInterface_Sender_Init (StreamPassInterface *i, StreamPassI
 
 static void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int data_len);
 
+static FlowTrace * StreamPassInterface_GetTrace (StreamPassInterface *i);
+
 void _StreamPassInterface_job_operation (StreamPassInterface *i);
 void _StreamPassInterface_job_done (StreamPassInterface *i);
 
@@ -108,6 +113,10 @@ void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterface_handl
     // set state
     i->state = SPI_STATE_NONE;
     
+    // init trace
+    FlowTrace_Init(&i->trace, "StreamPass");
+    FlowTrace_SetSink(&i->trace, user);
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -115,6 +124,9 @@ void StreamPassInterface_Free (StreamPassInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    // free trace
+    FlowTrace_Free(&i->trace);
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_operation);
@@ -143,6 +155,8 @@ void StreamPassInterface_Sender_Init (StreamPassInterface *i, StreamPassInterfac
     
     i->handler_done = handler_done;
     i->user_user = user;
+    
+    FlowTrace_SetSource(&i->trace, user);
 }
 
 void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int data_len)
@@ -160,6 +174,15 @@ void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int
     
     // set state
     i->state = SPI_STATE_OPERATION_PENDING;
+    
+    FlowTrace_Begin(&i->trace);
+}
+
+FlowTrace * StreamPassInterface_GetTrace (StreamPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return &i->trace;
 }
 
 #endif
@@ -68,6 +68,7 @@ void StreamRecvConnector_Init (StreamRecvConnector *o, BPendingGroup *pg)
 {
     // init output
     StreamRecvInterface_Init(&o->output, (StreamRecvInterface_handler_recv)output_handler_recv, o, pg);
+    FlowTrace_SetName(StreamRecvInterface_GetTrace(&o->output), "StreamRecvConnector");
     
     // have no output packet
     o->out_avail = -1;
@@ -50,6 +50,8 @@ void _StreamRecvInterface_job_done (StreamRecvInterface *i)
     // set state
     i->state = SRI_STATE_NONE;
     
+    FlowTrace_End(&i->trace, i->job_done_len);
+    
     // call handler
     i->handler_done(i->user_user, i->job_done_len);
     return;
@@ -45,6 +45,7 @@
 #include <misc/debug.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
+#include <flow/FlowTrace.h>
 
 #define SRI_STATE_NONE 1
 #define SRI_STATE_OPERATION_PENDING 2
@@ -76,6 +77,8 @@ typedef struct {
     // state
     int state;
     
+    FlowTrace trace;
+    
     DebugObject d_obj;
 } StreamRecvInterface;
 
@@ -89,6 +92,8 @@ static void StreamRecvInterface_Receiver_Init (StreamRecvInterface *i, StreamRec
 
 static void StreamRecvInterface_Receiver_Recv (StreamRecvInterface *i, uint8_t *data, int data_len);
 
+static FlowTrace * StreamRecvInterface_GetTrace (StreamRecvInterface *i);
+
 void _StreamRecvInterface_job_operation (StreamRecvInterface *i);
 void _StreamRecvInterface_job_done (StreamRecvInterface *i);
 
@@ -108,6 +113,10 @@ void StreamRecvInterface_Init (StreamRecvInterface *i, StreamRecvInterface_handl
     // set state
     i->state = SRI_STATE_NONE;
     
+    // init trace
+    FlowTrace_Init(&i->trace, "StreamRecv");
+    FlowTrace_SetSource(&i->trace, user);
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -115,6 +124,9 @@ void StreamRecvInterface_Free (StreamRecvInterface *i)
 {
     DebugObject_Free(&i->d_obj);
     
+    // free trace
+    FlowTrace_Free(&i->trace);
+    
     // free jobs
     BPending_Free(&i->job_done);
     BPending_Free(&i->job_operation);
@@ -143,6 +155,8 @@ void StreamRecvInterface_Receiver_Init (StreamRecvInterface *i, StreamRecvInterf
     
     i->handler_done = handler_done;
     i->user_user = user;
+    
+    FlowTrace_SetSink(&i->trace, user);
 }
 
 void StreamRecvInterface_Receiver_Recv (StreamRecvInterface *i, uint8_t *data, int data_len)
@@ -160,6 +174,15 @@ void StreamRecvInterface_Receiver_Recv (StreamRecvInterface *i, uint8_t *data, i
     
     // set state
     i->state = SRI_STATE_OPERATION_PENDING;
+    
+    FlowTrace_Begin(&i->trace);
+}
+
+FlowTrace * StreamRecvInterface_GetTrace (StreamRecvInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return &i->trace;
 }
 
 #endif
@@ -83,6 +83,7 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     
     // init input
     PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketPassInactivityMonitor");
     if (PacketPassInterface_HasCancel(o->output)) {
         PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     }
@@ -0,0 +1,150 @@
+/**
+ * @file PacketPassShaper.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#include "PacketPassShaper.h"
+
+static void try_send (PacketPassShaper *o)
+{
+    ASSERT(o->held_data)
+    
+    // wait if the buckets are empty
+    btime_t wait = TokenBucket_GetWait(&o->bucket);
+    if (wait > 0) {
+        BReactor_SetTimerAfter(o->reactor, &o->timer, wait);
+        return;
+    }
+    
+    uint8_t *data = o->held_data;
+    int data_len = o->held_len;
+    
+    // no longer holding
+    o->held_data = NULL;
+    
+    // take tokens
+    TokenBucket_Consume(&o->bucket, data_len);
+    
+    // schedule send
+    PacketPassInterface_Sender_Send(o->output, data, data_len);
+}
+
+static void input_handler_send (PacketPassShaper *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->held_data)
+    
+    // hold packet
+    o->held_data = data;
+    o->held_len = data_len;
+    
+    try_send(o);
+}
+
+static void input_handler_requestcancel (PacketPassShaper *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // if the packet is still being held, drop it
+    if (o->held_data) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+        o->held_data = NULL;
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // request cancel
+    PacketPassInterface_Sender_RequestCancel(o->output);
+}
+
+static void output_handler_done (PacketPassShaper *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->held_data)
+    
+    // call done
+    PacketPassInterface_Done(&o->input);
+}
+
+static void timer_handler (PacketPassShaper *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->held_data)
+    
+    try_send(o);
+}
+
+void PacketPassShaper_Init (PacketPassShaper *o, PacketPassInterface *output, BReactor *reactor, int64_t rate, int64_t burst, TokenBucket *parent)
+{
+    // init arguments
+    o->output = output;
+    o->reactor = reactor;
+    
+    // init bucket
+    TokenBucket_Init(&o->bucket, parent, rate, burst);
+    
+    // init input
+    PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->input), "PacketPassShaper");
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init timer
+    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
+    
+    // set not holding
+    o->held_data = NULL;
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void PacketPassShaper_Free (PacketPassShaper *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &o->timer);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free bucket
+    TokenBucket_Free(&o->bucket);
+}
+
+PacketPassInterface * PacketPassShaper_GetInput (PacketPassShaper *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
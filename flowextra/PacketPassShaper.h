@@ -0,0 +1,97 @@
+/**
+ * @file PacketPassShaper.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A {@link PacketPassInterface} layer which limits the rate of packets
+ * using a {@link TokenBucket}.
+ */
+
+#ifndef BADVPN_PACKETPASSSHAPER_H
+#define BADVPN_PACKETPASSSHAPER_H
+
+#include <stdint.h>
+
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <flow/PacketPassInterface.h>
+#include <flowextra/TokenBucket.h>
+
+/**
+ * A {@link PacketPassInterface} layer which limits the rate of packets
+ * using a {@link TokenBucket}.
+ * 
+ * The object has its own bucket, which may be nested in a parent bucket
+ * shared with other shapers to limit them together.
+ * When the input calls Send and the buckets allow it, the packet is passed
+ * on to the output immediately, and its size is taken from the buckets.
+ * Otherwise the packet is held back and a timer is started for when the
+ * buckets will have refilled.
+ */
+typedef struct {
+    PacketPassInterface *output;
+    BReactor *reactor;
+    TokenBucket bucket;
+    PacketPassInterface input;
+    BTimer timer;
+    uint8_t *held_data;
+    int held_len;
+    DebugObject d_obj;
+} PacketPassShaper;
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param output output interface
+ * @param reactor reactor we live in
+ * @param rate rate limit of this shaper in bytes per second, or 0 to only be
+ *             limited by the parent. See {@link TokenBucket_Init}.
+ * @param burst bucket size of this shaper in bytes. See {@link TokenBucket_Init}.
+ * @param parent parent bucket, or NULL. Must outlive the shaper.
+ */
+void PacketPassShaper_Init (PacketPassShaper *o, PacketPassInterface *output, BReactor *reactor, int64_t rate, int64_t burst, TokenBucket *parent);
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void PacketPassShaper_Free (PacketPassShaper *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be the same as of the output interface.
+ * The interface supports cancel functionality if the output interface supports it.
+ * 
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketPassShaper_GetInput (PacketPassShaper *o);
+
+#endif
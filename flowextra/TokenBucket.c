@@ -0,0 +1,147 @@
+/**
+ * @file TokenBucket.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TokenBucket.h"
+
+// Tokens are counted in thousandths of a byte, so that a millisecond
+// adds exactly rate tokens.
+#define TOKENS_PER_BYTE 1000
+
+static void refill (TokenBucket *o, btime_t now)
+{
+    if (o->rate == 0) {
+        return;
+    }
+    
+    btime_t elapsed = now - o->last_time;
+    o->last_time = now;
+    
+    if (elapsed <= 0) {
+        return;
+    }
+    
+    // add tokens, without overflowing for long idle times
+    if (elapsed >= (o->max_tokens - o->tokens) / o->rate + 1) {
+        o->tokens = o->max_tokens;
+    } else {
+        o->tokens += elapsed * o->rate;
+    }
+}
+
+void TokenBucket_Init (TokenBucket *o, TokenBucket *parent, int64_t rate, int64_t burst)
+{
+    ASSERT(rate >= 0)
+    ASSERT(rate <= TOKENBUCKET_MAX_RATE)
+    ASSERT(burst >= 0)
+    ASSERT(burst <= TOKENBUCKET_MAX_BURST)
+    
+    // init arguments
+    o->parent = parent;
+    o->rate = rate;
+    o->max_tokens = burst * TOKENS_PER_BYTE;
+    
+    // start full
+    o->tokens = o->max_tokens;
+    o->last_time = btime_gettime();
+    
+    if (o->parent) {
+        DebugCounter_Increment(&o->parent->d_ctr);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_ctr);
+}
+
+void TokenBucket_Free (TokenBucket *o)
+{
+    DebugCounter_Free(&o->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    if (o->parent) {
+        DebugCounter_Decrement(&o->parent->d_ctr);
+    }
+}
+
+btime_t TokenBucket_GetWait (TokenBucket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    btime_t now = btime_gettime();
+    btime_t wait = 0;
+    
+    // wait for the emptiest bucket on the way to the root
+    for (TokenBucket *b = o; b; b = b->parent) {
+        refill(b, now);
+        
+        if (b->rate > 0 && b->tokens < 0) {
+            btime_t b_wait = (-b->tokens + b->rate - 1) / b->rate;
+            if (b_wait > wait) {
+                wait = b_wait;
+            }
+        }
+    }
+    
+    return wait;
+}
+
+void TokenBucket_Consume (TokenBucket *o, int amount)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(amount >= 0)
+    
+    btime_t now = btime_gettime();
+    
+    for (TokenBucket *b = o; b; b = b->parent) {
+        if (b->rate == 0) {
+            continue;
+        }
+        
+        refill(b, now);
+        
+        // allow going into debt, but not without bound
+        int64_t take = (int64_t)amount * TOKENS_PER_BYTE;
+        if (b->tokens - take < -TOKENBUCKET_MAX_BURST * TOKENS_PER_BYTE) {
+            b->tokens = -TOKENBUCKET_MAX_BURST * TOKENS_PER_BYTE;
+        } else {
+            b->tokens -= take;
+        }
+    }
+}
+
+int64_t TokenBucket_DefaultBurst (int64_t rate, int64_t min_burst)
+{
+    ASSERT(rate >= 0)
+    ASSERT(rate <= TOKENBUCKET_MAX_RATE)
+    ASSERT(min_burst >= 0)
+    ASSERT(min_burst <= TOKENBUCKET_MAX_BURST)
+    
+    int64_t burst = rate / (1000 / TOKENBUCKET_DEFAULT_BURST_TIME);
+    
+    return (burst > min_burst ? burst : min_burst);
+}
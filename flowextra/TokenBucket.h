@@ -0,0 +1,113 @@
+/**
+ * @file TokenBucket.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Token bucket for rate limiting, optionally nested in a parent bucket.
+ */
+
+#ifndef BADVPN_TOKENBUCKET_H
+#define BADVPN_TOKENBUCKET_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <base/DebugObject.h>
+#include <system/BTime.h>
+
+/**
+ * Token bucket for rate limiting, optionally nested in a parent bucket.
+ * 
+ * The bucket fills up at a given rate, up to a given burst size. Data may
+ * be sent when the bucket and all its ancestors are not empty; sending takes
+ * tokens from all of them. A bucket may go into debt by sending more than
+ * it holds, so packets larger than the burst size can still pass.
+ * Buckets sharing a parent are limited together by the parent's rate.
+ */
+typedef struct TokenBucket_s {
+    struct TokenBucket_s *parent;
+    int64_t rate;
+    int64_t max_tokens;
+    int64_t tokens;
+    btime_t last_time;
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} TokenBucket;
+
+/**
+ * Initializes the bucket. It starts out full.
+ * 
+ * @param o the object
+ * @param parent parent bucket, or NULL. Must outlive this bucket.
+ * @param rate fill rate in bytes per second. Must be >=0 and <=TOKENBUCKET_MAX_RATE.
+ *             Zero means the bucket itself does not limit, only its ancestors do.
+ * @param burst bucket size in bytes. Must be >=0 and <=TOKENBUCKET_MAX_BURST.
+ */
+void TokenBucket_Init (TokenBucket *o, TokenBucket *parent, int64_t rate, int64_t burst);
+
+/**
+ * Frees the bucket.
+ * Buckets having this one as parent must have been freed.
+ * 
+ * @param o the object
+ */
+void TokenBucket_Free (TokenBucket *o);
+
+/**
+ * Returns how long to wait until data may be sent through the bucket.
+ * 
+ * @param o the object
+ * @return time in milliseconds, 0 if data may be sent now
+ */
+btime_t TokenBucket_GetWait (TokenBucket *o);
+
+/**
+ * Takes tokens for sent data from the bucket and all its ancestors.
+ * 
+ * @param o the object
+ * @param amount number of bytes sent. Must be >=0.
+ */
+void TokenBucket_Consume (TokenBucket *o, int amount);
+
+/**
+ * Returns the default bucket size for a rate: the amount of data sent in
+ * {@link TOKENBUCKET_DEFAULT_BURST_TIME} milliseconds, but at least the
+ * given minimum, typically the maximum packet size.
+ * 
+ * @param rate rate in bytes per second. Must be >=0 and <=TOKENBUCKET_MAX_RATE.
+ * @param min_burst minimum bucket size in bytes. Must be >=0 and <=TOKENBUCKET_MAX_BURST.
+ * @return bucket size in bytes
+ */
+int64_t TokenBucket_DefaultBurst (int64_t rate, int64_t min_burst);
+
+#define TOKENBUCKET_MAX_RATE (INT64_C(1) << 40)
+#define TOKENBUCKET_MAX_BURST (INT64_C(1) << 40)
+#define TOKENBUCKET_DEFAULT_BURST_TIME 100
+
+#endif
@@ -143,3 +143,6 @@
 {"BThreadSignal", 4},
 {"BLockReactor", 4},
 {"ncd_load_module", 4},
+{"CommIndex", 4},
+{"DatagramSharedSocket", 4},
+{"StatsListener", 4},
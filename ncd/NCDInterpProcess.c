@@ -240,6 +240,14 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
             goto loop_fail1;
         }
         
+        // Arguments without placeholders are the same every time the statement
+        // is initialized, so they can be shared instead of copied. They consist
+        // of ID strings only, so they never need converting to continuous strings.
+        e->arg_const = (e->arg_prog.num_instrs == 0);
+        
+        e->method_cache_type = -1;
+        e->method_cache_module = NULL;
+        
         if (NCDStatement_RegObjName(s)) {
             if (!ncd_make_name_indices(string_index, NCDStatement_RegObjName(s), &e->objnames, &e->num_objnames)) {
                 BLog(BLOG_ERROR, "ncd_make_name_indices failed");
@@ -383,7 +391,22 @@ const struct NCDInterpModule * NCDInterpProcess_StatementGetMethodModule (NCDInt
     ASSERT(obj_type >= 0)
     ASSERT(module_index)
     
-    return NCDModuleIndex_GetMethodModule(module_index, obj_type, o->stmts[i].binding.method_name_id);
+    struct NCDInterpProcess__stmt *e = &o->stmts[i];
+    
+    // the object is usually of the same type as last time
+    if (obj_type == e->method_cache_type) {
+        return e->method_cache_module;
+    }
+    
+    const struct NCDInterpModule *module = NCDModuleIndex_GetMethodModule(module_index, obj_type, e->binding.method_name_id);
+    
+    // don't remember failed lookups, the module may be loaded later
+    if (module) {
+        e->method_cache_module = module;
+        e->method_cache_type = obj_type;
+    }
+    
+    return module;
 }
 
 int NCDInterpProcess_CopyStatementArgs (NCDInterpProcess *o, int i, NCDValMem *out_valmem, NCDValRef *out_val, NCDValReplaceProg *out_prog)
@@ -406,6 +429,23 @@ int NCDInterpProcess_CopyStatementArgs (NCDInterpProcess *o, int i, NCDValMem *o
     return 1;
 }
 
+int NCDInterpProcess_StatementConstArgs (NCDInterpProcess *o, int i, NCDValRef *out_val)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    ASSERT(out_val)
+    
+    struct NCDInterpProcess__stmt *e = &o->stmts[i];
+    
+    if (!e->arg_const) {
+        return 0;
+    }
+    
+    *out_val = NCDVal_FromSafe(&e->arg_mem, e->arg_ref);
+    return 1;
+}
+
 void NCDInterpProcess_StatementBumpAllocSize (NCDInterpProcess *o, int i, int alloc_size)
 {
     DebugObject_Access(&o->d_obj);
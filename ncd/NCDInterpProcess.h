@@ -53,6 +53,9 @@ struct NCDInterpProcess__stmt {
     NCDValMem arg_mem;
     NCDValSafeRef arg_ref;
     NCDValReplaceProg arg_prog;
+    int arg_const;
+    NCD_string_id_t method_cache_type;
+    const struct NCDInterpModule *method_cache_module;
     int alloc_size;
     int prealloc_offset;
     int hash_next;
@@ -87,6 +90,7 @@ void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_s
 const struct NCDInterpModule * NCDInterpProcess_StatementGetSimpleModule (NCDInterpProcess *o, int i, NCDStringIndex *string_index, NCDModuleIndex *module_index);
 const struct NCDInterpModule * NCDInterpProcess_StatementGetMethodModule (NCDInterpProcess *o, int i, NCD_string_id_t obj_type, NCDModuleIndex *module_index);
 int NCDInterpProcess_CopyStatementArgs (NCDInterpProcess *o, int i, NCDValMem *out_valmem, NCDValRef *out_val, NCDValReplaceProg *out_prog) WARN_UNUSED;
+int NCDInterpProcess_StatementConstArgs (NCDInterpProcess *o, int i, NCDValRef *out_val);
 void NCDInterpProcess_StatementBumpAllocSize (NCDInterpProcess *o, int i, int alloc_size);
 int NCDInterpProcess_PreallocSize (NCDInterpProcess *o);
 int NCDInterpProcess_StatementPreallocSize (NCDInterpProcess *o, int i);
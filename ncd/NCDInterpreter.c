@@ -888,26 +888,31 @@ void process_advance (struct process *p)
         }
     }
     
-    // copy arguments
     NCDValRef args;
-    NCDValReplaceProg prog;
-    if (!NCDInterpProcess_CopyStatementArgs(p->iprocess, ps->i, &ps->args_mem, &args, &prog)) {
-        STATEMENT_LOG(ps, BLOG_ERROR, "NCDInterpProcess_CopyStatementArgs failed");
-        goto fail0;
-    }
-    
-    // replace placeholders with values of variables
-    if (!NCDValReplaceProg_Execute(prog, &ps->args_mem, replace_placeholders_callback, p)) {
-        STATEMENT_LOG(ps, BLOG_ERROR, "failed to replace variables in arguments with values");
-        goto fail1;
-    }
-    
-    // convert non-continuous strings unless the module can handle them
-    if (!(module->module.flags & NCDMODULE_FLAG_ACCEPT_NON_CONTINUOUS_STRINGS)) {
-        if (!NCDValMem_ConvertNonContinuousStrings(&ps->args_mem, &args)) {
-            STATEMENT_LOG(ps, BLOG_ERROR, "NCDValMem_ConvertNonContinuousStrings failed");
+    if (NCDInterpProcess_StatementConstArgs(p->iprocess, ps->i, &args)) {
+        // arguments have no variables; use the shared copy in the NCDInterpProcess
+        NCDValMem_Init(&ps->args_mem);
+    } else {
+        // copy arguments
+        NCDValReplaceProg prog;
+        if (!NCDInterpProcess_CopyStatementArgs(p->iprocess, ps->i, &ps->args_mem, &args, &prog)) {
+            STATEMENT_LOG(ps, BLOG_ERROR, "NCDInterpProcess_CopyStatementArgs failed");
+            goto fail0;
+        }
+        
+        // replace placeholders with values of variables
+        if (!NCDValReplaceProg_Execute(prog, &ps->args_mem, replace_placeholders_callback, p)) {
+            STATEMENT_LOG(ps, BLOG_ERROR, "failed to replace variables in arguments with values");
             goto fail1;
         }
+        
+        // convert non-continuous strings unless the module can handle them
+        if (!(module->module.flags & NCDMODULE_FLAG_ACCEPT_NON_CONTINUOUS_STRINGS)) {
+            if (!NCDValMem_ConvertNonContinuousStrings(&ps->args_mem, &args)) {
+                STATEMENT_LOG(ps, BLOG_ERROR, "NCDValMem_ConvertNonContinuousStrings failed");
+                goto fail1;
+            }
+        }
     }
     
     // allocate memory
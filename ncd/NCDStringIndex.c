@@ -121,6 +121,7 @@ static NCD_string_id_t do_get (NCDStringIndex *o, const char *str, size_t str_le
         return -1;
     }
     entry->str_len = str_len;
+    entry->hash = badvpn_djb2_hash_bin((const uint8_t *)str, str_len);
     entry->has_nulls = !!memchr(str, '\0', str_len);
     
     NCDStringIndex__HashRef newref = {entry, o->entries_size};
@@ -244,6 +245,16 @@ int NCDStringIndex_HasNulls (NCDStringIndex *o, NCD_string_id_t id)
     return o->entries[id].has_nulls;
 }
 
+size_t NCDStringIndex_Hash (NCDStringIndex *o, NCD_string_id_t id)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(id >= 0)
+    ASSERT(id < o->entries_size)
+    ASSERT(o->entries[id].str)
+    
+    return o->entries[id].hash;
+}
+
 int NCDStringIndex_GetRequests (NCDStringIndex *o, struct NCD_string_request *requests)
 {
     DebugObject_Access(&o->d_obj);
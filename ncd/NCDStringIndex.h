@@ -46,6 +46,7 @@ typedef int NCD_string_id_t;
 struct NCDStringIndex__entry {
     char *str;
     size_t str_len;
+    size_t hash;
     int has_nulls;
     NCD_string_id_t hash_next;
 };
@@ -78,6 +79,7 @@ NCD_string_id_t NCDStringIndex_GetBin (NCDStringIndex *o, const char *str, size_
 const char * NCDStringIndex_Value (NCDStringIndex *o, NCD_string_id_t id);
 size_t NCDStringIndex_Length (NCDStringIndex *o, NCD_string_id_t id);
 int NCDStringIndex_HasNulls (NCDStringIndex *o, NCD_string_id_t id);
+size_t NCDStringIndex_Hash (NCDStringIndex *o, NCD_string_id_t id);
 int NCDStringIndex_GetRequests (NCDStringIndex *o, struct NCD_string_request *requests) WARN_UNUSED;
 
 #endif
@@ -51,6 +51,20 @@
 #define EXTERNALSTRING_TYPE (NCDVAL_STRING | (2 << 3))
 #define COMPOSEDSTRING_TYPE (NCDVAL_STRING | (3 << 3))
 
+// Header in front of a heap buffer of a memory object. Memory objects created
+// with NCDValMem_InitCopy share the buffer until one of them modifies it.
+union NCDVal__bufhdr {
+    int refcnt;
+    struct NCDVal__ref align_ref;
+    struct NCDVal__string align_string;
+    struct NCDVal__list align_list;
+    struct NCDVal__mapelem align_mapelem;
+    struct NCDVal__idstring align_idstring;
+    struct NCDVal__externalstring align_externalstring;
+    struct NCDVal__composedstring align_composedstring;
+    struct NCDVal__cms_link align_cms_link;
+};
+
 static int make_type (int internal_type, int depth)
 {
     ASSERT(internal_type == NCDVAL_LIST ||
@@ -100,6 +114,92 @@ static void * NCDValMem__BufAt (NCDValMem *o, NCDVal__idx idx)
     return (o->buf ? o->buf : o->fastbuf) + idx;
 }
 
+static union NCDVal__bufhdr * NCDValMem__BufHdr (NCDValMem *o)
+{
+    ASSERT(o->buf)
+    
+    return (union NCDVal__bufhdr *)o->buf - 1;
+}
+
+static int NCDValMem__BufShared (NCDValMem *o)
+{
+    return o->buf && NCDValMem__BufHdr(o)->refcnt > 1;
+}
+
+static char * NCDValMem__NewBuf (NCDVal__idx size)
+{
+    union NCDVal__bufhdr *hdr = malloc(sizeof(*hdr) + size);
+    if (!hdr) {
+        return NULL;
+    }
+    
+    hdr->refcnt = 1;
+    
+    return (char *)(hdr + 1);
+}
+
+static int NCDValMem__RefTargets (NCDValMem *o)
+{
+    NCDVal__idx refidx = o->first_ref;
+    while (refidx != -1) {
+        struct NCDVal__ref *ref = NCDValMem__BufAt(o, refidx);
+        ASSERT(ref->target)
+        if (!BRefTarget_Ref(ref->target)) {
+            goto fail;
+        }
+        refidx = ref->next;
+    }
+    
+    return 1;
+    
+fail:;
+    NCDVal__idx undo_refidx = o->first_ref;
+    while (undo_refidx != refidx) {
+        struct NCDVal__ref *ref = NCDValMem__BufAt(o, undo_refidx);
+        BRefTarget_Deref(ref->target);
+        undo_refidx = ref->next;
+    }
+    return 0;
+}
+
+// Gives the memory object a buffer of 'newsize' bytes which it does not share,
+// copying the contents of the shared buffer.
+static int NCDValMem__CopyBuf (NCDValMem *o, NCDVal__idx newsize)
+{
+    ASSERT(NCDValMem__BufShared(o))
+    ASSERT(newsize >= o->size)
+    
+    char *newbuf = NCDValMem__NewBuf(newsize);
+    if (!newbuf) {
+        return 0;
+    }
+    
+    // the copy holds its own references to the reference targets
+    if (!NCDValMem__RefTargets(o)) {
+        free((union NCDVal__bufhdr *)newbuf - 1);
+        return 0;
+    }
+    
+    memcpy(newbuf, o->buf, o->used);
+    
+    NCDValMem__BufHdr(o)->refcnt--;
+    
+    o->buf = newbuf;
+    o->size = newsize;
+    
+    return 1;
+}
+
+// Must be called before modifying the buffer other than via NCDValMem__Alloc.
+static int NCDValMem__Unshare (NCDValMem *o)
+{
+    if (!NCDValMem__BufShared(o)) {
+        return 1;
+    }
+    
+    return NCDValMem__CopyBuf(o, o->size);
+}
+
 static NCDVal__idx NCDValMem__Alloc (NCDValMem *o, NCDVal__idx alloc_size, NCDVal__idx align)
 {
     NCDVal__idx mod = o->used % align;
@@ -119,23 +219,31 @@ static NCDVal__idx NCDValMem__Alloc (NCDValMem *o, NCDVal__idx alloc_size, NCDVa
             newsize *= 2;
         }
         
-        char *newbuf;
-        
         if (!o->buf) {
-            newbuf = malloc(newsize);
+            char *newbuf = NCDValMem__NewBuf(newsize);
             if (!newbuf) {
                 return -1;
             }
             memcpy(newbuf, o->fastbuf, o->used);
-        } else {
-            newbuf = realloc(o->buf, newsize);
-            if (!newbuf) {
+            o->buf = newbuf;
+            o->size = newsize;
+        }
+        else if (NCDValMem__BufShared(o)) {
+            if (!NCDValMem__CopyBuf(o, newsize)) {
                 return -1;
             }
         }
-        
-        o->buf = newbuf;
-        o->size = newsize;
+        else {
+            union NCDVal__bufhdr *newhdr = realloc(NCDValMem__BufHdr(o), sizeof(union NCDVal__bufhdr) + newsize);
+            if (!newhdr) {
+                return -1;
+            }
+            o->buf = (char *)(newhdr + 1);
+            o->size = newsize;
+        }
+    }
+    else if (!NCDValMem__Unshare(o)) {
+        return -1;
     }
     
     NCDVal__idx idx = o->used + align_extra;
@@ -160,6 +268,7 @@ static void NCDVal__AssertMem (NCDValMem *mem)
     ASSERT(mem->used <= mem->size)
     ASSERT(mem->buf || mem->size == NCDVAL_FASTBUF_SIZE)
     ASSERT(!mem->buf || mem->size >= NCDVAL_FIRST_SIZE)
+    ASSERT(!mem->buf || NCDValMem__BufHdr(mem)->refcnt > 0)
 }
 
 static void NCDVal_AssertExternal (NCDValMem *mem, const void *e_buf, size_t e_len)
@@ -208,6 +317,7 @@ static void NCDVal__AssertValOnly (NCDValMem *mem, NCDVal__idx idx)
             ASSERT(map_e->maxcount >= 0)
             ASSERT(map_e->count >= 0)
             ASSERT(map_e->count <= map_e->maxcount)
+            ASSERT(map_e->hash_idx == -1 || (map_e->hash_idx >= 0 && map_e->hash_idx < mem->used))
             ASSERT(idx + sizeof(struct NCDVal__map) + map_e->maxcount * sizeof(struct NCDVal__mapelem) <= mem->used)
         } break;
         case IDSTRING_TYPE: {
@@ -255,7 +365,7 @@ static void NCDVal__MapAssertElemOnly (NCDValRef map, NCDVal__idx elemidx)
     struct NCDVal__map *map_e = NCDValMem__BufAt(map.mem, map.idx);
     ASSERT(elemidx >= map.idx + offsetof(struct NCDVal__map, elems))
     ASSERT(elemidx < map.idx + offsetof(struct NCDVal__map, elems) + map_e->count * sizeof(struct NCDVal__mapelem))
-
+    
     struct NCDVal__mapelem *me_e = NCDValMem__BufAt(map.mem, elemidx);
     NCDVal__AssertValOnly(map.mem, me_e->key_idx);
     NCDVal__AssertValOnly(map.mem, me_e->val_idx);
@@ -273,6 +383,15 @@ static NCDVal__idx NCDVal__MapElemIdx (NCDVal__idx mapidx, NCDVal__idx pos)
     return mapidx + offsetof(struct NCDVal__map, elems) + pos * sizeof(struct NCDVal__mapelem);
 }
 
+static NCDVal__idx NCDVal__MapCopyLink (NCDVal__idx link, NCDVal__idx old_mapidx, NCDVal__idx new_mapidx)
+{
+    if (link == -1) {
+        return -1;
+    }
+    
+    return link - old_mapidx + new_mapidx;
+}
+
 static int NCDVal__Depth (NCDValRef val)
 {
     ASSERT(val.idx != -1)
@@ -375,6 +494,127 @@ static const char * NCDVal__composedstring_cstring_func (const b_cstring *cstr,
 #include "NCDVal_maptree.h"
 #include <structure/CAvl_impl.h>
 
+static NCDVal__idx * NCDVal__MapHashBuckets (struct NCDVal__maphash *hash_e, NCDVal__idx maxcount)
+{
+    return (NCDVal__idx *)&hash_e->entries[maxcount];
+}
+
+static NCDVal__idx NCDVal__MapHashBucket (size_t hash, NCDVal__idx num_buckets)
+{
+    return (hash ^ (hash >> 15)) & (num_buckets - 1);
+}
+
+static size_t NCDVal__HashBytes (size_t hash, const char *data, size_t length)
+{
+    // continues badvpn_djb2_hash_bin(), which NCDStringIndex uses for ID strings
+    while (length-- > 0) {
+        hash = ((hash << 5) + hash) + (uint8_t)*data++;
+    }
+    
+    return hash;
+}
+
+size_t NCDVal_Hash (NCDValRef val)
+{
+    NCDVal__AssertVal(val);
+    
+    switch (NCDVal_Type(val)) {
+        case NCDVAL_STRING: {
+            void *ptr = NCDValMem__BufAt(val.mem, val.idx);
+            if (get_internal_type(*(int *)ptr) == IDSTRING_TYPE) {
+                struct NCDVal__idstring *ids_e = ptr;
+                return NCDStringIndex_Hash(ids_e->string_index, ids_e->string_id);
+            }
+            
+            size_t hash = 5381;
+            b_cstring cstr = NCDVal_StringCstring(val);
+            B_CSTRING_LOOP(cstr, pos, chunk_data, chunk_length, {
+                hash = NCDVal__HashBytes(hash, chunk_data, chunk_length);
+            })
+            
+            return hash;
+        } break;
+        
+        case NCDVAL_LIST: {
+            size_t hash = NCDVAL_LIST;
+            size_t count = NCDVal_ListCount(val);
+            
+            for (size_t i = 0; i < count; i++) {
+                hash = 31 * hash + NCDVal_Hash(NCDVal_ListGet(val, i));
+            }
+            
+            return hash;
+        } break;
+        
+        case NCDVAL_MAP: {
+            // must not depend on the order of entries
+            size_t hash = NCDVAL_MAP;
+            
+            for (NCDValMapElem e = NCDVal_MapFirst(val); !NCDVal_MapElemInvalid(e); e = NCDVal_MapNext(val, e)) {
+                hash += 31 * NCDVal_Hash(NCDVal_MapElemKey(val, e)) + NCDVal_Hash(NCDVal_MapElemVal(val, e));
+            }
+            
+            return hash;
+        } break;
+        
+        case NCDVAL_PLACEHOLDER: {
+            return NCDVal_PlaceholderId(val);
+        } break;
+        
+        default:
+            ASSERT(0);
+            return 0;
+    }
+}
+
+static int NCDVal__KeyEquals (NCDValRef key1, NCDValRef key2)
+{
+    // ID strings from the same string index are equal exactly when their IDs are
+    if (NCDVal_IsIdString(key1) && NCDVal_IsIdString(key2) &&
+        NCDVal_IdStringStringIndex(key1) == NCDVal_IdStringStringIndex(key2)
+    ) {
+        return NCDVal_IdStringId(key1) == NCDVal_IdStringId(key2);
+    }
+    
+    return !NCDVal_Compare(key1, key2);
+}
+
+static NCDVal__idx NCDVal__MapHashLookup (NCDValRef map, NCDValRef key, size_t hash)
+{
+    struct NCDVal__map *map_e = NCDValMem__BufAt(map.mem, map.idx);
+    ASSERT(map_e->hash_idx != -1)
+    struct NCDVal__maphash *hash_e = NCDValMem__BufAt(map.mem, map_e->hash_idx);
+    
+    NCDVal__idx pos = NCDVal__MapHashBuckets(hash_e, map_e->maxcount)[NCDVal__MapHashBucket(hash, hash_e->num_buckets)];
+    
+    while (pos != -1) {
+        ASSERT(pos >= 0)
+        ASSERT(pos < map_e->count)
+        
+        if (hash_e->entries[pos].hash == hash && NCDVal__KeyEquals(NCDVal__Ref(map.mem, map_e->elems[pos].key_idx), key)) {
+            return pos;
+        }
+        
+        pos = hash_e->entries[pos].next;
+    }
+    
+    return -1;
+}
+
+static void NCDVal__MapHashAdd (NCDValMem *mem, struct NCDVal__map *map_e, NCDVal__idx pos, size_t hash)
+{
+    ASSERT(map_e->hash_idx != -1)
+    ASSERT(pos >= 0)
+    ASSERT(pos < map_e->maxcount)
+    
+    struct NCDVal__maphash *hash_e = NCDValMem__BufAt(mem, map_e->hash_idx);
+    NCDVal__idx *bucket = &NCDVal__MapHashBuckets(hash_e, map_e->maxcount)[NCDVal__MapHashBucket(hash, hash_e->num_buckets)];
+    
+    hash_e->entries[pos].hash = hash;
+    hash_e->entries[pos].next = *bucket;
+    *bucket = pos;
+}
+
 void NCDValMem_Init (NCDValMem *o)
 {
     o->buf = NULL;
@@ -388,6 +628,10 @@ void NCDValMem_Free (NCDValMem *o)
 {
     NCDVal__AssertMem(o);
     
+    if (o->buf && --NCDValMem__BufHdr(o)->refcnt > 0) {
+        return;
+    }
+    
     NCDVal__idx refidx = o->first_ref;
     while (refidx != -1) {
         struct NCDVal__ref *ref = NCDValMem__BufAt(o, refidx);
@@ -397,7 +641,7 @@ void NCDValMem_Free (NCDValMem *o)
     }
     
     if (o->buf) {
-        BFree(o->buf);
+        free(NCDValMem__BufHdr(o));
     }
 }
 
@@ -410,41 +654,23 @@ int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other)
     o->first_ref = other->first_ref;
     o->first_cms_link = other->first_cms_link;
     
-    if (!other->buf) {
-        o->buf = NULL;
-        memcpy(o->fastbuf, other->fastbuf, other->used);
-    } else {
-        o->buf = BAlloc(other->size);
-        if (!o->buf) {
-            goto fail0;
-        }
-        memcpy(o->buf, other->buf, other->used);
-    }
-    
-    NCDVal__idx refidx = o->first_ref;
-    while (refidx != -1) {
-        struct NCDVal__ref *ref = NCDValMem__BufAt(o, refidx);
-        ASSERT(ref->target)
-        if (!BRefTarget_Ref(ref->target)) {
-            goto fail1;
+    // A heap buffer is shared with the original and only copied once either
+    // memory object modifies it. The copy then gets the capacity of the
+    // original, so that a copy which is extended does not have to grow again.
+    if (other->buf) {
+        union NCDVal__bufhdr *hdr = NCDValMem__BufHdr(other);
+        if (hdr->refcnt == INT_MAX) {
+            return 0;
         }
-        refidx = ref->next;
+        hdr->refcnt++;
+        o->buf = other->buf;
+        return 1;
     }
     
-    return 1;
+    o->buf = NULL;
+    memcpy(o->fastbuf, other->fastbuf, other->used);
     
-fail1:;
-    NCDVal__idx undo_refidx = o->first_ref;
-    while (undo_refidx != refidx) {
-        struct NCDVal__ref *ref = NCDValMem__BufAt(o, undo_refidx);
-        BRefTarget_Deref(ref->target);
-        undo_refidx = ref->next;
-    }
-    if (o->buf) {
-        BFree(o->buf);
-    }
-fail0:
-    return 0;
+    return NCDValMem__RefTargets(o);
 }
 
 int NCDValMem_ConvertNonContinuousStrings (NCDValMem *o, NCDValRef *root_val)
@@ -604,28 +830,78 @@ NCDValRef NCDVal_NewCopy (NCDValMem *mem, NCDValRef val)
         } break;
         
         case NCDVAL_MAP: {
-            size_t count = NCDVal_MapCount(val);
+            struct NCDVal__map *map_e = ptr;
+            
+            // The elements are copied in place together with the tree and the
+            // cached key hashes, so the keys do not need to be compared or hashed
+            // again. Tree links are absolute indices and are translated to the
+            // position of the copy.
+            NCDVal__idx count = map_e->count;
+            int hashed = (map_e->hash_idx != -1);
             
-            NCDValRef copy = NCDVal_NewMap(mem, count);
+            NCDValRef copy = (hashed ? NCDVal_NewHashMap(mem, count) : NCDVal_NewMap(mem, count));
             if (NCDVal_IsInvalid(copy)) {
                 goto fail;
             }
+            NCDVal__idx idx = copy.idx;
             
-            for (NCDValMapElem e = NCDVal_MapFirst(val); !NCDVal_MapElemInvalid(e); e = NCDVal_MapNext(val, e)) {
-                NCDValRef key_copy = NCDVal_NewCopy(mem, NCDVal_MapElemKey(val, e));
-                NCDValRef val_copy = NCDVal_NewCopy(mem, NCDVal_MapElemVal(val, e));
-                if (NCDVal_IsInvalid(key_copy) || NCDVal_IsInvalid(val_copy)) {
+            map_e = NCDValMem__BufAt(val.mem, val.idx);
+            struct NCDVal__map *new_map_e = NCDValMem__BufAt(mem, idx);
+            
+            memcpy(new_map_e->elems, map_e->elems, count * sizeof(struct NCDVal__mapelem));
+            new_map_e->type = map_e->type;
+            new_map_e->count = count;
+            new_map_e->tree.root = NCDVal__MapCopyLink(map_e->tree.root, val.idx, idx);
+            
+            if (hashed) {
+                struct NCDVal__maphash *hash_e = NCDValMem__BufAt(val.mem, map_e->hash_idx);
+                for (NCDVal__idx i = 0; i < count; i++) {
+                    NCDVal__MapHashAdd(mem, new_map_e, i, hash_e->entries[i].hash);
+                }
+            }
+            
+            for (NCDVal__idx i = 0; i < count; i++) {
+                struct NCDVal__mapelem *me_e = &new_map_e->elems[i];
+                me_e->tree_child[0] = NCDVal__MapCopyLink(me_e->tree_child[0], val.idx, idx);
+                me_e->tree_child[1] = NCDVal__MapCopyLink(me_e->tree_child[1], val.idx, idx);
+                me_e->tree_parent = NCDVal__MapCopyLink(me_e->tree_parent, val.idx, idx);
+            }
+            
+            for (NCDVal__idx i = 0; i < count; i++) {
+                map_e = NCDValMem__BufAt(val.mem, val.idx);
+                NCDValRef key_copy = NCDVal_NewCopy(mem, NCDVal__Ref(val.mem, map_e->elems[i].key_idx));
+                if (NCDVal_IsInvalid(key_copy)) {
                     goto fail;
                 }
                 
-                int inserted;
-                if (!NCDVal_MapInsert(copy, key_copy, val_copy, &inserted)) {
+                NCDVal__idx elemidx = NCDVal__MapElemIdx(idx, i);
+                
+                if (NCDValMem__NeedRegisterLink(mem, key_copy.idx)) {
+                    if (!NCDValMem__RegisterLink(mem, key_copy.idx, elemidx + offsetof(struct NCDVal__mapelem, key_idx))) {
+                        goto fail;
+                    }
+                }
+                
+                new_map_e = NCDValMem__BufAt(mem, idx);
+                new_map_e->elems[i].key_idx = key_copy.idx;
+                
+                map_e = NCDValMem__BufAt(val.mem, val.idx);
+                NCDValRef val_copy = NCDVal_NewCopy(mem, NCDVal__Ref(val.mem, map_e->elems[i].val_idx));
+                if (NCDVal_IsInvalid(val_copy)) {
                     goto fail;
                 }
-                ASSERT_EXECUTE(inserted)
+                
+                if (NCDValMem__NeedRegisterLink(mem, val_copy.idx)) {
+                    if (!NCDValMem__RegisterLink(mem, val_copy.idx, elemidx + offsetof(struct NCDVal__mapelem, val_idx))) {
+                        goto fail;
+                    }
+                }
+                
+                new_map_e = NCDValMem__BufAt(mem, idx);
+                new_map_e->elems[i].val_idx = val_copy.idx;
             }
             
-            return copy;
+            return NCDVal__Ref(mem, idx);
         } break;
         
         case IDSTRING_TYPE: {
@@ -683,6 +959,13 @@ int NCDVal_Compare (NCDValRef val1, NCDValRef val2)
     
     switch (type1) {
         case NCDVAL_STRING: {
+            if (NCDVal_IsIdString(val1) && NCDVal_IsIdString(val2) &&
+                NCDVal_IdStringStringIndex(val1) == NCDVal_IdStringStringIndex(val2) &&
+                NCDVal_IdStringId(val1) == NCDVal_IdStringId(val2)
+            ) {
+                return 0;
+            }
+            
             size_t len1 = NCDVal_StringLength(val1);
             size_t len2 = NCDVal_StringLength(val2);
             size_t min_len = len1 < len2 ? len1 : len2;
@@ -1502,6 +1785,10 @@ int NCDVal_ListAppend (NCDValRef list, NCDValRef elem)
     ASSERT(elem.mem == list.mem)
     NCDVal__AssertValOnly(list.mem, elem.idx);
     
+    if (!NCDValMem__Unshare(list.mem)) {
+        return 0;
+    }
+    
     struct NCDVal__list *list_e = NCDValMem__BufAt(list.mem, list.idx);
     
     int new_type = list_e->type;
@@ -1626,6 +1913,7 @@ NCDValRef NCDVal_NewMap (NCDValMem *mem, size_t maxcount)
     map_e->type = make_type(NCDVAL_MAP, 0);
     map_e->maxcount = maxcount;
     map_e->count = 0;
+    map_e->hash_idx = -1;
     NCDVal__MapTree_Init(&map_e->tree);
     
     return NCDVal__Ref(mem, idx);
@@ -1634,6 +1922,66 @@ fail:
     return NCDVal_NewInvalid();
 }
 
+NCDValRef NCDVal_NewHashMap (NCDValMem *mem, size_t maxcount)
+{
+    NCDVal__AssertMem(mem);
+    
+    // bounds num_buckets below by less than 2 * maxcount
+    if (maxcount > (NCDVAL_MAXIDX - sizeof(struct NCDVal__maphash)) / (sizeof(struct NCDVal__hashentry) + 2 * sizeof(NCDVal__idx))) {
+        goto fail;
+    }
+    
+    NCDVal__idx num_buckets = 1;
+    while (num_buckets < maxcount) {
+        num_buckets *= 2;
+    }
+    
+    NCDValRef map = NCDVal_NewMap(mem, maxcount);
+    if (NCDVal_IsInvalid(map)) {
+        goto fail;
+    }
+    
+    NCDVal__idx size = sizeof(struct NCDVal__maphash) + maxcount * sizeof(struct NCDVal__hashentry) + num_buckets * sizeof(NCDVal__idx);
+    NCDVal__idx hash_idx = NCDValMem__Alloc(mem, size, __alignof(struct NCDVal__maphash));
+    if (hash_idx < 0) {
+        goto fail;
+    }
+    
+    struct NCDVal__maphash *hash_e = NCDValMem__BufAt(mem, hash_idx);
+    hash_e->num_buckets = num_buckets;
+    
+    NCDVal__idx *buckets = NCDVal__MapHashBuckets(hash_e, maxcount);
+    for (NCDVal__idx i = 0; i < num_buckets; i++) {
+        buckets[i] = -1;
+    }
+    
+    struct NCDVal__map *map_e = NCDValMem__BufAt(mem, map.idx);
+    map_e->hash_idx = hash_idx;
+    
+    return map;
+    
+fail:
+    return NCDVal_NewInvalid();
+}
+
+NCDValRef NCDVal_NewMapAuto (NCDValMem *mem, size_t maxcount)
+{
+    if (maxcount >= NCDVAL_HASHMAP_MIN_COUNT) {
+        return NCDVal_NewHashMap(mem, maxcount);
+    }
+    
+    return NCDVal_NewMap(mem, maxcount);
+}
+
+int NCDVal_MapIsHashed (NCDValRef map)
+{
+    ASSERT(NCDVal_IsMap(map))
+    
+    struct NCDVal__map *map_e = NCDValMem__BufAt(map.mem, map.idx);
+    
+    return map_e->hash_idx != -1;
+}
+
 int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inserted)
 {
     ASSERT(NCDVal_IsMap(map))
@@ -1643,6 +1991,10 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
     NCDVal__AssertValOnly(map.mem, key.idx);
     NCDVal__AssertValOnly(map.mem, val.idx);
     
+    if (!NCDValMem__Unshare(map.mem)) {
+        goto fail0;
+    }
+    
     struct NCDVal__map *map_e = NCDValMem__BufAt(map.mem, map.idx);
     
     int new_type = map_e->type;
@@ -1650,6 +2002,19 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
         goto fail0;
     }
     
+    size_t hash = 0;
+    if (map_e->hash_idx != -1) {
+        ASSERT(!NCDVal_IsPlaceholder(key))
+        
+        hash = NCDVal_Hash(key);
+        if (NCDVal__MapHashLookup(map, key, hash) != -1) {
+            if (out_inserted) {
+                *out_inserted = 0;
+            }
+            return 1;
+        }
+    }
+    
     NCDVal__idx elemidx = NCDVal__MapElemIdx(map.idx, map_e->count);
     
     if (NCDValMem__NeedRegisterLink(map.mem, key.idx)) {
@@ -1673,12 +2038,18 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
     
     int res = NCDVal__MapTree_Insert(&map_e->tree, map.mem, NCDVal__MapTreeDeref(map.mem, elemidx), NULL);
     if (!res) {
+        // a hashed map has already checked for the key
+        ASSERT(map_e->hash_idx == -1)
         if (out_inserted) {
             *out_inserted = 0;
         }
         return 1;
     }
     
+    if (map_e->hash_idx != -1) {
+        NCDVal__MapHashAdd(map.mem, map_e, map_e->count, hash);
+    }
+    
     map_e->type = new_type;
     map_e->count++;
     
@@ -1805,6 +2176,11 @@ NCDValMapElem NCDVal_MapFindKey (NCDValRef map, NCDValRef key)
     
     struct NCDVal__map *map_e = NCDValMem__BufAt(map.mem, map.idx);
     
+    if (map_e->hash_idx != -1) {
+        NCDVal__idx pos = NCDVal__MapHashLookup(map, key, NCDVal_Hash(key));
+        return NCDVal__MapElem(pos == -1 ? -1 : NCDVal__MapElemIdx(map.idx, pos));
+    }
+    
     NCDVal__MapTreeRef ref = NCDVal__MapTree_LookupExact(&map_e->tree, map.mem, key);
     ASSERT(ref.link == -1 || (NCDVal__MapAssertElemOnly(map, ref.link), 1))
     
@@ -2004,6 +2380,10 @@ int NCDValReplaceProg_Execute (NCDValReplaceProg prog, NCDValMem *mem, NCDVal_re
     NCDVal__AssertMem(mem);
     ASSERT(replace)
     
+    if (prog.num_instrs > 0 && !NCDValMem__Unshare(mem)) {
+        return 0;
+    }
+    
     for (size_t i = 0; i < prog.num_instrs; i++) {
         struct NCDVal__instr instr = prog.instrs[i];
         
@@ -2032,6 +2412,7 @@ int NCDValReplaceProg_Execute (NCDValReplaceProg prog, NCDValMem *mem, NCDVal_re
                 NCDVal__AssertValOnly(mem, instr.reinsert.mapidx);
                 struct NCDVal__map *map_e = NCDValMem__BufAt(mem, instr.reinsert.mapidx);
                 ASSERT(map_e->type == NCDVAL_MAP)
+                ASSERT(map_e->hash_idx == -1)
                 ASSERT(instr.reinsert.elempos >= 0)
                 ASSERT(instr.reinsert.elempos < map_e->count)
                 
@@ -44,6 +44,7 @@
 #define NCDVAL_FASTBUF_SIZE 64
 #define NCDVAL_FIRST_SIZE 256
 #define NCDVAL_MAX_DEPTH 32
+#define NCDVAL_HASHMAP_MIN_COUNT 16
 
 #define NCDVAL_MAXIDX INT_MAX
 #define NCDVAL_MINIDX INT_MIN
@@ -141,10 +142,22 @@ struct NCDVal__map {
     int type;
     NCDVal__idx maxcount;
     NCDVal__idx count;
+    NCDVal__idx hash_idx;
     NCDVal__MapTree tree;
     struct NCDVal__mapelem elems[];
 };
 
+struct NCDVal__hashentry {
+    size_t hash;
+    NCDVal__idx next;
+};
+
+struct NCDVal__maphash {
+    NCDVal__idx num_buckets;
+    struct NCDVal__hashentry entries[];
+    // followed by NCDVal__idx buckets[num_buckets]
+};
+
 typedef struct {
     NCDVal__idx elemidx;
 } NCDValMapElem;
@@ -228,6 +241,8 @@ void NCDValMem_Free (NCDValMem *o);
  * to {@link NCDValSafeRef} using {@link NCDVal_ToSafe} and back to
  * {@link NCDValRef} using {@link NCDVal_FromSafe} with the new memory object
  * specified. Alternatively, {@link NCDVal_Moved} can be used.
+ * This takes constant time: the two memory objects share the memory buffer
+ * until either of them is modified, which then copies the buffer.
  * Returns 1 on success and 0 on failure.
  */
 int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other) WARN_UNUSED;
@@ -312,6 +327,13 @@ NCDValRef NCDVal_NewCopy (NCDValMem *mem, NCDValRef val);
  */
 int NCDVal_Compare (NCDValRef val1, NCDValRef val2);
 
+/**
+ * Computes a hash of a value, which must not be an invalid reference.
+ * Values which are equal according to {@link NCDVal_Compare} have equal
+ * hashes, regardless of how their strings are stored.
+ */
+size_t NCDVal_Hash (NCDValRef val);
+
 /**
  * Converts a value reference to a safe referece format, which remains valid
  * if the memory object is moved (safe references do not contain a pointer
@@ -715,6 +737,33 @@ int NCDVal_IsMap (NCDValRef val);
  */
 NCDValRef NCDVal_NewMap (NCDValMem *mem, size_t maxcount);
 
+/**
+ * Like {@link NCDVal_NewMap}, but the map additionally gets a hash table
+ * indexing its keys. With a hash table, {@link NCDVal_MapFindKey} takes
+ * constant time on average, instead of performing a logarithmic number of
+ * comparisons. The entries are still kept in the AVL tree, so ordered
+ * iteration and comparison cost the same as for other maps.
+ * Keys inserted into a hashed map must not contain placeholders.
+ * Returns a reference to the new value, or an invalid reference
+ * on out of memory.
+ */
+NCDValRef NCDVal_NewHashMap (NCDValMem *mem, size_t maxcount);
+
+/**
+ * Builds a new map value, using {@link NCDVal_NewHashMap} if 'maxcount'
+ * is at least NCDVAL_HASHMAP_MIN_COUNT, and {@link NCDVal_NewMap} otherwise.
+ * Use this when building maps of arbitrary size out of values that contain
+ * no placeholders.
+ */
+NCDValRef NCDVal_NewMapAuto (NCDValMem *mem, size_t maxcount);
+
+/**
+ * Determines if a map value has a hash table, i.e. was created using
+ * {@link NCDVal_NewHashMap}, or was copied from such a map.
+ * The 'map' reference must point to a map value.
+ */
+int NCDVal_MapIsHashed (NCDValRef map);
+
 /**
  * Inserts an entry to the map value.
  * The 'map' reference must point to a map value, and the
@@ -723,7 +772,7 @@ NCDValRef NCDVal_NewMap (NCDValMem *mem, size_t maxcount);
  * Inserting an entry does not in any way change the 'key'and 'val';
  * internally, the map only points to it.
  * You must not modify the key after inserting it into a map. This is because
- * the map builds an embedded AVL tree of entries indexed by keys.
+ * the map builds an embedded AVL tree or hash table of entries indexed by keys.
  * If insertion fails due to a maximum depth limit, returns 0.
  * Otherwise returns 1, and *out_inserted is set to 1 if the key did not
  * yet exist and the entry was inserted, and to 0 if it did exist and the
@@ -106,7 +106,7 @@ static int complete_value (NCDValCons *o, NCDValConsVal val, NCDValSafeRef *out,
         } break;
         
         case NCDVALCONS_TYPE_INCOMPLETE_MAP: {
-            NCDValRef map = NCDVal_NewMap(o->mem, val.u.incomplete.count);
+            NCDValRef map = NCDVal_NewMapAuto(o->mem, val.u.incomplete.count);
             if (NCDVal_IsInvalid(map)) {
                 goto fail_memory;
             }
@@ -85,6 +85,13 @@
  *   list::set(list l1, ..., list lN)
  * Description:
  *   Replaces the list with the concatenation of given lists.
+ * 
+ * The first list::contains, list::find or list::remove on a list with at least
+ * 16 elements builds a hash index of its elements, which is then kept up to date,
+ * so that large lists used as sets are searched in constant time instead of
+ * comparing every element.
+ * Elements are kept in a counted tree, so list::get and list::remove_at
+ * take logarithmic time.
  */
 
 #include <stdlib.h>
@@ -95,6 +102,7 @@
 #include <misc/offset.h>
 #include <misc/parse_number.h>
 #include <structure/IndexedList.h>
+#include <structure/CHash.h>
 #include <ncd/NCDModule.h>
 #include <ncd/extra/value_utils.h>
 
@@ -102,15 +110,32 @@
 
 #define ModuleLog(i, ...) NCDModuleInst_Backend_Log((i), BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
+#define LIST_HASH_MIN_COUNT 16
+#define LIST_HASH_INITIAL_BUCKETS 16
+
 struct elem {
     IndexedListNode il_node;
     NCDValMem mem;
     NCDValRef val;
+    uint64_t seq;
+    size_t hash;
+    struct elem *hash_next;
+};
+
+struct list_hash_key {
+    NCDValRef val;
+    size_t hash;
 };
 
+#include "list_hash.h"
+#include <structure/CHash_decl.h>
+
 struct instance {
     NCDModuleInst *i;
     IndexedList il;
+    uint64_t next_seq;
+    int have_hash;
+    ListHash hash;
 };
 
 struct length_instance {
@@ -135,14 +160,64 @@ struct find_instance {
     uint64_t found_pos;
 };
 
+#include "list_hash.h"
+#include <structure/CHash_impl.h>
+
 static uint64_t list_count (struct instance *o)
 {
     return IndexedList_Count(&o->il);
 }
 
+static void hash_add_elem (struct instance *o, struct elem *e)
+{
+    ASSERT(o->have_hash)
+    
+    e->hash = NCDVal_Hash(e->val);
+    
+    // keep the load factor at most one; if growing fails, chains just get longer
+    if (list_count(o) > o->hash.num_buckets) {
+        ListHash_MultiplyBuckets(&o->hash, 0, 1);
+    }
+    
+    ListHashRef ref = {e, e};
+    ListHash_InsertMulti(&o->hash, 0, ref);
+}
+
+static int build_hash (struct instance *o)
+{
+    ASSERT(!o->have_hash)
+    
+    size_t num_buckets = LIST_HASH_INITIAL_BUCKETS;
+    while (num_buckets < list_count(o) && num_buckets <= SIZE_MAX / 2) {
+        num_buckets *= 2;
+    }
+    
+    if (!ListHash_Init(&o->hash, num_buckets)) {
+        return 0;
+    }
+    
+    o->have_hash = 1;
+    
+    for (IndexedListNode *iln = IndexedList_GetFirst(&o->il); iln; iln = IndexedList_GetNext(&o->il, iln)) {
+        struct elem *e = UPPER_OBJECT(iln, struct elem, il_node);
+        hash_add_elem(o, e);
+    }
+    
+    return 1;
+}
+
+static void free_hash (struct instance *o)
+{
+    if (o->have_hash) {
+        ListHash_Free(&o->hash);
+        o->have_hash = 0;
+    }
+}
+
 static struct elem * insert_value (NCDModuleInst *i, struct instance *o, NCDValRef val, uint64_t idx)
 {
     ASSERT(idx <= list_count(o))
+    ASSERT(idx == list_count(o)) // elements are only appended, so seq order is list order
     ASSERT(!NCDVal_IsInvalid(val))
     
     struct elem *e = malloc(sizeof(*e));
@@ -159,6 +234,11 @@ static struct elem * insert_value (NCDModuleInst *i, struct instance *o, NCDValR
     }
     
     IndexedList_InsertAt(&o->il, &e->il_node, idx);
+    e->seq = o->next_seq++;
+    
+    if (o->have_hash) {
+        hash_add_elem(o, e);
+    }
     
     return e;
     
@@ -171,6 +251,11 @@ fail0:
 
 static void remove_elem (struct instance *o, struct elem *e)
 {
+    if (o->have_hash) {
+        ListHashRef ref = {e, e};
+        ListHash_Remove(&o->hash, 0, ref);
+    }
+    
     IndexedList_Remove(&o->il, &e->il_node);
     NCDValMem_Free(&e->mem);
     free(e);
@@ -270,12 +355,54 @@ fail:
     return 0;
 }
 
+static int use_hash (struct instance *o)
+{
+    return o->have_hash || (list_count(o) >= LIST_HASH_MIN_COUNT && build_hash(o));
+}
+
+static int contains_elem (struct instance *o, NCDValRef val)
+{
+    if (use_hash(o)) {
+        struct list_hash_key key = {val, NCDVal_Hash(val)};
+        return !!ListHash_Lookup(&o->hash, 0, key).link;
+    }
+    
+    for (IndexedListNode *iln = IndexedList_GetFirst(&o->il); iln; iln = IndexedList_GetNext(&o->il, iln)) {
+        struct elem *e = UPPER_OBJECT(iln, struct elem, il_node);
+        if (NCDVal_Compare(e->val, val) == 0) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
 static struct elem * find_elem (struct instance *o, NCDValRef val, uint64_t start_idx, uint64_t *out_idx)
 {
     if (start_idx >= list_count(o)) {
         return NULL;
     }
     
+    if (use_hash(o)) {
+        struct list_hash_key key = {val, NCDVal_Hash(val)};
+        
+        // The equal elements are not in list order in the hash table, but seq order
+        // is list order. Pick the one with the lowest seq at or after start_idx.
+        uint64_t min_seq = (start_idx == 0 ? 0 : get_elem_at(o, start_idx)->seq);
+        struct elem *found = NULL;
+        
+        for (ListHashRef ref = ListHash_Lookup(&o->hash, 0, key); ref.link; ref = ListHash_GetNextEqual(&o->hash, 0, ref)) {
+            if (ref.ptr->seq >= min_seq && (!found || ref.ptr->seq < found->seq)) {
+                found = ref.ptr;
+            }
+        }
+        
+        if (found && out_idx) {
+            *out_idx = IndexedList_IndexOf(&o->il, &found->il_node);
+        }
+        return found;
+    }
+    
     for (IndexedListNode *iln = IndexedList_GetAt(&o->il, start_idx); iln; iln = IndexedList_GetNext(&o->il, iln)) {
         struct elem *e = UPPER_OBJECT(iln, struct elem, il_node);
         if (NCDVal_Compare(e->val, val) == 0) {
@@ -323,6 +450,8 @@ static void func_new_list (void *vo, NCDModuleInst *i, const struct NCDModuleIns
     
     // init list
     IndexedList_Init(&o->il);
+    o->next_seq = 0;
+    o->have_hash = 0;
     
     // append contents
     if (!append_list_contents(i, o, params->args)) {
@@ -345,6 +474,8 @@ static void func_new_listfrom (void *vo, NCDModuleInst *i, const struct NCDModul
     
     // init list
     IndexedList_Init(&o->il);
+    o->next_seq = 0;
+    o->have_hash = 0;
     
     // append contents contents
     if (!append_list_contents_contents(i, o, params->args)) {
@@ -367,6 +498,9 @@ static void func_die (void *vo)
     // free list elements
     cut_list_front(o, 0);
     
+    // free hash index
+    free_hash(o);
+    
     NCDModuleInst_Backend_Dead(o->i);
 }
 
@@ -607,7 +741,7 @@ static void contains_func_new (void *vo, NCDModuleInst *i, const struct NCDModul
     struct instance *mo = NCDModuleInst_Backend_GetUser((NCDModuleInst *)params->method_user);
     
     // search
-    o->contains = !!find_elem(mo, value_arg, 0, NULL);
+    o->contains = contains_elem(mo, value_arg);
     
     // signal up
     NCDModuleInst_Backend_Up(o->i);
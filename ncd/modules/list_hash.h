@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME ListHash
+#define CHASH_PARAM_ENTRY struct elem
+#define CHASH_PARAM_LINK struct elem *
+#define CHASH_PARAM_KEY struct list_hash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct elem *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) ((key).hash)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->hash == (entry2).ptr->hash && !NCDVal_Compare((entry1).ptr->val, (entry2).ptr->val))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).hash == (entry2).ptr->hash && !NCDVal_Compare((key1).val, (entry2).ptr->val))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -929,7 +929,7 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
         } break;
         
         case NCDVAL_MAP: {
-            *out_value = NCDVal_NewMap(mem, value_map_len(v));
+            *out_value = NCDVal_NewMapAuto(mem, value_map_len(v));
             if (NCDVal_IsInvalid(*out_value)) {
                 goto fail;
             }
@@ -29,11 +29,15 @@
 
 #include <prerror.h>
 #include <ssl.h>
+#include <pk11pub.h>
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <misc/print_macros.h>
+#include <misc/offset.h>
+#include <misc/minmax.h>
 #include <base/BLog.h>
 
 #include "BSSLConnection.h"
@@ -45,7 +49,16 @@
 #define THREADWORK_STATE_READ 2
 #define THREADWORK_STATE_WRITE 3
 
+#define HS_STATE_NONE 0
+#define HS_STATE_WAITING 1
+#define HS_STATE_ACTIVE 2
+
+#define SESSION_CACHE_KEY_HASH_LEN 32
+
 static void backend_threadwork_start (struct BSSLConnection_backend *b, int op);
+static void pool_admit (BSSLHandshakePool *p);
+static void connection_leave_pool (BSSLConnection *o);
+static int connection_handshake_in_threads (BSSLConnection *o);
 static int backend_threadwork_do_io (struct BSSLConnection_backend *b);
 static void connection_init_job_handler (BSSLConnection *o);
 static void connection_init_up (BSSLConnection *o);
@@ -53,6 +66,10 @@ static void connection_try_io (BSSLConnection *o);
 static void connection_threadwork_func_work (void *user);
 static void connection_threadwork_handler_done (void *user);
 static void connection_recv_job_handler (BSSLConnection *o);
+static void connection_flush_job_handler (BSSLConnection *o);
+static int connection_send_pending (BSSLConnection *o);
+static void connection_coalesce_send (BSSLConnection *o);
+static void connection_coalesce_flush (BSSLConnection *o);
 static void connection_try_handshake (BSSLConnection *o);
 static void connection_try_send (BSSLConnection *o);
 static void connection_try_recv (BSSLConnection *o);
@@ -78,10 +95,8 @@ static PRStatus method_close (PRFileDesc *fd)
     ASSERT(b->threadwork_state == THREADWORK_STATE_NONE)
     
     // free mutexes
-    if ((b->flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE) || (b->flags & BSSLCONNECTION_FLAG_THREADWORK_IO)) {
-        BMutex_Free(&b->recv_buf_mutex);
-        BMutex_Free(&b->send_buf_mutex);
-    }
+    BMutex_Free(&b->recv_buf_mutex);
+    BMutex_Free(&b->send_buf_mutex);
     
     // free backend
     free(b);
@@ -389,10 +404,16 @@ static void backend_threadwork_start (struct BSSLConnection_backend *b, int op)
     ASSERT(b->threadwork_state == THREADWORK_STATE_NONE)
     ASSERT(op == THREADWORK_STATE_HANDSHAKE || op == THREADWORK_STATE_READ || op == THREADWORK_STATE_WRITE)
     
+    // handshakes of pooled connections run in the pool's dispatcher
+    BThreadWorkDispatcher *twd = b->twd;
+    if (op == THREADWORK_STATE_HANDSHAKE && b->con->hs_pool) {
+        twd = b->con->hs_pool->twd;
+    }
+    
     b->threadwork_state = op;
     b->threadwork_want_recv = 0;
     b->threadwork_want_send = 0;
-    BThreadWork_Init(&b->threadwork, b->twd, connection_threadwork_handler_done, b->con, connection_threadwork_func_work, b->con);
+    BThreadWork_Init(&b->threadwork, twd, connection_threadwork_handler_done, b->con, connection_threadwork_func_work, b->con);
 }
 
 static int backend_threadwork_do_io (struct BSSLConnection_backend *b)
@@ -416,10 +437,74 @@ static int backend_threadwork_do_io (struct BSSLConnection_backend *b)
     return io_ready;
 }
 
+static void pool_admit (BSSLHandshakePool *p)
+{
+    LinkedList1Node *node;
+    while ((p->max_handshakes == 0 || p->num_handshakes < p->max_handshakes) && (node = LinkedList1_GetFirst(&p->waiting_list))) {
+        BSSLConnection *o = UPPER_OBJECT(node, BSSLConnection, hs_list_node);
+        ASSERT(o->hs_pool == p)
+        ASSERT(o->hs_state == HS_STATE_WAITING)
+        
+        // remove from waiting list
+        LinkedList1_Remove(&p->waiting_list, &o->hs_list_node);
+        
+        // set active
+        o->hs_state = HS_STATE_ACTIVE;
+        p->num_handshakes++;
+        
+        // start handshake
+        BPending_Set(&o->init_job);
+    }
+}
+
+static void connection_leave_pool (BSSLConnection *o)
+{
+    BSSLHandshakePool *p = o->hs_pool;
+    
+    switch (o->hs_state) {
+        case HS_STATE_NONE:
+            return;
+        
+        case HS_STATE_WAITING: {
+            LinkedList1_Remove(&p->waiting_list, &o->hs_list_node);
+        } break;
+        
+        case HS_STATE_ACTIVE: {
+            ASSERT(p->num_handshakes > 0)
+            p->num_handshakes--;
+        } break;
+        
+        default:
+            ASSERT(0);
+    }
+    
+    o->hs_state = HS_STATE_NONE;
+    
+    // let waiting connections proceed
+    pool_admit(p);
+}
+
+static int connection_handshake_in_threads (BSSLConnection *o)
+{
+    if (o->hs_pool) {
+        return (o->hs_pool->twd && BThreadWorkDispatcher_UsingThreads(o->hs_pool->twd));
+    }
+    
+    return !!(o->backend->flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE);
+}
+
 static void connection_report_error (BSSLConnection *o)
 {
     ASSERT(!o->have_error)
     
+    // release handshake slot
+    connection_leave_pool(o);
+    
+    // don't write out collected data any more
+    if (o->up) {
+        BPending_Unset(&o->flush_job);
+    }
+    
     // set error
     o->have_error = 1;
     
@@ -438,6 +523,9 @@ static void connection_init_job_handler (BSSLConnection *o)
 
 static void connection_init_up (BSSLConnection *o)
 {
+    // release handshake slot
+    connection_leave_pool(o);
+    
     // unset init job
     // (just in the impossible case that handshake completed before the init job executed)
     BPending_Unset(&o->init_job);
@@ -451,9 +539,17 @@ static void connection_init_up (BSSLConnection *o)
     // init recv job
     BPending_Init(&o->recv_job, o->pg, (BPending_handler)connection_recv_job_handler, o);
     
+    // init flush job
+    BPending_Init(&o->flush_job, o->pg, (BPending_handler)connection_flush_job_handler, o);
+    
     // set no send data
     o->send_len = -1;
     
+    // write out any data collected by a previous connection on this backend
+    if (o->backend->coalesce_pos < o->backend->coalesce_len) {
+        BPending_Set(&o->flush_job);
+    }
+    
     // set no recv data
     o->recv_avail = -1;
     
@@ -471,7 +567,7 @@ static void connection_try_io (BSSLConnection *o)
         return;
     }
     
-    if (o->send_len > 0) {
+    if (connection_send_pending(o)) {
         if (o->recv_avail > 0) {
             BPending_Set(&o->recv_job);
         }
@@ -529,7 +625,8 @@ static void connection_threadwork_handler_done (void *user)
     switch (op) {
         case THREADWORK_STATE_HANDSHAKE: {
             ASSERT(!o->up)
-            ASSERT((b->flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE))
+            ASSERT(connection_handshake_in_threads(o))
+            ASSERT(o->hs_state != HS_STATE_WAITING)
             
             if (b->threadwork_result_sec == SECFailure) {
                 if (b->threadwork_error == PR_WOULD_BLOCK_ERROR) {
@@ -654,13 +751,127 @@ static void connection_recv_job_handler (BSSLConnection *o)
     return;
 }
 
+static void connection_flush_job_handler (BSSLConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->have_error)
+    ASSERT(o->up)
+    ASSERT(o->backend->coalesce_pos < o->backend->coalesce_len)
+    
+    connection_coalesce_flush(o);
+    return;
+}
+
+static int connection_send_pending (BSSLConnection *o)
+{
+    return (o->send_len > 0 || o->backend->coalesce_pos < o->backend->coalesce_len);
+}
+
+static void connection_coalesce_send (BSSLConnection *o)
+{
+    ASSERT(!o->have_error)
+    ASSERT(o->up)
+    ASSERT((o->backend->flags & BSSLCONNECTION_FLAG_COALESCE_WRITES))
+    
+    struct BSSLConnection_backend *b = o->backend;
+    
+    // take as much of the user's data as fits into the buffer
+    int amount = 0;
+    if (o->send_len > 0) {
+        // make space at the end if the start has been written already
+        if (b->coalesce_len == BSSLCONNECTION_COALESCE_BUF_SIZE && b->coalesce_pos > 0) {
+            memmove(b->coalesce_buf, b->coalesce_buf + b->coalesce_pos, b->coalesce_len - b->coalesce_pos);
+            b->coalesce_len -= b->coalesce_pos;
+            b->coalesce_pos = 0;
+        }
+        
+        amount = bmin_int(o->send_len, BSSLCONNECTION_COALESCE_BUF_SIZE - b->coalesce_len);
+        if (amount > 0) {
+            memcpy(b->coalesce_buf + b->coalesce_len, o->send_data, amount);
+            b->coalesce_len += amount;
+            
+            // set no send data
+            o->send_len = -1;
+        }
+    }
+    
+    // Unless the buffer is full, leave writing to the flush job. It must be set before
+    // reporting Done: jobs run in LIFO order, so the job the user gets for our Done then
+    // runs first, and whatever the user sends next in the same go goes into the same record.
+    if (b->coalesce_len < BSSLCONNECTION_COALESCE_BUF_SIZE) {
+        ASSERT(o->send_len == -1)
+        
+        if (b->coalesce_pos < b->coalesce_len) {
+            BPending_Set(&o->flush_job);
+        }
+        
+        if (amount > 0) {
+            StreamPassInterface_Done(&o->send_if, amount);
+        }
+        return;
+    }
+    
+    if (amount > 0) {
+        StreamPassInterface_Done(&o->send_if, amount);
+    }
+    
+    connection_coalesce_flush(o);
+    return;
+}
+
+static void connection_coalesce_flush (BSSLConnection *o)
+{
+    ASSERT(!o->have_error)
+    ASSERT(o->up)
+    ASSERT((o->backend->flags & BSSLCONNECTION_FLAG_COALESCE_WRITES))
+    
+    struct BSSLConnection_backend *b = o->backend;
+    
+    // unset flush job
+    BPending_Unset(&o->flush_job);
+    
+    // write collected data
+    while (b->coalesce_pos < b->coalesce_len) {
+        PRInt32 res = PR_Write(o->prfd, b->coalesce_buf + b->coalesce_pos, b->coalesce_len - b->coalesce_pos);
+        if (res < 0) {
+            PRErrorCode error = PR_GetError();
+            if (error == PR_WOULD_BLOCK_ERROR) {
+                return;
+            }
+            BLog(BLOG_ERROR, "PR_Write failed (%"PRIi32")", error);
+            connection_report_error(o);
+            return;
+        }
+        
+        ASSERT(res > 0)
+        ASSERT(res <= b->coalesce_len - b->coalesce_pos)
+        
+        b->coalesce_pos += res;
+    }
+    
+    // buffer is empty
+    b->coalesce_pos = 0;
+    b->coalesce_len = 0;
+    
+    // take data which didn't fit before
+    if (o->send_len > 0) {
+        connection_coalesce_send(o);
+        return;
+    }
+}
+
 static void connection_try_handshake (BSSLConnection *o)
 {
     ASSERT(!o->have_error)
     ASSERT(!o->up)
     
+    // wait until the handshake pool lets us start
+    if (o->hs_state == HS_STATE_WAITING) {
+        return;
+    }
+    
     // continue in threadwork if requested
-    if ((o->backend->flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE)) {
+    if (connection_handshake_in_threads(o)) {
         if (o->backend->threadwork_state == THREADWORK_STATE_NONE) {
             backend_threadwork_start(o->backend, THREADWORK_STATE_HANDSHAKE);
         }
@@ -691,6 +902,14 @@ static void connection_try_send (BSSLConnection *o)
 {
     ASSERT(!o->have_error)
     ASSERT(o->up)
+    ASSERT(connection_send_pending(o))
+    
+    // collect data into larger writes if requested
+    if ((o->backend->flags & BSSLCONNECTION_FLAG_COALESCE_WRITES)) {
+        connection_coalesce_send(o);
+        return;
+    }
+    
     ASSERT(o->send_len > 0)
     
     // continue in threadwork if requested
@@ -837,7 +1056,7 @@ int BSSLConnection_GlobalInit (void)
 int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if, StreamRecvInterface *recv_if, BThreadWorkDispatcher *twd, int flags)
 {
     ASSERT(bprconnection_initialized)
-    ASSERT(!(flags & ~(BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE | BSSLCONNECTION_FLAG_THREADWORK_IO)))
+    ASSERT(!(flags & ~(BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE | BSSLCONNECTION_FLAG_THREADWORK_IO | BSSLCONNECTION_FLAG_COALESCE_WRITES)))
     ASSERT(!(flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE) || twd)
     ASSERT(!(flags & BSSLCONNECTION_FLAG_THREADWORK_IO) || twd)
     
@@ -849,24 +1068,29 @@ int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if,
         flags &= ~(BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE | BSSLCONNECTION_FLAG_THREADWORK_IO);
     }
     
-    // allocate backend
-    struct BSSLConnection_backend *b = (struct BSSLConnection_backend *)malloc(sizeof(*b));
+    // writes from threads can't be coalesced
+    if ((flags & BSSLCONNECTION_FLAG_THREADWORK_IO)) {
+        flags &= ~BSSLCONNECTION_FLAG_COALESCE_WRITES;
+    }
+    
+    // allocate backend, with the coalescing buffer if needed
+    size_t alloc_size = sizeof(struct BSSLConnection_backend) + ((flags & BSSLCONNECTION_FLAG_COALESCE_WRITES) ? BSSLCONNECTION_COALESCE_BUF_SIZE : 0);
+    struct BSSLConnection_backend *b = (struct BSSLConnection_backend *)malloc(alloc_size);
     if (!b) {
         BLog(BLOG_ERROR, "malloc failed");
         goto fail0;
     }
     
     // init mutexes
-    if ((flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE) || (flags & BSSLCONNECTION_FLAG_THREADWORK_IO)) {
-        if (!BMutex_Init(&b->send_buf_mutex)) {
-            BLog(BLOG_ERROR, "BMutex_Init failed");
-            goto fail1;
-        }
-        
-        if (!BMutex_Init(&b->recv_buf_mutex)) {
-            BLog(BLOG_ERROR, "BMutex_Init failed");
-            goto fail2;
-        }
+    // (always, since the handshake may be moved to a handshake pool's threads)
+    if (!BMutex_Init(&b->send_buf_mutex)) {
+        BLog(BLOG_ERROR, "BMutex_Init failed");
+        goto fail1;
+    }
+    
+    if (!BMutex_Init(&b->recv_buf_mutex)) {
+        BLog(BLOG_ERROR, "BMutex_Init failed");
+        goto fail2;
     }
     
     // init arguments
@@ -895,6 +1119,10 @@ int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if,
     // set threadwork state
     b->threadwork_state = THREADWORK_STATE_NONE;
     
+    // set no collected data
+    b->coalesce_pos = 0;
+    b->coalesce_len = 0;
+    
     // init prfd
     memset(prfd, 0, sizeof(*prfd));
     prfd->methods = &methods;
@@ -903,20 +1131,72 @@ int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if,
     
     return 1;
     
-    if ((flags & BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE) || (flags & BSSLCONNECTION_FLAG_THREADWORK_IO)) {
 fail2:
-        BMutex_Free(&b->send_buf_mutex);
-    }
+    BMutex_Free(&b->send_buf_mutex);
 fail1:
     free(b);
 fail0:
     return 0;
 }
 
-void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BPendingGroup *pg, void *user,
-                          BSSLConnection_handler handler)
+int BSSLConnection_SetSessionCacheKey (PRFileDesc *prfd, const uint8_t *peer_cert, int peer_cert_len)
+{
+    ASSERT(peer_cert_len >= 0)
+    
+    // Client sessions are cached by NSS under the peer address, which our bottom
+    // layer doesn't have, so without a key all sessions would be offered to all peers.
+    // Key them by the hash of the certificate we expect the peer to have.
+    
+    unsigned char hash[SESSION_CACHE_KEY_HASH_LEN];
+    if (PK11_HashBuf(SEC_OID_SHA256, hash, peer_cert, peer_cert_len) != SECSuccess) {
+        BLog(BLOG_ERROR, "PK11_HashBuf failed");
+        return 0;
+    }
+    
+    char key[2 * SESSION_CACHE_KEY_HASH_LEN + 1];
+    for (int i = 0; i < SESSION_CACHE_KEY_HASH_LEN; i++) {
+        sprintf(key + 2 * i, "%02x", (unsigned int)hash[i]);
+    }
+    
+    if (SSL_SetSockPeerID(prfd, key) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_SetSockPeerID failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
+void BSSLHandshakePool_Init (BSSLHandshakePool *o, BThreadWorkDispatcher *twd, int max_handshakes)
+{
+    ASSERT(max_handshakes >= 0)
+    
+    // init arguments
+    o->twd = twd;
+    o->max_handshakes = max_handshakes;
+    
+    // set no handshakes
+    o->num_handshakes = 0;
+    
+    // init waiting list
+    LinkedList1_Init(&o->waiting_list);
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_ctr);
+}
+
+void BSSLHandshakePool_Free (BSSLHandshakePool *o)
+{
+    DebugCounter_Free(&o->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    ASSERT(o->num_handshakes == 0)
+    ASSERT(LinkedList1_IsEmpty(&o->waiting_list))
+}
+
+static void connection_init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BSSLHandshakePool *pool, BPendingGroup *pg, void *user,
+                             BSSLConnection_handler handler)
 {
     ASSERT(force_handshake == 0 || force_handshake == 1)
+    ASSERT(!pool || force_handshake)
     ASSERT(handler)
     ASSERT(bprconnection_initialized)
     ASSERT(get_bottom(prfd)->identity == bprconnection_identity)
@@ -933,6 +1213,10 @@ void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handsha
     ASSERT(!o->backend->con)
     ASSERT(o->backend->threadwork_state == THREADWORK_STATE_NONE)
     
+    // set handshake pool
+    o->hs_pool = pool;
+    o->hs_state = HS_STATE_NONE;
+    
     // set have no error
     o->have_error = 0;
     
@@ -943,8 +1227,15 @@ void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handsha
         // set not up
         o->up = 0;
         
-        // set init job
-        BPending_Set(&o->init_job);
+        if (pool) {
+            // wait for the pool to admit us; this sets the init job
+            LinkedList1_Append(&pool->waiting_list, &o->hs_list_node);
+            o->hs_state = HS_STATE_WAITING;
+            pool_admit(pool);
+        } else {
+            // set init job
+            BPending_Set(&o->init_job);
+        }
     } else {
         // init up
         connection_init_up(o);
@@ -958,20 +1249,46 @@ void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handsha
     o->releasebuffers_called = 0;
 #endif
     
+    if (o->hs_pool) {
+        DebugCounter_Increment(&o->hs_pool->d_ctr);
+    }
     DebugError_Init(&o->d_err, o->pg);
     DebugObject_Init(&o->d_obj);
 }
 
+void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BPendingGroup *pg, void *user,
+                          BSSLConnection_handler handler)
+{
+    connection_init(o, prfd, force_handshake, NULL, pg, user, handler);
+}
+
+void BSSLConnection_InitPooled (BSSLConnection *o, PRFileDesc *prfd, BSSLHandshakePool *pool, BPendingGroup *pg, void *user,
+                                BSSLConnection_handler handler)
+{
+    DebugObject_Access(&pool->d_obj);
+    
+    connection_init(o, prfd, 1, pool, pg, user, handler);
+}
+
 void BSSLConnection_Free (BSSLConnection *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
+    if (o->hs_pool) {
+        DebugCounter_Decrement(&o->hs_pool->d_ctr);
+    }
 #ifndef NDEBUG
     ASSERT(o->releasebuffers_called || !o->user_io_started)
 #endif
     ASSERT(o->backend->threadwork_state == THREADWORK_STATE_NONE)
     
+    // release handshake slot
+    connection_leave_pool(o);
+    
     if (o->up) {
+        // free flush job
+        BPending_Free(&o->flush_job);
+        
         // free recv job
         BPending_Free(&o->recv_job);
         
@@ -1007,6 +1324,19 @@ void BSSLConnection_ReleaseBuffers (BSSLConnection *o)
 #endif
 }
 
+int BSSLConnection_IsResumed (BSSLConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->up)
+    
+    SSLChannelInfo info;
+    if (SSL_GetChannelInfo(o->prfd, &info, sizeof(info)) != SECSuccess) {
+        return 0;
+    }
+    
+    return (info.resumed == PR_TRUE);
+}
+
 StreamPassInterface * BSSLConnection_GetSendIf (BSSLConnection *o)
 {
     DebugObject_Access(&o->d_obj);
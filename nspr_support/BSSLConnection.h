@@ -35,6 +35,8 @@
 
 #include <misc/debug.h>
 #include <misc/debugerror.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
 #include <base/BMutex.h>
@@ -47,25 +49,54 @@
 
 #define BSSLCONNECTION_BUF_SIZE 4096
 
+// maximum amount of plaintext in a TLS record
+#define BSSLCONNECTION_COALESCE_BUF_SIZE 16384
+
 #define BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE (1 << 0)
 #define BSSLCONNECTION_FLAG_THREADWORK_IO (1 << 1)
 
+// Collect data sent in quick succession (e.g. multiple small packets) into a single
+// PR_Write, and so a single TLS record. Data is written when the buffer is full, or
+// from a job which runs once the user stops sending more data in response to Done.
+// Has no effect with BSSLCONNECTION_FLAG_THREADWORK_IO.
+#define BSSLCONNECTION_FLAG_COALESCE_WRITES (1 << 2)
+
 typedef void (*BSSLConnection_handler) (void *user, int event);
 
 struct BSSLConnection_backend;
 
+/**
+ * Admission control for handshakes of connections initialized with
+ * {@link BSSLConnection_InitPooled}.
+ * At most max_handshakes handshakes are in progress at any time; further connections
+ * wait in FIFO order until one of them completes or fails. If twd uses threads,
+ * the handshakes run there instead of in the reactor thread.
+ */
+typedef struct {
+    BThreadWorkDispatcher *twd;
+    int max_handshakes;
+    int num_handshakes;
+    LinkedList1 waiting_list;
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} BSSLHandshakePool;
+
 typedef struct {
     PRFileDesc *prfd;
     BPendingGroup *pg;
     void *user;
     BSSLConnection_handler handler;
     struct BSSLConnection_backend *backend;
+    BSSLHandshakePool *hs_pool;
+    int hs_state;
+    LinkedList1Node hs_list_node;
     int have_error;
     int up;
     BPending init_job;
     StreamPassInterface send_if;
     StreamRecvInterface recv_if;
     BPending recv_job;
+    BPending flush_job;
     const uint8_t *send_data;
     int send_len;
     uint8_t *recv_data;
@@ -101,15 +132,25 @@ struct BSSLConnection_backend {
     PRErrorCode threadwork_error;
     BMutex send_buf_mutex;
     BMutex recv_buf_mutex;
+    int coalesce_pos;
+    int coalesce_len;
+    uint8_t coalesce_buf[];
 };
 
 int BSSLConnection_GlobalInit (void) WARN_UNUSED;
 int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if, StreamRecvInterface *recv_if, BThreadWorkDispatcher *twd, int flags) WARN_UNUSED;
+int BSSLConnection_SetSessionCacheKey (PRFileDesc *prfd, const uint8_t *peer_cert, int peer_cert_len) WARN_UNUSED;
+
+void BSSLHandshakePool_Init (BSSLHandshakePool *o, BThreadWorkDispatcher *twd, int max_handshakes);
+void BSSLHandshakePool_Free (BSSLHandshakePool *o);
 
 void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BPendingGroup *pg, void *user,
                           BSSLConnection_handler handler);
+void BSSLConnection_InitPooled (BSSLConnection *o, PRFileDesc *prfd, BSSLHandshakePool *pool, BPendingGroup *pg, void *user,
+                                BSSLConnection_handler handler);
 void BSSLConnection_Free (BSSLConnection *o);
 void BSSLConnection_ReleaseBuffers (BSSLConnection *o);
+int BSSLConnection_IsResumed (BSSLConnection *o);
 StreamPassInterface * BSSLConnection_GetSendIf (BSSLConnection *o);
 StreamRecvInterface * BSSLConnection_GetRecvIf (BSSLConnection *o);
 
@@ -35,6 +35,7 @@
 #include <misc/offset.h>
 #include <misc/balloc.h>
 #include <misc/compare.h>
+#include <misc/minmax.h>
 #include <predicate/BPredicate_internal.h>
 #include <predicate/BPredicate_parser.h>
 #include <predicate/LexMemoryBufferInput.h>
@@ -45,6 +46,8 @@
 #include <generated/blog_channel_BPredicate.h>
 
 static int eval_predicate_node (BPredicate *p, struct predicate_node *root);
+static void count_predicate_node (struct predicate_node *root, int *num_nodes, int *num_args);
+static int compile_predicate_node (BPredicateCompiled *o, struct predicate_node *root);
 
 void yyerror (YYLTYPE *yylloc, yyscan_t scanner, struct predicate_node **result, char *str)
 {
@@ -179,6 +182,134 @@ int eval_predicate_node (BPredicate *p, struct predicate_node *root)
     }
 }
 
+void count_predicate_node (struct predicate_node *root, int *num_nodes, int *num_args)
+{
+    ASSERT(root)
+    
+    (*num_nodes)++;
+    
+    switch (root->type) {
+        case NODE_CONSTANT:
+            break;
+        case NODE_NEG:
+            count_predicate_node(root->neg.op, num_nodes, num_args);
+            break;
+        case NODE_CONJUNCT:
+            count_predicate_node(root->conjunct.op1, num_nodes, num_args);
+            count_predicate_node(root->conjunct.op2, num_nodes, num_args);
+            break;
+        case NODE_DISJUNCT:
+            count_predicate_node(root->disjunct.op1, num_nodes, num_args);
+            count_predicate_node(root->disjunct.op2, num_nodes, num_args);
+            break;
+        case NODE_FUNCTION:
+            for (struct arguments_node *arg = root->function.args; arg; arg = arg->next) {
+                (*num_args)++;
+                if (arg->arg.type == ARGUMENT_PREDICATE) {
+                    count_predicate_node(arg->arg.predicate, num_nodes, num_args);
+                }
+            }
+            break;
+        default:
+            ASSERT(0);
+    }
+}
+
+static int compile_add_node (BPredicateCompiled *o, int op)
+{
+    int index = o->num_nodes++;
+    o->nodes[index].op = op;
+    
+    return index;
+}
+
+static int compile_function (BPredicateCompiled *o, struct predicate_node *root)
+{
+    ASSERT(root->type == NODE_FUNCTION)
+    
+    // lookup function by name
+    BAVLNode *tree_node;
+    if (!(tree_node = BAVL_LookupExact(&o->p->functions_tree, root->function.name))) {
+        return compile_add_node(o, BPREDICATE_OP_ERROR);
+    }
+    BPredicateFunction *func = UPPER_OBJECT(tree_node, BPredicateFunction, tree_node);
+    
+    // check arguments before compiling any, so that a function which
+    // would evaluate to error leaves no unused nodes behind
+    struct arguments_node *arg = root->function.args;
+    for (int i = 0; i < func->num_args; i++) {
+        if (!arg) {
+            return compile_add_node(o, BPREDICATE_OP_ERROR);
+        }
+        int expected = (func->args[i] == PREDICATE_TYPE_BOOL ? ARGUMENT_PREDICATE : ARGUMENT_STRING);
+        if (arg->arg.type != expected) {
+            return compile_add_node(o, BPREDICATE_OP_ERROR);
+        }
+        arg = arg->next;
+    }
+    if (arg) {
+        return compile_add_node(o, BPREDICATE_OP_ERROR);
+    }
+    
+    // compile arguments
+    int args_start = o->num_args;
+    o->num_args += func->num_args;
+    arg = root->function.args;
+    for (int i = 0; i < func->num_args; i++) {
+        BPredicateCompiledArg *carg = &o->args[args_start + i];
+        if (arg->arg.type == ARGUMENT_PREDICATE) {
+            carg->node = compile_predicate_node(o, arg->arg.predicate);
+            carg->string = NULL;
+        } else {
+            carg->node = -1;
+            carg->string = arg->arg.string;
+        }
+        arg = arg->next;
+    }
+    
+    int index = compile_add_node(o, BPREDICATE_OP_FUNCTION);
+    o->nodes[index].function.func = func;
+    o->nodes[index].function.args_start = args_start;
+    
+    return index;
+}
+
+int compile_predicate_node (BPredicateCompiled *o, struct predicate_node *root)
+{
+    ASSERT(root)
+    
+    int index;
+    
+    switch (root->type) {
+        case NODE_CONSTANT:
+            index = compile_add_node(o, BPREDICATE_OP_CONSTANT);
+            o->nodes[index].constant.val = root->constant.val;
+            return index;
+        case NODE_NEG: {
+            int op = compile_predicate_node(o, root->neg.op);
+            index = compile_add_node(o, BPREDICATE_OP_NEG);
+            o->nodes[index].neg.op = op;
+            return index;
+        }
+        case NODE_CONJUNCT:
+        case NODE_DISJUNCT: {
+            struct predicate_node *op1 = (root->type == NODE_CONJUNCT ? root->conjunct.op1 : root->disjunct.op1);
+            struct predicate_node *op2 = (root->type == NODE_CONJUNCT ? root->conjunct.op2 : root->disjunct.op2);
+            int cop1 = compile_predicate_node(o, op1);
+            int cop2 = compile_predicate_node(o, op2);
+            index = compile_add_node(o, (root->type == NODE_CONJUNCT ? BPREDICATE_OP_CONJUNCT : BPREDICATE_OP_DISJUNCT));
+            o->nodes[index].binary.op1 = cop1;
+            o->nodes[index].binary.op2 = cop2;
+            return index;
+        }
+        case NODE_FUNCTION:
+            return compile_function(o, root);
+        default:
+            ASSERT(0)
+            return -1;
+    }
+}
+
 int BPredicate_Init (BPredicate *p, char *str)
 {
     // initialize input buffer object
@@ -217,6 +348,7 @@ int BPredicate_Init (BPredicate *p, char *str)
     
     // init debug object
     DebugObject_Init(&p->d_obj);
+    DebugCounter_Init(&p->d_compiled_ctr);
     
     return 1;
 }
@@ -227,6 +359,7 @@ void BPredicate_Free (BPredicate *p)
     ASSERT(!p->in_function)
     
     // free debug object
+    DebugCounter_Free(&p->d_compiled_ctr);
     DebugObject_Free(&p->d_obj);
     
     // free tree
@@ -254,6 +387,9 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
         ASSERT(args[i] == PREDICATE_TYPE_BOOL || args[i] == PREDICATE_TYPE_STRING)
     }
     ASSERT(!p->in_function)
+    #ifndef NDEBUG
+    ASSERT(p->d_compiled_ctr.c == 0)
+    #endif
     
     // init arguments
     o->p = p;
@@ -273,6 +409,9 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
 void BPredicateFunction_Free (BPredicateFunction *o)
 {
     ASSERT(!o->p->in_function)
+    #ifndef NDEBUG
+    ASSERT(o->p->d_compiled_ctr.c == 0)
+    #endif
     
     BPredicate *p = o->p;
     
@@ -282,3 +421,57 @@ void BPredicateFunction_Free (BPredicateFunction *o)
     // remove from tree
     BAVL_Remove(&p->functions_tree, &o->tree_node);
 }
+
+int BPredicateCompiled_Init (BPredicateCompiled *o, BPredicate *p)
+{
+    DebugObject_Access(&p->d_obj);
+    ASSERT(!p->in_function)
+    
+    o->p = p;
+    
+    // count tree nodes and arguments, which bounds the compiled sizes
+    int max_nodes = 0;
+    int max_args = 0;
+    count_predicate_node((struct predicate_node *)p->root, &max_nodes, &max_args);
+    
+    // allocate nodes
+    if (!(o->nodes = (BPredicateCompiledNode *)BAllocArray(max_nodes, sizeof(o->nodes[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // allocate arguments
+    if (!(o->args = (BPredicateCompiledArg *)BAllocArray(bmax_int(max_args, 1), sizeof(o->args[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    // compile
+    o->num_nodes = 0;
+    o->num_args = 0;
+    compile_predicate_node(o, (struct predicate_node *)p->root);
+    ASSERT(o->num_nodes > 0)
+    ASSERT(o->num_nodes <= max_nodes)
+    ASSERT(o->num_args <= max_args)
+    
+    DebugCounter_Increment(&p->d_compiled_ctr);
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    BFree(o->nodes);
+fail0:
+    return 0;
+}
+
+void BPredicateCompiled_Free (BPredicateCompiled *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Decrement(&o->p->d_compiled_ctr);
+    
+    // free arguments
+    BFree(o->args);
+    
+    // free nodes
+    BFree(o->nodes);
+}
@@ -78,6 +78,7 @@
 #define BADVPN_PREDICATE_BPREDICATE_H
 
 #include <misc/debug.h>
+#include <misc/debugcounter.h>
 #include <structure/BAVL.h>
 #include <base/DebugObject.h>
 
@@ -110,6 +111,7 @@ typedef struct {
     #ifndef NDEBUG
     int in_function;
     #endif
+    DebugCounter d_compiled_ctr;
 } BPredicate;
 
 /**
@@ -126,6 +128,67 @@ typedef struct {
     BAVLNode tree_node;
 } BPredicateFunction;
 
+#define BPREDICATE_OP_CONSTANT 1
+#define BPREDICATE_OP_ERROR 2
+#define BPREDICATE_OP_NEG 3
+#define BPREDICATE_OP_CONJUNCT 4
+#define BPREDICATE_OP_DISJUNCT 5
+#define BPREDICATE_OP_FUNCTION 6
+
+/**
+ * Node of a {@link BPredicateCompiled}.
+ */
+typedef struct {
+    int op;
+    union {
+        struct {
+            int val;
+        } constant;
+        struct {
+            int op;
+        } neg;
+        struct {
+            int op1;
+            int op2;
+        } binary;
+        struct {
+            BPredicateFunction *func;
+            int args_start;
+        } function;
+    };
+} BPredicateCompiledNode;
+
+/**
+ * Function argument of a {@link BPredicateCompiled}.
+ * For PREDICATE_TYPE_BOOL arguments, node is the index of the argument's node,
+ * and for PREDICATE_TYPE_STRING arguments, string is the argument.
+ */
+typedef struct {
+    int node;
+    const char *string;
+} BPredicateCompiledArg;
+
+/**
+ * Flattened form of a {@link BPredicate} expression, with functions
+ * resolved and their arguments checked in advance.
+ * 
+ * Nodes are stored in post-order, so operands always precede the nodes
+ * using them, and the root is the last node. Function calls that would
+ * always evaluate to error (unknown function, wrong number or type of
+ * arguments) are compiled into BPREDICATE_OP_ERROR nodes. Evaluating the
+ * nodes with the rules of {@link BPredicate}, where an error in any operand
+ * that is evaluated makes the whole expression evaluate to error, gives
+ * the same result as {@link BPredicate_Eval}.
+ */
+typedef struct {
+    BPredicate *p;
+    BPredicateCompiledNode *nodes;
+    int num_nodes;
+    BPredicateCompiledArg *args;
+    int num_args;
+    DebugObject d_obj;
+} BPredicateCompiled;
+
 /**
  * Initializes the object.
  * 
@@ -137,7 +200,7 @@ int BPredicate_Init (BPredicate *p, char *str) WARN_UNUSED;
 
 /**
  * Frees the object.
- * Must have no custom functions.
+ * Must have no custom functions and no compiled forms.
  * Must not be called from function handlers.
  * 
  * @param p the object
@@ -169,9 +232,30 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
 /**
  * Removes a custom function for {@link BPredicate}.
  * Must not be called from function handlers.
+ * The predicate must have no compiled forms.
  * 
  * @param o the object
  */
 void BPredicateFunction_Free (BPredicateFunction *o);
 
+/**
+ * Compiles the expression of a {@link BPredicate} into a flat array of nodes.
+ * Functions are resolved against the custom functions registered at the time
+ * of this call; functions must not be registered or removed while the compiled
+ * form exists.
+ * String arguments point into the predicate and stay valid until it is freed.
+ * 
+ * @param o the object
+ * @param p predicate to compile
+ * @return 1 on success, 0 on failure
+ */
+int BPredicateCompiled_Init (BPredicateCompiled *o, BPredicate *p) WARN_UNUSED;
+
+/**
+ * Frees the compiled form.
+ * 
+ * @param o the object
+ */
+void BPredicateCompiled_Free (BPredicateCompiled *o);
+
 #endif
@@ -88,4 +88,82 @@ B_END_PACKED
 
 #define DATAPROTO_MAX_OVERHEAD (sizeof(struct dataproto_header) + DATAPROTO_MAX_PEER_IDS * sizeof(struct dataproto_peer_id))
 
+#define DATAPROTO_PMTU_MAGIC UINT32_C(0x75746d70)
+
+#define DATAPROTO_PMTU_TYPE_PROBE 1
+#define DATAPROTO_PMTU_TYPE_ACK 2
+
+/**
+ * Path MTU discovery record.
+ * 
+ * A packet with no destination peer IDs (a keep-alive) may carry this record
+ * right after the header, optionally followed by padding. Peers which do not
+ * do path MTU discovery ignore anything after the header of such packets.
+ */
+B_START_PACKED
+struct dataproto_pmtu_record {
+    /**
+     * Must be DATAPROTO_PMTU_MAGIC.
+     */
+    uint32_t magic;
+    
+    /**
+     * Record type. Possible values:
+     *   - DATAPROTO_PMTU_TYPE_PROBE
+     *     The packet was padded so that it is sent in a FragmentProto packet
+     *     of its own, whose length is given by the size field. The receiver
+     *     should answer with an ack record with the same size.
+     *   - DATAPROTO_PMTU_TYPE_ACK
+     *     A probe with the given size has been received.
+     */
+    uint8_t type;
+    
+    /**
+     * Length of the FragmentProto packet carrying the probe.
+     */
+    uint16_t size;
+} B_PACKED;
+B_END_PACKED
+
+#define DATAPROTO_PING_MAGIC UINT32_C(0x676e6970)
+
+#define DATAPROTO_PING_TYPE_REQUEST 1
+#define DATAPROTO_PING_TYPE_REPLY 2
+
+/**
+ * Round-trip time measurement record.
+ * 
+ * A keep-alive may carry this record right after the header. Peers which do not
+ * measure round-trip times ignore it.
+ */
+B_START_PACKED
+struct dataproto_ping_record {
+    /**
+     * Must be DATAPROTO_PING_MAGIC.
+     */
+    uint32_t magic;
+    
+    /**
+     * Record type. Possible values:
+     *   - DATAPROTO_PING_TYPE_REQUEST
+     *     The receiver should answer with a reply record carrying the same time.
+     *   - DATAPROTO_PING_TYPE_REPLY
+     *     Answer to a request.
+     */
+    uint8_t type;
+    
+    /**
+     * In a request, when the request was sent, in milliseconds on the sender's clock.
+     * In a reply, copied from the request.
+     */
+    uint64_t time;
+    
+    /**
+     * In a reply, milliseconds between receiving the request and sending the reply.
+     * Zero in a request.
+     */
+    uint32_t hold_time;
+} B_PACKED;
+B_END_PACKED
+
 #endif
@@ -0,0 +1,690 @@
+/**
+ * @file CommIndex.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/hashfun.h>
+#include <base/BLog.h>
+
+#include <server/CommIndex.h>
+
+#include <generated/blog_channel_CommIndex.h>
+
+#define VALUE_FALSE 0
+#define VALUE_TRUE 1
+#define VALUE_ERROR 2
+#define VALUE_UNKNOWN 3
+
+#define NODE_KIND_OTHER 0
+#define NODE_KIND_ERROR 1
+#define NODE_KIND_P1NAME 2
+#define NODE_KIND_P2NAME 3
+#define NODE_KIND_P1ADDR 4
+#define NODE_KIND_P2ADDR 5
+
+#define SOURCE_TYPE_NAME 1
+#define SOURCE_TYPE_ADDR 2
+
+struct CommIndex__node_info {
+    int kind;
+    const char *name;
+    size_t name_hash;
+    BIPAddr addr;
+};
+
+struct CommIndex__source {
+    int type;
+    CommIndexEntry *first;
+};
+
+static size_t CommIndex__addr_hash (BIPAddr *addr)
+{
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4:
+            return badvpn_djb2_hash_bin((const uint8_t *)&addr->ipv4, sizeof(addr->ipv4));
+        case BADDR_TYPE_IPV6:
+            return badvpn_djb2_hash_bin(addr->ipv6, sizeof(addr->ipv6));
+        default:
+            return 0;
+    }
+}
+
+#include "CommIndex_names_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "CommIndex_addrs_hash.h"
+#include <structure/CHash_impl.h>
+
+static int func_p1name_cb (CommIndex *o, void **args)
+{
+    return !strcmp((char *)args[0], o->eval_p1name);
+}
+
+static int func_p2name_cb (CommIndex *o, void **args)
+{
+    return !strcmp((char *)args[0], o->eval_p2name);
+}
+
+static int func_p1addr_cb (CommIndex *o, void **args)
+{
+    BIPAddr addr;
+    if (!BIPAddr_Resolve(&addr, (char *)args[0], 1)) {
+        BLog(BLOG_WARNING, "failed to parse address");
+        return -1;
+    }
+    
+    return BIPAddr_Compare(&addr, &o->eval_p1addr);
+}
+
+static int func_p2addr_cb (CommIndex *o, void **args)
+{
+    BIPAddr addr;
+    if (!BIPAddr_Resolve(&addr, (char *)args[0], 1)) {
+        BLog(BLOG_WARNING, "failed to parse address");
+        return -1;
+    }
+    
+    return BIPAddr_Compare(&addr, &o->eval_p2addr);
+}
+
+static void init_node_info (CommIndex *o, int i)
+{
+    BPredicateCompiledNode *node = &o->compiled.nodes[i];
+    struct CommIndex__node_info *info = &o->node_infos[i];
+    
+    info->kind = NODE_KIND_OTHER;
+    
+    if (node->op != BPREDICATE_OP_FUNCTION) {
+        return;
+    }
+    
+    // all functions take a single string argument
+    BPredicateFunction *func = node->function.func;
+    const char *arg = o->compiled.args[node->function.args_start].string;
+    ASSERT(arg)
+    
+    if (func == &o->func_p1name || func == &o->func_p2name) {
+        info->kind = (func == &o->func_p1name ? NODE_KIND_P1NAME : NODE_KIND_P2NAME);
+        info->name = arg;
+        info->name_hash = badvpn_djb2_hash((const uint8_t *)arg);
+    }
+    else if (func == &o->func_p1addr || func == &o->func_p2addr) {
+        if (!BIPAddr_Resolve(&info->addr, (char *)arg, 1)) {
+            BLog(BLOG_WARNING, "failed to parse address %s", arg);
+            info->kind = NODE_KIND_ERROR;
+            return;
+        }
+        info->kind = (func == &o->func_p1addr ? NODE_KIND_P1ADDR : NODE_KIND_P2ADDR);
+    }
+    else {
+        ASSERT(0);
+    }
+}
+
+static int combine_values (BPredicateCompiledNode *node, int *values)
+{
+    switch (node->op) {
+        case BPREDICATE_OP_NEG: {
+            int v = values[node->neg.op];
+            return ((v == VALUE_TRUE || v == VALUE_FALSE) ? !v : v);
+        }
+        case BPREDICATE_OP_CONJUNCT: {
+            int v1 = values[node->binary.op1];
+            return (v1 == VALUE_TRUE ? values[node->binary.op2] : v1);
+        }
+        case BPREDICATE_OP_DISJUNCT: {
+            int v1 = values[node->binary.op1];
+            return (v1 == VALUE_FALSE ? values[node->binary.op2] : v1);
+        }
+        default:
+            ASSERT(0)
+            return VALUE_ERROR;
+    }
+}
+
+static void evaluate_for_query (CommIndex *o, const char *name, BIPAddr *addr)
+{
+    size_t name_hash = badvpn_djb2_hash((const uint8_t *)name);
+    
+    for (int i = 0; i < o->compiled.num_nodes; i++) {
+        BPredicateCompiledNode *node = &o->compiled.nodes[i];
+        struct CommIndex__node_info *info = &o->node_infos[i];
+        int v;
+        
+        switch (node->op) {
+            case BPREDICATE_OP_CONSTANT:
+                v = node->constant.val;
+                break;
+            case BPREDICATE_OP_ERROR:
+                v = VALUE_ERROR;
+                break;
+            case BPREDICATE_OP_FUNCTION:
+                switch (info->kind) {
+                    case NODE_KIND_ERROR:
+                        v = VALUE_ERROR;
+                        break;
+                    case NODE_KIND_P1NAME:
+                        v = (info->name_hash == name_hash && !strcmp(info->name, name));
+                        break;
+                    case NODE_KIND_P1ADDR:
+                        v = BIPAddr_Compare(&info->addr, addr);
+                        break;
+                    default:
+                        v = VALUE_UNKNOWN;
+                        break;
+                }
+                break;
+            default:
+                v = combine_values(node, o->query_values);
+                break;
+        }
+        
+        o->query_values[i] = v;
+    }
+}
+
+static int evaluate_for_entry (CommIndex *o, CommIndexEntry *e)
+{
+    // only nodes depending on p2 need evaluating, the rest are known from the query
+    for (int i = 0; i < o->compiled.num_nodes; i++) {
+        int v = o->query_values[i];
+        
+        if (v == VALUE_UNKNOWN) {
+            BPredicateCompiledNode *node = &o->compiled.nodes[i];
+            struct CommIndex__node_info *info = &o->node_infos[i];
+            
+            if (node->op == BPREDICATE_OP_FUNCTION) {
+                if (info->kind == NODE_KIND_P2NAME) {
+                    v = (info->name_hash == e->name_hash && !strcmp(info->name, e->name));
+                } else {
+                    ASSERT(info->kind == NODE_KIND_P2ADDR)
+                    v = BIPAddr_Compare(&info->addr, &e->addr);
+                }
+            } else {
+                v = combine_values(node, o->entry_values);
+            }
+        }
+        
+        o->entry_values[i] = v;
+    }
+    
+    return (o->entry_values[o->compiled.num_nodes - 1] == VALUE_TRUE);
+}
+
+static size_t source_size (CommIndex *o, struct CommIndex__source *s)
+{
+    size_t size = 0;
+    
+    if (s->type == SOURCE_TYPE_NAME) {
+        CommIndex__NamesHashRef ref = {s->first, s->first};
+        do {
+            size++;
+            ref = CommIndex__NamesHash_GetNextEqual(&o->names_hash, 0, ref);
+        } while (ref.link);
+    } else {
+        CommIndex__AddrsHashRef ref = {s->first, s->first};
+        do {
+            size++;
+            ref = CommIndex__AddrsHash_GetNextEqual(&o->addrs_hash, 0, ref);
+        } while (ref.link);
+    }
+    
+    return size;
+}
+
+// Appends to o->sources entries covering all indexed entries for which the node
+// may evaluate to want (VALUE_TRUE or VALUE_FALSE), setting *out_size to the
+// number of entries appended. Returns 0 if no such cover better than all entries
+// was found, in which case nothing is appended.
+static int collect_candidates (CommIndex *o, int i, int want, size_t *out_size)
+{
+    ASSERT(want == VALUE_TRUE || want == VALUE_FALSE)
+    
+    int v = o->query_values[i];
+    
+    if (v != VALUE_UNKNOWN) {
+        *out_size = 0;
+        return (v != want);
+    }
+    
+    BPredicateCompiledNode *node = &o->compiled.nodes[i];
+    int start = o->num_sources;
+    
+    switch (node->op) {
+        case BPREDICATE_OP_FUNCTION: {
+            struct CommIndex__node_info *info = &o->node_infos[i];
+            
+            // a comparison can be false for any entry
+            if (want == VALUE_FALSE) {
+                return 0;
+            }
+            
+            struct CommIndex__source *s = &o->sources[o->num_sources];
+            if (info->kind == NODE_KIND_P2NAME) {
+                s->type = SOURCE_TYPE_NAME;
+                s->first = CommIndex__NamesHash_Lookup(&o->names_hash, 0, info->name).ptr;
+            } else {
+                ASSERT(info->kind == NODE_KIND_P2ADDR)
+                s->type = SOURCE_TYPE_ADDR;
+                s->first = CommIndex__AddrsHash_Lookup(&o->addrs_hash, 0, &info->addr).ptr;
+            }
+            
+            if (!s->first) {
+                *out_size = 0;
+                return 1;
+            }
+            
+            o->num_sources++;
+            *out_size = source_size(o, s);
+            return 1;
+        } break;
+        
+        case BPREDICATE_OP_NEG:
+            return collect_candidates(o, node->neg.op, !want, out_size);
+        
+        case BPREDICATE_OP_CONJUNCT:
+        case BPREDICATE_OP_DISJUNCT: {
+            // a conjunction is true and a disjunction is false only if both
+            // operands are; otherwise it suffices that either operand is
+            int need_both = ((node->op == BPREDICATE_OP_CONJUNCT) == (want == VALUE_TRUE));
+            
+            size_t size1;
+            int res1 = collect_candidates(o, node->binary.op1, want, &size1);
+            int mid = o->num_sources;
+            
+            size_t size2;
+            int res2 = collect_candidates(o, node->binary.op2, want, &size2);
+            
+            if (need_both) {
+                // keep the smaller cover
+                if (!res1 && !res2) {
+                    return 0;
+                }
+                if (res1 && (!res2 || size1 <= size2)) {
+                    o->num_sources = mid;
+                    *out_size = size1;
+                } else {
+                    memmove(&o->sources[start], &o->sources[mid], (o->num_sources - mid) * sizeof(o->sources[0]));
+                    o->num_sources = start + (o->num_sources - mid);
+                    *out_size = size2;
+                }
+                return 1;
+            }
+            
+            // keep the union of the covers
+            if (!res1 || !res2) {
+                o->num_sources = start;
+                return 0;
+            }
+            *out_size = size1 + size2;
+            return 1;
+        } break;
+        
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+static void add_result (CommIndex *o, size_t *num_results, CommIndexEntry *e)
+{
+    ASSERT(*num_results < o->num_entries)
+    
+    o->results[(*num_results)++] = e;
+}
+
+static int grow_results (CommIndex *o, size_t min_capacity)
+{
+    if (o->results_capacity >= min_capacity) {
+        return 1;
+    }
+    
+    size_t new_capacity = (o->results_capacity > 0 ? o->results_capacity : 16);
+    while (new_capacity < min_capacity) {
+        if (new_capacity > SIZE_MAX / 2) {
+            return 0;
+        }
+        new_capacity *= 2;
+    }
+    
+    CommIndexEntry **new_results = (CommIndexEntry **)BReallocArray(o->results, new_capacity, sizeof(o->results[0]));
+    if (!new_results) {
+        return 0;
+    }
+    
+    o->results = new_results;
+    o->results_capacity = new_capacity;
+    
+    return 1;
+}
+
+int CommIndex_Init (CommIndex *o, char *predicate)
+{
+    o->have_predicate = !!predicate;
+    
+    if (o->have_predicate) {
+        // init predicate
+        if (!BPredicate_Init(&o->predicate, predicate)) {
+            BLog(BLOG_ERROR, "BPredicate_Init failed");
+            goto fail0;
+        }
+        
+        // init functions
+        int args[] = {PREDICATE_TYPE_STRING};
+        BPredicateFunction_Init(&o->func_p1name, &o->predicate, "p1name", args, 1, (BPredicate_callback)func_p1name_cb, o);
+        BPredicateFunction_Init(&o->func_p2name, &o->predicate, "p2name", args, 1, (BPredicate_callback)func_p2name_cb, o);
+        BPredicateFunction_Init(&o->func_p1addr, &o->predicate, "p1addr", args, 1, (BPredicate_callback)func_p1addr_cb, o);
+        BPredicateFunction_Init(&o->func_p2addr, &o->predicate, "p2addr", args, 1, (BPredicate_callback)func_p2addr_cb, o);
+        
+        // compile predicate
+        if (!BPredicateCompiled_Init(&o->compiled, &o->predicate)) {
+            BLog(BLOG_ERROR, "BPredicateCompiled_Init failed");
+            goto fail1;
+        }
+        
+        int num_nodes = o->compiled.num_nodes;
+        
+        // allocate node infos
+        if (!(o->node_infos = (struct CommIndex__node_info *)BAllocArray(num_nodes, sizeof(o->node_infos[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail2;
+        }
+        
+        // allocate query values
+        if (!(o->query_values = (int *)BAllocArray(num_nodes, sizeof(o->query_values[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail3;
+        }
+        
+        // allocate entry values
+        if (!(o->entry_values = (int *)BAllocArray(num_nodes, sizeof(o->entry_values[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail4;
+        }
+        
+        // allocate candidate sources; each node adds at most one
+        if (!(o->sources = (struct CommIndex__source *)BAllocArray(num_nodes, sizeof(o->sources[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail5;
+        }
+        
+        // resolve function arguments
+        for (int i = 0; i < num_nodes; i++) {
+            init_node_info(o, i);
+        }
+    }
+    
+    // init entries list
+    LinkedList1_Init(&o->entries_list);
+    o->num_entries = 0;
+    
+    // init names hash table
+    if (!CommIndex__NamesHash_Init(&o->names_hash, COMMINDEX_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "CommIndex__NamesHash_Init failed");
+        goto fail6;
+    }
+    
+    // init addresses hash table
+    if (!CommIndex__AddrsHash_Init(&o->addrs_hash, COMMINDEX_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "CommIndex__AddrsHash_Init failed");
+        goto fail7;
+    }
+    
+    // init results
+    o->results = NULL;
+    o->results_capacity = 0;
+    
+    // init query mark; entries start with mark zero
+    o->query_mark = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_entries_ctr);
+    return 1;
+    
+fail7:
+    CommIndex__NamesHash_Free(&o->names_hash);
+fail6:
+    if (o->have_predicate) {
+        BFree(o->sources);
+fail5:
+        BFree(o->entry_values);
+fail4:
+        BFree(o->query_values);
+fail3:
+        BFree(o->node_infos);
+fail2:
+        BPredicateCompiled_Free(&o->compiled);
+fail1:
+        BPredicateFunction_Free(&o->func_p2addr);
+        BPredicateFunction_Free(&o->func_p1addr);
+        BPredicateFunction_Free(&o->func_p2name);
+        BPredicateFunction_Free(&o->func_p1name);
+        BPredicate_Free(&o->predicate);
+    }
+fail0:
+    return 0;
+}
+
+void CommIndex_Free (CommIndex *o)
+{
+    ASSERT(LinkedList1_IsEmpty(&o->entries_list))
+    DebugCounter_Free(&o->d_entries_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // free results
+    if (o->results) {
+        BFree(o->results);
+    }
+    
+    // free hash tables
+    CommIndex__AddrsHash_Free(&o->addrs_hash);
+    CommIndex__NamesHash_Free(&o->names_hash);
+    
+    if (o->have_predicate) {
+        // free evaluation state
+        BFree(o->sources);
+        BFree(o->entry_values);
+        BFree(o->query_values);
+        BFree(o->node_infos);
+        
+        // free compiled predicate
+        BPredicateCompiled_Free(&o->compiled);
+        
+        // free functions
+        BPredicateFunction_Free(&o->func_p2addr);
+        BPredicateFunction_Free(&o->func_p1addr);
+        BPredicateFunction_Free(&o->func_p2name);
+        BPredicateFunction_Free(&o->func_p1name);
+        
+        // free predicate
+        BPredicate_Free(&o->predicate);
+    }
+}
+
+int CommIndex_Allowed (CommIndex *o, const char *name1, BIPAddr addr1, const char *name2, BIPAddr addr2)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->have_predicate) {
+        return 1;
+    }
+    
+    // set values to compare against
+    o->eval_p1name = name1;
+    o->eval_p2name = name2;
+    o->eval_p1addr = addr1;
+    o->eval_p2addr = addr2;
+    
+    // evaluate predicate
+    int res = BPredicate_Eval(&o->predicate);
+    if (res < 0) {
+        return 0;
+    }
+    
+    return res;
+}
+
+size_t CommIndex_Query (CommIndex *o, const char *name, BIPAddr addr, CommIndexEntry ***out_entries)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(out_entries)
+    
+    *out_entries = o->results;
+    size_t num_results = 0;
+    
+    // without a predicate, everyone is allowed
+    if (!o->have_predicate) {
+        for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->entries_list); ln; ln = LinkedList1Node_Next(ln)) {
+            add_result(o, &num_results, UPPER_OBJECT(ln, CommIndexEntry, list_node));
+        }
+        return num_results;
+    }
+    
+    // evaluate what can be evaluated knowing only p1
+    evaluate_for_query(o, name, &addr);
+    
+    int root = o->compiled.num_nodes - 1;
+    int root_value = o->query_values[root];
+    
+    if (root_value == VALUE_FALSE || root_value == VALUE_ERROR) {
+        return 0;
+    }
+    
+    // find candidates
+    o->num_sources = 0;
+    size_t cover_size = 0;
+    int have_cover = (root_value == VALUE_UNKNOWN && collect_candidates(o, root, VALUE_TRUE, &cover_size));
+    
+    // no narrower cover, check all entries
+    if (!have_cover) {
+        for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->entries_list); ln; ln = LinkedList1Node_Next(ln)) {
+            CommIndexEntry *e = UPPER_OBJECT(ln, CommIndexEntry, list_node);
+            if (root_value == VALUE_TRUE || evaluate_for_entry(o, e)) {
+                add_result(o, &num_results, e);
+            }
+        }
+        return num_results;
+    }
+    
+    // get a fresh mark for skipping entries in multiple sources
+    if (++o->query_mark == 0) {
+        for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->entries_list); ln; ln = LinkedList1Node_Next(ln)) {
+            UPPER_OBJECT(ln, CommIndexEntry, list_node)->query_mark = 0;
+        }
+        o->query_mark = 1;
+    }
+    
+    // check candidates
+    for (int i = 0; i < o->num_sources; i++) {
+        struct CommIndex__source *s = &o->sources[i];
+        CommIndexEntry *e = s->first;
+        
+        while (e) {
+            if (e->query_mark != o->query_mark) {
+                e->query_mark = o->query_mark;
+                if (evaluate_for_entry(o, e)) {
+                    add_result(o, &num_results, e);
+                }
+            }
+            
+            if (s->type == SOURCE_TYPE_NAME) {
+                CommIndex__NamesHashRef ref = {e, e};
+                e = CommIndex__NamesHash_GetNextEqual(&o->names_hash, 0, ref).ptr;
+            } else {
+                CommIndex__AddrsHashRef ref = {e, e};
+                e = CommIndex__AddrsHash_GetNextEqual(&o->addrs_hash, 0, ref).ptr;
+            }
+        }
+    }
+    
+    return num_results;
+}
+
+int CommIndexEntry_Init (CommIndexEntry *o, CommIndex *index, const char *name, BIPAddr addr)
+{
+    DebugObject_Access(&index->d_obj);
+    ASSERT(name)
+    
+    // make sure a query can return every entry
+    if (!grow_results(index, index->num_entries + 1)) {
+        BLog(BLOG_ERROR, "failed to grow results");
+        return 0;
+    }
+    
+    // init arguments
+    o->index = index;
+    o->name = name;
+    o->name_hash = badvpn_djb2_hash((const uint8_t *)name);
+    o->addr = addr;
+    o->addr_hash = CommIndex__addr_hash(&addr);
+    o->query_mark = 0;
+    
+    // add to list
+    LinkedList1_Append(&index->entries_list, &o->list_node);
+    index->num_entries++;
+    
+    // add to hash tables
+    CommIndex__NamesHashRef name_ref = {o, o};
+    CommIndex__NamesHash_InsertMulti(&index->names_hash, 0, name_ref);
+    CommIndex__AddrsHashRef addr_ref = {o, o};
+    CommIndex__AddrsHash_InsertMulti(&index->addrs_hash, 0, addr_ref);
+    
+    // grow the hash tables if needed; failure only makes lookups slower
+    if (index->num_entries > index->names_hash.num_buckets) {
+        CommIndex__NamesHash_MultiplyBuckets(&index->names_hash, 0, 1);
+    }
+    if (index->num_entries > index->addrs_hash.num_buckets) {
+        CommIndex__AddrsHash_MultiplyBuckets(&index->addrs_hash, 0, 1);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&index->d_entries_ctr);
+    return 1;
+}
+
+void CommIndexEntry_Free (CommIndexEntry *o)
+{
+    CommIndex *index = o->index;
+    DebugCounter_Decrement(&index->d_entries_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // remove from hash tables
+    CommIndex__AddrsHashRef addr_ref = {o, o};
+    CommIndex__AddrsHash_Remove(&index->addrs_hash, 0, addr_ref);
+    CommIndex__NamesHashRef name_ref = {o, o};
+    CommIndex__NamesHash_Remove(&index->names_hash, 0, name_ref);
+    
+    // remove from list
+    LinkedList1_Remove(&index->entries_list, &o->list_node);
+    index->num_entries--;
+}
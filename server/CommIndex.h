@@ -0,0 +1,181 @@
+/**
+ * @file CommIndex.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Index of clients used by the server to find the peers a new client is
+ * allowed to communicate with, according to the communication predicate.
+ * 
+ * The predicate is compiled once. For a query, the p1name and p1addr terms
+ * are evaluated against the new client, which usually leaves an expression
+ * in which only a few p2name and p2addr terms matter. Those terms are looked
+ * up in hash tables of the indexed clients by common name and by address,
+ * giving a candidate set, and only the candidates are checked against the
+ * remaining expression. Expressions which cannot be narrowed down this way
+ * (e.g. a negated p2name) fall back to checking every indexed client, which
+ * is still cheaper than evaluating the full predicate for every pair.
+ */
+
+#ifndef BADVPN_SERVER_COMMINDEX_H
+#define BADVPN_SERVER_COMMINDEX_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <predicate/BPredicate.h>
+#include <system/BAddr.h>
+
+#define COMMINDEX_HASH_INITIAL_BUCKETS 64
+
+struct CommIndexEntry_s;
+struct CommIndex__node_info;
+struct CommIndex__source;
+
+typedef struct CommIndexEntry_s *CommIndex__hash_link;
+
+#include "CommIndex_names_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "CommIndex_addrs_hash.h"
+#include <structure/CHash_decl.h>
+
+/**
+ * Index of clients for evaluating the communication predicate.
+ */
+typedef struct {
+    int have_predicate;
+    BPredicate predicate;
+    BPredicateFunction func_p1name;
+    BPredicateFunction func_p2name;
+    BPredicateFunction func_p1addr;
+    BPredicateFunction func_p2addr;
+    BPredicateCompiled compiled;
+    struct CommIndex__node_info *node_infos;
+    int *query_values;
+    int *entry_values;
+    struct CommIndex__source *sources;
+    int num_sources;
+    const char *eval_p1name;
+    const char *eval_p2name;
+    BIPAddr eval_p1addr;
+    BIPAddr eval_p2addr;
+    LinkedList1 entries_list;
+    size_t num_entries;
+    CommIndex__NamesHash names_hash;
+    CommIndex__AddrsHash addrs_hash;
+    struct CommIndexEntry_s **results;
+    size_t results_capacity;
+    unsigned int query_mark;
+    DebugObject d_obj;
+    DebugCounter d_entries_ctr;
+} CommIndex;
+
+/**
+ * Indexed client.
+ */
+typedef struct CommIndexEntry_s {
+    CommIndex *index;
+    const char *name;
+    size_t name_hash;
+    BIPAddr addr;
+    size_t addr_hash;
+    LinkedList1Node list_node;
+    struct CommIndexEntry_s *names_next;
+    struct CommIndexEntry_s *addrs_next;
+    unsigned int query_mark;
+    DebugObject d_obj;
+} CommIndexEntry;
+
+/**
+ * Initializes the index.
+ * 
+ * @param o the object
+ * @param predicate communication predicate, using the functions p1name, p2name,
+ *                  p1addr and p2addr, or NULL to allow all pairs of clients
+ * @return 1 on success, 0 on failure
+ */
+int CommIndex_Init (CommIndex *o, char *predicate) WARN_UNUSED;
+
+/**
+ * Frees the index.
+ * There must be no entries.
+ * 
+ * @param o the object
+ */
+void CommIndex_Free (CommIndex *o);
+
+/**
+ * Evaluates the predicate for a single pair of clients, without using the index.
+ * 
+ * @param o the object
+ * @param name1 common name of the first client (p1)
+ * @param addr1 address of the first client (p1)
+ * @param name2 common name of the second client (p2)
+ * @param addr2 address of the second client (p2)
+ * @return 1 if the clients are allowed to communicate, 0 if not
+ */
+int CommIndex_Allowed (CommIndex *o, const char *name1, BIPAddr addr1, const char *name2, BIPAddr addr2);
+
+/**
+ * Finds the indexed clients a client is allowed to communicate with, that is,
+ * the entries for which the predicate evaluates to true when p1 is the given
+ * client and p2 is the entry's client.
+ * 
+ * @param o the object
+ * @param name common name of the client
+ * @param addr address of the client
+ * @param out_entries on success, receives a pointer to an array of the resulting
+ *                    entries. The array is valid until the next query or until
+ *                    an entry is added.
+ * @return number of resulting entries
+ */
+size_t CommIndex_Query (CommIndex *o, const char *name, BIPAddr addr, CommIndexEntry ***out_entries);
+
+/**
+ * Adds a client to the index.
+ * 
+ * @param o the object
+ * @param index index to add to
+ * @param name common name of the client. Must remain valid until the entry is freed.
+ * @param addr address of the client
+ * @return 1 on success, 0 on failure
+ */
+int CommIndexEntry_Init (CommIndexEntry *o, CommIndex *index, const char *name, BIPAddr addr) WARN_UNUSED;
+
+/**
+ * Removes a client from the index.
+ * 
+ * @param o the object
+ */
+void CommIndexEntry_Free (CommIndexEntry *o);
+
+#endif
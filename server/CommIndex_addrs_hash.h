@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME CommIndex__AddrsHash
+#define CHASH_PARAM_ENTRY struct CommIndexEntry_s
+#define CHASH_PARAM_LINK CommIndex__hash_link
+#define CHASH_PARAM_KEY BIPAddr *
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((CommIndex__hash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->addr_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) (CommIndex__addr_hash((key)))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (BIPAddr_Compare(&(entry1).ptr->addr, &(entry2).ptr->addr))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (BIPAddr_Compare((key1), &(entry2).ptr->addr))
+#define CHASH_PARAM_ENTRY_NEXT addrs_next
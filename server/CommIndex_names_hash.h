@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME CommIndex__NamesHash
+#define CHASH_PARAM_ENTRY struct CommIndexEntry_s
+#define CHASH_PARAM_LINK CommIndex__hash_link
+#define CHASH_PARAM_KEY const char *
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((CommIndex__hash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->name_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) (badvpn_djb2_hash((const uint8_t *)(key)))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (!strcmp((entry1).ptr->name, (entry2).ptr->name))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (!strcmp((key1), (entry2).ptr->name))
+#define CHASH_PARAM_ENTRY_NEXT names_next
@@ -90,6 +90,8 @@ struct {
     int threads;
     int use_threads_for_ssl_handshake;
     int use_threads_for_ssl_data;
+    int ssl_handshake_threads;
+    int max_ssl_handshakes;
     int ssl;
     char *nssdb;
     char *server_cert_name;
@@ -105,20 +107,8 @@ struct {
 BAddr listen_addrs[MAX_LISTEN_ADDRS];
 int num_listen_addrs;
 
-// communication predicate
-BPredicate comm_predicate;
-
-// communication predicate functions
-BPredicateFunction comm_predicate_func_p1name;
-BPredicateFunction comm_predicate_func_p2name;
-BPredicateFunction comm_predicate_func_p1addr;
-BPredicateFunction comm_predicate_func_p2addr;
-
-// variables when evaluating the predicate, adjusted before every evaluation
-const char *comm_predicate_p1name;
-const char *comm_predicate_p2name;
-BIPAddr comm_predicate_p1addr;
-BIPAddr comm_predicate_p2addr;
+// index of clients for the communication predicate
+CommIndex comm_index;
 
 // relay predicate
 BPredicate relay_predicate;
@@ -141,6 +131,12 @@ BReactor ss;
 // thread work dispatcher
 BThreadWorkDispatcher twd;
 
+// thread work dispatcher dedicated to SSL handshakes
+BThreadWorkDispatcher handshake_twd;
+
+// limits concurrent SSL handshakes
+BSSLHandshakePool handshake_pool;
+
 // server certificate if using SSL
 CERTCertificate *server_cert;
 
@@ -167,6 +163,9 @@ LinkedList1 clients;
 // clients tree (by ID)
 BAVL clients_tree;
 
+// buffers for client-to-client flows
+PacketBufferPool peer_flow_pool;
+
 // prints help text to standard output
 static void print_help (const char *name);
 
@@ -181,6 +180,9 @@ static int process_arguments (void);
 
 static int ssl_flags (void);
 
+// returns the dispatcher to do SSL handshakes in, or NULL to do them in the main thread
+static BThreadWorkDispatcher * ssl_handshake_twd (void);
+
 // handler for program termination request
 static void signal_handler (void *unused);
 
@@ -192,6 +194,9 @@ static void client_dealloc (struct client_data *client);
 
 static int client_compute_buffer_size (struct client_data *client);
 
+// computes the number of buffers in the pool for client-to-client flows
+static int compute_peer_flow_pool_size (int packets_per_client);
+
 // initializes the I/O porition of the client
 static int client_init_io (struct client_data *client);
 
@@ -284,21 +289,8 @@ static peerid_t new_client_id (void);
 // finds a client by its ID
 static struct client_data * find_client_by_id (peerid_t id);
 
-// checks if two clients are allowed to communicate. May depend on the order
-// of the clients.
-static int clients_allowed (struct client_data *client1, struct client_data *client2);
-
-// communication predicate function p1name
-static int comm_predicate_func_p1name_cb (void *user, void **args);
-
-// communication predicate function p2name
-static int comm_predicate_func_p2name_cb (void *user, void **args);
-
-// communication predicate function p1addr
-static int comm_predicate_func_p1addr_cb (void *user, void **args);
-
-// communication predicate function p2addr
-static int comm_predicate_func_p2addr_cb (void *user, void **args);
+// common name of a client for evaluating predicates
+static const char * client_predicate_name (struct client_data *client);
 
 // checks if relay is allowed for a client through another client
 static int relay_allowed (struct client_data *client, struct client_data *relay);
@@ -434,6 +426,13 @@ int main (int argc, char *argv[])
             BLog(BLOG_ERROR, "SSL_ConfigSecureServer failed");
             goto fail05;
         }
+        
+        // enable session tickets, so that clients can resume sessions which have
+        // dropped out of the session cache
+        if (SSL_OptionSet(model_prfd, SSL_ENABLE_SESSION_TICKETS, PR_TRUE) != SECSuccess) {
+            BLog(BLOG_ERROR, "SSL_OptionSet(SSL_ENABLE_SESSION_TICKETS) failed");
+            goto fail05;
+        }
     }
     
     // initialize network
@@ -448,20 +447,10 @@ int main (int argc, char *argv[])
         goto fail1;
     }
     
-    // init communication predicate
-    if (options.comm_predicate) {
-        // init predicate
-        if (!BPredicate_Init(&comm_predicate, options.comm_predicate)) {
-            BLog(BLOG_ERROR, "BPredicate_Init failed");
-            goto fail1;
-        }
-        
-        // init functions
-        int args[] = {PREDICATE_TYPE_STRING};
-        BPredicateFunction_Init(&comm_predicate_func_p1name, &comm_predicate, "p1name", args, 1, comm_predicate_func_p1name_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p2name, &comm_predicate, "p2name", args, 1, comm_predicate_func_p2name_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p1addr, &comm_predicate, "p1addr", args, 1, comm_predicate_func_p1addr_cb, NULL);
-        BPredicateFunction_Init(&comm_predicate_func_p2addr, &comm_predicate, "p2addr", args, 1, comm_predicate_func_p2addr_cb, NULL);
+    // init communication predicate index
+    if (!CommIndex_Init(&comm_index, options.comm_predicate)) {
+        BLog(BLOG_ERROR, "CommIndex_Init failed");
+        goto fail1;
     }
     
     // init relay predicate
@@ -495,10 +484,19 @@ int main (int argc, char *argv[])
         goto fail3a;
     }
     
+    // init SSL handshake thread work dispatcher
+    if (!BThreadWorkDispatcher_Init(&handshake_twd, &ss, options.ssl_handshake_threads)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+        goto fail4;
+    }
+    
+    // init SSL handshake pool
+    BSSLHandshakePool_Init(&handshake_pool, ssl_handshake_twd(), options.max_ssl_handshakes);
+    
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
-        goto fail4;
+        goto fail4a;
     }
     
     // initialize number of clients
@@ -513,6 +511,11 @@ int main (int argc, char *argv[])
     // initialize clients tree
     BAVL_Init(&clients_tree, OFFSET_DIFF(struct client_data, id, tree_node), (BAVL_comparator)peerid_comparator, NULL);
     
+    // initialize buffer pool for client-to-client flows
+    PacketBufferPool_Init(&peer_flow_pool, PACKETPROTO_ENCLEN(SC_MAX_ENC),
+                          compute_peer_flow_pool_size(PEER_FLOW_POOL_PACKETS_PER_CLIENT),
+                          compute_peer_flow_pool_size(PEER_FLOW_POOL_FREE_PACKETS_PER_CLIENT));
+    
     // initialize listeners
     num_listeners = 0;
     while (num_listeners < num_listen_addrs) {
@@ -567,8 +570,11 @@ fail10:
         num_listeners--;
         BListener_Free(&listeners[num_listeners]);
     }
-    
+    PacketBufferPool_Free(&peer_flow_pool);
     BSignal_Finish();
+fail4a:
+    BSSLHandshakePool_Free(&handshake_pool);
+    BThreadWorkDispatcher_Free(&handshake_twd);
 fail4:
     BThreadWorkDispatcher_Free(&twd);
 fail3a:
@@ -582,13 +588,7 @@ fail3:
         BPredicate_Free(&relay_predicate);
     }
 fail2:
-    if (options.comm_predicate) {
-        BPredicateFunction_Free(&comm_predicate_func_p2addr);
-        BPredicateFunction_Free(&comm_predicate_func_p1addr);
-        BPredicateFunction_Free(&comm_predicate_func_p2name);
-        BPredicateFunction_Free(&comm_predicate_func_p1name);
-        BPredicate_Free(&comm_predicate);
-    }
+    CommIndex_Free(&comm_index);
 fail1:
     if (options.ssl) {
 fail05:
@@ -631,6 +631,8 @@ void print_help (const char *name)
         "        [--threads <integer>]\n"
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
+        "        [--ssl-handshake-threads <integer>]\n"
+        "        [--max-ssl-handshakes <number>]\n"
         "        [--listen-addr <addr>] ...\n"
         "        [--ssl --nssdb <string> --server-cert-name <string>]\n"
         "        [--comm-predicate <string>]\n"
@@ -663,6 +665,8 @@ int parse_arguments (int argc, char *argv[])
     options.threads = 0;
     options.use_threads_for_ssl_handshake = 0;
     options.use_threads_for_ssl_data = 0;
+    options.ssl_handshake_threads = 0;
+    options.max_ssl_handshakes = 0;
     options.ssl = 0;
     options.nssdb = NULL;
     options.server_cert_name = NULL;
@@ -761,6 +765,28 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--use-threads-for-ssl-data")) {
             options.use_threads_for_ssl_data = 1;
         }
+        else if (!strcmp(arg, "--ssl-handshake-threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.ssl_handshake_threads = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-ssl-handshakes")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_ssl_handshakes = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--ssl")) {
             options.ssl = 1;
         }
@@ -871,7 +897,8 @@ int process_arguments (void)
 
 int ssl_flags (void)
 {
-    int flags = 0;
+    // collect control messages into larger TLS records
+    int flags = BSSLCONNECTION_FLAG_COALESCE_WRITES;
     if (options.use_threads_for_ssl_handshake) {
         flags |= BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE;
     }
@@ -881,6 +908,17 @@ int ssl_flags (void)
     return flags;
 }
 
+BThreadWorkDispatcher * ssl_handshake_twd (void)
+{
+    if (options.ssl_handshake_threads > 0) {
+        return &handshake_twd;
+    }
+    if (options.use_threads_for_ssl_handshake) {
+        return &twd;
+    }
+    return NULL;
+}
+
 void signal_handler (void *unused)
 {
     BLog(BLOG_NOTICE, "termination requested");
@@ -958,8 +996,8 @@ void listener_handler (BListener *listener)
             goto fail3;
         }
         
-        // init SSL connection
-        BSSLConnection_Init(&client->sslcon, client->ssl_prfd, 1, BReactor_PendingGroup(&ss), client, (BSSLConnection_handler)client_sslcon_handler);
+        // init SSL connection, with the handshake subject to the handshake pool
+        BSSLConnection_InitPooled(&client->sslcon, client->ssl_prfd, &handshake_pool, BReactor_PendingGroup(&ss), client, (BSSLConnection_handler)client_sslcon_handler);
     } else {
         // initialize I/O
         if (!client_init_io(client)) {
@@ -1023,6 +1061,11 @@ void client_dealloc (struct client_data *client)
     // free dying
     BPending_Free(&client->dying_job);
     
+    // remove from communication index
+    if (client->initstatus == INITSTATUS_COMPLETE) {
+        CommIndexEntry_Free(&client->comm_index_entry);
+    }
+    
     // link out
     BAVL_Remove(&clients_tree, &client->tree_node);
     LinkedList1_Remove(&clients, &client->list_node);
@@ -1064,6 +1107,17 @@ int client_compute_buffer_size (struct client_data *client)
     }
 }
 
+int compute_peer_flow_pool_size (int packets_per_client)
+{
+    bsize_t s = bsize_mul(bsize_fromsize(options.max_clients), bsize_fromsize(packets_per_client));
+    
+    if (s.is_overflow || s.value > INT_MAX) {
+        return INT_MAX;
+    } else {
+        return s.value;
+    }
+}
+
 int client_init_io (struct client_data *client)
 {
     StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
@@ -1113,7 +1167,7 @@ int client_init_io (struct client_data *client)
     PacketPassPriorityQueueFlow_Init(&client->output_peers_qflow, &client->output_priorityqueue, 0);
     
     // init fair queue (for different peers)
-    if (!PacketPassFairQueue_Init(&client->output_peers_fairqueue, PacketPassPriorityQueueFlow_GetInput(&client->output_peers_qflow), BReactor_PendingGroup(&ss), 0, 1)) {
+    if (!PacketPassFairQueue_InitMode(&client->output_peers_fairqueue, PacketPassPriorityQueueFlow_GetInput(&client->output_peers_qflow), BReactor_PendingGroup(&ss), 0, 1, FAIRQUEUE_MODE_DRR)) {
         client_log(client, BLOG_ERROR, "PacketPassFairQueue_Init failed");
         goto fail3;
     }
@@ -1346,7 +1400,7 @@ void client_sslcon_handler (struct client_data *client, int event)
     // set client state
     client->initstatus = INITSTATUS_WAITHELLO;
     
-    client_log(client, BLOG_INFO, "handshake complete");
+    client_log(client, BLOG_INFO, "handshake complete%s", (BSSLConnection_IsResumed(&client->sslcon) ? " (session resumed)" : ""));
     
     return;
     
@@ -1565,13 +1619,27 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     
     client_log(client, BLOG_INFO, "received hello");
     
+    // add to communication index
+    BIPAddr client_ipaddr;
+    BAddr_GetIPAddr(&client->addr, &client_ipaddr);
+    if (!CommIndexEntry_Init(&client->comm_index_entry, &comm_index, client_predicate_name(client), client_ipaddr)) {
+        client_log(client, BLOG_ERROR, "CommIndexEntry_Init failed");
+        client_remove(client);
+        return;
+    }
+    
     // set client state to complete
     client->initstatus = INITSTATUS_COMPLETE;
     
+    // find clients we're allowed to communicate with
+    CommIndexEntry **allowed;
+    size_t num_allowed = CommIndex_Query(&comm_index, client_predicate_name(client), client_ipaddr, &allowed);
+    
     // publish client
-    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&clients); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, list_node);
-        if (client2 == client || client2->initstatus != INITSTATUS_COMPLETE || client2->dying || !clients_allowed(client, client2)) {
+    for (size_t i = 0; i < num_allowed; i++) {
+        struct client_data *client2 = UPPER_OBJECT(allowed[i], struct client_data, comm_index_entry);
+        ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
+        if (client2 == client || client2->dying) {
             continue;
         }
         
@@ -1851,15 +1919,9 @@ int peer_flow_init_io (struct peer_flow *flow)
     // init queue flow
     PacketPassFairQueueFlow_Init(&flow->qflow, &flow->dest_client->output_peers_fairqueue);
     
-    // init PacketProtoFlow
-    if (!PacketProtoFlow_Init(
-        &flow->oflow, SC_MAX_ENC, CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS,
-        PacketPassFairQueueFlow_GetInput(&flow->qflow), BReactor_PendingGroup(&ss)
-    )) {
-        BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
-        goto fail1;
-    }
-    flow->input = PacketProtoFlow_GetInput(&flow->oflow);
+    // init buffer pool flow, which only takes buffers from the shared pool while
+    // it has packets queued
+    PacketBufferPoolFlow_Init(&flow->pflow, &peer_flow_pool, CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS, PacketPassFairQueueFlow_GetInput(&flow->qflow));
     
     // set no packet
     flow->packet_len = -1;
@@ -1868,10 +1930,6 @@ int peer_flow_init_io (struct peer_flow *flow)
     flow->have_io = 1;
     
     return 1;
-    
-fail1:
-    PacketPassFairQueueFlow_Free(&flow->qflow);
-    return 0;
 }
 
 void peer_flow_free_io (struct peer_flow *flow)
@@ -1879,8 +1937,8 @@ void peer_flow_free_io (struct peer_flow *flow)
     ASSERT(flow->have_io)
     PacketPassFairQueueFlow_AssertFree(&flow->qflow);
     
-    // free PacketProtoFlow
-    PacketProtoFlow_Free(&flow->oflow);
+    // free buffer pool flow
+    PacketBufferPoolFlow_Free(&flow->pflow);
     
     // free queue flow
     PacketPassFairQueueFlow_Free(&flow->qflow);
@@ -1926,7 +1984,7 @@ int peer_flow_start_packet (struct peer_flow *flow, void **data, int len)
     ASSERT(!(len > 0) || data)
     
     // obtain location for writing the packet
-    if (!BufferWriter_StartPacket(flow->input, &flow->packet)) {
+    if (!PacketBufferPoolFlow_StartPacket(&flow->pflow, &flow->packet)) {
         return 0;
     }
     
@@ -1934,7 +1992,7 @@ int peer_flow_start_packet (struct peer_flow *flow, void **data, int len)
     flow->packet_len = len;
     
     if (data) {
-        *data = flow->packet + sizeof(struct sc_header);
+        *data = flow->packet + sizeof(struct packetproto_header) + sizeof(struct sc_header);
     }
     return 1;
 }
@@ -1945,13 +2003,18 @@ void peer_flow_end_packet (struct peer_flow *flow, uint8_t type)
     ASSERT(flow->packet_len >= 0)
     ASSERT(flow->packet_len <= SC_MAX_PAYLOAD)
     
+    // write PacketProto header
+    struct packetproto_header pp_header;
+    pp_header.len = htol16(sizeof(struct sc_header) + flow->packet_len);
+    memcpy(flow->packet, &pp_header, sizeof(pp_header));
+    
     // write header
     struct sc_header header;
     header.type = type;
-    memcpy(flow->packet, &header, sizeof(header));
+    memcpy(flow->packet + sizeof(pp_header), &header, sizeof(header));
     
     // finish writing packet
-    BufferWriter_EndPacket(flow->input, sizeof(struct sc_header) + flow->packet_len);
+    PacketBufferPoolFlow_EndPacket(&flow->pflow, PACKETPROTO_ENCLEN(sizeof(struct sc_header) + flow->packet_len));
     
     // set have no packet
     flow->packet_len = -1;
@@ -2097,70 +2160,9 @@ struct client_data * find_client_by_id (peerid_t id)
     return UPPER_OBJECT(node, struct client_data, tree_node);
 }
 
-int clients_allowed (struct client_data *client1, struct client_data *client2)
+const char * client_predicate_name (struct client_data *client)
 {
-    ASSERT(client1->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client1->dying)
-    ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client2->dying)
-    
-    if (!options.comm_predicate) {
-        return 1;
-    }
-    
-    // set values to compare against
-    comm_predicate_p1name = (client1->common_name ? client1->common_name : "");
-    comm_predicate_p2name = (client2->common_name ? client2->common_name : "");
-    BAddr_GetIPAddr(&client1->addr, &comm_predicate_p1addr);
-    BAddr_GetIPAddr(&client2->addr, &comm_predicate_p2addr);
-    
-    // evaluate predicate
-    int res = BPredicate_Eval(&comm_predicate);
-    if (res < 0) {
-        return 0;
-    }
-    
-    return res;
-}
-
-int comm_predicate_func_p1name_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
-    
-    return (!strcmp(arg, comm_predicate_p1name));
-}
-
-int comm_predicate_func_p2name_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
-    
-    return (!strcmp(arg, comm_predicate_p2name));
-}
-
-int comm_predicate_func_p1addr_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
-    
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
-        return -1;
-    }
-    
-    return BIPAddr_Compare(&addr, &comm_predicate_p1addr);
-}
-
-int comm_predicate_func_p2addr_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
-    
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
-        return -1;
-    }
-    
-    return BIPAddr_Compare(&addr, &comm_predicate_p2addr);
+    return (client->common_name ? client->common_name : "");
 }
 
 int relay_allowed (struct client_data *client, struct client_data *relay)
@@ -2170,8 +2172,8 @@ int relay_allowed (struct client_data *client, struct client_data *relay)
     }
     
     // set values to compare against
-    relay_predicate_pname = (client->common_name ? client->common_name : "");
-    relay_predicate_rname = (relay->common_name ? relay->common_name : "");
+    relay_predicate_pname = client_predicate_name(client);
+    relay_predicate_rname = client_predicate_name(relay);
     BAddr_GetIPAddr(&client->addr, &relay_predicate_paddr);
     BAddr_GetIPAddr(&relay->addr, &relay_predicate_raddr);
     
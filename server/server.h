@@ -37,9 +37,11 @@
 #include <flow/PacketPassPriorityQueue.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketProtoFlow.h>
+#include <flow/PacketBufferPool.h>
 #include <system/BReactor.h>
 #include <system/BConnection.h>
 #include <nspr_support/BSSLConnection.h>
+#include <server/CommIndex.h>
 
 // name of the program
 #define PROGRAM_NAME "server"
@@ -50,8 +52,12 @@
 // it must hold: initdata, newclient's, endclient's (if other peers die when informing them)
 // make it big enough to hold the initial packet burst (initdata, newclient's),
 #define CLIENT_CONTROL_BUFFER_MIN_PACKETS (1 + 2*(MAX_CLIENTS - 1))
-// size of client-to-client buffers in packets
+// maximum number of packets queued in a client-to-client flow
 #define CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS 10
+// number of packet buffers shared by all client-to-client flows, per client
+#define PEER_FLOW_POOL_PACKETS_PER_CLIENT 32
+// number of unused packet buffers kept allocated for client-to-client flows, per client
+#define PEER_FLOW_POOL_FREE_PACKETS_PER_CLIENT 2
 // after how long of not hearing anything from the client we disconnect it
 #define CLIENT_NO_DATA_TIME_LIMIT 30000
 // SO_SNDBFUF socket option for clients
@@ -93,8 +99,7 @@ struct peer_flow {
     // output chain
     int have_io;
     PacketPassFairQueueFlow qflow;
-    PacketProtoFlow oflow;
-    BufferWriter *input;
+    PacketBufferPoolFlow pflow;
     int packet_len;
     uint8_t *packet;
     // reset timer
@@ -152,6 +157,9 @@ struct client_data {
     // node in clients tree (by ID)
     BAVLNode tree_node;
     
+    // entry in communication index, if initstatus is INITSTATUS_COMPLETE
+    CommIndexEntry comm_index_entry;
+    
     // knowledge lists
     LinkedList1 know_out_list;
     LinkedList1 know_in_list;
@@ -974,6 +974,7 @@ void BConnection_SendAsync_Init (BConnection *o)
     
     // init interface
     StreamPassInterface_Init(&o->send.iface, (StreamPassInterface_handler_send)connection_send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(StreamPassInterface_GetTrace(&o->send.iface), "BConnection.send");
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)connection_send_job_handler, o);
@@ -1019,6 +1020,7 @@ void BConnection_RecvAsync_Init (BConnection *o)
     
     // init interface
     StreamRecvInterface_Init(&o->recv.iface, (StreamRecvInterface_handler_recv)connection_recv_if_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(StreamRecvInterface_GetTrace(&o->recv.iface), "BConnection.recv");
     
     // init job
     BPending_Init(&o->recv.job, BReactor_PendingGroup(o->reactor), (BPending_handler)connection_recv_job_handler, o);
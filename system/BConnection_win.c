@@ -798,6 +798,7 @@ void BConnection_SendAsync_Init (BConnection *o)
     
     // init interface
     StreamPassInterface_Init(&o->send.iface, (StreamPassInterface_handler_send)connection_send_iface_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(StreamPassInterface_GetTrace(&o->send.iface), "BConnection.send");
     
     // set not busy
     o->send.busy = 0;
@@ -841,6 +842,7 @@ void BConnection_RecvAsync_Init (BConnection *o)
     
     // init interface
     StreamRecvInterface_Init(&o->recv.iface, (StreamRecvInterface_handler_recv)connection_recv_iface_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(StreamRecvInterface_GetTrace(&o->recv.iface), "BConnection.recv");
     
     // set not busy
     o->recv.busy = 0;
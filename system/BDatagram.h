@@ -142,6 +142,18 @@ int BDatagram_GetFd (BDatagram *o);
  */
 int BDatagram_SetReuseAddr (BDatagram *o, int reuse);
 
+/**
+ * Makes datagrams sent through the socket not be fragmented, without limiting
+ * their size to the path MTU the operating system believes in. This is meant
+ * for doing path MTU probing ourselves; datagrams which are too large for the
+ * path are dropped. Datagrams which the system refuses to send because they
+ * are too large for the outgoing interface are dropped without an error.
+ * 
+ * @param o the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetDontFragment (BDatagram *o);
+
 /**
  * Initializes the send interface.
  * The send interface must not be initialized.
@@ -171,6 +183,22 @@ void BDatagram_SendAsync_Free (BDatagram *o);
  */
 PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o);
 
+/**
+ * Makes the send interface collect packets into batches which are sent with
+ * as few system calls as possible. Consecutive packets of the same size go out
+ * in a single call using UDP segmentation offload if the kernel supports it,
+ * otherwise the batch is sent with sendmmsg().
+ * Packets are reported as sent once they are copied into the batch; the batch
+ * is sent when the sender stops submitting packets or the batch is full.
+ * Only supported on Linux.
+ * The send interface must be initialized and must not be busy. Batching must
+ * not already be enabled.
+ * 
+ * @param o the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SendAsync_EnableBatching (BDatagram *o) WARN_UNUSED;
+
 /**
  * Initializes the receive interface.
  * The receive interface must not be initialized.
@@ -200,6 +228,19 @@ void BDatagram_RecvAsync_Free (BDatagram *o);
  */
 PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o);
 
+/**
+ * Lets the kernel coalesce consecutive datagrams from the same sender (UDP_GRO),
+ * which are then received with a single system call and passed to the receive
+ * interface one by one. Datagrams larger than the receive MTU are dropped.
+ * Only supported on Linux and for IPv4 and IPv6 sockets.
+ * The receive interface must be initialized and must not be busy. Coalescing must
+ * not already be enabled.
+ * 
+ * @param o the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_RecvAsync_EnableCoalescing (BDatagram *o) WARN_UNUSED;
+
 #ifdef BADVPN_USE_WINAPI
 #include "BDatagram_win.h"
 #else
@@ -40,15 +40,31 @@
 #ifdef BADVPN_LINUX
 #    include <netpacket/packet.h>
 #    include <net/ethernet.h>
+#    include <netinet/udp.h>
 #endif
 
 #include <misc/nonblocking.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
 #include <base/BLog.h>
 
 #include "BDatagram.h"
 
 #include <generated/blog_channel_BDatagram.h>
 
+#ifdef BADVPN_LINUX
+#    ifndef UDP_SEGMENT
+#        define UDP_SEGMENT 103
+#    endif
+#    ifndef UDP_GRO
+#        define UDP_GRO 104
+#    endif
+#endif
+
+// limits for one segmentation offload send, as enforced by the kernel
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+
 struct sys_addr {
     socklen_t len;
     union {
@@ -61,13 +77,35 @@ struct sys_addr {
     } addr;
 };
 
+union pktinfo_cdata {
+#ifdef BADVPN_FREEBSD
+    char in[CMSG_SPACE(sizeof(struct in_addr))];
+#else
+    char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#endif
+    char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+};
+
 static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void set_pktinfo (int fd, int family);
+static size_t write_pktinfo (struct cmsghdr *cmsg, BIPAddr local_addr);
 static void report_error (BDatagram *o);
+static void start_recv (BDatagram *o);
 static void do_send (BDatagram *o);
+#ifdef BADVPN_LINUX
+static int batch_addrs_match (BDatagram *o);
+static void batch_schedule_flush (BDatagram *o);
+static void batch_add (BDatagram *o);
+static int batch_send_gso (BDatagram *o, struct sys_addr *sysaddr, int num, int len);
+static int batch_send_mmsg (BDatagram *o, struct sys_addr *sysaddr, int num);
+static void do_flush (BDatagram *o);
+static void batch_job_handler (BDatagram *o);
+static void recv_segment (BDatagram *o);
+#endif
 static void do_recv (BDatagram *o);
+static int send_can_write (BDatagram *o);
 static void fd_handler (BDatagram *o, int events);
 static void send_job_handler (BDatagram *o);
 static void recv_job_handler (BDatagram *o);
@@ -231,6 +269,43 @@ static void set_pktinfo (int fd, int family)
     }
 }
 
+static size_t write_pktinfo (struct cmsghdr *cmsg, BIPAddr local_addr)
+{
+    switch (local_addr.type) {
+        case BADDR_TYPE_IPV4: {
+#ifdef BADVPN_FREEBSD
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_SENDSRCADDR;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
+            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
+            addrinfo->s_addr = local_addr.ipv4;
+            return CMSG_SPACE(sizeof(struct in_addr));
+#else
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_PKTINFO;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
+            pktinfo->ipi_spec_dst.s_addr = local_addr.ipv4;
+            return CMSG_SPACE(sizeof(struct in_pktinfo));
+#endif
+        } break;
+        
+        case BADDR_TYPE_IPV6: {
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in6_pktinfo)));
+            cmsg->cmsg_level = IPPROTO_IPV6;
+            cmsg->cmsg_type = IPV6_PKTINFO;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+            memcpy(pktinfo->ipi6_addr.s6_addr, local_addr.ipv6, 16);
+            return CMSG_SPACE(sizeof(struct in6_pktinfo));
+        } break;
+    }
+    
+    return 0;
+}
+
 static void report_error (BDatagram *o)
 {
     DebugError_AssertNoError(&o->d_err);
@@ -240,12 +315,27 @@ static void report_error (BDatagram *o)
     return;
 }
 
+static void start_recv (BDatagram *o)
+{
+    // if recv wasn't started yet, start it
+    if (!o->recv.started) {
+        // set recv started
+        o->recv.started = 1;
+        
+        // continue receiving
+        if (o->recv.inited && o->recv.busy) {
+            BPending_Set(&o->recv.job);
+        }
+    }
+}
+
 static void do_send (BDatagram *o)
 {
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->send.inited)
     ASSERT(o->send.busy)
     ASSERT(o->send.have_addrs)
+    ASSERT(!o->send.batching)
     
     // limit
     if (!BReactorLimit_Increment(&o->send.limit)) {
@@ -263,14 +353,7 @@ static void do_send (BDatagram *o)
     iov.iov_base = (uint8_t *)o->send.busy_data;
     iov.iov_len = o->send.busy_data_len;
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
+    union pktinfo_cdata cdata;
     
     struct msghdr msg;
     memset(&msg, 0, sizeof(msg));
@@ -281,43 +364,7 @@ static void do_send (BDatagram *o)
     msg.msg_control = &cdata;
     msg.msg_controllen = sizeof(cdata);
     
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-    
-    size_t controllen = 0;
-    
-    switch (o->send.local_addr.type) {
-        case BADDR_TYPE_IPV4: {
-#ifdef BADVPN_FREEBSD
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
-            cmsg->cmsg_level = IPPROTO_IP;
-            cmsg->cmsg_type = IP_SENDSRCADDR;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
-            struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            addrinfo->s_addr = o->send.local_addr.ipv4;
-            controllen += CMSG_SPACE(sizeof(struct in_addr));
-#else
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
-            cmsg->cmsg_level = IPPROTO_IP;
-            cmsg->cmsg_type = IP_PKTINFO;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-            struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            pktinfo->ipi_spec_dst.s_addr = o->send.local_addr.ipv4;
-            controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
-#endif
-        } break;
-        
-        case BADDR_TYPE_IPV6: {
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in6_pktinfo)));
-            cmsg->cmsg_level = IPPROTO_IPV6;
-            cmsg->cmsg_type = IPV6_PKTINFO;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            memcpy(pktinfo->ipi6_addr.s6_addr, o->send.local_addr.ipv6, 16);
-            controllen += CMSG_SPACE(sizeof(struct in6_pktinfo));
-        } break;
-    }
-    
-    msg.msg_controllen = controllen;
+    msg.msg_controllen = write_pktinfo(CMSG_FIRSTHDR(&msg), o->send.local_addr);
     
     if (msg.msg_controllen == 0) {
         msg.msg_control = NULL;
@@ -333,9 +380,15 @@ static void do_send (BDatagram *o)
             return;
         }
         
-        BLog(BLOG_ERROR, "send failed");
-        report_error(o);
-        return;
+        if (errno != EMSGSIZE) {
+            BLog(BLOG_ERROR, "send failed");
+            report_error(o);
+            return;
+        }
+        
+        // too large to send without fragmenting, drop it
+        BLog(BLOG_INFO, "send failed: datagram too large");
+        bytes = o->send.busy_data_len;
     }
     
     ASSERT(bytes >= 0)
@@ -346,16 +399,78 @@ static void do_send (BDatagram *o)
     }
     
     // if recv wasn't started yet, start it
-    if (!o->recv.started) {
-        // set recv started
-        o->recv.started = 1;
-        
-        // continue receiving
-        if (o->recv.inited && o->recv.busy) {
-            BPending_Set(&o->recv.job);
-        }
+    start_recv(o);
+    
+    // set not busy
+    o->send.busy = 0;
+    
+    // done
+    PacketPassInterface_Done(&o->send.iface);
+}
+
+#ifdef BADVPN_LINUX
+
+static int batch_addrs_match (BDatagram *o)
+{
+    if (!BAddr_Compare(&o->send.batch_remote_addr, &o->send.remote_addr)) {
+        return 0;
+    }
+    
+    if (o->send.batch_local_addr.type == BADDR_TYPE_NONE) {
+        return (o->send.local_addr.type == BADDR_TYPE_NONE);
+    }
+    
+    return BIPAddr_Compare(&o->send.batch_local_addr, &o->send.local_addr);
+}
+
+static void batch_schedule_flush (BDatagram *o)
+{
+    ASSERT(o->send.batch_count > 0)
+    
+    // if we're waiting for the fd, the flush will continue from there
+    if (o->wait_events & BREACTOR_WRITE) {
+        return;
+    }
+    
+    // Set the flush job. Since jobs execute in LIFO order, any packets the sender
+    // submits in response to our Done end up in the same batch.
+    BPending_Set(&o->send.batch_job);
+}
+
+static void batch_add (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batching)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    
+    // If the batch has no room for the packet or the addresses changed, keep the packet
+    // and flush the batch first. The packet is added once the flush completes.
+    if (o->send.batch_count > 0 && (
+        o->send.batch_count == BDATAGRAM_BATCH_MAX_PACKETS ||
+        o->send.busy_data_len > o->send.batch_buf_size - o->send.batch_len ||
+        !batch_addrs_match(o)
+    )) {
+        batch_schedule_flush(o);
+        return;
     }
     
+    // remember addresses for the batch
+    if (o->send.batch_count == 0) {
+        o->send.batch_remote_addr = o->send.remote_addr;
+        o->send.batch_local_addr = o->send.local_addr;
+    }
+    
+    // append packet
+    memcpy(o->send.batch_buf + o->send.batch_len, o->send.busy_data, o->send.busy_data_len);
+    o->send.batch_lens[o->send.batch_count] = o->send.busy_data_len;
+    o->send.batch_count++;
+    o->send.batch_len += o->send.busy_data_len;
+    
+    // schedule flush
+    batch_schedule_flush(o);
+    
     // set not busy
     o->send.busy = 0;
     
@@ -363,6 +478,255 @@ static void do_send (BDatagram *o)
     PacketPassInterface_Done(&o->send.iface);
 }
 
+static int batch_send_gso (BDatagram *o, struct sys_addr *sysaddr, int num, int len)
+{
+    ASSERT(o->send.batch_gso)
+    ASSERT(num > 1)
+    ASSERT(num <= o->send.batch_count - o->send.batch_sent)
+    
+    struct iovec iov;
+    iov.iov_base = o->send.batch_buf + o->send.batch_sent_len;
+    iov.iov_len = len;
+    
+    union {
+        struct cmsghdr align;
+        char data[sizeof(union pktinfo_cdata) + CMSG_SPACE(sizeof(uint16_t))];
+    } cdata;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sysaddr->addr.generic;
+    msg.msg_namelen = sysaddr->len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &cdata;
+    msg.msg_controllen = sizeof(cdata);
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    size_t controllen = write_pktinfo(cmsg, o->send.batch_local_addr);
+    
+    // ask the kernel to split the buffer into datagrams of the size of the first one
+    cmsg = (struct cmsghdr *)((char *)cmsg + controllen);
+    memset(cmsg, 0, CMSG_SPACE(sizeof(uint16_t)));
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = o->send.batch_lens[o->send.batch_sent];
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    controllen += CMSG_SPACE(sizeof(uint16_t));
+    
+    msg.msg_controllen = controllen;
+    
+    // send
+    if (sendmsg(o->fd, &msg, 0) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        
+        if (errno != EIO && errno != EINVAL && errno != EMSGSIZE) {
+            BLog(BLOG_ERROR, "send failed");
+            return -1;
+        }
+        
+        // EIO means the device can't do checksum offload, which segmentation requires
+        if (errno == EIO) {
+            BLog(BLOG_INFO, "segmentation offload not available, sending datagrams separately");
+            o->send.batch_gso = 0;
+        }
+        
+        // send the datagrams separately
+        return batch_send_mmsg(o, sysaddr, num);
+    }
+    
+    return num;
+}
+
+static int batch_send_mmsg (BDatagram *o, struct sys_addr *sysaddr, int num)
+{
+    ASSERT(num > 0)
+    ASSERT(num <= o->send.batch_count - o->send.batch_sent)
+    
+    union pktinfo_cdata cdata;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = &cdata;
+    msg.msg_controllen = sizeof(cdata);
+    
+    size_t controllen = write_pktinfo(CMSG_FIRSTHDR(&msg), o->send.batch_local_addr);
+    
+    struct iovec iovs[BDATAGRAM_BATCH_MAX_PACKETS];
+    struct mmsghdr msgs[BDATAGRAM_BATCH_MAX_PACKETS];
+    
+    int offset = o->send.batch_sent_len;
+    
+    for (int i = 0; i < num; i++) {
+        int len = o->send.batch_lens[o->send.batch_sent + i];
+        
+        iovs[i].iov_base = o->send.batch_buf + offset;
+        iovs[i].iov_len = len;
+        
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &sysaddr->addr.generic;
+        msgs[i].msg_hdr.msg_namelen = sysaddr->len;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = (controllen > 0 ? (void *)&cdata : NULL);
+        msgs[i].msg_hdr.msg_controllen = controllen;
+        
+        offset += len;
+    }
+    
+    // send
+    int res = sendmmsg(o->fd, msgs, num, 0);
+    if (res < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        
+        if (errno != EMSGSIZE) {
+            BLog(BLOG_ERROR, "send failed");
+            return -1;
+        }
+        
+        // too large to send without fragmenting, drop it
+        BLog(BLOG_INFO, "send failed: datagram too large");
+        return 1;
+    }
+    
+    ASSERT(res > 0)
+    ASSERT(res <= num)
+    
+    return res;
+}
+
+static void do_flush (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batching)
+    ASSERT(o->send.batch_sent < o->send.batch_count)
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    // convert destination address
+    struct sys_addr sysaddr;
+    addr_socket_to_sys(&sysaddr, o->send.batch_remote_addr);
+    
+    while (o->send.batch_sent < o->send.batch_count) {
+        int first = o->send.batch_sent;
+        int seg = o->send.batch_lens[first];
+        
+        // collect datagrams of the same size for a segmentation offload send;
+        // the last one is allowed to be shorter
+        int num = 1;
+        int len = seg;
+        if (o->send.batch_gso && seg > 0) {
+            while (first + num < o->send.batch_count && num < GSO_MAX_SEGMENTS) {
+                int next_len = o->send.batch_lens[first + num];
+                if (next_len > seg || next_len > GSO_MAX_BYTES - len) {
+                    break;
+                }
+                num++;
+                len += next_len;
+                if (next_len < seg) {
+                    break;
+                }
+            }
+        }
+        
+        int res;
+        if (num > 1) {
+            res = batch_send_gso(o, &sysaddr, num, len);
+        } else {
+            // without segmentation offload, send everything we have at once
+            res = batch_send_mmsg(o, &sysaddr, (o->send.batch_gso ? 1 : o->send.batch_count - first));
+        }
+        
+        if (res < 0) {
+            report_error(o);
+            return;
+        }
+        
+        if (res == 0) {
+            // wait for fd
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        // skip sent datagrams
+        for (int i = 0; i < res; i++) {
+            o->send.batch_sent_len += o->send.batch_lens[o->send.batch_sent];
+            o->send.batch_sent++;
+        }
+    }
+    
+    // clear batch
+    o->send.batch_count = 0;
+    o->send.batch_len = 0;
+    o->send.batch_sent = 0;
+    o->send.batch_sent_len = 0;
+    
+    // if recv wasn't started yet, start it
+    start_recv(o);
+    
+    // add any packet that didn't fit into the batch
+    if (o->send.busy && o->send.have_addrs) {
+        batch_add(o);
+        return;
+    }
+}
+
+static void batch_job_handler (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batching)
+    ASSERT(o->send.batch_sent < o->send.batch_count)
+    ASSERT(!(o->wait_events & BREACTOR_WRITE))
+    
+    do_flush(o);
+    return;
+}
+
+static void recv_segment (BDatagram *o)
+{
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.coalescing)
+    ASSERT(o->recv.gro_pos <= o->recv.gro_len)
+    
+    int len = bmin_int(o->recv.gro_segment, o->recv.gro_len - o->recv.gro_pos);
+    uint8_t *data = o->recv.gro_buf + o->recv.gro_pos;
+    o->recv.gro_pos += len;
+    
+    if (len > o->recv.mtu) {
+        BLog(BLOG_INFO, "recv: datagram too large, dropping");
+        
+        // continue receiving
+        BPending_Set(&o->recv.job);
+        return;
+    }
+    
+    memcpy(o->recv.busy_data, data, len);
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, len);
+}
+
+#endif
+
 static void do_recv (BDatagram *o)
 {
     DebugError_AssertNoError(&o->d_err);
@@ -370,6 +734,14 @@ static void do_recv (BDatagram *o)
     ASSERT(o->recv.busy)
     ASSERT(o->recv.started)
     
+#ifdef BADVPN_LINUX
+    // hand out the remaining segments of a coalesced datagram
+    if (o->recv.coalescing && o->recv.gro_pos < o->recv.gro_len) {
+        recv_segment(o);
+        return;
+    }
+#endif
+    
     // limit
     if (!BReactorLimit_Increment(&o->recv.limit)) {
         // wait for fd
@@ -381,16 +753,20 @@ static void do_recv (BDatagram *o)
     struct sys_addr sysaddr;
     
     struct iovec iov;
-    iov.iov_base = o->recv.busy_data;
-    iov.iov_len = o->recv.mtu;
+#ifdef BADVPN_LINUX
+    if (o->recv.coalescing) {
+        iov.iov_base = o->recv.gro_buf;
+        iov.iov_len = BDATAGRAM_GRO_BUF_SIZE;
+    } else
+#endif
+    {
+        iov.iov_base = o->recv.busy_data;
+        iov.iov_len = o->recv.mtu;
+    }
     
     union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+        struct cmsghdr align;
+        char data[sizeof(union pktinfo_cdata) + CMSG_SPACE(sizeof(int))];
     } cdata;
     
     struct msghdr msg;
@@ -418,14 +794,17 @@ static void do_recv (BDatagram *o)
     }
     
     ASSERT(bytes >= 0)
-    ASSERT(bytes <= o->recv.mtu)
+    ASSERT((size_t)bytes <= iov.iov_len)
     
     // read returned address
     sysaddr.len = msg.msg_namelen;
     addr_sys_to_socket(&o->recv.remote_addr, sysaddr);
     
-    // read returned local address
+    // read returned local address and segment size
     BIPAddr_InitInvalid(&o->recv.local_addr);
+#ifdef BADVPN_LINUX
+    int segment = 0;
+#endif
     for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 #ifdef BADVPN_FREEBSD
         if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
@@ -442,11 +821,28 @@ static void do_recv (BDatagram *o)
             struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
             BIPAddr_InitIPv6(&o->recv.local_addr, pktinfo->ipi6_addr.s6_addr);
         }
+#ifdef BADVPN_LINUX
+        else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+        }
+#endif
     }
     
     // set have addresses
     o->recv.have_addrs = 1;
     
+#ifdef BADVPN_LINUX
+    if (o->recv.coalescing) {
+        // remember datagram, consisting of one or more segments
+        o->recv.gro_len = bytes;
+        o->recv.gro_pos = 0;
+        o->recv.gro_segment = (segment > 0 ? segment : bytes);
+        
+        recv_segment(o);
+        return;
+    }
+#endif
+    
     // set not busy
     o->recv.busy = 0;
     
@@ -454,6 +850,21 @@ static void do_recv (BDatagram *o)
     PacketRecvInterface_Done(&o->recv.iface, bytes);
 }
 
+static int send_can_write (BDatagram *o)
+{
+    if (!o->send.inited) {
+        return 0;
+    }
+    
+#ifdef BADVPN_LINUX
+    if (o->send.batching) {
+        return (o->send.batch_sent < o->send.batch_count);
+    }
+#endif
+    
+    return (o->send.busy && o->send.have_addrs);
+}
+
 static void fd_handler (BDatagram *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -466,10 +877,8 @@ static void fd_handler (BDatagram *o, int events)
     int have_send = 0;
     int have_recv = 0;
     
-    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && o->send.busy && o->send.have_addrs)) {
-        ASSERT(o->send.inited)
-        ASSERT(o->send.busy)
-        ASSERT(o->send.have_addrs)
+    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && send_can_write(o))) {
+        ASSERT(send_can_write(o))
         
         have_send = 1;
     }
@@ -487,6 +896,13 @@ static void fd_handler (BDatagram *o, int events)
             BPending_Set(&o->recv.job);
         }
         
+#ifdef BADVPN_LINUX
+        if (o->send.batching) {
+            do_flush(o);
+            return;
+        }
+#endif
+        
         do_send(o);
         return;
     }
@@ -509,6 +925,13 @@ static void send_job_handler (BDatagram *o)
     ASSERT(o->send.busy)
     ASSERT(o->send.have_addrs)
     
+#ifdef BADVPN_LINUX
+    if (o->send.batching) {
+        batch_add(o);
+        return;
+    }
+#endif
+    
     do_send(o);
     return;
 }
@@ -597,6 +1020,7 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->reactor = reactor;
     o->user = user;
     o->handler = handler;
+    o->family = family;
     
     // init fd
     if ((o->fd = socket(family_socket_to_sys(family), SOCK_DGRAM, 0)) < 0) {
@@ -754,6 +1178,50 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
     return 1;
 }
 
+int BDatagram_SetDontFragment (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    switch (o->family) {
+        case BADDR_TYPE_IPV4: {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+            int opt = IP_PMTUDISC_PROBE;
+            if (setsockopt(o->fd, IPPROTO_IP, IP_MTU_DISCOVER, &opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#elif defined(IP_DONTFRAG)
+            int opt = 1;
+            if (setsockopt(o->fd, IPPROTO_IP, IP_DONTFRAG, &opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#else
+            return 0;
+#endif
+        } break;
+        
+        case BADDR_TYPE_IPV6: {
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+            int opt = IPV6_PMTUDISC_PROBE;
+            if (setsockopt(o->fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#elif defined(IPV6_DONTFRAG)
+            int opt = 1;
+            if (setsockopt(o->fd, IPPROTO_IPV6, IPV6_DONTFRAG, &opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#else
+            return 0;
+#endif
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    return 1;
+}
+
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -766,6 +1234,7 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     
     // init interface
     PacketPassInterface_Init(&o->send.iface, o->send.mtu, (PacketPassInterface_handler_send)send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->send.iface), "BDatagram.send");
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_job_handler, o);
@@ -773,6 +1242,9 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     // set not busy
     o->send.busy = 0;
     
+    // set not batching
+    o->send.batching = 0;
+    
     // set inited
     o->send.inited = 1;
 }
@@ -786,6 +1258,16 @@ void BDatagram_SendAsync_Free (BDatagram *o)
     o->wait_events &= ~BREACTOR_WRITE;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef BADVPN_LINUX
+    if (o->send.batching) {
+        // free batch job
+        BPending_Free(&o->send.batch_job);
+        
+        // free batch buffer
+        BFree(o->send.batch_buf);
+    }
+#endif
+    
     // free job
     BPending_Free(&o->send.job);
     
@@ -804,6 +1286,45 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o)
     return &o->send.iface;
 }
 
+int BDatagram_SendAsync_EnableBatching (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(!o->send.busy)
+    ASSERT(!o->send.batching)
+    
+#ifdef BADVPN_LINUX
+    // allocate batch buffer
+    o->send.batch_buf_size = bmax_int(BDATAGRAM_BATCH_MAX_BYTES, o->send.mtu);
+    if (!(o->send.batch_buf = (uint8_t *)BAlloc(o->send.batch_buf_size))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // check if the kernel knows about segmentation offload
+    int opt;
+    socklen_t optlen = sizeof(opt);
+    o->send.batch_gso = (getsockopt(o->fd, SOL_UDP, UDP_SEGMENT, &opt, &optlen) == 0);
+    
+    // init batch job
+    BPending_Init(&o->send.batch_job, BReactor_PendingGroup(o->reactor), (BPending_handler)batch_job_handler, o);
+    
+    // set batch empty
+    o->send.batch_count = 0;
+    o->send.batch_len = 0;
+    o->send.batch_sent = 0;
+    o->send.batch_sent_len = 0;
+    
+    // set batching
+    o->send.batching = 1;
+    
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -816,6 +1337,7 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     
     // init interface
     PacketRecvInterface_Init(&o->recv.iface, o->recv.mtu, (PacketRecvInterface_handler_recv)recv_if_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->recv.iface), "BDatagram.recv");
     
     // init job
     BPending_Init(&o->recv.job, BReactor_PendingGroup(o->reactor), (BPending_handler)recv_job_handler, o);
@@ -823,6 +1345,9 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     // set not busy
     o->recv.busy = 0;
     
+    // set not coalescing
+    o->recv.coalescing = 0;
+    
     // set inited
     o->recv.inited = 1;
 }
@@ -836,6 +1361,19 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
     o->wait_events &= ~BREACTOR_READ;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef BADVPN_LINUX
+    if (o->recv.coalescing) {
+        // stop receiving coalesced datagrams
+        int opt = 0;
+        if (setsockopt(o->fd, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(UDP_GRO) failed");
+        }
+        
+        // free coalescing buffer
+        BFree(o->recv.gro_buf);
+    }
+#endif
+    
     // free job
     BPending_Free(&o->recv.job);
     
@@ -853,3 +1391,42 @@ PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
     
     return &o->recv.iface;
 }
+
+int BDatagram_RecvAsync_EnableCoalescing (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(!o->recv.busy)
+    ASSERT(!o->recv.coalescing)
+    
+#ifdef BADVPN_LINUX
+    if (o->family != BADDR_TYPE_IPV4 && o->family != BADDR_TYPE_IPV6) {
+        return 0;
+    }
+    
+    // allocate coalescing buffer
+    if (!(o->recv.gro_buf = (uint8_t *)BAlloc(BDATAGRAM_GRO_BUF_SIZE))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // ask the kernel to coalesce datagrams
+    int opt = 1;
+    if (setsockopt(o->fd, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) < 0) {
+        BFree(o->recv.gro_buf);
+        return 0;
+    }
+    
+    // set no datagram
+    o->recv.gro_len = 0;
+    o->recv.gro_pos = 0;
+    
+    // set coalescing
+    o->recv.coalescing = 1;
+    
+    return 1;
+#else
+    return 0;
+#endif
+}
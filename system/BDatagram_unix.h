@@ -33,10 +33,15 @@
 #define BDATAGRAM_SEND_LIMIT 2
 #define BDATAGRAM_RECV_LIMIT 2
 
+#define BDATAGRAM_BATCH_MAX_PACKETS 64
+#define BDATAGRAM_BATCH_MAX_BYTES 65000
+#define BDATAGRAM_GRO_BUF_SIZE 65535
+
 struct BDatagram_s {
     BReactor *reactor;
     void *user;
     BDatagram_handler handler;
+    int family;
     int fd;
     BFileDescriptor bfd;
     int wait_events;
@@ -52,6 +57,18 @@ struct BDatagram_s {
         int busy;
         const uint8_t *busy_data;
         int busy_data_len;
+        int batching;
+        uint8_t *batch_buf;
+        int batch_buf_size;
+        int batch_lens[BDATAGRAM_BATCH_MAX_PACKETS];
+        int batch_count;
+        int batch_len;
+        int batch_sent;
+        int batch_sent_len;
+        BAddr batch_remote_addr;
+        BIPAddr batch_local_addr;
+        int batch_gso;
+        BPending batch_job;
     } send;
     struct {
         BReactorLimit limit;
@@ -65,6 +82,11 @@ struct BDatagram_s {
         BPending job;
         int busy;
         uint8_t *busy_data;
+        int coalescing;
+        uint8_t *gro_buf;
+        int gro_len;
+        int gro_pos;
+        int gro_segment;
     } recv;
     DebugError d_err;
     DebugObject d_obj;
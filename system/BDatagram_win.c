@@ -492,6 +492,7 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->reactor = reactor;
     o->user = user;
     o->handler = handler;
+    o->family = family;
     
     // init socket
     if ((o->sock = WSASocket(family_socket_to_sys(family), SOCK_DGRAM, 0, NULL, 0, WSA_FLAG_OVERLAPPED)) == INVALID_SOCKET) {
@@ -650,6 +651,40 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
     return 1;
 }
 
+int BDatagram_SetDontFragment (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    DWORD opt = 1;
+    
+    switch (o->family) {
+        case BADDR_TYPE_IPV4: {
+#ifdef IP_DONTFRAGMENT
+            if (setsockopt(o->sock, IPPROTO_IP, IP_DONTFRAGMENT, (char *)&opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#else
+            return 0;
+#endif
+        } break;
+        
+        case BADDR_TYPE_IPV6: {
+#ifdef IPV6_DONTFRAG
+            if (setsockopt(o->sock, IPPROTO_IPV6, IPV6_DONTFRAG, (char *)&opt, sizeof(opt)) < 0) {
+                return 0;
+            }
+#else
+            return 0;
+#endif
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    return 1;
+}
+
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -663,6 +698,7 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     
     // init interface
     PacketPassInterface_Init(&o->send.iface, o->send.mtu, (PacketPassInterface_handler_send)send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketPassInterface_GetTrace(&o->send.iface), "BDatagram.send");
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_job_handler, o);
@@ -702,6 +738,14 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o)
     return &o->send.iface;
 }
 
+int BDatagram_SendAsync_EnableBatching (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send.inited)
+    
+    return 0;
+}
+
 void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -715,6 +759,7 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     
     // init interface
     PacketRecvInterface_Init(&o->recv.iface, o->recv.mtu, (PacketRecvInterface_handler_recv)recv_if_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    FlowTrace_SetName(PacketRecvInterface_GetTrace(&o->recv.iface), "BDatagram.recv");
     
     // init job
     BPending_Init(&o->recv.job, BReactor_PendingGroup(o->reactor), (BPending_handler)recv_job_handler, o);
@@ -753,3 +798,11 @@ PacketRecvInterface * BDatagram_RecvAsync_GetIf (BDatagram *o)
     
     return &o->recv.iface;
 }
+
+int BDatagram_RecvAsync_EnableCoalescing (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv.inited)
+    
+    return 0;
+}
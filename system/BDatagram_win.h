@@ -51,6 +51,7 @@ struct BDatagram_s {
     BReactor *reactor;
     void *user;
     BDatagram_handler handler;
+    int family;
     SOCKET sock;
     LPFN_WSASENDMSG fnWSASendMsg;
     LPFN_WSARECVMSG fnWSARecvMsg;
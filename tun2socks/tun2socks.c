@@ -54,6 +54,7 @@
 #include <system/BAddr.h>
 #include <system/BNetwork.h>
 #include <flow/SinglePacketBuffer.h>
+#include <flowextra/TokenBucket.h>
 #include <socksclient/BSocksClient.h>
 #include <tuntap/BTap.h>
 #include <lwip/init.h>
@@ -110,7 +111,10 @@ struct {
     char *udpgw_remote_server_addr;
     int udpgw_max_connections;
     int udpgw_connection_buffer_size;
+    int udpgw_connection_codel_target;
     int udpgw_transparent_dns;
+    int tcp_client_rate_limit;
+    int tcp_total_rate_limit;
 } options;
 
 // TCP client
@@ -135,6 +139,10 @@ struct tcp_client {
     int socks_recv_buf_sent;
     int socks_recv_waiting;
     int socks_recv_tcp_pending;
+    TokenBucket socks_send_bucket;
+    TokenBucket socks_recv_bucket;
+    BTimer socks_send_timer;
+    BTimer socks_recv_timer;
 };
 
 // IP address of netif
@@ -182,6 +190,13 @@ int udp_mtu;
 // TCP timer
 BTimer tcp_timer;
 
+// whether TCP clients are rate limited
+int shaping;
+
+// rate limits shared by all TCP clients, for each direction
+TokenBucket total_send_bucket;
+TokenBucket total_recv_bucket;
+
 // job for initializing lwip
 BPending lwip_init_job;
 
@@ -231,8 +246,10 @@ static void client_err_func (void *arg, err_t err);
 static err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static void client_socks_handler (struct tcp_client *client, int event);
 static void client_send_to_socks (struct tcp_client *client);
+static void client_socks_send_timer_handler (struct tcp_client *client);
 static void client_socks_send_handler_done (struct tcp_client *client, int data_len);
 static void client_socks_recv_initiate (struct tcp_client *client);
+static void client_socks_recv_timer_handler (struct tcp_client *client);
 static void client_socks_recv_handler_done (struct tcp_client *client, int data_len);
 static int client_socks_recv_send_out (struct tcp_client *client);
 static err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len);
@@ -366,7 +383,7 @@ int main (int argc, char **argv)
         }
         
         // init udpgw client
-        if (!SocksUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS, options.udpgw_connection_buffer_size, UDPGW_KEEPALIVE_TIME,
+        if (!SocksUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS, options.udpgw_connection_buffer_size, options.udpgw_connection_codel_target, UDPGW_KEEPALIVE_TIME,
                                    socks_server_addr, socks_auth_info, socks_num_auth_info,
                                    udpgw_remote_server_addr, UDPGW_RECONNECT_TIME, &ss, NULL, udpgw_client_handler_received
         )) {
@@ -390,6 +407,12 @@ int main (int argc, char **argv)
     BTimer_Init(&tcp_timer, TCP_TMR_INTERVAL, tcp_timer_handler, NULL);
     BReactor_SetTimer(&ss, &tcp_timer);
     
+    // init rate limits
+    shaping = (options.tcp_client_rate_limit > 0 || options.tcp_total_rate_limit > 0);
+    int64_t total_burst = TokenBucket_DefaultBurst(options.tcp_total_rate_limit, CLIENT_SOCKS_RECV_BUF_SIZE);
+    TokenBucket_Init(&total_send_bucket, NULL, options.tcp_total_rate_limit, total_burst);
+    TokenBucket_Init(&total_recv_bucket, NULL, options.tcp_total_rate_limit, total_burst);
+    
     // set no netif
     have_netif = 0;
     
@@ -427,6 +450,8 @@ int main (int argc, char **argv)
         netif_remove(&netif);
     }
     
+    TokenBucket_Free(&total_recv_bucket);
+    TokenBucket_Free(&total_send_bucket);
     BReactor_RemoveTimer(&ss, &tcp_timer);
     BFree(device_write_buf);
 fail5:
@@ -494,7 +519,10 @@ void print_help (const char *name)
         "        [--udpgw-remote-server-addr <addr>]\n"
         "        [--udpgw-max-connections <number>]\n"
         "        [--udpgw-connection-buffer-size <number>]\n"
+        "        [--udpgw-connection-codel-target <ms>]\n"
         "        [--udpgw-transparent-dns]\n"
+        "        [--tcp-client-rate-limit <bytes-per-second>]\n"
+        "        [--tcp-total-rate-limit <bytes-per-second>]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -534,7 +562,10 @@ int parse_arguments (int argc, char *argv[])
     options.udpgw_remote_server_addr = NULL;
     options.udpgw_max_connections = DEFAULT_UDPGW_MAX_CONNECTIONS;
     options.udpgw_connection_buffer_size = DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE;
+    options.udpgw_connection_codel_target = DEFAULT_UDPGW_CONNECTION_CODEL_TARGET;
     options.udpgw_transparent_dns = 0;
+    options.tcp_client_rate_limit = 0;
+    options.tcp_total_rate_limit = 0;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -709,9 +740,42 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--udpgw-connection-codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_connection_codel_target = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--udpgw-transparent-dns")) {
             options.udpgw_transparent_dns = 1;
         }
+        else if (!strcmp(arg, "--tcp-client-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_client_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-total-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_total_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
@@ -1276,6 +1340,15 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
         goto fail1;
     }
     
+    // init rate limits
+    TokenBucket *send_parent = (options.tcp_total_rate_limit > 0 ? &total_send_bucket : NULL);
+    TokenBucket *recv_parent = (options.tcp_total_rate_limit > 0 ? &total_recv_bucket : NULL);
+    int64_t burst = TokenBucket_DefaultBurst(options.tcp_client_rate_limit, CLIENT_SOCKS_RECV_BUF_SIZE);
+    TokenBucket_Init(&client->socks_send_bucket, send_parent, options.tcp_client_rate_limit, burst);
+    TokenBucket_Init(&client->socks_recv_bucket, recv_parent, options.tcp_client_rate_limit, burst);
+    BTimer_Init(&client->socks_send_timer, 0, (BTimer_handler)client_socks_send_timer_handler, client);
+    BTimer_Init(&client->socks_recv_timer, 0, (BTimer_handler)client_socks_recv_timer_handler, client);
+    
     // init dead vars
     DEAD_INIT(client->dead);
     DEAD_INIT(client->dead_client);
@@ -1338,6 +1411,9 @@ void client_handle_freed_client (struct tcp_client *client)
     // set client closed
     client->client_closed = 1;
     
+    // stop waiting to receive from SOCKS
+    BReactor_RemoveTimer(&ss, &client->socks_recv_timer);
+    
     // if we have data to be sent to SOCKS and can send it, keep sending
     if (client->buf_used > 0 && !client->socks_closed) {
         client_log(client, BLOG_INFO, "waiting untill buffered data is sent to SOCKS");
@@ -1399,6 +1475,10 @@ void client_free_socks (struct tcp_client *client)
     // free SOCKS
     BSocksClient_Free(&client->socks_client);
     
+    // stop waiting to send to and receive from SOCKS
+    BReactor_RemoveTimer(&ss, &client->socks_send_timer);
+    BReactor_RemoveTimer(&ss, &client->socks_recv_timer);
+    
     // set SOCKS closed
     client->socks_closed = 1;
     
@@ -1438,6 +1518,10 @@ void client_murder (struct tcp_client *client)
         // free SOCKS
         BSocksClient_Free(&client->socks_client);
         
+        // stop waiting to send to and receive from SOCKS
+        BReactor_RemoveTimer(&ss, &client->socks_send_timer);
+        BReactor_RemoveTimer(&ss, &client->socks_recv_timer);
+        
         // set SOCKS closed
         client->socks_closed = 1;
     }
@@ -1461,6 +1545,10 @@ void client_dealloc (struct tcp_client *client)
     // kill dead var
     DEAD_KILL(client->dead);
     
+    // free rate limits
+    TokenBucket_Free(&client->socks_recv_bucket);
+    TokenBucket_Free(&client->socks_send_bucket);
+    
     // free memory
     free(client->socks_username);
     free(client);
@@ -1585,10 +1673,28 @@ void client_send_to_socks (struct tcp_client *client)
     ASSERT(client->socks_up)
     ASSERT(client->buf_used > 0)
     
+    // wait if over the rate limit
+    if (shaping) {
+        btime_t wait = TokenBucket_GetWait(&client->socks_send_bucket);
+        if (wait > 0) {
+            BReactor_SetTimerAfter(&ss, &client->socks_send_timer, wait);
+            return;
+        }
+    }
+    
     // schedule sending
     StreamPassInterface_Sender_Send(client->socks_send_if, client->buf, client->buf_used);
 }
 
+void client_socks_send_timer_handler (struct tcp_client *client)
+{
+    ASSERT(!client->socks_closed)
+    ASSERT(client->socks_up)
+    ASSERT(client->buf_used > 0)
+    
+    client_send_to_socks(client);
+}
+
 void client_socks_send_handler_done (struct tcp_client *client, int data_len)
 {
     ASSERT(!client->socks_closed)
@@ -1601,6 +1707,11 @@ void client_socks_send_handler_done (struct tcp_client *client, int data_len)
     memmove(client->buf, client->buf + data_len, client->buf_used - data_len);
     client->buf_used -= data_len;
     
+    // count sent data against the rate limit
+    if (shaping) {
+        TokenBucket_Consume(&client->socks_send_bucket, data_len);
+    }
+    
     if (!client->client_closed) {
         // confirm sent data
         tcp_recved(client->pcb, data_len);
@@ -1608,7 +1719,7 @@ void client_socks_send_handler_done (struct tcp_client *client, int data_len)
     
     if (client->buf_used > 0) {
         // send any further data
-        StreamPassInterface_Sender_Send(client->socks_send_if, client->buf, client->buf_used);
+        client_send_to_socks(client);
     }
     else if (client->client_closed) {
         // client was closed we've sent everything we had buffered; we're done with it
@@ -1625,9 +1736,28 @@ void client_socks_recv_initiate (struct tcp_client *client)
     ASSERT(client->socks_up)
     ASSERT(client->socks_recv_buf_used == -1)
     
+    // wait if over the rate limit
+    if (shaping) {
+        btime_t wait = TokenBucket_GetWait(&client->socks_recv_bucket);
+        if (wait > 0) {
+            BReactor_SetTimerAfter(&ss, &client->socks_recv_timer, wait);
+            return;
+        }
+    }
+    
     StreamRecvInterface_Receiver_Recv(client->socks_recv_if, client->socks_recv_buf, sizeof(client->socks_recv_buf));
 }
 
+void client_socks_recv_timer_handler (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(!client->socks_closed)
+    ASSERT(client->socks_up)
+    ASSERT(client->socks_recv_buf_used == -1)
+    
+    client_socks_recv_initiate(client);
+}
+
 void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
 {
     ASSERT(data_len > 0)
@@ -1636,6 +1766,11 @@ void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
     ASSERT(client->socks_up)
     ASSERT(client->socks_recv_buf_used == -1)
     
+    // count received data against the rate limit
+    if (shaping) {
+        TokenBucket_Consume(&client->socks_recv_bucket, data_len);
+    }
+    
     // if client was closed, stop receiving
     if (client->client_closed) {
         return;
@@ -36,6 +36,9 @@
 // udpgw per-connection send buffer size, in number of packets
 #define DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE 8
 
+// udpgw per-connection send buffer CoDel target delay, 0 to disable
+#define DEFAULT_UDPGW_CONNECTION_CODEL_TARGET 0
+
 // udpgw reconnect time after connection fails
 #define UDPGW_RECONNECT_TIME 5000
 
@@ -57,6 +57,7 @@
 #include <flow/PacketStreamSender.h>
 #include <flow/PacketProtoFlow.h>
 #include <flow/SinglePacketBuffer.h>
+#include <flowextra/PacketPassShaper.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
@@ -73,6 +74,9 @@
 
 #define DNS_UPDATE_TIME 2000
 
+// share of a client's send queue given to DNS connections relative to others
+#define DNS_FLOW_WEIGHT 8
+
 struct client {
     BConnection con;
     BAddr addr;
@@ -80,6 +84,7 @@ struct client {
     PacketProtoDecoder recv_decoder;
     PacketPassInterface recv_if;
     PacketPassFairQueue send_queue;
+    PacketPassShaper send_shaper;
     PacketStreamSender send_sender;
     BAVL connections_tree;
     LinkedList1 connections_list;
@@ -135,6 +140,8 @@ struct {
     int max_clients;
     int max_connections_for_client;
     int client_socket_sndbuf;
+    int client_rate_limit;
+    int total_rate_limit;
     int local_udp_num_ports;
     char *local_udp_addr;
     int local_udp_ip6_num_ports;
@@ -146,6 +153,12 @@ struct {
 int udpgw_mtu;
 int pp_mtu;
 
+// whether sending to clients is rate limited
+int shaping;
+
+// rate limit shared by all clients
+TokenBucket total_rate_bucket;
+
 // listen addresses
 BAddr listen_addrs[MAX_LISTEN_ADDRS];
 int num_listen_addrs;
@@ -187,7 +200,7 @@ static void client_recv_if_handler_send (struct client *client, uint8_t *data, i
 static int get_local_num_ports (int addr_type);
 static BAddr get_local_addr (int addr_type);
 static uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con);
-static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len);
+static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int is_dns, const uint8_t *data, int data_len);
 static void connection_free (struct connection *con);
 static void connection_logfunc (struct connection *con);
 static void connection_log (struct connection *con, int level, const char *fmt, ...);
@@ -292,6 +305,10 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    // init rate limiting
+    shaping = (options.client_rate_limit > 0 || options.total_rate_limit > 0);
+    TokenBucket_Init(&total_rate_bucket, NULL, options.total_rate_limit, TokenBucket_DefaultBurst(options.total_rate_limit, pp_mtu));
+    
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
         BLog(BLOG_ERROR, "BSignal_Init failed");
@@ -330,6 +347,9 @@ fail3:
     // finish signal handling
     BSignal_Finish();
 fail2:
+    // free rate limiting
+    TokenBucket_Free(&total_rate_bucket);
+    
     // free reactor
     BReactor_Free(&ss);
 fail1:
@@ -364,6 +384,8 @@ void print_help (const char *name)
         "        [--max-clients <number>]\n"
         "        [--max-connections-for-client <number>]\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
+        "        [--client-rate-limit <bytes-per-second / 0>]\n"
+        "        [--total-rate-limit <bytes-per-second / 0>]\n"
         "        [--local-udp-addrs <addr> <num_ports>]\n"
         "        [--local-udp-ip6-addrs <addr> <num_ports>]\n"
         "        [--unique-local-ports]\n"
@@ -399,6 +421,8 @@ int parse_arguments (int argc, char *argv[])
     options.max_clients = DEFAULT_MAX_CLIENTS;
     options.max_connections_for_client = DEFAULT_MAX_CONNECTIONS_FOR_CLIENT;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SEND_BUFFER;
+    options.client_rate_limit = 0;
+    options.total_rate_limit = 0;
     options.local_udp_num_ports = -1;
     options.local_udp_ip6_num_ports = -1;
     options.unique_local_ports = 0;
@@ -536,6 +560,28 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--client-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--total-rate-limit")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.total_rate_limit = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--local-udp-addrs")) {
             if (2 >= argc - i) {
                 fprintf(stderr, "%s: requires two arguments\n", arg);
@@ -671,9 +717,17 @@ void listener_handler (BListener *listener)
     
     // init send sender
     PacketStreamSender_Init(&client->send_sender, BConnection_SendAsync_GetIf(&client->con), pp_mtu, BReactor_PendingGroup(&ss));
+    PacketPassInterface *send_out = PacketStreamSender_GetInput(&client->send_sender);
+    
+    // init send shaper
+    if (shaping) {
+        TokenBucket *parent = (options.total_rate_limit > 0 ? &total_rate_bucket : NULL);
+        PacketPassShaper_Init(&client->send_shaper, send_out, &ss, options.client_rate_limit, TokenBucket_DefaultBurst(options.client_rate_limit, pp_mtu), parent);
+        send_out = PacketPassShaper_GetInput(&client->send_shaper);
+    }
     
     // init send queue
-    if (!PacketPassFairQueue_Init(&client->send_queue, PacketStreamSender_GetInput(&client->send_sender), BReactor_PendingGroup(&ss), 0, 1)) {
+    if (!PacketPassFairQueue_InitMode(&client->send_queue, send_out, BReactor_PendingGroup(&ss), 0, 1, FAIRQUEUE_MODE_DRR)) {
         BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
         goto fail3;
     }
@@ -699,6 +753,9 @@ void listener_handler (BListener *listener)
     return;
     
 fail3:
+    if (shaping) {
+        PacketPassShaper_Free(&client->send_shaper);
+    }
     PacketStreamSender_Free(&client->send_sender);
     PacketProtoDecoder_Free(&client->recv_decoder);
 fail2:
@@ -737,6 +794,11 @@ void client_free (struct client *client)
     // free send queue
     PacketPassFairQueue_Free(&client->send_queue);
     
+    // free send shaper
+    if (shaping) {
+        PacketPassShaper_Free(&client->send_shaper);
+    }
+    
     // free send sender
     PacketStreamSender_Free(&client->send_sender);
     
@@ -896,7 +958,7 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
         }
         
         // create new connection
-        connection_init(client, conid, addr, orig_addr, data, data_len);
+        connection_init(client, conid, addr, orig_addr, !!(flags & UDPGW_CLIENT_FLAG_DNS), data, data_len);
     } else {
         // submit packet to existing connection
         connection_send_to_udp(con, data, data_len);
@@ -983,7 +1045,7 @@ uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_ad
     return port_usage;
 }
 
-void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len)
+void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int is_dns, const uint8_t *data, int data_len)
 {
     ASSERT(client->num_connections < options.max_connections_for_client)
     ASSERT(!find_connection(client, conid))
@@ -1021,6 +1083,11 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     // init send queue flow
     PacketPassFairQueueFlow_Init(&con->send_qflow, &client->send_queue);
     
+    // let DNS replies through ahead of bulk traffic
+    if (is_dns) {
+        PacketPassFairQueueFlow_SetWeight(&con->send_qflow, DNS_FLOW_WEIGHT);
+    }
+    
     // init send PacketProtoFlow
     if (!PacketProtoFlow_Init(&con->send_ppflow, udpgw_mtu, CONNECTION_CLIENT_BUFFER_SIZE, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(&ss))) {
         client_log(client, BLOG_ERROR, "PacketProtoFlow_Init failed");
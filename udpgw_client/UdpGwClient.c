@@ -38,6 +38,12 @@
 
 #include <generated/blog_channel_UdpGwClient.h>
 
+// share of the send queue given to DNS connections relative to others
+#define DNS_FLOW_WEIGHT 8
+
+// CoDel interval for connection send buffers, if CoDel is enabled
+#define CODEL_INTERVAL 100
+
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
 static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2);
 static void free_server (UdpGwClient *o);
@@ -263,10 +269,26 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     // init queue flow
     PacketPassFairQueueFlow_Init(&con->send_qflow, &o->send_queue);
     
-    // init PacketProtoFlow
-    if (!PacketProtoFlow_Init(&con->send_ppflow, o->udpgw_mtu, o->send_buffer_size, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(o->reactor))) {
-        BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
-        goto fail1;
+    // let DNS queries through ahead of bulk traffic
+    if ((flags & UDPGW_CLIENT_FLAG_DNS)) {
+        PacketPassFairQueueFlow_SetWeight(&con->send_qflow, DNS_FLOW_WEIGHT);
+    }
+    
+    // init PacketProtoFlow, with CoDel if requested
+    if (o->send_buffer_codel_target > 0) {
+        struct PacketCodel_params codel;
+        codel.clock = btime_gettime;
+        codel.target = o->send_buffer_codel_target;
+        codel.interval = CODEL_INTERVAL;
+        if (!PacketProtoFlow_InitCodel(&con->send_ppflow, o->udpgw_mtu, o->send_buffer_size, &codel, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(o->reactor))) {
+            BLog(BLOG_ERROR, "PacketProtoFlow_InitCodel failed");
+            goto fail1;
+        }
+    } else {
+        if (!PacketProtoFlow_Init(&con->send_ppflow, o->udpgw_mtu, o->send_buffer_size, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(o->reactor))) {
+            BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
+            goto fail1;
+        }
     }
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
@@ -399,7 +421,7 @@ static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct
     return con;
 }
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t send_buffer_codel_target, btime_t keepalive_time, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received)
 {
@@ -408,11 +430,13 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     ASSERT(udpgw_compute_mtu(udp_mtu) <= PACKETPROTO_MAXPAYLOAD)
     ASSERT(max_connections > 0)
     ASSERT(send_buffer_size > 0)
+    ASSERT(send_buffer_codel_target >= 0)
     
     // init arguments
     o->udp_mtu = udp_mtu;
     o->max_connections = max_connections;
     o->send_buffer_size = send_buffer_size;
+    o->send_buffer_codel_target = send_buffer_codel_target;
     o->keepalive_time = keepalive_time;
     o->reactor = reactor;
     o->user = user;
@@ -450,7 +474,7 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     PacketPassInactivityMonitor_Init(&o->send_monitor, PacketPassConnector_GetInput(&o->send_connector), o->reactor, o->keepalive_time, (PacketPassInactivityMonitor_handler)send_monitor_handler, o);
     
     // init send queue
-    if (!PacketPassFairQueue_Init(&o->send_queue, PacketPassInactivityMonitor_GetInput(&o->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1)) {
+    if (!PacketPassFairQueue_InitMode(&o->send_queue, PacketPassInactivityMonitor_GetInput(&o->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1, FAIRQUEUE_MODE_DRR)) {
         goto fail0;
     }
     
@@ -529,7 +553,7 @@ void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_ad
     struct UdpGwClient_connection *con = find_connection_by_conaddr(o, conaddr);
     
     uint8_t flags = 0;
-
+    
     if (is_dns) {
         // route to remote DNS server instead of provided address
         flags |= UDPGW_CLIENT_FLAG_DNS;
@@ -539,6 +563,9 @@ void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_ad
     if (!con && o->num_connections == o->max_connections) {
         con = reuse_connection(o, conaddr);
         flags |= UDPGW_CLIENT_FLAG_REBIND;
+        
+        // the connection may change between DNS and other traffic
+        PacketPassFairQueueFlow_SetWeight(&con->send_qflow, (is_dns ? DNS_FLOW_WEIGHT : 1));
     }
     
     if (!con) {
@@ -60,6 +60,7 @@ typedef struct {
     int udp_mtu;
     int max_connections;
     int send_buffer_size;
+    btime_t send_buffer_codel_target;
     btime_t keepalive_time;
     BReactor *reactor;
     void *user;
@@ -107,7 +108,7 @@ struct UdpGwClient_connection {
     LinkedList1Node connections_list_node;
 };
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t send_buffer_codel_target, btime_t keepalive_time, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received) WARN_UNUSED;
 void UdpGwClient_Free (UdpGwClient *o);